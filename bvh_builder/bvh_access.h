@@ -85,6 +85,7 @@ protected:
     { 
       m_convertedLayout.clear(); 
       m_convertedTrinagles.clear(); 
+      m_vertOffsetByMeshId.clear();
       m_totalMeshTriangleCount = 0; 
       embreeFormat = ""; 
     }
@@ -93,11 +94,13 @@ protected:
 
     std::vector<BVHNode> m_convertedLayout;
     std::vector<float4>  m_convertedTrinagles;
+    std::unordered_map<int, size_t> m_vertOffsetByMeshId; ///< mesh vertices offset in m_convertedTrinagles for indexed leaves
     size_t               m_totalMeshTriangleCount;
     std::string          embreeFormat;
   };
 
   bool m_earlySplit;
+  bool m_indexedLeaves; ///< store leaf triangles of tree 0 as vertex indices to shared per mesh vertex array instead of copying them
 
   std::vector<LinearTree>   m_ltrees;
   int                       m_ltreeId;
@@ -107,6 +110,7 @@ protected:
 
   size_t ConvertBvh4TwoLevel(BVH4::NodeRef node, size_t currNodeOffset, int depth, int instDepth, int a_meshId, const char* a_treeType, int a_treeId);
   void InsertTrainglesInLeaf(size_t currNodeOffset, BVH4::NodeRef node, EmbreeBVH4_2::LinearTree& lt, int a_meshId, const char* a_treeType);
+  size_t AllocMeshVertices(EmbreeBVH4_2::LinearTree& lt, int a_meshId);
 
 
   /////////////////////////////////////////////////////////////////////////////////////////////////////////
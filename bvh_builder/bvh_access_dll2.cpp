@@ -26,8 +26,9 @@ EmbreeBVH4_2::EmbreeBVH4_2() : m_device(nullptr), m_algorithmFlags(RTC_INTERSECT
  
   m_ltrees.resize(1);
   m_ltrees[0].m_totalMeshTriangleCount = 0;
-  m_ltreeId    = 0;
-  m_earlySplit = false;
+  m_ltreeId       = 0;
+  m_earlySplit    = false;
+  m_indexedLeaves = false;
 }
 
 EmbreeBVH4_2::~EmbreeBVH4_2()
@@ -48,6 +49,8 @@ void EmbreeBVH4_2::Init(const char* cfg)
     m_tree[i].m_sceneTriNum   = 0;
   }
 
+  m_indexedLeaves = (cfg != nullptr && std::string(cfg).find("-indexed_leaves 1") != std::string::npos);
+
   //if (cfg != nullptr && std::string(cfg) == "-allow_insert_copy 1")
   //  m_allowInsertCopies = true;
   //else
@@ -259,8 +262,28 @@ inline static embree::BBox3fa CalcBoundingBoxOfChilds(BVH4::NodeRef node)
 
 #include "../../kernels/geometry/object_intersector.h"
 
+size_t EmbreeBVH4_2::AllocMeshVertices(EmbreeBVH4_2::LinearTree& lt, int a_meshId)
+{
+  auto p = lt.m_vertOffsetByMeshId.find(a_meshId);
+  if (p != lt.m_vertOffsetByMeshId.end())
+    return p->second;
+
+  const auto& inputMeshData = m_inputMeshData[a_meshId];
+  const float4* vert4f      = (const float4*)inputMeshData.vert4f;
+
+  const size_t currSize = lt.m_convertedTrinagles.size();
+  lt.m_convertedTrinagles.insert(lt.m_convertedTrinagles.end(), vert4f, vert4f + inputMeshData.numVert);
+  lt.m_vertOffsetByMeshId[a_meshId] = currSize;
+  return currSize;
+}
+
 void EmbreeBVH4_2::InsertTrainglesInLeaf(size_t currNodeOffset, BVH4::NodeRef node, EmbreeBVH4_2::LinearTree& lt, int a_meshId, const char* a_treeType)
 {
+  // tree 0 never has alpha test table, so only it can use indexed leaves; mesh vertices must be put before the header to keep leaf triangles contiguous
+  //
+  const bool   indexedLeaf = m_indexedLeaves && (m_ltreeId == 0);
+  const size_t vertOffset  = indexedLeaf ? AllocMeshVertices(lt, a_meshId) : 0;
+
   size_t objListOffset = Alloc1Float4(lt.m_convertedTrinagles);
   lt.m_convertedLayout[currNodeOffset].SetLeftOffset((unsigned int)objListOffset);
 
@@ -276,7 +299,36 @@ void EmbreeBVH4_2::InsertTrainglesInLeaf(size_t currNodeOffset, BVH4::NodeRef no
   const float3 leafMin = lt.m_convertedLayout[currNodeOffset].m_boxMin;
   const float3 leafMax = lt.m_convertedLayout[currNodeOffset].m_boxMax;
 
-  if (laName == "custom")
+  if (indexedLeaf)
+  {
+    const int* ind = m_inputMeshData[a_meshId].indices;
+
+    auto putIndexedTriangle = [&](int triId)
+    {
+      const int iA = int(vertOffset) + ind[triId * 3 + 0];
+      const int iB = int(vertOffset) + ind[triId * 3 + 1];
+      const int iC = int(vertOffset) + ind[triId * 3 + 2];
+      lt.m_convertedTrinagles.push_back(float4(as_float(iA), as_float(iB), as_float(iC), as_float(triId)));
+      totalTriNum++;
+    };
+
+    if (laName == "custom")
+    {
+      using PrimType = embree::sse2::ObjectIntersector1<0>::Primitive;
+      const PrimType* pdata = (const PrimType*)node.leaf(num);
+      auto& triRefs         = m_refsHash[a_meshId];
+
+      for (size_t i = 0; i < num; i++)
+        putIndexedTriangle(triRefs[pdata[i].primID()].triId);
+    }
+    else
+    {
+      for (size_t i = 0; i < num; i++)
+        for (size_t j = 0; j < tri[i].size(); j++)
+          putIndexedTriangle(int(tri[i].primID(j)));
+    }
+  }
+  else if (laName == "custom")
   {
     using PrimType = embree::sse2::ObjectIntersector1<0>::Primitive;
     const PrimType* pdata = (const PrimType*)node.leaf(num);
@@ -345,8 +397,8 @@ void EmbreeBVH4_2::InsertTrainglesInLeaf(size_t currNodeOffset, BVH4::NodeRef no
 
   (*(pTriNumber + 0)) = int(objListOffset+1);
   (*(pTriNumber + 1)) = totalTriNum;
-  (*(pTriNumber + 2)) = -1;
-  (*(pTriNumber + 3)) = -1;
+  (*(pTriNumber + 2)) = indexedLeaf ? a_meshId : -1;
+  (*(pTriNumber + 3)) = indexedLeaf ? OBJLIST_LEAF_INDEXED : -1;
 
 }
 
@@ -595,6 +647,7 @@ ConvertionResult EmbreeBVH4_2::ConvertMap()
 
     lt.m_convertedTrinagles.resize(0);
     lt.m_convertedTrinagles.reserve(3 * lt.m_totalMeshTriangleCount * 2);
+    lt.m_vertOffsetByMeshId.clear();
 
     m_instNodesConnections.resize(0);
     m_instNodesConnections.reserve(m_tree[realTreeId].m_matByInstId.size() + 10);
@@ -675,6 +728,7 @@ ConvertionResult EmbreeBVH4_2::ConvertMap()
     
     res.nodesNum[finalBvhNumber]      = int(m_ltrees[i].m_convertedLayout.size());
     res.trif4Num[finalBvhNumber]      = int(m_ltrees[i].m_convertedTrinagles.size());
+    res.leafIdx [finalBvhNumber]      = m_indexedLeaves && (i == 0);
     
     finalBvhNumber++;
   }
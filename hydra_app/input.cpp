@@ -34,6 +34,8 @@ Input::Input()
   enableOpenGL1 = false; ///< if you want to draw scene for some debug needs with OpenGL1.
   exitStatus    = false;
   runTests      = false;
+  benchTexLayouts = false;
+  benchPathGuiding = false;
 
   camMoveSpeed     = 2.5f;
   mouseSensitivity = 0.1f;
@@ -171,6 +173,8 @@ void Input::ParseCommandLineParams(const std::unordered_map<std::string, std::st
   ReadBoolCmd(a_params,   "-alloc_image_b",   &allocInternalImageB);
   ReadBoolCmd(a_params,   "-evalgbuffer",     &getGBufferBeforeRender);
   ReadBoolCmd(a_params,   "-boxmode",         &boxMode);
+  ReadBoolCmd(a_params,   "-bench_tex_layouts", &benchTexLayouts);
+  ReadBoolCmd(a_params,   "-bench_path_guiding", &benchPathGuiding);
  
   if (listDevicesAndExit)
     noWindow = true;
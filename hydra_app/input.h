@@ -15,6 +15,8 @@ struct Input
   bool enableMLT;
   bool allocInternalImageB;
   bool runTests;     ///< run all functional tests from HydraAPI folder 
+  bool benchTexLayouts; ///< run CPU micro-benchmark of texture fetch for linear and tiled layouts and exit
+  bool benchPathGuiding; ///< render inLibraryPath scene for equal time with and without path guiding on CPU and inDeviceId, compare to reference and exit
   bool listDevicesAndExit;
   bool cpuFB;
   bool inDevelopment;
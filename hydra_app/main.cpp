@@ -104,6 +104,8 @@ void sig_handler(int signo)
 void window_main (std::shared_ptr<IHRRenderDriver> a_pDriverPointer);
 void console_main(std::shared_ptr<IHRRenderDriver> a_pDriverPointer, IHRSharedAccumImage* a_pSharedImage);
 void tests_main  (std::shared_ptr<IHRRenderDriver> a_pDriverPointer);
+void bench_texture_layouts();
+void bench_path_guiding();
 
 extern int g_width;
 extern int g_height;
@@ -198,7 +200,15 @@ int main(int argc, const char** argv)
 
   try
   {
-    if (g_input.runTests)
+    if (g_input.benchTexLayouts)
+    {
+      bench_texture_layouts();
+    }
+    else if (g_input.benchPathGuiding)
+    {
+      bench_path_guiding();
+    }
+    else if (g_input.runTests)
     {
       g_pDriver = std::shared_ptr<IHRRenderDriver>(CreateDriverRTE(L"", g_input.winWidth, g_input.winHeight, g_input.inDeviceId, GPU_RT_NOWINDOW | GPU_RT_DO_NOT_PRINT_PASS_NUMBER, nullptr));
       
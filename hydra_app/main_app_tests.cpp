@@ -4,6 +4,9 @@
 #include "main.h"
 #include "../../HydraAPI/hydra_api/HR_HDRImageTool.h"
 
+#include <chrono>
+#include <cstring>
+
 using pugi::xml_node;
 using pugi::xml_attribute;
 using namespace HydraXMLHelpers;
@@ -165,3 +168,179 @@ void tests_main(std::shared_ptr<IHRRenderDriver> a_pDetachedRenderDriverPointer)
 
   std::cout << "end tests" << std::endl;
 }
+
+static void FillTexelsRGBA8(std::vector<int4>& a_tex, int w, int h, bool a_tiled)
+{
+  SWTextureHeader header;
+  header.width  = w;
+  header.height = h;
+  header.mips   = 1;
+  header.bpp    = TEX_FORMAT_RGBA8 | (a_tiled ? TEX_LAYOUT_TILED : 0);
+
+  a_tex.resize(1 + size_t(w)*size_t(h)/4); // w and h are multiples of 4
+  memcpy(a_tex.data(), &header, sizeof(SWTextureHeader));
+
+  unsigned int* texels = (unsigned int*)(a_tex.data() + 1);
+  for (int y = 0; y < h; y++)
+  {
+    for (int x = 0; x < w; x++)
+    {
+      const int offset = a_tiled ? textureTiledOffset(x, y, w) : y*w + x;
+      texels[offset]   = (unsigned int)((x*7 + y*13) & 0xFF) | ((unsigned int)(x ^ y) & 0xFF) << 8 | 0xFF000000;
+    }
+  }
+}
+
+/**
+\brief CPU micro-benchmark of bilinear fetch (read_imagef_sw4) for row major and TEX_LAYOUT_TILED layouts.
+
+Coherent pattern walks texture along rotated scanlines like neighbour pixels of primary rays do; 
+incoherent one takes random uv like secondary bounces.
+
+*/
+void bench_texture_layouts()
+{
+  const int w = 4096;
+  const int h = 4096;
+  const int fetchNum = 1 << 24;
+
+  std::vector<float2> uvCoherent(fetchNum), uvRandom(fetchNum);
+
+  unsigned int state = 12345;
+  for (int i = 0; i < fetchNum; i++)
+  {
+    const float sx = float(i % 4096) / 4096.0f;
+    const float sy = float(i / 4096) / 4096.0f;
+    uvCoherent[i]  = make_float2(0.8f*sx + 0.6f*sy, -0.6f*sx + 0.8f*sy);
+
+    state = state*1664525u + 1013904223u; const float rx = float(state >> 8)*(1.0f / 16777216.0f);
+    state = state*1664525u + 1013904223u; const float ry = float(state >> 8)*(1.0f / 16777216.0f);
+    uvRandom[i] = make_float2(rx, ry);
+  }
+
+  std::cout << "[bench_texture_layouts]: " << w << "x" << h << " RGBA8, " << fetchNum << " bilinear fetches per run" << std::endl;
+
+  for (int tiled = 0; tiled < 2; tiled++)
+  {
+    std::vector<int4> tex;
+    FillTexelsRGBA8(tex, w, h, tiled == 1);
+
+    for (int pattern = 0; pattern < 2; pattern++)
+    {
+      const std::vector<float2>& uv = (pattern == 0) ? uvCoherent : uvRandom;
+
+      float summ = 0.0f;
+      const auto before = std::chrono::high_resolution_clock::now();
+      for (int i = 0; i < fetchNum; i++)
+        summ += read_imagef_sw4(tex.data(), uv[i], 0).x;
+      const auto after = std::chrono::high_resolution_clock::now();
+
+      const float ms = std::chrono::duration_cast<std::chrono::microseconds>(after - before).count()/1000.f;
+      std::cout << (tiled ? "tiled 4x4 " : "row major ") << ((pattern == 0) ? "coherent  " : "incoherent") << ": " 
+                << std::fixed << float(fetchNum) / (1000.0f*ms) << " MFetch/s (" << ms << " ms, checksum " << summ << ")" << std::endl;
+    }
+  }
+}
+
+static int RenderForTime(std::shared_ptr<IHRRenderDriver> a_pDriver, int a_pathGuiding, float a_seconds, const std::wstring& a_outName,
+                         std::vector<float>& a_outHDR)
+{
+  if (!InitSceneLibAndRTE(camRef, scnRef, renderRef, a_pDriver))
+  {
+    std::cerr << "[bench_path_guiding]: can not load scene library at " << g_input.inLibraryPath << std::endl;
+    return 0;
+  }
+
+  hrRenderOpen(renderRef, HR_OPEN_EXISTING);
+  {
+    auto paramNode = hrRenderParamNode(renderRef);
+    paramNode.force_child(L"method_primary").text()  = L"pathtracing";
+    paramNode.force_child(L"maxRaysPerPixel").text() = 1000000; // stop by time, not by spp
+    paramNode.force_child(L"path_guiding").text()    = a_pathGuiding;
+    paramNode.force_child(L"seed").text()            = 777;
+  }
+  hrRenderClose(renderRef);
+
+  hrCommit(scnRef, renderRef, camRef);
+
+  int passes = 0;
+  const auto before = std::chrono::high_resolution_clock::now();
+  while (true)
+  {
+    hrDrawPassOnly(scnRef, renderRef, camRef);
+    passes++;
+    const auto now = std::chrono::high_resolution_clock::now();
+    if (std::chrono::duration_cast<std::chrono::milliseconds>(now - before).count() >= int(1000.0f*a_seconds))
+      break;
+  }
+
+  a_outHDR.resize(4*g_input.winWidth*g_input.winHeight);
+  a_pDriver->GetFrameBufferHDR(g_input.winWidth, g_input.winHeight, a_outHDR.data(), L"color");
+
+  hrRenderSaveFrameBufferHDR(renderRef, a_outName.c_str());
+  return passes;
+}
+
+/**
+\brief relative MSE of linear HDR colors; error of bright pixels is not hidden by tone mapping and they don't dominate the average.
+
+*/
+static float ImagesRelMSE(const std::vector<float>& a_image, const std::vector<float>& a_ref)
+{
+  if (a_image.size() != a_ref.size() || a_ref.empty())
+    return 10000.0f;
+
+  double summ = 0.0;
+  for (size_t i = 0; i < a_ref.size(); i += 4)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      const double diff = double(a_image[i + c]) - double(a_ref[i + c]);
+      summ += (diff*diff) / (double(a_ref[i + c])*double(a_ref[i + c]) + 1e-2);
+    }
+  }
+
+  return float(summ / double(3*(a_ref.size()/4)));
+}
+
+/**
+\brief Equal time comparison of path tracing with and without path guiding (HRT_PATH_GUIDING) on g_input.inLibraryPath scene.
+
+Runs on CPU layer and, if g_input.inDeviceId is set, on that OpenCL device. Reference is unguided and rendered REF_TIME_SCALE 
+times longer on the same device; error is relative MSE of HDR frame buffers.
+
+*/
+void bench_path_guiding()
+{
+  const float budget         = 30.0f; // seconds per run
+  const float REF_TIME_SCALE = 16.0f;
+
+  std::cout << "[bench_path_guiding]: scene " << g_input.inLibraryPath << ", " << budget << " s per run" << std::endl;
+
+  std::vector<int> devices = { -1 };
+  if (g_input.inDeviceId >= 0)
+    devices.push_back(g_input.inDeviceId);
+
+  for (int devId : devices)
+  {
+    const std::wstring prefix     = (devId < 0) ? L"z_guiding_cpu" : L"z_guiding_ocl";
+    const std::wstring refName    = prefix + L"_ref.exr";
+    const std::wstring outName[2] = { prefix + L"_off.exr", prefix + L"_on.exr" };
+
+    std::vector<float> ref, image;
+
+    {
+      std::shared_ptr<IHRRenderDriver> pDriver(CreateDriverRTE(L"", g_input.winWidth, g_input.winHeight, devId, GPU_RT_NOWINDOW | GPU_RT_DO_NOT_PRINT_PASS_NUMBER, nullptr));
+      const int passes = RenderForTime(pDriver, 0, budget*REF_TIME_SCALE, refName, ref);
+      std::cout << "device " << devId << ", reference: " << passes << " passes" << std::endl;
+    }
+
+    for (int guiding = 0; guiding < 2; guiding++)
+    {
+      std::shared_ptr<IHRRenderDriver> pDriver(CreateDriverRTE(L"", g_input.winWidth, g_input.winHeight, devId, GPU_RT_NOWINDOW | GPU_RT_DO_NOT_PRINT_PASS_NUMBER, nullptr));
+      const int passes  = RenderForTime(pDriver, guiding, budget, outName[guiding], image);
+      const float error = ImagesRelMSE(image, ref);
+      std::cout << "device " << devId << ", " << (guiding ? "guided  " : "unguided") << ": " << passes << " passes, relMSE = " << std::fixed << error << std::endl;
+    }
+  }
+}
@@ -3,9 +3,63 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "MemoryStorageCPU.h"
 
+/**
+\brief Double buffer for images produced by background render passes. Writer and readers never lock each other.
+
+ Writer fills the back buffer and then publishes it by swapping 'front' index. Reader marks the front buffer as used;
+ if the writer finds its back buffer used by a reader, it skips publishing for this pass (next pass will publish again).
+
+*/
+struct RenderSnapshots
+{
+  RenderSnapshots() : front(0) { readers[0] = 0; readers[1] = 0; }
+
+  struct Snapshot
+  {
+    Snapshot() : spp(0) {}
+    std::vector<float4> hdr;
+    std::vector<uint>   ldr;
+    int                 spp;
+  };
+
+  Snapshot* BeginWrite()
+  {
+    const int back = 1 - front.load();
+    return (readers[back].load() == 0) ? &data[back] : nullptr;
+  }
+
+  void EndWrite() { front.store(1 - front.load()); }
+
+  const Snapshot* BeginRead(int* a_pId) const
+  {
+    while (true)
+    {
+      const int id = front.load();
+      readers[id]++;
+      if (front.load() == id)
+      {
+        (*a_pId) = id;
+        return &data[id];
+      }
+      readers[id]--;
+    }
+  }
+
+  void EndRead(int a_id) const { readers[a_id]--; }
+
+  Snapshot                 data[2];
+  std::atomic<int>         front;
+  mutable std::atomic<int> readers[2];
+};
+
 class CPUExpLayer : public CPUSharedData
 {
   typedef CPUSharedData Base;
@@ -38,22 +92,51 @@ public:
 
   void ResizeScreen(int w, int h, int a_flags);
 
+  void FinishAll() override { StopAsyncPasses(); }
+  void StopAsyncPasses() override;
+
+  float GetSPP() const override;
+
   size_t GetAvaliableMemoryAmount(bool allMem);
+  size_t GetFrameBufferMemoryAmount() const override;
   MRaysStat GetRaysStat();
 
   bool StoreCPUData()     const { return true; }
 
 protected:
 
+  // asynchronous render session (HRT_CPU_ASYNC_RENDER): BeginTracingPass only wakes up background thread which runs
+  // passes continuously until HRT_MAX_SAMPLES_PER_PIXEL and publishes images to m_snapshots; StopAsyncPasses interrupts current pass between tiles.
+  //
+  bool AsyncMode() const { return m_vars.m_varsI[HRT_CPU_ASYNC_RENDER] != 0; }
+  void StartAsyncPasses();
+  void ExitAsyncPasses();
+  void AsyncRenderLoop();
+  bool PublishSnapshot();
+
+  std::thread             m_asyncThread;
+  std::mutex              m_asyncMutex;
+  std::condition_variable m_asyncCond;
+  bool                    m_asyncRun;       ///< guarded by m_asyncMutex
+  bool                    m_asyncBusy;      ///< guarded by m_asyncMutex; background thread is inside DoPass
+  bool                    m_asyncExit;      ///< guarded by m_asyncMutex
+  bool                    m_asyncCancelled; ///< last pass was interrupted, accumulated image must be reset before next one
+  int                     m_asyncMaxSpp;    ///< guarded by m_asyncMutex; background thread stops when integrator reaches it
+  std::atomic<int>        m_asyncCancel;
+  std::atomic<int>        m_asyncSpp;       ///< passes in the last published snapshot
+  RenderSnapshots         m_snapshots;
+
   void renderSubPixelData(const char* a_dataName, const std::vector<ushort2>& a_pixels, int spp, float4* a_pixValues, float4* a_subPixValues);
 
-  std::vector<uint>       m_tempImage;
-  std::vector<ZBlock>     m_tempBlocks;
-  std::vector<float4>     m_cachedTx;
+  mutable std::vector<uint> m_tempImage;
+  mutable bool              m_tempImageDirty; ///< LDR image is converted from HDR lazily, only in GetLDRImage
+  std::vector<ZBlock>       m_tempBlocks;
+  std::vector<float4>       m_cachedTx;
 };
 
 
-CPUExpLayer::CPUExpLayer(int w, int h, int a_flags) : Base(w, h, a_flags)
+CPUExpLayer::CPUExpLayer(int w, int h, int a_flags) : Base(w, h, a_flags), m_tempImageDirty(true), 
+                                                       m_asyncRun(false), m_asyncBusy(false), m_asyncExit(false), m_asyncCancelled(false), m_asyncMaxSpp(0), m_asyncCancel(0), m_asyncSpp(0)
 {
   ResizeScreen(w, h, a_flags);
 }
@@ -61,14 +144,16 @@ CPUExpLayer::CPUExpLayer(int w, int h, int a_flags) : Base(w, h, a_flags)
 
 CPUExpLayer::~CPUExpLayer()
 {
-
+  ExitAsyncPasses();
 }
 
 
 void CPUExpLayer::ResizeScreen(int width, int height, int a_flags)
 {
+  StopAsyncPasses();
   IHWLayer::ResizeScreen(width, height, a_flags);
   m_tempImage.resize(width*height);
+  m_tempImageDirty = true;
   m_width  = width;
   m_height = height;
 
@@ -92,7 +177,16 @@ void CPUExpLayer::ResizeScreen(int width, int height, int a_flags)
 
 size_t CPUExpLayer::GetAvaliableMemoryAmount(bool allMem)
 {
-  return size_t(8) * size_t(1024 * 1024 * 1024); // 8 Gb 
+  return allMem ? HostMemoryTotal() : HostMemoryAvailable();
+}
+
+size_t CPUExpLayer::GetFrameBufferMemoryAmount() const
+{
+  const size_t pixels    = size_t(m_width)*size_t(m_height);
+  const size_t accum     = pixels*sizeof(float4);                 // integrator color accumulator
+  const size_t ldr       = pixels*sizeof(uint);                   // m_tempImage
+  const size_t snapshots = AsyncMode() ? 2*(accum + ldr) : 0;     // m_snapshots double buffer
+  return accum + ldr + snapshots;
 }
 
 
@@ -118,6 +212,20 @@ IMemoryStorage* CPUExpLayer::CreateMemStorage(uint64_t a_maxSizeInBytes, const c
 ////
 void CPUExpLayer::PrepareEngineGlobals()
 {
+  if (m_asyncThread.joinable() && m_cdataPrepared.size() != 0)
+  {
+    const EngineGlobals* pPrepared = (const EngineGlobals*)&m_cdataPrepared[0];
+
+    if (memcmp(pPrepared, &m_globsBuffHeader, sizeof(EngineGlobals)) == 0) // nothing changed, don't interrupt passes
+      return;
+
+    const bool camChanged = (memcmp(pPrepared->mWorldViewInverse, m_globsBuffHeader.mWorldViewInverse, sizeof(float) * 16) != 0) ||
+                            (memcmp(pPrepared->mProjInverse,      m_globsBuffHeader.mProjInverse,      sizeof(float) * 16) != 0);
+    StopAsyncPasses();
+    if (camChanged)
+      m_asyncCancelled = true; // restart accumulation with new camera
+  }
+
   Base::PrepareEngineGlobals();
   m_pIntegrator->SetConstants((EngineGlobals*)&m_cdataPrepared[0]);
   m_pIntegrator->SetMaxDepth(m_vars.m_varsI[HRT_TRACE_DEPTH]);
@@ -129,6 +237,22 @@ void CPUExpLayer::GetLDRImage(uint* data, int width, int height) const
   if (width != m_width || height != m_height)
     return;
 
+  if (m_asyncThread.joinable())
+  {
+    int id = 0;
+    const RenderSnapshots::Snapshot* pSnap = m_snapshots.BeginRead(&id);
+    if (pSnap->ldr.size() == size_t(m_width*m_height))
+      memcpy(data, pSnap->ldr.data(), m_width*m_height*sizeof(int));
+    m_snapshots.EndRead(id);
+    return;
+  }
+
+  if (m_tempImageDirty)
+  {
+    m_pIntegrator->GetImageToLDR(m_tempImage);
+    m_tempImageDirty = false;
+  }
+
   memcpy(data, &m_tempImage[0], m_width*m_height*sizeof(int));
 }
 
@@ -137,17 +261,33 @@ void CPUExpLayer::GetHDRImage(float4* data, int width, int height) const
   if (data == nullptr)
     return;
 
+  if (m_asyncThread.joinable())
+  {
+    int id = 0;
+    const RenderSnapshots::Snapshot* pSnap = m_snapshots.BeginRead(&id);
+    if (width == m_width && height == m_height && pSnap->hdr.size() == size_t(width*height))
+      memcpy(data, pSnap->hdr.data(), width*height*sizeof(float4));
+    m_snapshots.EndRead(id);
+    return;
+  }
+
   m_pIntegrator->GetImageHDR(data, width, height);
 }
 
 void CPUExpLayer::InitPathTracing(int seed)
 {
+  StopAsyncPasses();
   m_pIntegrator->Reset();
+  m_asyncSpp.store(0);
+  m_tempImageDirty = true;
 }
 
 void CPUExpLayer::ClearAccumulatedColor()                                                                      
 {
+  StopAsyncPasses();
   m_pIntegrator->ClearAccumulatedColor();
+  m_asyncSpp.store(0);
+  m_tempImageDirty = true;
 }
 
 void CPUExpLayer::renderSubPixelData(const char* a_dataName, const std::vector<ushort2>& a_pixels, int a_spp, float4* a_pixValues, float4* a_subPixValues)
@@ -287,9 +427,24 @@ void CPUExpLayer::ResetPerfCounters()
 
 }
 
+float CPUExpLayer::GetSPP() const
+{
+  if (m_asyncThread.joinable())
+    return float(m_asyncSpp.load()); // report what GetHDRImage/GetLDRImage actually return
+  return (m_pIntegrator == nullptr) ? 0.0f : float(m_pIntegrator->GetSpp());
+}
+
 void CPUExpLayer::BeginTracingPass()
 {
+  if (AsyncMode())
+  {
+    StartAsyncPasses();
+    return;
+  }
+
+  ExitAsyncPasses(); // 'cpu_async_render' was turned off; readers must see integrator image again
   m_pIntegrator->DoPass(m_tempImage);
+  m_tempImageDirty = true;
   //m_pIntegrator->TracePrimary(m_tempImage);
   //m_pIntegrator->TraceForTest(m_tempImage);
 }
@@ -299,6 +454,135 @@ void CPUExpLayer::EndTracingPass()
 
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//// asynchronous render session
+
+void CPUExpLayer::StartAsyncPasses()
+{
+  if (m_pIntegrator == nullptr)
+    return;
+
+  if (!m_asyncThread.joinable())
+  {
+    m_pIntegrator->SetCancelFlag(&m_asyncCancel);
+    m_asyncThread = std::thread(&CPUExpLayer::AsyncRenderLoop, this);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(m_asyncMutex);
+    if (m_asyncCancelled && !m_asyncBusy)
+    {
+      m_pIntegrator->Reset();
+      m_asyncCancelled = false;
+      m_asyncSpp.store(0);
+    }
+    m_asyncMaxSpp = std::max(m_vars.m_varsI[HRT_MAX_SAMPLES_PER_PIXEL], 1);
+    m_asyncRun    = true;
+  }
+  m_asyncCond.notify_all();
+}
+
+/**
+\brief Stop background thread and return to blocking passes. Interrupted pass leaves partial image, so accumulation is restarted.
+
+*/
+void CPUExpLayer::ExitAsyncPasses()
+{
+  if (!m_asyncThread.joinable())
+    return;
+
+  {
+    std::unique_lock<std::mutex> lock(m_asyncMutex);
+    m_asyncExit = true;
+    m_asyncCancel.store(1);
+  }
+  m_asyncCond.notify_all();
+  m_asyncThread.join();
+
+  m_asyncRun    = false;
+  m_asyncBusy   = false;
+  m_asyncExit   = false;
+  m_asyncCancel.store(0);
+  m_asyncSpp.store(0);
+
+  if (m_pIntegrator != nullptr)
+  {
+    m_pIntegrator->SetCancelFlag(nullptr);
+    if (m_asyncCancelled)
+      m_pIntegrator->Reset();
+  }
+  m_asyncCancelled = false;
+  m_tempImageDirty = true;
+}
+
+void CPUExpLayer::StopAsyncPasses()
+{
+  if (!m_asyncThread.joinable())
+    return;
+
+  std::unique_lock<std::mutex> lock(m_asyncMutex);
+  m_asyncRun = false;
+  m_asyncCancel.store(1);
+  m_asyncCond.wait(lock, [this]() { return !m_asyncBusy; });
+  m_asyncCancel.store(0);
+}
+
+void CPUExpLayer::AsyncRenderLoop()
+{
+  std::unique_lock<std::mutex> lock(m_asyncMutex);
+
+  while (true)
+  {
+    m_asyncCond.wait(lock, [this]() { return m_asyncRun || m_asyncExit; });
+    if (m_asyncExit)
+      break;
+
+    if (m_pIntegrator->GetSpp() >= m_asyncMaxSpp) // budget is done; sleep until reset or new budget
+    {
+      m_asyncRun = false;
+      continue;
+    }
+
+    const int maxSpp = m_asyncMaxSpp;
+    m_asyncBusy = true;
+    lock.unlock();
+
+    const int sppBefore = m_pIntegrator->GetSpp();
+    m_pIntegrator->DoPass(m_tempImage);
+    const int  sppAfter    = m_pIntegrator->GetSpp();
+    const bool interrupted = (sppAfter == sppBefore); // partially updated image is biased
+
+    if (!interrupted)
+    {
+      const bool lastPass = (sppAfter >= maxSpp);
+      while (!PublishSnapshot() && lastPass) // final image must be published, nothing will overwrite it later
+        std::this_thread::yield();
+    }
+
+    lock.lock();
+    m_asyncCancelled = m_asyncCancelled || interrupted;
+    m_asyncBusy      = false;
+    m_asyncCond.notify_all();
+  }
+}
+
+bool CPUExpLayer::PublishSnapshot()
+{
+  RenderSnapshots::Snapshot* pSnap = m_snapshots.BeginWrite();
+  if (pSnap == nullptr) // reader still copies previous image; publish after next pass
+    return false;
+
+  pSnap->hdr.resize(m_width*m_height);
+  pSnap->ldr.resize(m_width*m_height);
+  m_pIntegrator->GetImageHDR(pSnap->hdr.data(), m_width, m_height);
+  m_pIntegrator->GetImageToLDR(pSnap->ldr);
+  pSnap->spp = m_pIntegrator->GetSpp();
+
+  m_snapshots.EndWrite();
+  m_asyncSpp.store(pSnap->spp);
+  return true;
+}
+
 
 IHWLayer* CreateCPUExpImpl(int w, int h, int a_flags) { return new CPUExpLayer(w, h, a_flags); }
 
@@ -4,6 +4,8 @@
   #define RAND_MLT_CPU
 #endif
 
+//#define INTEGRATOR_PATH_GRAMMAR // record path grammar ("EDGSL") and vertices positions per thread; for debug only
+
 #include "cglobals.h"
 #include "crandom.h"
 #include "cfetch.h"
@@ -19,9 +21,14 @@
 
 #include <vector>
 #include <tuple>
+#include <algorithm>
+#include <cassert>
+#include <atomic>
+#include <memory>
 #include <omp.h>
 
 #include "IBVHBuilderAPI.h"
+#include "CPUExp_PathGuiding.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// old
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// old
@@ -102,6 +109,57 @@ struct SceneMTexData
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/**
+\brief Fixed capacity array with a subset of std::vector interface. Stored in place, never touches the heap; copy copies only size() elements.
+
+*/
+template<typename T, int N>
+struct FixedVector
+{
+  FixedVector() : m_size(0) {}
+  explicit FixedVector(size_t a_size) : m_size(0) { resize(a_size); }
+
+  FixedVector(const FixedVector& a_rhs) : m_size(a_rhs.m_size) { std::copy(a_rhs.m_data, a_rhs.m_data + m_size, m_data); }
+  FixedVector& operator=(const FixedVector& a_rhs)
+  {
+    m_size = a_rhs.m_size;
+    std::copy(a_rhs.m_data, a_rhs.m_data + m_size, m_data);
+    return *this;
+  }
+
+  void resize(size_t a_size)
+  {
+    assert(a_size <= size_t(N));
+    const int newSize = int(std::min(a_size, size_t(N)));
+    for (int i = m_size; i < newSize; i++)
+      m_data[i] = T();
+    m_size = newSize;
+  }
+
+  void push_back(const T& a_val) { assert(m_size < N); if (m_size < N) m_data[m_size++] = a_val; }
+  void clear() { m_size = 0; }
+
+  size_t size()     const { return size_t(m_size); }
+  bool   empty()    const { return m_size == 0; }
+  constexpr static size_t capacity() { return size_t(N); }
+
+  T*       data()       { return m_data; }
+  const T* data() const { return m_data; }
+
+  T*       begin()       { return m_data; }
+  T*       end()         { return m_data + m_size; }
+  const T* begin() const { return m_data; }
+  const T* end()   const { return m_data + m_size; }
+
+  T&       operator[](size_t i)       { return m_data[i]; }
+  const T& operator[](size_t i) const { return m_data[i]; }
+
+private:
+
+  T   m_data[N];
+  int m_size;
+};
+
 struct SurfaceInfo
 {
   SurfaceInfo() { traceDepth = -1; }
@@ -113,7 +171,7 @@ class Integrator
 {
 public:
 
-  Integrator() : m_maxDepth(6), m_computeIndirectMLT(false), m_spp(0) {}
+  Integrator() : m_maxDepth(6), m_computeIndirectMLT(false), m_spp(0), m_pCancel(nullptr) {}
   virtual ~Integrator(){}
 
   virtual float3 PathTrace(float3 a_rpos, float3 a_rdir, MisData misPrev, int a_currDepth, uint flags) = 0;
@@ -125,7 +183,7 @@ public:
   virtual void TraceForTest(std::vector<uint>& a_imageLDR) { }
 
   virtual void GetImageHDR(float4* data, int width, int height) const = 0;
-  virtual void GetImageToLDR(std::vector<uint>& a_imageLDR)     const = 0;
+  virtual void GetImageToLDR(std::vector<uint>& a_imageLDR)     const = 0; ///< DoPass does not update LDR image; call this when you actually need it
 
   // full core implemenation
   //
@@ -151,14 +209,20 @@ public:
 
   virtual void SetMaxDepth(int a_depth) { m_maxDepth = a_depth; }
 
+  void SetCancelFlag(const std::atomic<int>* a_pCancel) { m_pCancel = a_pCancel; } ///< DoPass skips remaining tiles when (*a_pCancel != 0); pass is not counted then
+
 protected:
 
   Integrator(const Integrator& a_rhs) {}
   Integrator& operator=(const Integrator& rhs) { return *this; }
 
+  bool PassCancelled() const { return (m_pCancel != nullptr) && (m_pCancel->load(std::memory_order_relaxed) != 0); }
+
   int  m_maxDepth;
   bool m_computeIndirectMLT;
   int  m_spp;
+
+  const std::atomic<int>* m_pCancel;
 };
 
 
@@ -183,13 +247,15 @@ public:
   //
   Lite_Hit       rayTrace(float3 a_rpos, float3 a_rdir, uint flags = 0);
   virtual float3 shadowTrace(float3 a_rpos, float3 a_rdir, float t_far, uint flags = 0);
-  SurfaceHit     surfaceEval(float3 a_rpos, float3 a_rdir, Lite_Hit hit);
+  SurfaceHit     surfaceEval(float3 a_rpos, float3 a_rdir, Lite_Hit hit, float a_coneWidth = -1.0f); ///< a_coneWidth is ray cone width at a_rpos; negative disables texture LOD
 
   GBufferAll     gbufferEval(int x, int y);
 
   const EngineGlobals* getEngineGlobals() const { return m_pGlobals; }
-  void GetImageToLDR(std::vector<uint>& a_imageLDR) const;
-  void GetImageHDR(float4* a_imageHDR, int w, int h) const;
+  void GetImageToLDR(std::vector<uint>& a_imageLDR) const override;
+  void GetImageHDR(float4* a_imageHDR, int w, int h) const override;
+
+  virtual float LDRScale() const { return 1.0f; } ///< m_summColors is a running mean by default; splatting integrators store summ and override this
 
   float3 evalDiffuseColor(float3 ray_dir, const SurfaceHit& a_hit);
   float3 EnviromnentColor(float3 a_rdir, MisData misPrev, uint flags);
@@ -258,7 +324,11 @@ protected:
 
   RandomGen& randomGen();
 
+  bool DeterministicRNG() const { return (m_pGlobals != nullptr) && (m_pGlobals->varsI[HRT_RNG_DETERMINISTIC] != 0); }
+  void SeedThreadGenerators(int a_sampleId, int a_stream = 0, int a_pass = -1);
+
   constexpr static int INTEGRATOR_MAX_THREADS_NUM = 32;
+  constexpr static int INTEGRATOR_MAX_PATH_DEPTH  = 32; ///< fixed capacity of per thread path storage; trace depth is clamped to this value
 
 
   struct PerThreadData
@@ -271,16 +341,17 @@ protected:
     RandomGen          gen;
     RandomGen          gen2;
 
-    std::vector<PdfVertex> pdfArray;
-    float                  pdfLightA0;
+    FixedVector<PdfVertex, INTEGRATOR_MAX_PATH_DEPTH + 1> pdfArray;
+    float                                                 pdfLightA0;
 
     int selectedLightIdFwd;
     int mBounceDone;
     int qmcPos;
     
-    std::string grammarCam;
-    std::string grammarLit;
-    std::vector<float3> vert;
+#ifdef INTEGRATOR_PATH_GRAMMAR
+    FixedVector<char,   INTEGRATOR_MAX_PATH_DEPTH + 2> grammarCam;
+    FixedVector<char,   INTEGRATOR_MAX_PATH_DEPTH + 2> grammarLit;
+    FixedVector<float3, INTEGRATOR_MAX_PATH_DEPTH + 1> vert;
 
     void clearPathGrammar(int a_vertNum) 
     { 
@@ -288,6 +359,14 @@ protected:
       for (size_t i = 0; i < vert.size(); i++)
         vert[i] = float3(0, 0, 0);
     }
+
+    void pushGrammarCam(char a_symbol)        { grammarCam.push_back(a_symbol); }
+    void storeVertex(int a_id, float3 a_pos)  { vert[a_id] = a_pos; }
+#else
+    void clearPathGrammar(int a_vertNum)      { }
+    void pushGrammarCam(char a_symbol)        { }
+    void storeVertex(int a_id, float3 a_pos)  { }
+#endif
   };
 
   std::vector<PerThreadData> m_perThread;     
@@ -297,6 +376,19 @@ protected:
   std::vector<float4>    m_summColors;  // experimental integrators use very simple not adaptive sampling, no tiles
   float4*                m_hdrData;     // @always equal to &m_summColors[0];
 
+  constexpr static int PASS_TILE_SIZE = 16; ///< DoPass processes image by tiles; cancellation (m_pCancel) is checked before each tile
+
+  // adaptive sampling, see DoPassAdaptive; used only when HRT_ADAPTIVE_SAMPLING is set
+  //
+  constexpr static int ADAPTIVE_MAX_SPP_PER_PASS = 16;
+
+  std::vector<float> m_summSquareLum; // running mean of squared luminance per pixel
+  std::vector<int>   m_pixelSpp;      // samples taken per pixel
+  std::vector<float> m_tileError;     // relative error of the mean per tile; tile is converged when error <= HRT_PATH_TRACE_ERROR
+
+  void DoPassAdaptive(std::vector<uint>& a_imageLDR);
+  void UpdateTileErrors();
+
   float3 Test_RayTrace(float3 ray_pos, float3 ray_dir);
   float4x4 fetchMatrix(const Lite_Hit& a_liteHit);
   int      fetchInstId(const Lite_Hit& a_liteHit);
@@ -369,9 +461,21 @@ class IntegratorMISPT : public IntegratorCommon
 {
 public:
 
-  IntegratorMISPT(int w, int h, EngineGlobals* a_pGlobals, int a_createFlags) : IntegratorCommon(w, h, a_pGlobals, a_createFlags) {}
+  IntegratorMISPT(int w, int h, EngineGlobals* a_pGlobals, int a_createFlags) : IntegratorCommon(w, h, a_pGlobals, a_createFlags) { ResetGuiding(); }
 
+  void   DoPass(std::vector<uint>& a_imageLDR) override;
+  void   SetSceneGlobals(int w, int h, EngineGlobals* a_pGlobals) override;
   float3 PathTrace(float3 a_rpos, float3 a_rdir, MisData misPrev, int a_currDepth, uint flags);
+
+protected:
+
+  // path guiding, used only when HRT_PATH_GUIDING is set. Training passes record incident radiance to m_guide,
+  // PathTrace samples the last SD-tree together with BSDF (see GuidingTrainer).
+  //
+  void ResetGuiding();
+
+  GuidingTrainer                 m_guide;
+  std::shared_ptr<GuidingSDTree> m_pGuide;  ///< tree that is sampled in current pass; nullptr until the first training iteration is done
 };
 
 class IntegratorMISPT_QMC : public IntegratorMISPT
@@ -392,6 +496,7 @@ public:
   IntegratorMISPT_AQMC(int w, int h, EngineGlobals* a_pGlobals, int a_createFlags);
   
   void DoPass(std::vector<uint>& a_imageLDR) override;
+  float LDRScale() const override { return 1.0f / float(std::max(m_spp, 1)); }
   
   const unsigned int* GetQMCTableIfEnabled() const override { return (const unsigned int*)m_tableQMC; }
 
@@ -519,6 +624,7 @@ public:
   }
 
   void DoPass(std::vector<uint>& a_imageLDR) override;
+  float LDRScale() const override { return 1.0f / float(std::max(m_spp, 1)); }
 
 protected:
 
@@ -546,6 +652,7 @@ public:
   }
 
   void DoPass(std::vector<uint>& a_imageLDR) override;
+  float LDRScale() const override { return 1.0f / float(std::max(m_spp, 1)); }
 
   void SetMaxDepth(int a_depth) override;
 
@@ -581,6 +688,7 @@ public:
   }
 
   void DoPass(std::vector<uint>& a_imageLDR) override;
+  float LDRScale() const override { return 1.0f / float(std::max(m_spp, 1)); }
 
   void SetMaxDepth(int a_depth) override;
 
@@ -624,6 +732,7 @@ public:
   }
 
   void DoPass(std::vector<uint>& a_imageLDR) override;
+  float LDRScale() const override { return 1.0f / float(std::max(m_spp, 1)); }
 
   void SetMaxDepth(int a_depth) override;
 
@@ -687,10 +796,11 @@ public:
 
   float DoPassEstimateAvgBrightness();
   void  DoPassDirectLight(float4* a_outImage);
-  void  DoPassIndirectMLT(float4* a_outImage);
+  void  DoPassIndirectMLT(int a_chainId, float4* a_outImage);
   float EstimateScaleCoeff() const;
 
   void GetImageHDR(float4* a_imageHDR, int w, int h) const;
+  void GetImageToLDR(std::vector<uint>& a_imageLDR) const override;
 
 protected:
 
@@ -718,21 +828,23 @@ protected:
  
   float  mLightSubPathCount; ///< piece of shit from smallVCM
 
-  typedef std::vector<float> PSSampleV;
+  typedef FixedVector<float, MMLT_HEAD_TOTAL_SIZE + MMLT_FLOATS_PER_BOUNCE*INTEGRATOR_MAX_PATH_DEPTH> PSSampleV; // in place, no heap allocations on mutation
 
   PSSampleV  m_pss       [INTEGRATOR_MAX_THREADS_NUM]; // primary space samples
   PathVertex m_oldLightV [INTEGRATOR_MAX_THREADS_NUM];
   PathVertex m_oldCameraV[INTEGRATOR_MAX_THREADS_NUM];
+  int        m_chainId   [INTEGRATOR_MAX_THREADS_NUM]; // chain that thread runs now
   bool  m_firstPass;
   float m_avgBrightness;
   std::vector<float> m_avgBPerBounce;
 
   float3    F(const PSSampleV& a_xVec, const int d, int m_type, int* pX, int* pY);
   PSSampleV InitialSamplePS(const int d, const int a_burnIters = 0);
-  PSSampleV MutatePrimarySpace(const PSSampleV& a_vec, int d, int* pMutationType);
+  void      MutatePrimarySpace(PSSampleV& a_vec, int d, int* pMutationType); ///< mutate a_vec in place
 
   void MutateLightPart(PSSampleV& a_vec, int s, RandomGen* pGen);
   void MutateCameraPart(PSSampleV& a_vec, int s, RandomGen* pGen);
+  int  GeneratorSkipSteps(int a_period, int a_range1, int a_range2) const; ///< extra generator steps that decorrelate chains
 
   HDRImage4f   m_direct;
   const float* m_mask;
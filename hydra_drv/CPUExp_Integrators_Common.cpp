@@ -2,6 +2,7 @@
 
 #include "CPUExp_Integrators.h"
 #include "ctrace.h"
+#include "ImageToLDR.h"
 
 #include <cmath>
 #include <algorithm>
@@ -42,19 +43,29 @@ void IntegratorCommon::SetSceneGlobals(int w, int h, EngineGlobals* a_pGlobals)
     {
       m_perThread[i].gen  = RandomGenInit(i*GetTickCount());
       m_perThread[i].gen2 = RandomGenInit(i*i*GetTickCount() + i + 7);
-      m_perThread[i].pdfArray.resize(a_pGlobals->varsI[HRT_TRACE_DEPTH] + 1);
+      m_perThread[i].pdfArray.resize(std::min(a_pGlobals->varsI[HRT_TRACE_DEPTH], int(INTEGRATOR_MAX_PATH_DEPTH)) + 1);
     }
   }
   m_initDoneOnce = true;
 
   m_summColors.resize(m_width*m_height);
+  m_pixelSpp.clear();
   m_spp = 0;
 
 }
 
 void IntegratorCommon::RandomizeAllGenerators()
 {
-  if (m_spp % 17 == 0)
+  if (DeterministicRNG()) // generators are reseeded per sample in SeedThreadGenerators; keep the rest reproducible too
+  {
+    const unsigned int seed = (unsigned int)m_pGlobals->varsI[HRT_RNG_SEED];
+    for (int i = 0; i < int(m_perThread.size()); i++)
+    {
+      m_perThread[i].gen  = RandomGenInitCounter(seed, 0xFFFFFFFFu - i, m_spp, 0);
+      m_perThread[i].gen2 = RandomGenInitCounter(seed, 0xFFFFFFFFu - i, m_spp, 1);
+    }
+  }
+  else if (m_spp % 17 == 0)
   {
     for (int i = 0; i < m_perThread.size(); i++)
     {
@@ -64,6 +75,37 @@ void IntegratorCommon::RandomizeAllGenerators()
   }
 }
 
+/**
+\brief reseed generators of current thread from (seed, sample, pass) when deterministic mode is enabled; does nothing otherwise.
+\param a_sampleId - index of sample inside current pass; usually linear pixel index
+\param a_stream   - use different streams for different loops inside single pass (light and camera paths for example)
+\param a_pass     - sample index inside pixel; -1 means current pass (m_spp)
+
+*/
+void IntegratorCommon::SeedThreadGenerators(int a_sampleId, int a_stream, int a_pass)
+{
+  if (!DeterministicRNG())
+    return;
+
+  const unsigned int seed = (unsigned int)m_pGlobals->varsI[HRT_RNG_SEED];
+  auto& data = PerThread();
+
+#ifdef RAND_MLT_CPU
+  const auto rptr1 = data.gen.rptr;
+  const auto rptr2 = data.gen2.rptr;
+#endif
+
+  const unsigned int pass = (a_pass >= 0) ? (unsigned int)a_pass : (unsigned int)m_spp;
+
+  data.gen  = RandomGenInitCounter(seed, (unsigned int)a_sampleId, pass, 2*a_stream + 0);
+  data.gen2 = RandomGenInitCounter(seed, (unsigned int)a_sampleId, pass, 2*a_stream + 1);
+
+#ifdef RAND_MLT_CPU
+  data.gen.rptr  = rptr1;
+  data.gen2.rptr = rptr2;
+#endif
+}
+
 extern "C" void initQuasirandomGenerator(unsigned int table[QRNG_DIMENSIONS][QRNG_RESOLUTION]);
 
 IntegratorCommon::IntegratorCommon(int w, int h, EngineGlobals* a_pGlobals, int a_createFlags) : m_initDoneOnce(false), m_matStorage(nullptr)
@@ -115,6 +157,7 @@ void IntegratorCommon::SetMaterialRemapListPtrs(const int* a_allLists, const int
 void IntegratorCommon::Reset()
 {
   m_spp = 0;
+  m_pixelSpp.clear();
   for (size_t i = 0; i < m_summColors.size(); i++)
     m_summColors[i] = float4(0, 0, 0, 0);
 }
@@ -190,7 +233,7 @@ int IntegratorCommon::fetchInstId(const Lite_Hit& a_liteHit)
 }
 
 
-SurfaceHit IntegratorCommon::surfaceEval(float3 a_rpos, float3 a_rdir, Lite_Hit hit)
+SurfaceHit IntegratorCommon::surfaceEval(float3 a_rpos, float3 a_rdir, Lite_Hit hit, float a_coneWidth)
 {
   // (1) mul ray with instanceMatrixInv
   //
@@ -231,6 +274,14 @@ SurfaceHit IntegratorCommon::surfaceEval(float3 a_rpos, float3 a_rdir, Lite_Hit
   surfHitWS.t          = length(surfHitWS.pos - a_rpos); // seems this is more precise. VERY strange !!!
   surfHitWS.sRayOff    = length(shadowStartPos);
 
+  if (a_coneWidth >= 0.0f)
+  {
+    const float coneWidth = a_coneWidth + rayConeSpreadAngle(m_pGlobals)*surfHitWS.t;
+    surfHitWS.texLod      = rayConeTexLod(surfHit.texLod + instanceUVLodBias(instanceMatrix), coneWidth, dot(a_rdir, surfHitWS.normal));
+  }
+  else
+    surfHitWS.texLod      = TEX_LOD_NONE;
+
   if (m_remapAllLists != nullptr && m_remapTable != nullptr && m_remapInstTab != nullptr)
   {
     surfHitWS.matId = remapMaterialId(surfHitWS.matId, hit.instId,
@@ -247,6 +298,7 @@ float3 IntegratorCommon::evalDiffuseColor(float3 ray_dir, const SurfaceHit& a_hi
 
   ProcTextureList ptl;
   InitProcTextureList(&ptl);
+  ptl.texLod = a_hit.texLod;
   return materialEvalDiffuse(pHitMaterial, ray_dir, a_hit.normal, a_hit.texCoord, m_pGlobals, m_texStorage, &ptl);
 }
 
@@ -280,58 +332,231 @@ void IntegratorCommon::DoPass(std::vector<uint>& a_imageLDR)
   if (m_width*m_height != a_imageLDR.size())
     RUN_TIME_ERROR("DoPass: bad output bufffer size");
 
+  if (m_pGlobals->varsI[HRT_ADAPTIVE_SAMPLING] != 0)
+  {
+    DoPassAdaptive(a_imageLDR);
+    return;
+  }
+
   // Update HDR image
   //
-  const float alpha = 1.0f / float(m_spp + 1);
+  const float alpha    = 1.0f / float(m_spp + 1);
+  const int   tilesX   = (m_width  + PASS_TILE_SIZE - 1) / PASS_TILE_SIZE;
+  const int   tilesY   = (m_height + PASS_TILE_SIZE - 1) / PASS_TILE_SIZE;
+  const int   tilesNum = tilesX*tilesY;
 
-  #pragma omp parallel for
-  for (int y = 0; y < m_height; y++)
+  #pragma omp parallel for schedule(dynamic)
+  for (int tileId = 0; tileId < tilesNum; tileId++)
   {
-    for (int x = 0; x < m_width; x++)
+    if (PassCancelled()) // don't wait for the whole image when camera was changed; just skip remaining tiles
+      continue;
+
+    const int tx = tileId % tilesX;
+    const int ty = tileId / tilesX;
+
+    const int xEnd = std::min((tx + 1)*PASS_TILE_SIZE, m_width);
+    const int yEnd = std::min((ty + 1)*PASS_TILE_SIZE, m_height);
+
+    for (int y = ty*PASS_TILE_SIZE; y < yEnd; y++)
     {
-      float3 ray_pos, ray_dir;
-      std::tie(ray_pos, ray_dir) = makeEyeRay(x, y);
+      for (int x = tx*PASS_TILE_SIZE; x < xEnd; x++)
+      {
+        SeedThreadGenerators(y*m_width + x);
 
-      if (x == 725 && y == 391)
-        int a = 2;
+        float3 ray_pos, ray_dir;
+        std::tie(ray_pos, ray_dir) = makeEyeRay(x, y);
 
-			const float3 color = PathTrace(ray_pos, ray_dir, makeInitialMisData(), 0, 0); 
-      const float maxCol = maxcomp(color);
+        const float3 color = PathTrace(ray_pos, ray_dir, makeInitialMisData(), 0, 0); 
+        const float maxCol = maxcomp(color);
 
-      m_summColors[y*m_width + x] = m_summColors[y*m_width + x] * (1.0f - alpha) + to_float4(color, maxCol)*alpha;
+        m_summColors[y*m_width + x] = m_summColors[y*m_width + x] * (1.0f - alpha) + to_float4(color, maxCol)*alpha;
+      }
     }
   }
 
+  if (PassCancelled())
+    return;
+
   RandomizeAllGenerators();
   
   m_spp++;
-  GetImageToLDR(a_imageLDR);
   
   //if (m_spp == 1)
     //DebugSaveGbufferImage(L"C:/[Hydra]/rendered_images/torus_gbuff");
 
-  std::cout << "IntegratorCommon: spp = " << m_spp << std::endl;
+  if (m_pGlobals->varsI[HRT_SILENT_MODE] == 0)
+    std::cout << "IntegratorCommon: spp = " << m_spp << std::endl;
 }
 
+/**
+\brief Same as DoPass, but spend the samples of each pass only on image tiles that are not converged yet.
 
-void IntegratorCommon::GetImageToLDR(std::vector<uint>& a_imageLDR) const
+ First HRT_ADAPTIVE_MIN_SPP passes are uniform. After that every pass takes (m_width*m_height) samples and distributes
+ them between noisy tiles proportional to their relative error. Tiles with error <= HRT_PATH_TRACE_ERROR are not sampled.
+ m_summColors stores per pixel mean for its own sample count (m_pixelSpp), so the image is always unbiased.
+
+*/
+void IntegratorCommon::DoPassAdaptive(std::vector<uint>& a_imageLDR)
 {
-  // get HDR to LDR
+  const int tilesX   = (m_width  + PASS_TILE_SIZE - 1) / PASS_TILE_SIZE;
+  const int tilesY   = (m_height + PASS_TILE_SIZE - 1) / PASS_TILE_SIZE;
+  const int tilesNum = tilesX*tilesY;
+
+  if (m_pixelSpp.size() != m_summColors.size() || m_tileError.size() != size_t(tilesNum))
+  {
+    m_pixelSpp.assign(m_summColors.size(), 0);
+    m_summSquareLum.assign(m_summColors.size(), 0.0f);
+    m_tileError.assign(tilesNum, 1.0f);
+    for (auto& color : m_summColors)
+      color = float4(0, 0, 0, 0);
+  }
+
+  const float threshold = m_pGlobals->varsF[HRT_PATH_TRACE_ERROR];
+  const int   minSpp    = std::max(m_pGlobals->varsI[HRT_ADAPTIVE_MIN_SPP], 1);
+
+  // (1) distribute samples between tiles
+  //
+  std::vector<int> tileSpp(tilesNum, 1);
+  int activeTiles = tilesNum;
+
+  if (m_spp >= minSpp)
+  {
+    float summErr = 0.0f;
+    activeTiles   = 0;
+    for (int tileId = 0; tileId < tilesNum; tileId++)
+    {
+      if (m_tileError[tileId] > threshold)
+      {
+        summErr += m_tileError[tileId];
+        activeTiles++;
+      }
+    }
+
+    const float budget = float(m_width*m_height);
+
+    for (int tileId = 0; tileId < tilesNum; tileId++)
+    {
+      if (m_tileError[tileId] <= threshold)
+      {
+        tileSpp[tileId] = 0;
+        continue;
+      }
+
+      const int tx = tileId % tilesX;
+      const int ty = tileId / tilesX;
+      const int tw = std::min(int(PASS_TILE_SIZE), m_width  - tx*PASS_TILE_SIZE);
+      const int th = std::min(int(PASS_TILE_SIZE), m_height - ty*PASS_TILE_SIZE);
+
+      const float spp = budget*(m_tileError[tileId] / summErr) / float(tw*th);
+      tileSpp[tileId] = std::min(std::max(int(spp + 0.5f), 1), int(ADAPTIVE_MAX_SPP_PER_PASS));
+    }
+  }
+
+  // (2) trace; each tile is processed by single thread, so no atomics are needed
   //
-  float gammaPow = 1.0f / m_pGlobals->varsF[HRT_IMAGE_GAMMA];  // gamma correction
+  if (activeTiles > 0)
+  {
+    #pragma omp parallel for schedule(dynamic)
+    for (int tileId = 0; tileId < tilesNum; tileId++)
+    {
+      if (PassCancelled())
+        continue;
+
+      const int tx = tileId % tilesX;
+      const int ty = tileId / tilesX;
+
+      const int xEnd = std::min((tx + 1)*PASS_TILE_SIZE, m_width);
+      const int yEnd = std::min((ty + 1)*PASS_TILE_SIZE, m_height);
+
+      for (int y = ty*PASS_TILE_SIZE; y < yEnd; y++)
+      {
+        for (int x = tx*PASS_TILE_SIZE; x < xEnd; x++)
+        {
+          const int pixelId = y*m_width + x;
+
+          for (int s = 0; s < tileSpp[tileId]; s++)
+          {
+            SeedThreadGenerators(pixelId, 0, m_pixelSpp[pixelId]);
+
+            float3 ray_pos, ray_dir;
+            std::tie(ray_pos, ray_dir) = makeEyeRay(x, y);
+
+            const float3 color = PathTrace(ray_pos, ray_dir, makeInitialMisData(), 0, 0);
+            const float maxCol = maxcomp(color);
+            const float lum    = 0.3333333f*(color.x + color.y + color.z);
+
+            m_pixelSpp[pixelId]++;
+            const float alpha = 1.0f / float(m_pixelSpp[pixelId]);
+
+            m_summColors   [pixelId] = m_summColors   [pixelId] * (1.0f - alpha) + to_float4(color, maxCol)*alpha;
+            m_summSquareLum[pixelId] = m_summSquareLum[pixelId] * (1.0f - alpha) + lum*lum*alpha;
+          }
+        }
+      }
+    }
+
+    if (PassCancelled()) // per pixel means are still valid because each pixel counts its own samples
+      return;
 
-  for (size_t i = 0; i < a_imageLDR.size(); i++)
+    UpdateTileErrors();
+  }
+
+  RandomizeAllGenerators();
+
+  m_spp++;
+
+  if (m_pGlobals->varsI[HRT_SILENT_MODE] == 0)
+    std::cout << "IntegratorCommon: spp = " << m_spp << ", active tiles = " << activeTiles << "/" << tilesNum << std::endl;
+}
+
+void IntegratorCommon::UpdateTileErrors()
+{
+  const int tilesX   = (m_width + PASS_TILE_SIZE - 1) / PASS_TILE_SIZE;
+  const int tilesNum = int(m_tileError.size());
+
+  #pragma omp parallel for
+  for (int tileId = 0; tileId < tilesNum; tileId++)
   {
-    float4 color = ToneMapping4(m_summColors[i]);
+    const int tx = tileId % tilesX;
+    const int ty = tileId / tilesX;
+
+    const int xEnd = std::min((tx + 1)*PASS_TILE_SIZE, m_width);
+    const int yEnd = std::min((ty + 1)*PASS_TILE_SIZE, m_height);
 
-    color.x = powf(color.x, gammaPow);
-    color.y = powf(color.y, gammaPow);
-    color.z = powf(color.z, gammaPow);
+    float summErr = 0.0f;
+    int   pixels  = 0;
 
-    a_imageLDR[i] = RealColorToUint32(color);
+    for (int y = ty*PASS_TILE_SIZE; y < yEnd; y++)
+    {
+      for (int x = tx*PASS_TILE_SIZE; x < xEnd; x++)
+      {
+        const int pixelId = y*m_width + x;
+        const int n       = m_pixelSpp[pixelId];
+        if (n == 0)
+          continue;
+
+        const float4 color   = m_summColors[pixelId];
+        const float  mean    = 0.3333333f*(color.x + color.y + color.z);
+        const float  D       = fmax(m_summSquareLum[pixelId] - mean*mean, 0.0f);
+        const float  errAbs  = sqrt(D / float(n));            // standard error of the mean
+        summErr += errAbs / fmax(mean, 0.01f);
+        pixels++;
+      }
+    }
+
+    m_tileError[tileId] = (pixels > 0) ? summErr / float(pixels) : 0.0f;
   }
 }
 
+
+void IntegratorCommon::GetImageToLDR(std::vector<uint>& a_imageLDR) const
+{
+  const float gammaPow = 1.0f / m_pGlobals->varsF[HRT_IMAGE_GAMMA];  // gamma correction
+  const int   size     = int(std::min(a_imageLDR.size(), m_summColors.size()));
+
+  HDRImageToLDR(m_hdrData, a_imageLDR.data(), size, LDRScale(), gammaPow, true);
+}
+
 void IntegratorCommon::GetImageHDR(float4* a_imageHDR, int w, int h) const
 {
   if (w != m_width || h != m_height)
@@ -521,6 +746,7 @@ float3 IntegratorCommon::emissionEval(const float3 ray_pos, const float3 ray_dir
 
   ProcTextureList ptl;
   InitProcTextureList(&ptl);
+  ptl.texLod = surfElem.texLod;
 
   return ::emissionEval(ray_pos, ray_dir, &surfElem, flags, (misPrev.isSpecular == 1), 
                         pLight, pHitMaterial, m_texStorage, m_pdfStorage, m_pGlobals, &ptl);
@@ -551,9 +777,12 @@ std::tuple<MatSample, int, float3> IntegratorCommon::sampleAndEvalBxDF(float3 ra
             m_pGlobals->rmQMC, PerThread().qmcPos, qmcTablePtr,
             allRands);
 
+  ProcTextureList ptl = m_ptlDummy;
+  ptl.texLod          = surfElem.texLod;
+
   MatSample brdfSample; int matOffset;
   MaterialSampleAndEvalBxDF(pHitMaterial, allRands, &surfElem, ray_dir, shadow, flags, a_fwdDir,
-                            m_pGlobals, m_texStorage, m_texStorageAux, &m_ptlDummy, 
+                            m_pGlobals, m_texStorage, m_texStorageAux, &ptl, 
                             &brdfSample, &matOffset);
 
   return std::make_tuple(brdfSample, matOffset, make_float3(1,1,1)); // #TODO: remove third parameter from tuple
@@ -566,6 +795,7 @@ float3 IntegratorCommon::evalAlphaTransparency(float3 ray_pos, float3 ray_dir, c
   
   ProcTextureList ptl;
   InitProcTextureList(&ptl);
+  ptl.texLod = currSurfaceHit.texLod;
   
   TransparencyAndFog matFogAndTransp = materialEvalTransparencyAndFog(pHitMaterial, ray_dir, currSurfaceHit.normal, currSurfaceHit.texCoord, m_pGlobals, nullptr, &ptl);
 
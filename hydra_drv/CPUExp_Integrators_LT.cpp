@@ -8,22 +8,9 @@ void IntegratorLT::DoPass(std::vector<uint>& a_imageLDR)
 
   #pragma omp parallel for
   for (int i = 0; i < samplesPerPass; i++)
-    DoLightPath(i);
-
-  constexpr float gammaPow = 1.0f/2.2f;
-  const float scaleInv     = 1.0f / float(m_spp + 1);
-
-  #pragma omp parallel for
-  for (int i = 0; i < int(a_imageLDR.size()); i++)
   {
-    float4 color = m_hdrData[i];
-
-    color.x = powf(clamp(color.x*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.y = powf(clamp(color.y*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.z = powf(clamp(color.z*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.w = 1.0f;
-
-    a_imageLDR[i] = RealColorToUint32(color);
+    SeedThreadGenerators(i);
+    DoLightPath(i);
   }
 
   RandomizeAllGenerators();
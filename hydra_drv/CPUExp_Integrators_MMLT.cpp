@@ -1,6 +1,7 @@
 #include <omp.h>
 #include "CPUExp_Integrators.h"
 #include "time.h"
+#include "ImageToLDR.h"
 
 #include <algorithm> 
 
@@ -34,7 +35,10 @@ static float EstimateAverageBrightness2(const float4* a_color, int a_size)
 
 void IntegratorMMLT::SetMaxDepth(int a_depth)
 {
-  m_maxDepth = a_depth;
+  if (a_depth > INTEGRATOR_MAX_PATH_DEPTH)
+    std::cerr << "IntegratorMMLT::SetMaxDepth: trace depth is clamped to " << INTEGRATOR_MAX_PATH_DEPTH << std::endl;
+
+  m_maxDepth = std::min(a_depth, int(INTEGRATOR_MAX_PATH_DEPTH));
   const int randArraySize = randArraySizeOfDepthMMLT(m_maxDepth); // let say d = 2 => (we have 3 vertices) => one material bounce for camera strategy;
 
   for (size_t i = 0; i < m_perThread.size(); i++)
@@ -56,6 +60,29 @@ IntegratorMMLT::PSSampleV IntegratorMMLT::InitialSamplePS(const int d, const int
   return result;
 }
 
+/**
+\brief Chains skip some generator steps from time to time to decorrelate from each other. The number of steps is taken from the clock;
+       in deterministic mode it is taken from (seed, chain, pass) with counter based generator instead, so passes are reproducible.
+\param a_period - skip steps approximately once per a_period calls
+\return (r1 % a_range1) + (r2 % a_range2) or 0
+
+*/
+int IntegratorMMLT::GeneratorSkipSteps(int a_period, int a_range1, int a_range2) const
+{
+  if (DeterministicRNG())
+  {
+    const unsigned int seed  = (unsigned int)m_pGlobals->varsI[HRT_RNG_SEED];
+    const unsigned int chain = 0xFFFFFF00u - (unsigned int)m_chainId[ThreadId()];
+    if (rndFloat1_Counter(seed, chain, m_spp, 0)*float(a_period) >= 1.0f)
+      return 0;
+    return int(rndFloat1_Counter(seed, chain, m_spp, 1)*float(a_range1)) + int(rndFloat1_Counter(seed, chain, m_spp, 2)*float(a_range2));
+  }
+
+  if (clock() % a_period != 0)
+    return 0;
+  return int(clock() % a_range1) + int(clock() % a_range2);
+}
+
 void IntegratorMMLT::MutateLightPart(PSSampleV& v2, int s, RandomGen* pGen)
 {
   const int lightBegin = MMLT_HEAD_TOTAL_SIZE;
@@ -90,21 +117,16 @@ void IntegratorMMLT::MutateCameraPart(PSSampleV& v2, int s, RandomGen* pGen)
 }
 
 
-IntegratorMMLT::PSSampleV IntegratorMMLT::MutatePrimarySpace(const PSSampleV& a_vec, int d, int* pMutationType)
+void IntegratorMMLT::MutatePrimarySpace(PSSampleV& v2, int d, int* pMutationType)
 {
   auto& gen = randomGen();
 
   //////////////////////////////////////////////////////////////////////////////////// randomize generator
-  if (clock() % 4 == 0)
-  {
-    const int NRandomisation = (clock() % 16) + (clock() % 3);
-    for (int i = 0; i < NRandomisation; i++)
-      NextState(&gen);
-  }
+  const int NRandomisation = GeneratorSkipSteps(4, 16, 3);
+  for (int i = 0; i < NRandomisation; i++)
+    NextState(&gen);
   //////////////////////////////////////////////////////////////////////////////////// 
 
-  PSSampleV v2(a_vec);
-
   const float plarge   = 0.33f;                     // 33% for large step;
   const float selector = rndFloat1_Pseudo(&gen);
 
@@ -139,8 +161,6 @@ IntegratorMMLT::PSSampleV IntegratorMMLT::MutatePrimarySpace(const PSSampleV& a_
       (*pMutationType) = MUTATE_CAMERA;
     }
   }
-  
-  return v2;
 }
 
 float3 IntegratorMMLT::F(const PSSampleV& a_xVec, const int d, int m_type,
@@ -345,8 +365,11 @@ static std::vector<float> PrefixSumm(const std::vector<float>& a_vec)
 //  return d;
 //}
 
-void IntegratorMMLT::DoPassIndirectMLT(float4* a_outImage)
+void IntegratorMMLT::DoPassIndirectMLT(int a_chainId, float4* a_outImage)
 {
+  m_chainId[ThreadId()] = a_chainId;
+  SeedThreadGenerators(a_chainId, 1); // chain does not depend on the thread that runs it; direct light pass leaves generators in scheduling dependent state
+
   float pdfSelector = 1.0f;
   auto avgBAccum  = PrefixSumm(m_avgBPerBounce);
   const float r   = rndFloat1_Pseudo(&PerThread().gen);
@@ -360,12 +383,9 @@ void IntegratorMMLT::DoPassIndirectMLT(int d, float a_bkScale, float4* a_outImag
   auto& gen2 = m_perThread[ThreadId()].gen2;
 
   //////////////////////////////////////////////////////////////////////////////////// randomize generator
-  if (clock() % 3 == 0)
-  {
-    const int NRandomisation = (clock() % 9) + (clock() % 4);
-    for (int i = 0; i < NRandomisation; i++)
-      NextState(&gen2);
-  }
+  const int NRandomisation = GeneratorSkipSteps(3, 9, 4);
+  for (int i = 0; i < NRandomisation; i++)
+    NextState(&gen2);
   //////////////////////////////////////////////////////////////////////////////////// 
 
   const int samplesPerPass = m_width*m_height;
@@ -381,12 +401,13 @@ void IntegratorMMLT::DoPassIndirectMLT(int d, float a_bkScale, float4* a_outImag
   // run MCMC
   //
   int accept = 0;
+  PSSampleV xNew;
   
   for (int sampleId = 0; sampleId < samplesPerPass; sampleId++)
   {
     int mtype = 0;
-    auto xOld  = xVec;
-    auto xNew  = MutatePrimarySpace(xOld, d, &mtype);
+    xNew = xVec;
+    MutatePrimarySpace(xNew, d, &mtype);
 
     float  yOld      = y;
     float3 yOldColor = yColor;
@@ -493,6 +514,8 @@ float IntegratorMMLT::DoPassEstimateAvgBrightness()
       {
         int xScrNew = 0, yScrNew = 0;
 
+        SeedThreadGenerators(sampleId, 1 + d, pass);
+
         auto xNew        = InitialSamplePS(d);
         float3 yNewColor = F(xNew, d, (MUTATE_CAMERA | MUTATE_LIGHT), &xScrNew, &yScrNew)*selectorInvPdf;
         const float c    = contribFunc(yNewColor);
@@ -529,6 +552,7 @@ void IntegratorMMLT::DoPassDirectLight(float4* a_outImage)
     for (int x = 0; x < m_width; x++)
     {
       randomGen().rptr = nullptr; // force disable taking random numbers from array.
+      SeedThreadGenerators(y*m_width + x);
 
       float3 colors[4];
       for (int i = 0; i < 4; i++) 
@@ -576,9 +600,10 @@ void IntegratorMMLT::DoPass(std::vector<uint>& a_imageLDR)
 
   // (2) Run MMLT. 
   //
-  constexpr int samplesPerPass = 8;
-  #pragma omp parallel num_threads(samplesPerPass)
-  DoPassIndirectMLT(indirect);
+  const int samplesPerPass = std::max(m_pGlobals->varsI[HRT_MMLT_CHAINS], 1); // fixed number of chains, not threads
+  #pragma omp parallel for schedule(dynamic)
+  for (int chainId = 0; chainId < samplesPerPass; chainId++)
+    DoPassIndirectMLT(chainId, indirect);
 
   // (3) estimate scale coeff
   //
@@ -587,25 +612,8 @@ void IntegratorMMLT::DoPass(std::vector<uint>& a_imageLDR)
   //if (m_spp%4 == 0 && m_spp > 0)
   //  DebugSaveBadPaths();
 
-  // (4) get final image
+  // (4) final image is composed in GetImageToLDR/GetImageHDR when needed
   //
-  constexpr float gammaPow = 1.0f / 2.2f;
-
-  const float scaleInv = 1.0f / float(m_spp + 1);
-
-  #pragma omp parallel for
-  for (int i = 0; i < int(a_imageLDR.size()); i++)
-  {
-    float4 color = direct[i] + kScaleIndirect*indirect[i]; 
-
-    color.x = powf(clamp(color.x, 0.0f, 1.0f), gammaPow);
-    color.y = powf(clamp(color.y, 0.0f, 1.0f), gammaPow);
-    color.z = powf(clamp(color.z, 0.0f, 1.0f), gammaPow);
-    color.w = 1.0f;
-
-    a_imageLDR[i] = RealColorToUint32(color);
-  }
-
   RandomizeAllGenerators();
 
   std::cout << "IntegratorMMLT: mpp  = " << m_spp*samplesPerPass << std::endl;
@@ -636,6 +644,14 @@ void IntegratorMMLT::GetImageHDR(float4* a_imageHDR, int w, int h) const
   }
 }
 
+void IntegratorMMLT::GetImageToLDR(std::vector<uint>& a_imageLDR) const
+{
+  const float kScaleIndirect = EstimateScaleCoeff();
+  const float gammaPow       = 1.0f / m_pGlobals->varsF[HRT_IMAGE_GAMMA];
+
+  HDRImageToLDR2((const float4*)m_direct.data(), 1.0f, m_hdrData, kScaleIndirect, a_imageLDR.data(), int(a_imageLDR.size()), gammaPow, true);
+}
+
 PathVertex IntegratorMMLT::LightPath(PerThreadData* a_perThread, int a_lightTraceDepth)
 {
   auto& rgen = randomGen();
@@ -975,8 +991,8 @@ float3 IntegratorMMLT::ConnectShadow(const PathVertex& a_cv, PerThreadData* a_pe
                 &lightSelector);
    
    float lightPickProb = 1.0f;
-   int lightOffset = SelectRandomLightRev(lightSelector.group2.z, surfElem.pos, m_pGlobals,
-                                          &lightPickProb);
+   int lightOffset = SelectRandomLightRevPower(lightSelector.group2.z, m_pGlobals,
+                                               &lightPickProb);
 
    if (lightOffset >= 0)
    {
@@ -1091,8 +1107,8 @@ float3 IntegratorMMLT::PathTraceDirectLight(float3 ray_pos, float3 ray_dir, MisD
 
   auto& gen = randomGen();
   float lightPickProb = 1.0f;
-  int lightOffset = SelectRandomLightRev(rndFloat1_Pseudo(&gen), surfElem.pos, m_pGlobals,
-                                         &lightPickProb);
+  int lightOffset = SelectRandomLightRevPower(rndFloat1_Pseudo(&gen), m_pGlobals,
+                                              &lightPickProb);
 
   if ((!m_computeIndirectMLT || a_currDepth > 0) && lightOffset >= 0) // if need to sample direct light ?
   {
@@ -202,12 +202,9 @@ void IntegratorMMLT_CompressedRand::DoPassIndirectMLT(int d, float a_bkScale, fl
   auto& gen2 = m_perThread[ThreadId()].gen2;
 
   //////////////////////////////////////////////////////////////////////////////////// randomize generator
-  if (clock() % 3 == 0)
-  {
-    const int NRandomisation = (clock() % 9) + (clock() % 4);
-    for (int i = 0; i < NRandomisation; i++)
-      NextState(&gen2);
-  }
+  const int NRandomisation = GeneratorSkipSteps(3, 9, 4);
+  for (int i = 0; i < NRandomisation; i++)
+    NextState(&gen2);
   //////////////////////////////////////////////////////////////////////////////////// 
 
   const int samplesPerPass = m_width*m_height;
@@ -227,8 +224,9 @@ void IntegratorMMLT_CompressedRand::DoPassIndirectMLT(int d, float a_bkScale, fl
   for (int sampleId = 0; sampleId < samplesPerPass; sampleId++)
   {
     int mtype = 0;
-    auto xOld  = xVec;
-    auto xNew  = Compress( MutatePrimarySpace(Decompress(xOld), d, &mtype) );
+    auto xTmp  = Decompress(xVec);
+    MutatePrimarySpace(xTmp, d, &mtype);
+    auto xNew  = Compress(xTmp);
 
     float  yOld      = y;
     float3 yOldColor = yColor;
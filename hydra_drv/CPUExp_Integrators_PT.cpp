@@ -1,4 +1,5 @@
 #include <omp.h>
+#include <cmath>
 #include "CPUExp_Integrators.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -16,7 +17,7 @@ float3 IntegratorStupidPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData mis
   if (HitNone(hit))
     return EnviromnentColor(ray_dir, misPrev, flags);
 
-  SurfaceHit surfElem = surfaceEval(ray_pos, ray_dir, hit);
+  SurfaceHit surfElem = surfaceEval(ray_pos, ray_dir, hit, misPrev.coneWidth);
 
   float3 emission = emissionEval(ray_pos, ray_dir, surfElem, flags, misPrev, fetchInstId(hit));
   if (dot(emission, emission) > 1e-6f)
@@ -34,7 +35,10 @@ float3 IntegratorStupidPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData mis
   
   flags = flagsNextBounceLite(flags, matSam, m_pGlobals);
 
-  return fabs(cosTheta)*bxdfVal*PathTrace(nextRay_pos, nextRay_dir, MisData(), a_currDepth + 1, flags);  // --*(1.0 / (1.0 - pabsorb));
+  MisData currMis   = MisData();
+  currMis.coneWidth = misPrev.coneWidth + rayConeSpreadAngle(m_pGlobals)*surfElem.t;
+
+  return fabs(cosTheta)*bxdfVal*PathTrace(nextRay_pos, nextRay_dir, currMis, a_currDepth + 1, flags);  // --*(1.0 / (1.0 - pabsorb));
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -50,7 +54,7 @@ float3  IntegratorShadowPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData mi
   if (HitNone(hit))
     return float3(0, 0, 0);
 
-  SurfaceHit surfElem = surfaceEval(ray_pos, ray_dir, hit);
+  SurfaceHit surfElem = surfaceEval(ray_pos, ray_dir, hit, misPrev.coneWidth);
 
   float3 emission = emissionEval(ray_pos, ray_dir, surfElem, flags, misPrev, fetchInstId(hit));
   if (dot(emission, emission) > 1e-3f)
@@ -60,7 +64,7 @@ float3  IntegratorShadowPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData mi
 
   auto& gen = randomGen();
   float lightPickProb = 1.0f;
-  int lightOffset = SelectRandomLightRev(rndFloat1_Pseudo(&gen), surfElem.pos, m_pGlobals,
+  int lightOffset = SelectRandomLightRev(rndFloat1_Pseudo(&gen), surfElem.pos, surfElem.normal, m_pGlobals,
                                          &lightPickProb);
 
   if (lightOffset >= 0)
@@ -80,6 +84,7 @@ float3  IntegratorShadowPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData mi
    
     auto ptlCopy = m_ptlDummy;
     GetProcTexturesIdListFromMaterialHead(pHitMaterial, &ptlCopy);
+    ptlCopy.texLod = surfElem.texLod;
 
     ShadeContext sc;
     sc.wp = surfElem.pos;
@@ -106,7 +111,10 @@ float3  IntegratorShadowPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData mi
 
   flags = flagsNextBounceLite(flags, matSam, m_pGlobals);
 
-  return explicitColor + cosTheta*bxdfVal*PathTrace(nextRay_pos, nextRay_dir, MisData(), a_currDepth + 1, flags);  // --*(1.0 / (1.0 - pabsorb));
+  MisData currMis   = MisData();
+  currMis.coneWidth = misPrev.coneWidth + rayConeSpreadAngle(m_pGlobals)*surfElem.t;
+
+  return explicitColor + cosTheta*bxdfVal*PathTrace(nextRay_pos, nextRay_dir, currMis, a_currDepth + 1, flags);  // --*(1.0 / (1.0 - pabsorb));
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -122,7 +130,7 @@ float3 IntegratorMISPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData misPre
   if (HitNone(hit))
     return environmentColor(ray_dir, misPrev, flags, m_pGlobals, m_matStorage, m_pdfStorage, m_texStorage);
   
-  SurfaceHit surfElem = surfaceEval(ray_pos, ray_dir, hit);
+  SurfaceHit surfElem = surfaceEval(ray_pos, ray_dir, hit, misPrev.coneWidth);
   
   float3 emission = emissionEval(ray_pos, ray_dir, surfElem, flags, misPrev, fetchInstId(hit));
   if (dot(emission, emission) > 1e-3f)
@@ -131,7 +139,7 @@ float3 IntegratorMISPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData misPre
 
     if (pLight != nullptr)
     {
-      float lgtPdf    = lightPdfSelectRev(pLight)*lightEvalPDF(pLight, ray_pos, ray_dir, surfElem.pos, surfElem.normal, surfElem.texCoord, m_pdfStorage, m_pGlobals);
+      float lgtPdf    = lightPdfSelectRevAt(pLight, ray_pos, decodeNormal(misPrev.prevNormal), m_pGlobals)*lightEvalPDF(pLight, ray_pos, ray_dir, surfElem.pos, surfElem.normal, surfElem.texCoord, m_pdfStorage, m_pGlobals);
       float bsdfPdf   = misPrev.matSamplePdf;
       float misWeight = misWeightHeuristic(bsdfPdf, lgtPdf);  // (bsdfPdf*bsdfPdf) / (lgtPdf*lgtPdf + bsdfPdf*bsdfPdf);
 
@@ -157,13 +165,29 @@ float3 IntegratorMISPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData misPre
   const float4 rndLightData = rndLight(&gen, a_currDepth,
                                        m_pGlobals->rmQMC, PerThread().qmcPos, qmcTablePtr);
   
+  const PlainMaterial* pHitMaterial = materialAt(m_pGlobals, m_matStorage, surfElem.matId);
+  const int guideLeaf               = (m_pGuide != nullptr && materialCanBeGuided(pHitMaterial)) ? m_pGuide->FindLeaf(surfElem.pos) : -1;
+
+  ShadeContext sc;
+  sc.wp = surfElem.pos;
+  sc.l  = (-1.0f)*ray_dir;
+  sc.v  = (-1.0f)*ray_dir;
+  sc.n  = surfElem.normal;
+  sc.fn = surfElem.flatNormal;
+  sc.tg = surfElem.tangent;
+  sc.bn = surfElem.biTangent;
+  sc.tc = surfElem.texCoord;
+
+  auto ptlCopy = m_ptlDummy;
+  GetProcTexturesIdListFromMaterialHead(pHitMaterial, &ptlCopy);
+  ptlCopy.texLod = surfElem.texLod;
+
   float lightPickProb = 1.0f;
-  int lightOffset     = SelectRandomLightRev(rndLightData.z, surfElem.pos, m_pGlobals,
+  int lightOffset     = SelectRandomLightRev(rndLightData.z, surfElem.pos, surfElem.normal, m_pGlobals,
                                              &lightPickProb);
   
   if (lightOffset >= 0) // if need to sample direct light ?
   { 
-    const PlainMaterial* pHitMaterial = materialAt(m_pGlobals, m_matStorage, surfElem.matId);
     __global const PlainLight* pLight = lightAt(m_pGlobals, lightOffset);
     
     ShadowSample explicitSam;
@@ -175,19 +199,7 @@ float3 IntegratorMISPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData misPre
 
     const float3 shadow = shadowTrace(shadowRayPos, shadowRayDir, length(shadowRayPos - explicitSam.pos)*0.995f);
         
-    ShadeContext sc;
-    sc.wp = surfElem.pos;
-    sc.l  = shadowRayDir;
-    sc.v  = (-1.0f)*ray_dir;
-    sc.n  = surfElem.normal;
-    sc.fn = surfElem.flatNormal;
-    sc.tg = surfElem.tangent;
-    sc.bn = surfElem.biTangent;
-    sc.tc = surfElem.texCoord;
-
-    auto ptlCopy = m_ptlDummy;
-    GetProcTexturesIdListFromMaterialHead(pHitMaterial, &ptlCopy);
-    
+    sc.l = shadowRayDir;
     const auto evalData      = materialEval(pHitMaterial, &sc, (EVAL_FLAG_DEFAULT), /* global data --> */ m_pGlobals, m_texStorage, m_texStorageAux, &ptlCopy);
     
     const float cosThetaOut1 = fmax(+dot(shadowRayDir, surfElem.normal), 0.0f);
@@ -196,14 +208,44 @@ float3 IntegratorMISPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData misPre
    
     const float lgtPdf       = explicitSam.pdf*lightPickProb;
     
-    float misWeight = misWeightHeuristic(lgtPdf, evalData.pdfFwd); // (lgtPdf*lgtPdf) / (lgtPdf*lgtPdf + bsdfPdf*bsdfPdf);
+    const float bsdfPdf = (guideLeaf >= 0) ? guidingMixturePdf(m_pGuide->Data().data(), guideLeaf, shadowRayDir, evalData.pdfFwd) : evalData.pdfFwd;
+
+    float misWeight = misWeightHeuristic(lgtPdf, bsdfPdf); // (lgtPdf*lgtPdf) / (lgtPdf*lgtPdf + bsdfPdf*bsdfPdf);
     if (explicitSam.isPoint)
       misWeight = 1.0f;
     
     explicitColor = (1.0f / lightPickProb)*(explicitSam.color * (1.0f / fmax(explicitSam.pdf, DEPSILON2)))*bxdfVal*misWeight*shadow; // clamp brdfVal? test it !!!
   }
   
-  const MatSample matSam = std::get<0>( sampleAndEvalBxDF(ray_dir, surfElem) );
+  // one-sample MIS of BSDF and guiding tree. Strategy is selected before sampling, so any non specular direction has the same mixture pdf 
+  // for both strategies; specular directions can come from BSDF only and their pdf is scaled by probability to select BSDF
+  //
+  const bool guideSample = (guideLeaf >= 0) && (rndFloat1_Pseudo(&gen) < GUIDING_SAMPLE_FRACTION);
+
+  MatSample matSam = std::get<0>( sampleAndEvalBxDF(ray_dir, surfElem) ); // for guided sample it gives event type only
+
+  if (guideSample)
+  {
+    float guidePdf = 0.0f;
+    sc.l = m_pGuide->Sample(guideLeaf, rndFloat2_Pseudo(&gen), &guidePdf);
+
+    const auto evalData = materialEval(pHitMaterial, &sc, (EVAL_FLAG_DEFAULT), /* global data --> */ m_pGlobals, m_texStorage, m_texStorageAux, &ptlCopy);
+    const bool transmit = (dot(sc.l, surfElem.normal) < 0.0f);
+    const int  event    = isPureSpecular(matSam) ? RAY_EVENT_G : (matSam.flags & (RAY_EVENT_D | RAY_EVENT_G));
+
+    matSam.direction = sc.l;
+    matSam.color     = transmit ? evalData.btdf : evalData.brdf;
+    matSam.flags     = transmit ? (event | RAY_EVENT_T) : event;
+    matSam.pdf       = GUIDING_SAMPLE_FRACTION*guidePdf + (1.0f - GUIDING_SAMPLE_FRACTION)*evalData.pdfFwd;
+  }
+  else if (guideLeaf >= 0)
+  {
+    if (isPureSpecular(matSam))
+      matSam.pdf *= (1.0f - GUIDING_SAMPLE_FRACTION);
+    else
+      matSam.pdf = guidingMixturePdf(m_pGuide->Data().data(), guideLeaf, matSam.direction, matSam.pdf);
+  }
+
   const float3 bxdfVal   = matSam.color * (1.0f / fmaxf(matSam.pdf, 1e-20f));
   const float cosTheta   = fabs(dot(matSam.direction, surfElem.normal));
 
@@ -213,12 +255,51 @@ float3 IntegratorMISPT::PathTrace(float3 ray_pos, float3 ray_dir, MisData misPre
   MisData currMis            = makeInitialMisData();
   currMis.isSpecular         = isPureSpecular(matSam);
   currMis.matSamplePdf       = matSam.pdf;
+  currMis.coneWidth          = misPrev.coneWidth + rayConeSpreadAngle(m_pGlobals)*surfElem.t;
+  currMis.prevNormal         = encodeNormal(surfElem.normal);
 
   flags = flagsNextBounceLite(flags, matSam, m_pGlobals);
 
-  return explicitColor + cosTheta*bxdfVal*PathTrace(nextRay_pos, nextRay_dir, currMis, a_currDepth + 1, flags);  // --*(1.0 / (1.0 - pabsorb));
+  const float3 incidentColor = PathTrace(nextRay_pos, nextRay_dir, currMis, a_currDepth + 1, flags);
+
+  if (m_guide.Training() && !isPureSpecular(matSam) && matSam.pdf > 0.0f)
+    m_guide.Record(ThreadId(), surfElem.pos, nextRay_dir, contribFunc(incidentColor) / matSam.pdf);
+
+  return explicitColor + cosTheta*bxdfVal*incidentColor;  // --*(1.0 / (1.0 - pabsorb));
+}
+
+void IntegratorMISPT::ResetGuiding()
+{
+  m_guide.Reset(INTEGRATOR_MAX_THREADS_NUM);
+  m_pGuide = nullptr;
 }
 
+void IntegratorMISPT::SetSceneGlobals(int w, int h, EngineGlobals* a_pGlobals)
+{
+  IntegratorCommon::SetSceneGlobals(w, h, a_pGlobals);
+  ResetGuiding();
+}
+
+void IntegratorMISPT::DoPass(std::vector<uint>& a_imageLDR)
+{
+  if (m_pGlobals->varsI[HRT_PATH_GUIDING] == 0)
+  {
+    if (m_pGuide != nullptr || m_guide.Pass() != 0)
+      ResetGuiding();
+    IntegratorCommon::DoPass(a_imageLDR);
+    return;
+  }
+
+  const int trainPasses = m_pGlobals->varsI[HRT_GUIDING_TRAIN_PASSES];
+
+  m_guide.BeginPass(trainPasses);
+  IntegratorCommon::DoPass(a_imageLDR);
+
+  if (m_guide.EndPass(trainPasses))
+    m_pGuide = m_guide.Tree();
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -14,6 +14,7 @@ void IntegratorMISPT_QMC::DoPass(std::vector<uint>& a_imageLDR)
   #pragma omp parallel for
   for (int i = 0; i < loopSize; ++i)
   {
+    SeedThreadGenerators(i);
     PerThread().qmcPos = qmcOffset + i;
     
     RandomGen& gen  = randomGen();
@@ -40,7 +41,6 @@ void IntegratorMISPT_QMC::DoPass(std::vector<uint>& a_imageLDR)
   }
   
   m_spp++;
-  GetImageToLDR(a_imageLDR);
   
   if(m_spp % 17 == 0)
     RandomizeAllGenerators();
@@ -98,6 +98,7 @@ void IntegratorMISPT_AQMC::DoPass(std::vector<uint>& a_imageLDR)
   #pragma omp parallel for
   for (int i = 0; i < loopSize; ++i)
   {
+    SeedThreadGenerators(i);
     PerThread().qmcPos = qmcOffset + i;
     
     RandomGen& gen  = randomGen();
@@ -138,22 +139,7 @@ void IntegratorMISPT_AQMC::DoPass(std::vector<uint>& a_imageLDR)
     }
   }
 
-  constexpr float gammaPow = 1.0f/2.2f;
-  const float scaleInv     = 1.0f / float(m_spp + 1);
-
-  #pragma omp parallel for
-  for (int i = 0; i < int(a_imageLDR.size()); i++)
-  {
-    float4 color = m_hdrData[i];
-
-    color.x = powf(clamp(color.x*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.y = powf(clamp(color.y*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.z = powf(clamp(color.z*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.w = 1.0f;
-
-    a_imageLDR[i] = RealColorToUint32(color);
-  }
-
+  const float scaleInv = 1.0f / float(m_spp + 1);
   
   m_spp++;
   
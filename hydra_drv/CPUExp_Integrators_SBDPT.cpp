@@ -3,7 +3,10 @@
 
 void IntegratorSBDPT::SetMaxDepth(int a_depth)
 {
-  m_maxDepth = a_depth;
+  if (a_depth > INTEGRATOR_MAX_PATH_DEPTH)
+    std::cerr << "IntegratorSBDPT::SetMaxDepth: trace depth is clamped to " << INTEGRATOR_MAX_PATH_DEPTH << std::endl;
+
+  m_maxDepth = std::min(a_depth, int(INTEGRATOR_MAX_PATH_DEPTH));
   for (size_t i = 0; i < m_perThread.size(); i++)
     m_perThread[i].pdfArray.resize(m_maxDepth + 1);
 }
@@ -16,6 +19,8 @@ void IntegratorSBDPT::DoPass(std::vector<uint>& a_imageLDR)
   #pragma omp parallel for
   for (int i = 0; i < samplesPerPass; i++)
   {
+    SeedThreadGenerators(i);
+
     // select path depth and pair of (s,t) where 's' is a light source and 't' is the camera 
     //
     const int d = rndInt(&PerThread().gen, 2, m_maxDepth+1);       // #TODO: change rndInt_Pseudo for spetial bounce selector random.      
@@ -194,23 +199,6 @@ void IntegratorSBDPT::DoPass(std::vector<uint>& a_imageLDR)
     //}
   }
 
-  constexpr float gammaPow = 1.0f / 2.2f;
-
-  const float scaleInv = 1.0f / float(m_spp + 1);
-
-  #pragma omp parallel for
-  for (int i = 0; i < int(a_imageLDR.size()); i++)
-  {
-    float4 color = m_hdrData[i];
-
-    color.x = powf(clamp(color.x*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.y = powf(clamp(color.y*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.z = powf(clamp(color.z*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.w = 1.0f;
-
-    a_imageLDR[i] = RealColorToUint32(color);
-  }
-
   RandomizeAllGenerators();
 
   std::cout << "IntegratorSBDPT: spp  = " << m_spp << std::endl;
@@ -352,7 +340,7 @@ PathVertex IntegratorSBDPT::CameraPath(float3 ray_pos, float3 ray_dir, float3 a_
 
   const SurfaceHit surfElem = surfaceEval(ray_pos, ray_dir, hit);
 
-  PerThread().vert[a_currDepth] = surfElem.pos;
+  PerThread().storeVertex(a_currDepth, surfElem.pos);
 
   const float cosHere = fabs(dot(ray_dir, surfElem.normal));
   const float cosPrev = fabs(dot(ray_dir, a_prevNormal));
@@ -367,7 +355,7 @@ PathVertex IntegratorSBDPT::CameraPath(float3 ray_pos, float3 ray_dir, float3 a_
     a_perThread->pdfArray[a_fullPathDepth].pdfRev = cameraPdfA;
     a_perThread->pdfArray[a_fullPathDepth].pdfFwd = 1.0f;
 
-    PerThread().grammarCam.push_back('E');
+    PerThread().pushGrammarCam('E');
   }
   else
   {
@@ -396,7 +384,7 @@ PathVertex IntegratorSBDPT::CameraPath(float3 ray_pos, float3 ray_dir, float3 a_
       a_perThread->pdfArray[1].pdfFwd = pdfLightWP*GTerm;
       a_perThread->pdfArray[1].pdfRev = a_misPrev.isSpecular ? -1.0f*GTerm : pdfMatRevWP*GTerm;
 
-      PerThread().grammarCam.push_back('L');
+      PerThread().pushGrammarCam('L');
 
       resVertex.accColor = emission;
       resVertex.valid    = true;
@@ -439,11 +427,11 @@ PathVertex IntegratorSBDPT::CameraPath(float3 ray_pos, float3 ray_dir, float3 a_
 
   ///////////////////////////////////////////////////////////////////////////////////////////////////////// DEBUG
   if (isPureSpecular(matSam))
-    PerThread().grammarCam.push_back('S');
+    PerThread().pushGrammarCam('S');
   else if (isGlossy(matSam))
-    PerThread().grammarCam.push_back('G');
+    PerThread().pushGrammarCam('G');
   else
-    PerThread().grammarCam.push_back('D');
+    PerThread().pushGrammarCam('D');
   ///////////////////////////////////////////////////////////////////////////////////////////////////////// DEBUG
 
   // eval reverse and forward pdfs
@@ -542,8 +530,8 @@ float3 IntegratorSBDPT::ConnectShadow(const PathVertex& a_cv, PerThreadData* a_p
                &lightSelector);
 
   float lightPickProb = 1.0f;
-  int lightOffset = SelectRandomLightRev(lightSelector.group2.z, surfElem.pos, m_pGlobals,
-                                         &lightPickProb);
+  int lightOffset = SelectRandomLightRevPower(lightSelector.group2.z, m_pGlobals,
+                                              &lightPickProb);
 
   if (!m_computeIndirectMLT && lightOffset >= 0) // if need to sample direct light ?
   {
@@ -605,6 +593,7 @@ float3 IntegratorSBDPT::ConnectEndPoints(const PathVertex& a_lv, const PathVerte
 
 void IntegratorSBDPT::DebugOutCurrPath(int d)
 {
+#ifdef INTEGRATOR_PATH_GRAMMAR
   static std::ofstream fout("zpath.txt");
 
   if (!fout.is_open())
@@ -612,10 +601,11 @@ void IntegratorSBDPT::DebugOutCurrPath(int d)
 
   #pragma omp critical
   {
-    fout << d << "\t" << PerThread().grammarCam.c_str() << "\t";
+    fout << d << "\t" << std::string(PerThread().grammarCam.begin(), PerThread().grammarCam.end()) << "\t";
     for (int i = 1; i <= d; i++)
       fout << PerThread().vert[i].x << " " << PerThread().vert[i].y << " " << PerThread().vert[i].z << "\t";
     fout << std::endl;
   }
+#endif
 
 }
@@ -34,13 +34,18 @@ void IntegratorThreeWay::DoPass(std::vector<uint>& a_imageLDR)
 
   #pragma omp parallel for
   for (int i = 0; i < samplesPerPass; i++)
+  {
+    SeedThreadGenerators(i, 1);
     DoLightPath();
+  }
 
   #pragma omp parallel for
   for (int y = 0; y < m_height; y++)
   {
     for (int x = 0; x < m_width; x++)
     {
+      SeedThreadGenerators(y*m_width + x);
+
       float3 ray_pos, ray_dir;
       std::tie(ray_pos, ray_dir) = makeEyeRay(x, y);
   
@@ -54,22 +59,6 @@ void IntegratorThreeWay::DoPass(std::vector<uint>& a_imageLDR)
     }
   }
 
-  constexpr float gammaPow = 1.0f / 2.2f;
-  const float scaleInv = 1.0f / float(m_spp + 1);
-
-  #pragma omp parallel for
-  for (int i = 0; i < int(a_imageLDR.size()); i++)
-  {
-    float4 color = m_hdrData[i];
-
-    color.x = powf(clamp(color.x*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.y = powf(clamp(color.y*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.z = powf(clamp(color.z*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.w = 1.0f;
-
-    a_imageLDR[i] = RealColorToUint32(color);
-  }
-
   RandomizeAllGenerators();
 
   std::cout << "IntegratorThreeWay: spp  = " << m_spp << std::endl;
@@ -147,7 +136,10 @@ void IntegratorThreeWay::TraceLightPath(float3 ray_pos, float3 ray_dir, int a_cu
 
   a_pAccData->pdfGTerm *= GTerm;
   if (a_currDepth == 1)
+  {
     a_pAccData->pdfCamA0 = GTerm; // spetial case, multyply it by pdf later ... 
+    perRayAccSetLightVert(a_pAccData, surfElem.pos, surfElem.normal);
+  }
 
   ConnectEye(surfElem, ray_pos, ray_dir, a_currDepth, 
              a_pAccData, a_color);
@@ -231,7 +223,7 @@ void IntegratorThreeWay::ConnectEye(SurfaceHit a_hit, float3 ray_pos, float3 ray
 
   const PlainLight* pLight     = lightAt(m_pGlobals, PerThread().selectedLightIdFwd);
   const float lightPickProbFwd = lightPdfSelectFwd(pLight);
-  const float lightPickProbRev = lightPdfSelectRev(pLight);  
+  const float lightPickProbRev = lightPdfSelectRevAt(pLight, perRayAccLightVertPos(a_pAccData), decodeNormal(a_pAccData->lightVertN), m_pGlobals); // explicit strategy picks light at vertex next to it
 
   // We put the virtual image plane at such a distance from the camera origin
   // that the pixel area is one and thus the image plane sampling pdf is 1.
@@ -343,7 +335,7 @@ float3  IntegratorThreeWay::PathTraceAcc(float3 ray_pos, float3 ray_dir, const f
 
     float pdfAccFwdA = 1.0f       * (a_accData->pdfLightWP ) * lightPdfA*lPdfFwd.pickProb;                                       // a_accData->pdfGTerm
     float pdfAccRevA = cameraPdfA * (a_accData->pdfCameraWP);                                                                    // a_accData->pdfGTerm
-    float pdfAccExpA = cameraPdfA * (a_accData->pdfCameraWP)*(lightPdfA*lightPdfSelectRev(pLight) / fmax(cancelPrev, DEPSILON)); // a_accData->pdfGTerm
+    float pdfAccExpA = cameraPdfA * (a_accData->pdfCameraWP)*(lightPdfA*lightPdfSelectRevAt(pLight, ray_pos, decodeNormal(misPrev.prevNormal), m_pGlobals) / fmax(cancelPrev, DEPSILON)); // a_accData->pdfGTerm
 
     if (a_currDepth == 0)
     {
@@ -372,7 +364,7 @@ float3  IntegratorThreeWay::PathTraceAcc(float3 ray_pos, float3 ray_dir, const f
   
   auto& gen = randomGen();
   float lightPickProb = 1.0f;
-  int lightOffset = SelectRandomLightRev(rndFloat1_Pseudo(&gen), surfElem.pos, m_pGlobals,
+  int lightOffset = SelectRandomLightRev(rndFloat1_Pseudo(&gen), surfElem.pos, surfElem.normal, m_pGlobals,
                                          &lightPickProb);
 
   if ((!m_computeIndirectMLT || a_currDepth > 0) && lightOffset >= 0) // if need to sample direct light ?
@@ -484,6 +476,7 @@ float3  IntegratorThreeWay::PathTraceAcc(float3 ray_pos, float3 ray_dir, const f
   MisData thisBounce       = makeInitialMisData();
   thisBounce.isSpecular    = isPureSpecular(matSam);
   thisBounce.matSamplePdf  = matSam.pdf;
+  thisBounce.prevNormal    = encodeNormal(surfElem.normal);
 
   const float3 thoroughput = bxdfVal*cosNext / fmax(matSam.pdf, DEPSILON);
 
@@ -14,13 +14,18 @@ void IntegratorTwoWay::DoPass(std::vector<uint>& a_imageLDR)
 
   #pragma omp parallel for
   for (int i = 0; i < samplesPerPass; i++)
+  {
+    SeedThreadGenerators(i, 1);
     DoLightPath();
+  }
 
   #pragma omp parallel for
   for (int y = 0; y < m_height; y++)
   {
     for (int x = 0; x < m_width; x++)
     {
+      SeedThreadGenerators(y*m_width + x);
+
       float3 ray_pos, ray_dir;
       std::tie(ray_pos, ray_dir) = makeEyeRay(x, y);
   
@@ -30,23 +35,6 @@ void IntegratorTwoWay::DoPass(std::vector<uint>& a_imageLDR)
     }
   }
 
-  constexpr float gammaPow = 1.0f / 2.2f;
-
-  const float scaleInv = 1.0f / float(m_spp + 1);
-
-  #pragma omp parallel for
-  for (int i = 0; i < int(a_imageLDR.size()); i++)
-  {
-    float4 color = m_hdrData[i];
-
-    color.x = powf(clamp(color.x*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.y = powf(clamp(color.y*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.z = powf(clamp(color.z*scaleInv, 0.0f, 1.0f), gammaPow);
-    color.w = 1.0f;
-
-    a_imageLDR[i] = RealColorToUint32(color);
-  }
-
   RandomizeAllGenerators();
 
   std::cout << "IntegratorTwoWay: spp  = " << m_spp << std::endl;
@@ -0,0 +1,238 @@
+#include "CPUExp_PathGuiding.h"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr static int   GUIDING_SPATIAL_LEAF_RECORDS = 4096;  ///< spatial leaf is split when it has more records
+constexpr static int   GUIDING_SPATIAL_MAX_DEPTH    = 48;
+constexpr static int   GUIDING_LEAF_MIN_RECORDS     = 32;    ///< don't guide from leaves with less records; estimate is too noisy
+constexpr static int   GUIDING_QUAD_MAX_DEPTH       = 16;
+constexpr static float GUIDING_QUAD_SUBDIV          = 0.01f; ///< quadrant is subdivided when it has more than this fraction of leaf energy
+
+static inline float  GuidingAxis(float3 v, int a_axis)             { return (a_axis == 0) ? v.x : ((a_axis == 1) ? v.y : v.z); }
+static inline float3 GuidingSetAxis(float3 v, int a_axis, float a) { if (a_axis == 0) v.x = a; else if (a_axis == 1) v.y = a; else v.z = a; return v; }
+
+void GuidingSDTree::Build(std::vector<GuidingRecord>& a_records)
+{
+  m_spatial.clear();
+  m_quad.clear();
+  m_dirTreeRoots.clear();
+  m_data.clear();
+
+  if (a_records.empty())
+    return;
+
+  m_boxMin = a_records[0].pos;
+  m_boxMax = a_records[0].pos;
+  for (const auto& rec : a_records)
+  {
+    m_boxMin = make_float3(fmin(m_boxMin.x, rec.pos.x), fmin(m_boxMin.y, rec.pos.y), fmin(m_boxMin.z, rec.pos.z));
+    m_boxMax = make_float3(fmax(m_boxMax.x, rec.pos.x), fmax(m_boxMax.y, rec.pos.y), fmax(m_boxMax.z, rec.pos.z));
+  }
+
+  // make box a bit larger to include points on its faces
+  //
+  const float3 eps = (m_boxMax - m_boxMin)*1e-4f + make_float3(1e-5f, 1e-5f, 1e-5f);
+  m_boxMin = m_boxMin - eps;
+  m_boxMax = m_boxMax + eps;
+
+  m_spatial.resize(1);
+  BuildSpatial(0, a_records, 0, int(a_records.size()), m_boxMin, m_boxMax, 0);
+
+  if (!m_dirTreeRoots.empty())
+    Pack();
+
+  m_spatial = std::vector<SpatialNode>();
+  m_quad    = std::vector<QuadNode>();
+}
+
+void GuidingSDTree::BuildSpatial(int a_nodeId, std::vector<GuidingRecord>& a_records, int a_begin, int a_end, float3 a_boxMin, float3 a_boxMax, int a_depth)
+{
+  SpatialNode node;
+  node.split   = 0.0f;
+  node.axis    = -1;
+  node.child   = -1;
+  node.dirTree = -1;
+
+  if (a_end - a_begin > GUIDING_SPATIAL_LEAF_RECORDS && a_depth < GUIDING_SPATIAL_MAX_DEPTH)
+  {
+    const float3 size = a_boxMax - a_boxMin;
+    node.axis  = (size.x >= size.y && size.x >= size.z) ? 0 : ((size.y >= size.z) ? 1 : 2);
+    node.split = 0.5f*(GuidingAxis(a_boxMin, node.axis) + GuidingAxis(a_boxMax, node.axis));
+    node.child = int(m_spatial.size());
+
+    const int axis  = node.axis;
+    const float pos = node.split;
+    auto middle     = std::partition(a_records.begin() + a_begin, a_records.begin() + a_end,
+                                     [axis, pos](const GuidingRecord& a_rec) { return GuidingAxis(a_rec.pos, axis) < pos; });
+    const int mid   = int(middle - a_records.begin());
+
+    m_spatial[a_nodeId] = node;
+    m_spatial.resize(m_spatial.size() + 2);
+
+    BuildSpatial(node.child + 0, a_records, a_begin, mid, a_boxMin, GuidingSetAxis(a_boxMax, axis, pos), a_depth + 1);
+    BuildSpatial(node.child + 1, a_records, mid, a_end, GuidingSetAxis(a_boxMin, axis, pos), a_boxMax, a_depth + 1);
+    return;
+  }
+
+  float total = 0.0f;
+  for (int i = a_begin; i < a_end; i++)
+    total += a_records[i].value;
+
+  if (a_end - a_begin >= GUIDING_LEAF_MIN_RECORDS && total > 0.0f)
+  {
+    node.dirTree = int(m_dirTreeRoots.size());
+    m_dirTreeRoots.push_back(BuildQuad(a_records, a_begin, a_end, make_float2(0.0f, 0.0f), 1.0f, total, 0));
+  }
+
+  m_spatial[a_nodeId] = node;
+}
+
+int GuidingSDTree::BuildQuad(std::vector<GuidingRecord>& a_records, int a_begin, int a_end, float2 a_min, float a_size, float a_total, int a_depth)
+{
+  const int nodeId = int(m_quad.size());
+  m_quad.push_back(QuadNode());
+
+  // sort records by quadrants: rows first, then columns inside each row
+  //
+  const float2 center = make_float2(a_min.x + 0.5f*a_size, a_min.y + 0.5f*a_size);
+
+  auto first  = a_records.begin();
+  auto rowMid = std::partition(first + a_begin, first + a_end, [center](const GuidingRecord& a_rec) { return guidingDirToCyl(a_rec.dir).y < center.y; });
+  auto col0   = std::partition(first + a_begin, rowMid,        [center](const GuidingRecord& a_rec) { return guidingDirToCyl(a_rec.dir).x < center.x; });
+  auto col1   = std::partition(rowMid, first + a_end,          [center](const GuidingRecord& a_rec) { return guidingDirToCyl(a_rec.dir).x < center.x; });
+
+  const int bounds[5] = { a_begin, int(col0 - first), int(rowMid - first), int(col1 - first), a_end };
+
+  QuadNode node;
+  for (int q = 0; q < 4; q++)
+  {
+    node.energy[q] = 0.0f;
+    node.child[q]  = 0;
+    for (int i = bounds[q]; i < bounds[q + 1]; i++)
+      node.energy[q] += a_records[i].value;
+  }
+  m_quad[nodeId] = node;
+
+  const float half = 0.5f*a_size;
+  for (int q = 0; q < 4; q++)
+  {
+    if (node.energy[q] <= GUIDING_QUAD_SUBDIV*a_total || a_depth + 1 >= GUIDING_QUAD_MAX_DEPTH || bounds[q + 1] - bounds[q] < 2)
+      continue;
+
+    const float2 childMin = make_float2(a_min.x + float(q & 1)*half, a_min.y + float(q >> 1)*half);
+    const int    child    = BuildQuad(a_records, bounds[q], bounds[q + 1], childMin, half, a_total, a_depth + 1);
+    m_quad[nodeId].child[q] = child;
+  }
+
+  return nodeId;
+}
+
+void GuidingSDTree::Pack()
+{
+  const int spatialBegin = GUIDING_HEADER_SIZE;
+  const int quadBegin    = spatialBegin + int(m_spatial.size());
+
+  m_data.resize(quadBegin + 2*m_quad.size());
+  m_data[0] = make_float4(as_float(int(m_spatial.size())), as_float(int(m_quad.size())), 0.0f, 0.0f);
+  m_data[1] = make_float4(m_boxMin.x, m_boxMin.y, m_boxMin.z, 0.0f);
+  m_data[2] = make_float4(m_boxMax.x, m_boxMax.y, m_boxMax.z, 0.0f);
+
+  for (size_t i = 0; i < m_spatial.size(); i++)
+  {
+    const SpatialNode& node = m_spatial[i];
+    const int child         = (node.axis == -1) ? -1 : spatialBegin + node.child;
+    const int quadRoot      = (node.dirTree == -1) ? -1 : quadBegin + 2*m_dirTreeRoots[node.dirTree];
+    m_data[spatialBegin + i] = make_float4(node.split, as_float(node.axis), as_float(child), as_float(quadRoot));
+  }
+
+  for (size_t i = 0; i < m_quad.size(); i++)
+  {
+    const QuadNode& node = m_quad[i];
+    int child[4];
+    for (int q = 0; q < 4; q++)
+      child[q] = (node.child[q] == 0) ? 0 : quadBegin + 2*node.child[q];
+
+    m_data[quadBegin + 2*i + 0] = make_float4(node.energy[0], node.energy[1], node.energy[2], node.energy[3]);
+    m_data[quadBegin + 2*i + 1] = make_float4(as_float(child[0]), as_float(child[1]), as_float(child[2]), as_float(child[3]));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void GuidingTrainer::Reset(int a_buffersNum)
+{
+  m_pTree    = nullptr;
+  m_training = false;
+  m_pass     = 0;
+  m_iterEnd  = 1;
+  m_buffers.clear();
+  m_buffers.resize(a_buffersNum);
+}
+
+bool GuidingTrainer::BeginPass(int a_trainPasses)
+{
+  m_training = (m_pass < a_trainPasses);
+  return m_training;
+}
+
+/**
+\brief Keep record in the buffer; when buffer is full keep uniform random subset of all records of current iteration (reservoir sampling).
+
+*/
+void GuidingTrainer::Record(int a_buffId, float3 a_pos, float3 a_dir, float a_value)
+{
+  if (!std::isfinite(a_value))
+    return;
+
+  RecordBuffer& buff      = m_buffers[a_buffId];
+  const size_t maxRecords = GUIDING_MAX_RECORDS / m_buffers.size();
+
+  GuidingRecord rec;
+  rec.pos   = a_pos;
+  rec.dir   = a_dir;
+  rec.value = a_value;
+
+  buff.seen++;
+  if (buff.records.size() < maxRecords)
+  {
+    buff.records.push_back(rec);
+    return;
+  }
+
+  buff.rng = buff.rng*1664525u + 1013904223u;
+  const uint64_t slot = (uint64_t(buff.rng) * buff.seen) >> 32;
+  if (slot < maxRecords)
+    buff.records[slot] = rec;
+}
+
+bool GuidingTrainer::EndPass(int a_trainPasses)
+{
+  if (!m_training)
+    return false;
+
+  m_pass++;
+  if (m_pass != m_iterEnd && m_pass != a_trainPasses)
+    return false;
+
+  std::vector<GuidingRecord> records;
+  for (auto& buff : m_buffers)
+  {
+    const double scale = (buff.seen > buff.records.size()) ? double(buff.seen) / double(buff.records.size()) : 1.0; // subset represents all seen records
+    for (auto rec : buff.records)
+    {
+      rec.value = float(double(rec.value)*scale);
+      records.push_back(rec);
+    }
+    buff.records.clear();
+    buff.seen = 0;
+  }
+
+  auto pTree = std::make_shared<GuidingSDTree>();
+  pTree->Build(records);
+  m_pTree = pTree->Empty() ? nullptr : pTree;
+
+  m_iterEnd = 2*m_iterEnd + 1;
+  return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "cglobals.h"
+#include "cguiding.h"
+
+#include <vector>
+#include <cstdint>
+#include <memory>
+
+/**
+\brief Sample of incident radiance that is recorded during training passes.
+
+*/
+struct GuidingRecord
+{
+  float3 pos;   ///< surface point
+  float3 dir;   ///< direction of incident radiance (from pos to the next vertex)
+  float  value; ///< luminance of incident radiance divided by pdf of dir; i.e. estimate of integral of radiance over the sphere
+};
+
+/**
+\brief Spatial-directional tree of incident radiance (Muller et al., "Practical Path Guiding for Efficient Light-Transport Simulation").
+       Spatial part is a binary tree over points; each leaf has quadtree over equal area cylindrical mapping of sphere directions.
+       Tree is rebuilt from scratch after each training iteration and is read only while rendering.
+       It is stored in the layout of cguiding.h, so the same data is sampled by CPU integrators and copied as is to OpenCL kernels.
+
+*/
+class GuidingSDTree
+{
+public:
+
+  GuidingSDTree() {}
+
+  void Build(std::vector<GuidingRecord>& a_records); ///< a_records are reordered
+
+  int    FindLeaf(float3 a_pos) const { return Empty() ? -1 : guidingFindLeaf(m_data.data(), a_pos); } ///< returns quadtree id or -1 if there is no radiance data near a_pos
+  float3 Sample(int a_leaf, float2 a_rands, float* a_pPdf) const { return guidingSample(m_data.data(), a_leaf, a_rands, a_pPdf); } ///< a_pPdf is pdf in solid angle
+  float  Pdf   (int a_leaf, float3 a_dir) const { return guidingPdf(m_data.data(), a_leaf, a_dir); }
+
+  bool   Empty() const { return m_data.empty(); }
+
+  const std::vector<float4>& Data() const { return m_data; } ///< packed tree, see cguiding.h
+
+protected:
+
+  struct SpatialNode
+  {
+    float split;    ///< split plane position along axis
+    int   axis;     ///< -1 for leaves
+    int   child;    ///< index of the first child; second is child + 1
+    int   dirTree;  ///< leaf only; index in m_dirTreeRoots or -1
+  };
+
+  struct QuadNode
+  {
+    float energy[4]; ///< summ of record values of each quadrant; (x,y) quadrant is (x + 2*y)
+    int   child[4];  ///< 0 for leaf quadrants
+  };
+
+  void BuildSpatial(int a_nodeId, std::vector<GuidingRecord>& a_records, int a_begin, int a_end, float3 a_boxMin, float3 a_boxMax, int a_depth);
+  int  BuildQuad(std::vector<GuidingRecord>& a_records, int a_begin, int a_end, float2 a_min, float a_size, float a_total, int a_depth);
+  void Pack();
+
+  std::vector<SpatialNode> m_spatial;
+  std::vector<QuadNode>    m_quad;
+  std::vector<int>         m_dirTreeRoots;
+  float3                   m_boxMin, m_boxMax;
+  std::vector<float4>      m_data;
+};
+
+/**
+\brief Training schedule of GuidingSDTree that is shared by CPU and OpenCL path tracers.
+       Training passes record incident radiance; tree is rebuilt after 1, 2, 4, ... training passes, so each iteration learns 
+       from the twice bigger number of samples than the previous one. Rendering passes sample the last tree.
+
+*/
+class GuidingTrainer
+{
+public:
+
+  GuidingTrainer() { Reset(1); }
+
+  void Reset(int a_buffersNum);                       ///< forget tree and records; a_buffersNum is the number of threads that record concurrently
+  bool BeginPass(int a_trainPasses);                  ///< returns true if current pass should record samples
+  void Record(int a_buffId, float3 a_pos, float3 a_dir, float a_value);
+  bool EndPass(int a_trainPasses);                    ///< returns true if tree was rebuilt
+
+  bool Training() const { return m_training; }
+  int  Pass()     const { return m_pass; }          ///< number of training passes done since Reset
+  std::shared_ptr<GuidingSDTree> Tree() const { return m_pTree; }   ///< nullptr until the first training iteration is done
+
+  constexpr static int GUIDING_MAX_RECORDS = 1 << 22; ///< total for all buffers; each buffer keeps uniform subset when it is exceeded
+
+protected:
+
+  struct RecordBuffer
+  {
+    std::vector<GuidingRecord> records;
+    uint64_t                   seen = 0;
+    uint32_t                   rng  = 0;
+  };
+
+  std::shared_ptr<GuidingSDTree> m_pTree;
+  std::vector<RecordBuffer>      m_buffers;
+  bool m_training;
+  int  m_pass;
+  int  m_iterEnd;                                     ///< training pass after which the tree is rebuilt
+};
@@ -55,7 +55,7 @@ IMemoryStorage* GPUOCLLayer::CreateMemStorage(uint64_t a_maxSizeInBytes, const c
   if (std::string(a_name) == "geom" || std::string(a_name) == "textures")
   {
     LinearStorageCPU* pCPUImpl = new LinearStorageCPU();
-    MemoryStorageOCL* pGPUImpl = new MemoryStorageOCL(m_globals.ctx, m_globals.cmdQueue);
+    MemoryStorageOCL* pGPUImpl = new MemoryStorageOCL(m_globals.ctx, m_globals.cmdQueue, (std::string(a_name) == "textures") ? CL_MEM_READ_WRITE : CL_MEM_READ_ONLY); // out of core textures write page requests
     pStorage = new MemoryStorageBothCPUAndGPU(pCPUImpl, pGPUImpl);
     pStorage->Reserve(a_maxSizeInBytes);
     buff = pGPUImpl->GetOCLBuffer();
@@ -593,11 +593,12 @@ void GPUOCLLayer::runKernel_ComputeHit(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_hi
   
   CHECK_CL(clSetKernelArg(kernHit, 9,  sizeof(cl_mem), (void*)&m_rays.rayFlags));
   CHECK_CL(clSetKernelArg(kernHit, 10, sizeof(cl_mem), (void*)&out_hitSurface));
+  CHECK_CL(clSetKernelArg(kernHit, 11, sizeof(cl_mem), (void*)&m_rays.pathMisDataPrev));
   
-  CHECK_CL(clSetKernelArg(kernHit, 11, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
-  CHECK_CL(clSetKernelArg(kernHit, 12, sizeof(cl_int), (void*)&m_scene.remapTableSize));
-  CHECK_CL(clSetKernelArg(kernHit, 13, sizeof(cl_int), (void*)&m_scene.totalInstanceNum));
-  CHECK_CL(clSetKernelArg(kernHit, 14, sizeof(cl_int), (void*)&isize));
+  CHECK_CL(clSetKernelArg(kernHit, 12, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+  CHECK_CL(clSetKernelArg(kernHit, 13, sizeof(cl_int), (void*)&m_scene.remapTableSize));
+  CHECK_CL(clSetKernelArg(kernHit, 14, sizeof(cl_int), (void*)&m_scene.totalInstanceNum));
+  CHECK_CL(clSetKernelArg(kernHit, 15, sizeof(cl_int), (void*)&isize));
 
   CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernHit, 1, NULL, &a_sizeRun, &localWorkSize, 0, NULL, NULL));
   waitIfDebug(__FILE__, __LINE__);
@@ -800,8 +801,18 @@ void GPUOCLLayer::runKernel_NextBounce(cl_mem a_rayFlags, cl_mem a_rpos, cl_mem
     CHECK_CL(clSetKernelArg(kernX, 19, sizeof(cl_mem), (void*)&m_scene.storageMat));
     CHECK_CL(clSetKernelArg(kernX, 20, sizeof(cl_mem), (void*)&m_scene.storagePdfs));
 
-    CHECK_CL(clSetKernelArg(kernX, 21, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
-    CHECK_CL(clSetKernelArg(kernX, 22, sizeof(cl_int), (void*)&isize));
+    cl_mem guideTree = m_guide.sample ? m_guide.tree      : nullptr;
+    cl_mem recPos    = m_guide.train  ? m_guide.recPos    : nullptr;
+    cl_mem recColor  = m_guide.train  ? m_guide.recColor  : nullptr;
+    cl_mem recWeight = m_guide.train  ? m_guide.recWeight : nullptr;
+
+    CHECK_CL(clSetKernelArg(kernX, 21, sizeof(cl_mem), (guideTree == nullptr) ? nullptr : (void*)&guideTree));
+    CHECK_CL(clSetKernelArg(kernX, 22, sizeof(cl_mem), (recPos    == nullptr) ? nullptr : (void*)&recPos));
+    CHECK_CL(clSetKernelArg(kernX, 23, sizeof(cl_mem), (recColor  == nullptr) ? nullptr : (void*)&recColor));
+    CHECK_CL(clSetKernelArg(kernX, 24, sizeof(cl_mem), (recWeight == nullptr) ? nullptr : (void*)&recWeight));
+
+    CHECK_CL(clSetKernelArg(kernX, 25, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+    CHECK_CL(clSetKernelArg(kernX, 26, sizeof(cl_int), (void*)&isize));
   }
 
   CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernX, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
@@ -809,6 +820,23 @@ void GPUOCLLayer::runKernel_NextBounce(cl_mem a_rayFlags, cl_mem a_rpos, cl_mem
 
 }
 
+void GPUOCLLayer::runKernel_GuidingRecordFinish(cl_mem in_color, size_t a_size)
+{
+  cl_kernel kernX = m_progs.material.kernel("GuidingRecordFinish");
+
+  size_t localWorkSize = 256;
+  int    isize         = int(a_size);
+  a_size               = roundBlocks(a_size, int(localWorkSize));
+
+  CHECK_CL(clSetKernelArg(kernX, 0, sizeof(cl_mem), (void*)&in_color));
+  CHECK_CL(clSetKernelArg(kernX, 1, sizeof(cl_mem), (void*)&m_guide.recColor));
+  CHECK_CL(clSetKernelArg(kernX, 2, sizeof(cl_mem), (void*)&m_guide.recWeight));
+  CHECK_CL(clSetKernelArg(kernX, 3, sizeof(cl_int), (void*)&isize));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernX, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+}
+
 void GPUOCLLayer::runKernel_NextTransparentBounce(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_thoroughput, size_t a_size)
 {
   cl_kernel kernX = m_progs.material.kernel("NextTransparentBounce");
@@ -1055,8 +1083,12 @@ void GPUOCLLayer::ShadePass(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_outColor, siz
     CHECK_CL(clSetKernelArg(kernZ, 12, sizeof(cl_mem), (void*)&m_scene.storageTexAux));
     CHECK_CL(clSetKernelArg(kernZ, 13, sizeof(cl_mem), (void*)&m_scene.storageMat));
     CHECK_CL(clSetKernelArg(kernZ, 14, sizeof(cl_mem), (void*)&m_scene.storagePdfs));
-    CHECK_CL(clSetKernelArg(kernZ, 15, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
-    CHECK_CL(clSetKernelArg(kernZ, 16, sizeof(cl_int), (void*)&isize));
+
+    cl_mem guideTree = m_guide.sample ? m_guide.tree : nullptr;
+    CHECK_CL(clSetKernelArg(kernZ, 15, sizeof(cl_mem), (guideTree == nullptr) ? nullptr : (void*)&guideTree));
+
+    CHECK_CL(clSetKernelArg(kernZ, 16, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+    CHECK_CL(clSetKernelArg(kernZ, 17, sizeof(cl_int), (void*)&isize));
 
     CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernZ, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));  
     waitIfDebug(__FILE__, __LINE__);
@@ -5,10 +5,12 @@
 #include "../../HydraAPI/hydra_api/ssemath.h"
 
 #include "cl_scan_gpu.h"
+#include "ImageToLDR.h"
 
 extern "C" void initQuasirandomGenerator(unsigned int table[QRNG_DIMENSIONS][QRNG_RESOLUTION]);
 
 #include <algorithm>
+#include <sstream>
 #undef min
 #undef max
 
@@ -119,8 +121,8 @@ size_t GPUOCLLayer::CL_BUFFERS_RAYS::resize(cl_context ctx, cl_command_queue cmd
 
   shadowRayPos = clCreateBuffer(ctx, CL_MEM_READ_WRITE | shareFlags, 4 * sizeof(cl_float)*MEGABLOCKSIZE, NULL, &ciErr1);   currSize += buff1Size * 4;
   shadowRayDir = clCreateBuffer(ctx, CL_MEM_READ_WRITE | shareFlags, 4 * sizeof(cl_float)*MEGABLOCKSIZE, NULL, &ciErr1);   currSize += buff1Size * 4;
-  accPdf       = clCreateBuffer(ctx, CL_MEM_READ_WRITE | shareFlags, 1 * sizeof(PerRayAcc)*MEGABLOCKSIZE, NULL, &ciErr1);  currSize += buff1Size * 1;
-  shadowTemp1i = clCreateBuffer(ctx, CL_MEM_READ_WRITE,              1 * sizeof(PerRayAcc)*MEGABLOCKSIZE, NULL, &ciErr1);  currSize += buff1Size * 1;
+  accPdf       = clCreateBuffer(ctx, CL_MEM_READ_WRITE | shareFlags, 1 * sizeof(PerRayAcc)*MEGABLOCKSIZE, NULL, &ciErr1);  currSize += buff1Size * 8;
+  shadowTemp1i = clCreateBuffer(ctx, CL_MEM_READ_WRITE,              1 * sizeof(PerRayAcc)*MEGABLOCKSIZE, NULL, &ciErr1);  currSize += buff1Size * 8;
                                                                                                                            
   if (ciErr1 != CL_SUCCESS)
     RUN_TIME_ERROR("Error in resize rays buffers");
@@ -667,6 +669,13 @@ GPUOCLLayer::GPUOCLLayer(int w, int h, int a_flags, int a_deviceId) : Base(w, h,
 
   std::cout << "[cl_core]: build cl programs complete" << std::endl << std::endl;
 
+  m_matProgs.materialPath  = yshaderpath;
+  m_matProgs.mltPath       = mshaderpath;
+  m_matProgs.devHash       = devHash;
+  m_matProgs.loadEncrypted = loadEncrypted;
+  m_matProgs.inDevelopment = inDevelopment;
+  m_matProgs.clearCache    = (a_flags & GPU_RT_CLEAR_SHADER_CACHE) || inDevelopment;
+
   if (!inDevelopment)
   {
     if (!isFileExists(ioshaderpathBin))
@@ -759,6 +768,7 @@ GPUOCLLayer::~GPUOCLLayer()
   
   MLT_Free();
   kmlt.free();
+  m_guide.free();
   m_rays.free();
   m_screen.free();
   m_scene.free();
@@ -810,6 +820,51 @@ size_t GPUOCLLayer::CalcMegaBlockSize(int a_flags)
   return MEGABLOCK_SIZE;
 }
 
+/**
+\brief Rebuild material and mlt programs only for material classes present in scene and with blend stack of required size.
+       Binaries are cached in shadercache with the feature set in their names, so each set of materials is compiled once.
+
+*/
+void GPUOCLLayer::SetMaterialFeatures(int a_classMask, int a_blendDepth)
+{
+  const int stackSize = std::min(std::max(a_blendDepth + 1, 2), MIX_TREE_MAX_DEEP); // each blend level of DFS keeps one more node in the stack
+
+  if (a_classMask == m_matProgs.classMask && stackSize == m_matProgs.stackSize)
+    return;
+
+  std::stringstream defines, key;
+  defines << " -D MATERIAL_CLASS_MASK=" << a_classMask << " -D MIX_TREE_MAX_DEEP=" << stackSize << " ";
+  key     << std::hex << a_classMask << std::dec << "_" << stackSize;
+
+  const std::string options = GetOCLShaderCompilerOptions() + defines.str();
+  const std::string yoshaderpathBin = HydraInstallPath() + "shadercache/" + "matsxx_" + m_matProgs.devHash + "_" + key.str() + ".bin";
+  const std::string moshaderpathBin = HydraInstallPath() + "shadercache/" + "mltxxx_" + m_matProgs.devHash + "_" + key.str() + ".bin";
+
+  if (m_matProgs.clearCache)
+  {
+    std::remove(yoshaderpathBin.c_str());
+    std::remove(moshaderpathBin.c_str());
+  }
+
+  std::cout << "[cl_core]: building " << m_matProgs.materialPath.c_str() << " for materials " << key.str().c_str() << " ..." << std::endl;
+  m_progs.material = CLProgram(m_globals.device, m_globals.ctx, m_matProgs.materialPath.c_str(), options.c_str(), HydraInstallPath(), m_matProgs.loadEncrypted, yoshaderpathBin, SAVE_BUILD_LOG);
+
+  std::cout << "[cl_core]: building " << m_matProgs.mltPath.c_str() << " for materials " << key.str().c_str() << " ..." << std::endl;
+  m_progs.mlt      = CLProgram(m_globals.device, m_globals.ctx, m_matProgs.mltPath.c_str(), options.c_str(), HydraInstallPath(), m_matProgs.loadEncrypted, moshaderpathBin, SAVE_BUILD_LOG);
+
+  if (!m_matProgs.inDevelopment)
+  {
+    if (!isFileExists(yoshaderpathBin))
+      m_progs.material.saveBinary(yoshaderpathBin);
+
+    if (!isFileExists(moshaderpathBin))
+      m_progs.mlt.saveBinary(moshaderpathBin);
+  }
+
+  m_matProgs.classMask = a_classMask;
+  m_matProgs.stackSize = stackSize;
+}
+
 std::string GPUOCLLayer::GetOCLShaderCompilerOptions()
 {
   std::string specDefines = "";
@@ -895,6 +950,7 @@ void GPUOCLLayer::ResizeScreen(int width, int height, int a_flags)
   if (m_screen.pbo != nullptr)
     memsetu32(m_screen.pbo, 0, m_width*m_height);
 
+  m_guide.free(); // record buffers have MEGABLOCKSIZE size
   m_memoryTaken[MEM_TAKEN_RAYS] = m_rays.resize(m_globals.ctx, m_globals.cmdQueue, MEGABLOCK_SIZE, m_globals.cpuTrace, m_screen.m_cpuFrameBuffer);
 
   MLT_Alloc_For_PT_QMC(1, kmlt.xVectorQMC); // Allocate memory for testing QMC/KMLT F(xVec,bounceNum); THIS IS IMPORTANT CALL! It sets internal KMLT variables
@@ -992,76 +1048,18 @@ void GPUOCLLayer::GetLDRImage(uint* data, int width, int height) const
     if (m_vars.m_flags & HRT_ENABLE_MMLT && (m_vars.m_flags & HRT_ENABLE_SBPT) == 0)  
       normConst = EstimateMLTNormConst(color0, width, height);
 
-    if (!HydraSSE::g_useSSE)
-    {
-      #pragma omp parallel for
-      for (int i = 0; i < size; i++)  // #TODO: use sse and fast pow
-      {
-        float4 color = color0[i];
-        color.x = powf(color.x*normConst, gammaInv);
-        color.y = powf(color.y*normConst, gammaInv);
-        color.z = powf(color.z*normConst, gammaInv);
-        color.w = powf(color.w*normConst, gammaInv);
-        data[i] = RealColorToUint32(ToneMapping4(color));
-      }
-    }
-    else
+    if (m_vars.m_flags & HRT_ENABLE_MMLT && (m_vars.m_flags & HRT_ENABLE_SBPT) == 0)
     {
-      const __m128 powerf4   = _mm_set_ps(gammaInv, gammaInv, gammaInv, gammaInv);
-      const __m128 normc     = _mm_set_ps(normConst, normConst, normConst, normConst);
-      const __m128 normc2    = _mm_set_ps(normConstDL, normConstDL, normConstDL, normConstDL);
-      const __m128 const_255 = _mm_set_ps1(255.0f);
-
-      const float* dataHDR  = (const float*)color0;
-      const float* dataHDR1 = (const float*)color1;
-
-      if (m_vars.m_flags & HRT_ENABLE_MMLT && (m_vars.m_flags & HRT_ENABLE_SBPT) == 0)
-      {
-        if (color1 != nullptr && color0 != nullptr)
-        {
-
-          #pragma omp parallel for
-          for (int i = 0; i < size; i++)
-          {
-            const __m128 colorDL = _mm_mul_ps(normc2, _mm_load_ps(dataHDR1 + i * 4));
-            const __m128 colorIL = _mm_mul_ps(normc, _mm_load_ps(dataHDR + i * 4));
-            const __m128 color2  = HydraSSE::powf4(_mm_add_ps(colorDL, colorIL), powerf4);
-            const __m128i rgba   = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(color2, const_255), const_255));
-            const __m128i out    = _mm_packus_epi32(rgba, _mm_setzero_si128());
-            const __m128i out2   = _mm_packus_epi16(out, _mm_setzero_si128());
-            data[i] = _mm_cvtsi128_si32(out2);
-          }
-
-        }
-        else if (color0 != nullptr)
-        {
-          #pragma omp parallel for
-          for (int i = 0; i < size; i++)
-          {
-            data[i] = HydraSSE::gammaCorr(dataHDR + i * 4, normc, powerf4);
-          }
-        }
-        else
-        {
-          std::cerr << "GPUOCLLayer::GetLDRImage(HRT_ENABLE_MMLT): both internal CPU images == nullptr!!!" << std::endl;
-          std::cerr.flush();
-        }
-
-        //#pragma omp parallel for
-        //for (int i = 0; i < size; i++)
-        //{
-        //  data[i] = HydraSSE::gammaCorr(dataHDR1 + i*4, normc2, powerf4);
-        //}
-      }
+      if (color0 != nullptr)
+        HDRImageToLDR2(color0, normConst, color1, normConstDL, data, size, gammaInv); // color1 (direct light) may be absent
       else
       {
-        #pragma omp parallel for
-        for (int i = 0; i < size; i++)
-        {
-          data[i] = HydraSSE::gammaCorr(dataHDR + i * 4, normc, powerf4);
-        }
+        std::cerr << "GPUOCLLayer::GetLDRImage(HRT_ENABLE_MMLT): both internal CPU images == nullptr!!!" << std::endl;
+        std::cerr.flush();
       }
     }
+    else
+      HDRImageToLDR(color0, data, size, normConst, gammaInv);
   }
   else
   {
@@ -1070,18 +1068,7 @@ void GPUOCLLayer::GetLDRImage(uint* data, int width, int height) const
       std::cerr << "[cl_core]: null m_screen.pbo, alloc temp buffer in host memory " << std::endl;
       std::vector<float4> hdrData(width*height);
       GetHDRImage(&hdrData[0], width, height);
-
-      #pragma omp parallel for
-      for (int i = 0; i < size; i++)  // #TODO: use sse and fast pow
-      {
-        float4 color = hdrData[i];
-        color.x = powf(color.x, gammaInv);
-        color.y = powf(color.y, gammaInv);
-        color.z = powf(color.z, gammaInv);
-        color.w = powf(color.w, gammaInv);
-        data[i] = RealColorToUint32(ToneMapping4(color));
-      }
-      
+      HDRImageToLDR(hdrData.data(), data, size, 1.0f, gammaInv);
     }
     else
     {
@@ -1138,6 +1125,7 @@ void GPUOCLLayer::InitPathTracing(int seed)
   m_sppContrib = 0.0f;
   m_passNumberForQMC = 0;
 
+  m_guide.free();
   ClearAccumulatedColor();
 }
 
@@ -1265,9 +1253,13 @@ void GPUOCLLayer::BeginTracingPass()
                                      m_rays.samZindex, kmlt.xVectorQMC);
       }
       
+      GuidingBeginPass();
+
       EvalPT(kmlt.xVectorQMC, m_rays.samZindex, minBounce, maxBounce, m_rays.MEGABLOCKSIZE,
              m_rays.pathAccColor);
 
+      GuidingEndPass(m_rays.pathAccColor);
+
       AddContributionToScreen(m_rays.pathAccColor, m_rays.samZindex);
     }
     
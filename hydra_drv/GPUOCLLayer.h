@@ -17,6 +17,7 @@
 #include "../vsgl3/Timer.h"
 
 #include "bitonic_sort_gpu.h"
+#include "CPUExp_PathGuiding.h"
 
 /** \brief OpenCL HWLayer.
 * 
@@ -71,6 +72,9 @@ public:
   void EvalLT(cl_mem in_xVector, int minBounce, int maxBounce, size_t a_size,
               cl_mem a_outColor);
 
+  void GuidingBeginPass();                      ///< select guiding mode of the next PT pass; alloc records and clear them for training passes
+  void GuidingEndPass(cl_mem in_color);         ///< read records of training pass; rebuild and upload tree when training iteration is done
+
   void FinishAll() override;
 
   void InitPathTracing(int seed);
@@ -108,6 +112,7 @@ public:
   void   MLT_Free();                            ///< free internal MLT DATA
 
   void RecompileProcTexShaders(const std::string& a_shaderPath) override;
+  void SetMaterialFeatures(int a_classMask, int a_blendDepth) override;
   
   float GetSPP       () const override { return m_spp; }
   float GetSPPDone   () const override { return m_sppDone + m_spp; }
@@ -389,6 +394,28 @@ protected:
   } m_globals;
 
 
+  struct CL_GUIDING_DATA // path guiding for PT, used only when HRT_PATH_GUIDING is set; see GuidingTrainer and NextBounce kernel
+  {
+    CL_GUIDING_DATA() : tree(nullptr), recPos(nullptr), recColor(nullptr), recWeight(nullptr), treeCapacity(0), treeSize(0), sample(false), train(false) {}
+
+    cl_mem tree;          ///< packed GuidingSDTree, see cguiding.h
+    cl_mem recPos;        ///< float4, MEGABLOCKSIZE size; training records; allocated on first training pass
+    cl_mem recColor;      ///< float4, MEGABLOCKSIZE size
+    cl_mem recWeight;     ///< float4, MEGABLOCKSIZE size
+
+    size_t treeCapacity;  ///< size of 'tree' buffer in float4
+    size_t treeSize;      ///< size of uploaded tree in float4; 0 if there is no tree yet
+    bool   sample;        ///< current pass samples tree in NextBounce and Shade
+    bool   train;         ///< current pass writes records in NextBounce
+
+    GuidingTrainer trainer;
+    std::vector<float4, aligned16<float4> > recPosCPU;
+    std::vector<float4, aligned16<float4> > recWeightCPU;
+
+    void free();
+
+  } m_guide;
+
   struct CL_SCENE_DATA
   {
     CL_SCENE_DATA() : storageTex(0), storageMat(0), storageGeom(0), storagePdfs(0), storageTexAux(0), matrices(0), instLightInst(0), 
@@ -457,6 +484,19 @@ protected:
 
   } m_progs;
 
+  struct MATERIAL_PROGS_INFO // how to rebuild programs that include cmaterial.h; see SetMaterialFeatures
+  {
+    std::string materialPath;
+    std::string mltPath;
+    std::string devHash;
+    std::string loadEncrypted;
+    bool        inDevelopment = false;
+    bool        clearCache    = false;
+    int         classMask     = MATERIAL_CLASS_MASK; ///< features that current m_progs.material and m_progs.mlt are compiled for
+    int         stackSize     = MIX_TREE_MAX_DEEP;
+
+  } m_matProgs;
+
   enum BIG_MEM_OBJECTS {       // try to account allocated memory, because OpenCL have no such functionality
     MEM_TAKEN_GEOMETRY    = 0,
     MEM_TAKEN_TEXTURES    = 1,
@@ -506,6 +546,7 @@ protected:
 
   void runKernel_NextBounce(cl_mem a_rayFlags, cl_mem a_rpos, cl_mem a_rdir, cl_mem a_outColor, size_t a_size);
   void runKernel_NextTransparentBounce(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_outColor, size_t a_size);
+  void runKernel_GuidingRecordFinish(cl_mem in_color, size_t a_size);
 
   void ShadePass(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_outColor, size_t a_size, bool a_measureTime);
   void ConnectEyePass(cl_mem in_rayFlags, cl_mem in_rayDirOld, cl_mem in_color, int a_bounce, size_t a_size);
@@ -227,6 +227,117 @@ void GPUOCLLayer::EvalPT(cl_mem in_xVector, cl_mem in_zind, int minBounce, int m
   kmlt.currZind = temp2; // restore
 }
 
+void GPUOCLLayer::CL_GUIDING_DATA::free()
+{
+  if (tree)      { clReleaseMemObject(tree);      tree      = nullptr; }
+  if (recPos)    { clReleaseMemObject(recPos);    recPos    = nullptr; }
+  if (recColor)  { clReleaseMemObject(recColor);  recColor  = nullptr; }
+  if (recWeight) { clReleaseMemObject(recWeight); recWeight = nullptr; }
+
+  treeCapacity = 0;
+  treeSize     = 0;
+  sample       = false;
+  train        = false;
+
+  trainer.Reset(1);
+  recPosCPU    = std::vector<float4, aligned16<float4> >();
+  recWeightCPU = std::vector<float4, aligned16<float4> >();
+}
+
+void GPUOCLLayer::GuidingBeginPass()
+{
+  m_guide.sample = false;
+  m_guide.train  = false;
+
+  // guiding mixture pdf is known for unidirectional PT MIS only
+  //
+  const bool enabled = (m_vars.m_varsI[HRT_PATH_GUIDING] != 0) && !(m_vars.m_flags & (HRT_FORWARD_TRACING | HRT_3WAY_MIS_WEIGHTS | HRT_ENABLE_MMLT | HRT_ENABLE_SBPT));
+  if (!enabled)
+  {
+    if (m_guide.recPos != nullptr || m_guide.trainer.Pass() != 0)
+      m_guide.free();
+    return;
+  }
+
+  m_guide.train  = m_guide.trainer.BeginPass(m_vars.m_varsI[HRT_GUIDING_TRAIN_PASSES]);
+  m_guide.sample = (m_guide.treeSize != 0);
+
+  if (m_guide.train && m_guide.recPos == nullptr)
+  {
+    cl_int ciErr1 = CL_SUCCESS;
+    const size_t buffSize = sizeof(float4)*m_rays.MEGABLOCKSIZE;
+
+    m_guide.recPos    = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, buffSize, NULL, &ciErr1);
+    m_guide.recColor  = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, buffSize, NULL, &ciErr1);
+    m_guide.recWeight = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, buffSize, NULL, &ciErr1);
+
+    if (ciErr1 != CL_SUCCESS)
+      RUN_TIME_ERROR("[cl_core]: Failed to create path guiding record buffers ");
+
+    m_guide.recPosCPU.resize(m_rays.MEGABLOCKSIZE);
+    m_guide.recWeightCPU.resize(m_rays.MEGABLOCKSIZE);
+
+    std::cout << "[AllocAll]: MEM(Guide)  = " << (3*buffSize) / size_t(1024*1024) << "\tMB" << std::endl;
+  }
+
+  if (m_guide.train)
+    memsetf4(m_guide.recColor, float4(0, 0, 0, 0), m_rays.MEGABLOCKSIZE); // recColor.w == 0 means path has no record
+}
+
+void GPUOCLLayer::GuidingEndPass(cl_mem in_color)
+{
+  const bool wasTraining = m_guide.train;
+
+  m_guide.sample = false;
+  m_guide.train  = false;
+
+  if (!wasTraining)
+    return;
+
+  runKernel_GuidingRecordFinish(in_color, m_rays.MEGABLOCKSIZE);
+
+  CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_guide.recPos,    CL_FALSE, 0, sizeof(float4)*m_rays.MEGABLOCKSIZE, m_guide.recPosCPU.data(),    0, NULL, NULL));
+  CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_guide.recWeight, CL_TRUE,  0, sizeof(float4)*m_rays.MEGABLOCKSIZE, m_guide.recWeightCPU.data(), 0, NULL, NULL));
+
+  for (size_t i = 0; i < m_rays.MEGABLOCKSIZE; i++)
+  {
+    const float value = m_guide.recWeightCPU[i].x;
+    if (value <= 0.0f)
+      continue;
+
+    const float4 posAndDir = m_guide.recPosCPU[i];
+    m_guide.trainer.Record(0, to_float3(posAndDir), decodeNormalOct(uint(as_int(posAndDir.w))), value);
+  }
+
+  if (!m_guide.trainer.EndPass(m_vars.m_varsI[HRT_GUIDING_TRAIN_PASSES]))
+    return;
+
+  auto pTree = m_guide.trainer.Tree();
+  if (pTree == nullptr)
+  {
+    m_guide.treeSize = 0;
+    return;
+  }
+
+  const std::vector<float4>& data = pTree->Data();
+
+  if (data.size() > m_guide.treeCapacity)
+  {
+    if (m_guide.tree != nullptr)
+      clReleaseMemObject(m_guide.tree);
+
+    cl_int ciErr1 = CL_SUCCESS;
+    m_guide.treeCapacity = data.size() + data.size()/2;
+    m_guide.tree         = clCreateBuffer(m_globals.ctx, CL_MEM_READ_ONLY, sizeof(float4)*m_guide.treeCapacity, NULL, &ciErr1);
+
+    if (ciErr1 != CL_SUCCESS)
+      RUN_TIME_ERROR("[cl_core]: Failed to create path guiding tree buffer ");
+  }
+
+  CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, m_guide.tree, CL_TRUE, 0, sizeof(float4)*data.size(), data.data(), 0, NULL, NULL));
+  m_guide.treeSize = data.size();
+}
+
 void GPUOCLLayer::EvalLT(cl_mem in_xVector, int minBounce, int maxBounce, size_t a_size,
                          cl_mem a_outColor)
 {
@@ -17,6 +17,7 @@ struct ConvertionResult
       trif4Num[i]       = 0;
       triAfNum[i]       = 0;
       bvhType [i]       = nullptr;
+      leafIdx [i]       = false;
     }
   }
 
@@ -28,6 +29,7 @@ struct ConvertionResult
   int            nodesNum[MAXBVHTREES];
   int            trif4Num[MAXBVHTREES];
   int            triAfNum[MAXBVHTREES];
+  bool           leafIdx [MAXBVHTREES]; ///< leaves are OBJLIST_LEAF_INDEXED; pTriangleData also holds shared mesh vertices
 
   int            treesNum;
 };
@@ -116,6 +116,7 @@ public:
   virtual void SetAllPODLights(PlainLight* a_lights2, size_t a_number);
 
   virtual void SetAllLightsSelectTable(const float* a_table, int32_t a_tableSize, bool a_fwd = false);
+  virtual void SetLightTree           (const float* a_tree, int32_t a_treeSize);
   virtual void SetAllRemapLists       (const int* a_allLists, const int2* a_table, int a_allSize, int a_tableSize) {}
   virtual void SetAllInstIdToRemapId  (const int* a_allInstId, int a_instNum) {}
 
@@ -132,6 +133,7 @@ public:
   virtual void EndTracingPass()    = 0;
   virtual void EvalGBuffer(IHRSharedAccumImage* a_pAccumImage, const std::vector<int32_t>& a_instIdByInstId) {}
   virtual void FinishAll() {}
+  virtual void StopAsyncPasses() {} ///< cancel and wait background passes (if layer has them); called before scene data is changed. Next BeginTracingPass resumes them.
 
   virtual void InitPathTracing(int seed) = 0;
   virtual void ClearAccumulatedColor() = 0;
@@ -147,6 +149,7 @@ public:
 
   virtual size_t    GetAvaliableMemoryAmount(bool allMem = false) = 0;
   virtual size_t    GetMaxBufferSizeInBytes() { return GetAvaliableMemoryAmount(); }
+  virtual size_t    GetFrameBufferMemoryAmount() const { return 0; } ///< memory taken by screen-sized buffers; 0 if layer counts them in 'GetAvaliableMemoryAmount(true) - GetAvaliableMemoryAmount(false)'
 
   virtual MRaysStat GetRaysStat() = 0;
   virtual int32_t   GetRayBuffSize() const { return 0; }
@@ -199,6 +202,7 @@ public:
   virtual EngineGlobals* GetEngineGlobals(); //#NOTE: this function used for debug needs only!!!
 
   virtual void RecompileProcTexShaders(const std::string& a_shaderPath) {}
+  virtual void SetMaterialFeatures(int a_classMask, int a_blendDepth) {} ///< material classes (1 << PLAIN_MAT_CLASS_*) and max blend nesting of scene; kernels may be specialized for them
 
   virtual float GetSPP       () const { return 0.0f;}
   virtual float GetSPPDone   () const { return GetSPP(); }
@@ -237,6 +241,7 @@ protected:
   std::vector<int>                                 m_geomTable;
   std::vector<float>                               m_lightSelectTableRev;
   std::vector<float>                               m_lightSelectTableFwd;
+  std::vector<float>                               m_lightTree;
 };
 
 
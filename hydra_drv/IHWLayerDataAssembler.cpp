@@ -132,6 +132,8 @@ void IHWLayer::SetCamMatrices(float mProjInverse[16], float mWorldViewInverse[16
 }
 
 
+static inline int LightSelectTableFloats(int a_tableSize) { return (a_tableSize > 0) ? 3*a_tableSize - 2 : 0; }
+
 size_t CalcConstGlobDataOffsets(EngineGlobals* pGlobals)
 {
   const int ALIGN_SIZE = 16;
@@ -146,8 +148,11 @@ size_t CalcConstGlobDataOffsets(EngineGlobals* pGlobals)
   pGlobals->texturesAuxTableOffset = int(currBuffOffset); currBuffOffset += roundBlocks(pGlobals->texturesAuxTableSize, ALIGN_SIZE);
   pGlobals->pdfTableTableOffset    = int(currBuffOffset); currBuffOffset += roundBlocks(pGlobals->pdfTableTableSize,    ALIGN_SIZE);
 
-  pGlobals->lightSelectorTableOffsetRev = int(currBuffOffset); currBuffOffset += roundBlocks(pGlobals->lightSelectorTableSizeRev, ALIGN_SIZE);
-  pGlobals->lightSelectorTableOffsetFwd = int(currBuffOffset); currBuffOffset += roundBlocks(pGlobals->lightSelectorTableSizeFwd, ALIGN_SIZE);
+  // light selector tables are prefix summs of N+1 floats followed by alias table of 2*N floats (see SelectIndexAlias)
+  //
+  pGlobals->lightSelectorTableOffsetRev = int(currBuffOffset); currBuffOffset += roundBlocks(LightSelectTableFloats(pGlobals->lightSelectorTableSizeRev), ALIGN_SIZE);
+  pGlobals->lightSelectorTableOffsetFwd = int(currBuffOffset); currBuffOffset += roundBlocks(LightSelectTableFloats(pGlobals->lightSelectorTableSizeFwd), ALIGN_SIZE);
+  pGlobals->lightTreeOffset             = int(currBuffOffset); currBuffOffset += roundBlocks(pGlobals->lightTreeSize,             ALIGN_SIZE);
 
   pGlobals->floatArraysOffset = int(currBuffOffset);      currBuffOffset += roundBlocks(pGlobals->floatsArraysSize, ALIGN_SIZE);
   pGlobals->lightsOffset      = int(currBuffOffset);      currBuffOffset += roundBlocks(pGlobals->lightsSize, ALIGN_SIZE);
@@ -165,24 +170,34 @@ void IHWLayer::ResizeTablesForEngineGlobals(int32_t a_geomNum, int32_t a_imgNum,
   m_globsBuffHeader.lightsSize           = int ( (sizeof(PlainLight)*a_lightNum) / sizeof(int) );
 }
 
+std::vector<float> AliasTableFromPrefixSumm(const std::vector<float>& a_accum);
+
 void IHWLayer::SetAllLightsSelectTable(const float* a_table, int32_t a_tableSize, bool a_fwd)
 {
+  std::vector<float> table(a_table, a_table + a_tableSize);
+  const std::vector<float> alias = AliasTableFromPrefixSumm(table);
+  table.insert(table.end(), alias.begin(), alias.end());
+
   if (a_fwd)
   {
     m_globsBuffHeader.lightSelectorTableSizeFwd = a_tableSize;
-    m_lightSelectTableFwd.resize(a_tableSize);
-    if (a_tableSize > 0)
-      memcpy(&m_lightSelectTableFwd[0], a_table, a_tableSize * sizeof(float));
+    m_lightSelectTableFwd = table;
   }
   else
   {
     m_globsBuffHeader.lightSelectorTableSizeRev = a_tableSize;
-    m_lightSelectTableRev.resize(a_tableSize);
-    if (a_tableSize > 0)
-      memcpy(&m_lightSelectTableRev[0], a_table, a_tableSize * sizeof(float));
+    m_lightSelectTableRev = table;
   }
 }
 
+void IHWLayer::SetLightTree(const float* a_tree, int32_t a_treeSize)
+{
+  m_globsBuffHeader.lightTreeSize = a_treeSize;
+  m_lightTree.resize(a_treeSize);
+  if (a_treeSize > 0)
+    memcpy(&m_lightTree[0], a_tree, a_treeSize * sizeof(float));
+}
+
 void memcpyu32_cpu(int* buff1, uint a_offset1, int* buff2, uint a_offset2, size_t a_size)
 {
   int* dst = buff1 + a_offset1;
@@ -371,6 +386,9 @@ void IHWLayer::PrepareEngineTables()
     memcpy(pbuff + m_globsBuffHeader.lightSelectorTableOffsetRev, &m_lightSelectTableRev[0], sizeof(float)*m_lightSelectTableRev.size());
     memcpy(pbuff + m_globsBuffHeader.lightSelectorTableOffsetFwd, &m_lightSelectTableFwd[0], sizeof(float)*m_lightSelectTableFwd.size());
   }
+
+  if (m_lightTree.size() > 0)
+    memcpy(pbuff + m_globsBuffHeader.lightTreeOffset, &m_lightTree[0], sizeof(float)*m_lightTree.size());
 }
 
 void IHWLayer::SetAllPODLights(PlainLight* a_lights2, size_t a_number)
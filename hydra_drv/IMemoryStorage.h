@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <vector>
 #include <unordered_map>
+#include <map>
 
 struct LChunk
 {
@@ -12,6 +13,18 @@ struct LChunk
   int offset; // not used right now, equal to 0
 };
 
+struct MemStorageStats
+{
+  MemStorageStats() : bytesUsed(0), bytesFree(0), bytesReused(0), chunksFree(0), allocsReused(0), defragmentations(0) {}
+
+  uint64_t bytesUsed;        ///< allocated for live objects
+  uint64_t bytesFree;        ///< holes in the free list; can be reused by Update or removed by Defragment
+  uint64_t bytesReused;      ///< total size of allocations that were taken from the free list
+  int      chunksFree;
+  int      allocsReused;
+  int      defragmentations;
+};
+
 struct IMemoryStorage
 {
   IMemoryStorage() : maxId(0) {}
@@ -27,22 +40,36 @@ struct IMemoryStorage
 
   virtual int32_t Update(int32_t id, const void* a_data, uint64_t a_sizeInBytes);                                  ///< can do realloc
   virtual void    UpdatePartial(int32_t id, const void* a_data, uint64_t a_offsetInBytes, uint64_t a_sizeInBytes); ///< in place update only
+  virtual void    ReadPartial(int32_t id, void* a_data, uint64_t a_offsetInBytes, uint64_t a_sizeInBytes);         ///< blocking read back of object part; needed for data that kernels write
+
+  virtual void   Delete(int32_t id);  ///< return object memory to the free list; for objects that no one refers by id anymore (old mesh light copies in pdf storage). Materials and textures are only replaced by Update.
+  virtual size_t Defragment();        ///< move live objects to the beginning of storage; offsets are changed, so call GetTable() again after it. Returns freed bytes.
 
   virtual std::vector<int32_t> GetTable();
+  virtual MemStorageStats      GetStats() const;
+  int GetDefragmentsNum() const { return m_stats.defragmentations; } ///< cached offsets (GetTable) must be read again when this number changes
 
   virtual int GetAlignSizeInBytes() const { return 16; }
   virtual int GetMaxObjectId()      const { return maxId; }
   virtual void DebugSaveToFile(const char* a_fileName) = 0;
 
   virtual void FreeHostMem() {}
+  virtual void Flush()       {} ///< wait for all asynchronous uploads; must be called before storage data is used
 
 protected:
 
   std::unordered_map<int, LChunk> objects;
   int maxId;
 
+  std::map<int, int> m_freeList; ///< free chunks, begin --> size (both in blocks); ordered by address to coalesce neighbours
+  MemStorageStats    m_stats;
+
   virtual void   MemCopyAt(uint64_t a_offsetInInts, const void* a_data, uint64_t a_sizeInBytes) = 0;
+  virtual void   MemMove(uint64_t a_dstOffsetInBytes, uint64_t a_srcOffsetInBytes, uint64_t a_sizeInBytes) = 0; ///< copy inside storage; dst < src
+  virtual void   MemReadAt(uint64_t a_offsetInBytes, void* a_data, uint64_t a_sizeInBytes) = 0;
   virtual LChunk AppendToTheEnd(const void* a_data, uint64_t a_sizeInBytes);
+  virtual LChunk AllocChunk(const void* a_data, uint64_t a_sizeInBytes);
+  virtual void   FreeChunk(int a_begin, int a_sizeInBlocks);
   virtual size_t SizeInBlocks(uint64_t a_sizeInBytes);
 
 };
@@ -0,0 +1,92 @@
+#include "ImageToLDR.h"
+
+#include "../../HydraAPI/hydra_api/ssemath.h"
+#include <smmintrin.h>
+
+#include <cmath>
+
+static inline uint PackLDR(float4 color, const float a_gammaInv, const bool a_opaqueAlpha)
+{
+  color.x = powf(fmax(color.x, 0.0f), a_gammaInv);
+  color.y = powf(fmax(color.y, 0.0f), a_gammaInv);
+  color.z = powf(fmax(color.z, 0.0f), a_gammaInv);
+  color.w = a_opaqueAlpha ? 1.0f : powf(fmax(color.w, 0.0f), a_gammaInv);
+  return RealColorToUint32(ToneMapping4(color));
+}
+
+static inline uint PackLDR_SSE(const __m128 a_color, const __m128 a_powerf4, const uint a_alphaMask)
+{
+  const __m128 const_255 = _mm_set_ps1(255.0f);
+
+  const __m128  color  = HydraSSE::powf4(_mm_max_ps(a_color, _mm_setzero_ps()), a_powerf4);
+  const __m128i rgba   = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(color, const_255), const_255)); // truncate like RealColorToUint32 does
+  const __m128i out    = _mm_packus_epi32(rgba, _mm_setzero_si128());
+  const __m128i out2   = _mm_packus_epi16(out, _mm_setzero_si128());
+
+  return uint(_mm_cvtsi128_si32(out2)) | a_alphaMask;
+}
+
+void HDRImageToLDR(const float4* a_hdr, uint* a_ldr, int a_size, float a_scale, float a_gammaInv, bool a_opaqueAlpha)
+{
+  if (a_hdr == nullptr || a_ldr == nullptr)
+    return;
+
+  if (!HydraSSE::g_useSSE)
+  {
+    #pragma omp parallel for
+    for (int i = 0; i < a_size; i++)
+      a_ldr[i] = PackLDR(a_hdr[i]*a_scale, a_gammaInv, a_opaqueAlpha);
+  }
+  else
+  {
+    const __m128 powerf4   = _mm_set_ps1(a_gammaInv);
+    const __m128 normc     = _mm_set_ps1(a_scale);
+    const uint   alphaMask = a_opaqueAlpha ? 0xFF000000 : 0;
+    const float* dataHDR   = (const float*)a_hdr;
+
+    #pragma omp parallel for
+    for (int i = 0; i < a_size; i++)
+      a_ldr[i] = PackLDR_SSE(_mm_mul_ps(normc, _mm_loadu_ps(dataHDR + i*4)), powerf4, alphaMask);
+  }
+}
+
+void HDRImageToLDR2(const float4* a_hdr1, float a_scale1, const float4* a_hdr2, float a_scale2, uint* a_ldr, int a_size, float a_gammaInv, bool a_opaqueAlpha)
+{
+  if (a_hdr2 == nullptr)
+  {
+    HDRImageToLDR(a_hdr1, a_ldr, a_size, a_scale1, a_gammaInv, a_opaqueAlpha);
+    return;
+  }
+  else if (a_hdr1 == nullptr)
+  {
+    HDRImageToLDR(a_hdr2, a_ldr, a_size, a_scale2, a_gammaInv, a_opaqueAlpha);
+    return;
+  }
+
+  if (a_ldr == nullptr)
+    return;
+
+  if (!HydraSSE::g_useSSE)
+  {
+    #pragma omp parallel for
+    for (int i = 0; i < a_size; i++)
+      a_ldr[i] = PackLDR(a_hdr1[i]*a_scale1 + a_hdr2[i]*a_scale2, a_gammaInv, a_opaqueAlpha);
+  }
+  else
+  {
+    const __m128 powerf4   = _mm_set_ps1(a_gammaInv);
+    const __m128 normc1    = _mm_set_ps1(a_scale1);
+    const __m128 normc2    = _mm_set_ps1(a_scale2);
+    const uint   alphaMask = a_opaqueAlpha ? 0xFF000000 : 0;
+    const float* dataHDR1  = (const float*)a_hdr1;
+    const float* dataHDR2  = (const float*)a_hdr2;
+
+    #pragma omp parallel for
+    for (int i = 0; i < a_size; i++)
+    {
+      const __m128 color1 = _mm_mul_ps(normc1, _mm_loadu_ps(dataHDR1 + i*4));
+      const __m128 color2 = _mm_mul_ps(normc2, _mm_loadu_ps(dataHDR2 + i*4));
+      a_ldr[i] = PackLDR_SSE(_mm_add_ps(color1, color2), powerf4, alphaMask);
+    }
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "cglobals.h"
+
+/**
+\brief Convert HDR image to LDR; ldr = uint32(255*min(pow(max(a_scale*hdr, 0), a_gammaInv), 1)). SSE + OpenMP when HydraSSE::g_useSSE, scalar OpenMP loop otherwise.
+\param a_hdr         - input HDR image
+\param a_ldr         - output LDR image, packed as RGBA8
+\param a_size        - pixels number
+\param a_scale       - normalization constant; 1.0f for running mean images and 1/spp for accumulated ones
+\param a_gammaInv    - 1/gamma
+\param a_opaqueAlpha - write 255 to alpha; otherwise alpha is converted from 'w' channel in the same way as colors
+
+*/
+void HDRImageToLDR(const float4* a_hdr, uint* a_ldr, int a_size, float a_scale, float a_gammaInv, bool a_opaqueAlpha = false);
+
+/**
+\brief Same as HDRImageToLDR, but for the summ of two images (a_scale1*a_hdr1 + a_scale2*a_hdr2); used for separate direct and indirect light images.
+
+*/
+void HDRImageToLDR2(const float4* a_hdr1, float a_scale1, const float4* a_hdr2, float a_scale2, uint* a_ldr, int a_size, float a_gammaInv, bool a_opaqueAlpha = false);
@@ -2,6 +2,8 @@
 #include <fstream>
 #include <assert.h>
 #include <cstring>
+#include <algorithm>
+#include <iterator>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -64,26 +66,159 @@ int32_t IMemoryStorage::Update(int32_t id, const void* a_data, uint64_t a_sizeIn
   {
     LChunk chunk = p->second;
 
-    if (chunk.begin + sizeInBlocks <= chunk.endMax) // Update in the place it's already located
+    if (chunk.begin != -1 && chunk.begin + sizeInBlocks <= chunk.endMax) // Update in the place it's already located
     {
       if (a_data != nullptr)
         MemCopyAt(chunk.begin*bytesPerBlock, a_data, a_sizeInBytes);
       p->second.endCur = chunk.begin + int(sizeInBlocks);
       return chunk.begin;
     }
-    else
+    
+    FreeChunk(chunk.begin, chunk.endMax - chunk.begin); // object is grown; its old place can be reused by others
+    objects.erase(p);
+  }
+
+  auto chunk  = AllocChunk(a_data, a_sizeInBytes);
+  objects[id] = chunk;
+  return chunk.begin;
+}
+
+void IMemoryStorage::Delete(int32_t id)
+{
+  auto p = objects.find(id);
+  if (p == objects.end())
+    return;
+
+  FreeChunk(p->second.begin, p->second.endMax - p->second.begin);
+  objects.erase(p);
+}
+
+/**
+\brief take the smallest free chunk that fits (best fit); append to the end if there is no such chunk. 
+
+ If the end of storage is reached, defragment storage and try again.
+
+*/
+LChunk IMemoryStorage::AllocChunk(const void* a_data, uint64_t a_sizeInBytes)
+{
+  const int bytesPerBlock = GetAlignSizeInBytes();
+  const int sizeInBlocks  = int(SizeInBlocks(a_sizeInBytes));
+
+  auto best = m_freeList.end();
+  for (auto p = m_freeList.begin(); p != m_freeList.end(); ++p)
+  {
+    if (p->second >= sizeInBlocks && (best == m_freeList.end() || p->second < best->second))
+      best = p;
+  }
+
+  if (best != m_freeList.end())
+  {
+    const int begin    = best->first;
+    const int freeSize = best->second;
+    m_freeList.erase(best);
+
+    if (freeSize > sizeInBlocks)
+      m_freeList[begin + sizeInBlocks] = freeSize - sizeInBlocks;
+
+    if (a_data != nullptr)
+      MemCopyAt(uint64_t(begin)*uint64_t(bytesPerBlock), a_data, a_sizeInBytes);
+
+    m_stats.bytesReused += uint64_t(sizeInBlocks)*uint64_t(bytesPerBlock);
+    m_stats.allocsReused++;
+
+    LChunk chunk;
+    chunk.begin  = begin;
+    chunk.endCur = begin + sizeInBlocks;
+    chunk.endMax = begin + sizeInBlocks;
+    chunk.offset = 0;
+    return chunk;
+  }
+
+  LChunk chunk = AppendToTheEnd(a_data, a_sizeInBytes);
+
+  if (chunk.begin == -1 && !m_freeList.empty())
+  {
+    Defragment();
+    chunk = AppendToTheEnd(a_data, a_sizeInBytes);
+  }
+
+  return chunk;
+}
+
+void IMemoryStorage::FreeChunk(int a_begin, int a_sizeInBlocks)
+{
+  if (a_begin < 0 || a_sizeInBlocks <= 0)
+    return;
+
+  int begin = a_begin;
+  int size  = a_sizeInBlocks;
+
+  // coalesce with neighbours
+  //
+  auto next = m_freeList.lower_bound(begin);
+  if (next != m_freeList.end() && next->first == begin + size)
+  {
+    size += next->second;
+    next  = m_freeList.erase(next);
+  }
+
+  if (next != m_freeList.begin())
+  {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == begin)
     {
-      auto chunk = AppendToTheEnd(a_data, a_sizeInBytes); // inser to the end of the buffer
-      objects[id] = chunk;
-      return chunk.begin;
+      begin = prev->first;
+      size += prev->second;
+      m_freeList.erase(prev);
     }
   }
+
+  // free chunk at the end of storage is not a hole; just shrink the storage
+  //
+  const uint64_t bytesPerBlock = uint64_t(GetAlignSizeInBytes());
+  if (uint64_t(begin + size)*bytesPerBlock == uint64_t(this->GetSize()))
+    this->Resize(uint64_t(begin)*bytesPerBlock);
   else
+    m_freeList[begin] = size;
+}
+
+size_t IMemoryStorage::Defragment()
+{
+  if (m_freeList.empty())
+    return 0;
+
+  const uint64_t bytesPerBlock = uint64_t(GetAlignSizeInBytes());
+  const size_t   oldSize       = this->GetSize();
+
+  std::vector<std::pair<int, int> > live; // (begin, id)
+  live.reserve(objects.size());
+  for (const auto& obj : objects)
   {
-    auto chunk = AppendToTheEnd(a_data, a_sizeInBytes);
-    objects[id] = chunk;
-    return chunk.begin;
+    if (obj.second.begin >= 0)
+      live.push_back(std::make_pair(obj.second.begin, obj.first));
   }
+  std::sort(live.begin(), live.end());
+
+  int dst = 0;
+  for (const auto& x : live)
+  {
+    LChunk& chunk  = objects[x.second];
+    const int size = chunk.endCur - chunk.begin; // unused tail of the chunk (endCur..endMax) is dropped too
+
+    if (chunk.begin != dst)
+      MemMove(uint64_t(dst)*bytesPerBlock, uint64_t(chunk.begin)*bytesPerBlock, uint64_t(size)*bytesPerBlock);
+
+    chunk.begin  = dst;
+    chunk.endCur = dst + size;
+    chunk.endMax = dst + size;
+    dst         += size;
+  }
+
+  m_freeList.clear();
+  this->Resize(uint64_t(dst)*bytesPerBlock);
+  m_stats.defragmentations++;
+
+  return oldSize - this->GetSize();
 }
 
 void IMemoryStorage::UpdatePartial(int32_t id, const void* a_data, uint64_t a_offsetInBytes, uint64_t a_sizeInBytes)
@@ -110,6 +245,21 @@ void IMemoryStorage::UpdatePartial(int32_t id, const void* a_data, uint64_t a_of
   MemCopyAt(offset, a_data, a_sizeInBytes);
 }
 
+void IMemoryStorage::ReadPartial(int32_t id, void* a_data, uint64_t a_offsetInBytes, uint64_t a_sizeInBytes)
+{
+  auto p = objects.find(id);
+  if (p == objects.end() || p->second.begin == -1)
+    return;
+
+  const int bytesPerBlock = GetAlignSizeInBytes();
+  LChunk chunk = p->second;
+
+  if (a_offsetInBytes + a_sizeInBytes > chunk.endMax*bytesPerBlock)
+    return;
+
+  MemReadAt(uint64_t(chunk.begin)*uint64_t(bytesPerBlock) + a_offsetInBytes, a_data, a_sizeInBytes);
+}
+
 std::vector<int32_t> IMemoryStorage::GetTable()
 {
   const int bytesPerBlock = GetAlignSizeInBytes();
@@ -126,6 +276,27 @@ std::vector<int32_t> IMemoryStorage::GetTable()
   return res;
 }
 
+MemStorageStats IMemoryStorage::GetStats() const
+{
+  const uint64_t bytesPerBlock = uint64_t(GetAlignSizeInBytes());
+
+  MemStorageStats res = m_stats;
+  res.bytesUsed  = 0;
+  res.bytesFree  = 0;
+  res.chunksFree = int(m_freeList.size());
+
+  for (const auto& obj : objects)
+  {
+    if (obj.second.begin >= 0)
+      res.bytesUsed += uint64_t(obj.second.endMax - obj.second.begin)*bytesPerBlock;
+  }
+
+  for (const auto& chunk : m_freeList)
+    res.bytesFree += uint64_t(chunk.second)*bytesPerBlock;
+
+  return res;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -135,6 +306,8 @@ void LinearStorageCPU::Clear()
   data    = std::vector<uint8_t>();
   objects = std::unordered_map<int, LChunk>();
   maxId   = 0;
+  m_freeList.clear();
+  m_stats = MemStorageStats();
 }
 
 size_t LinearStorageCPU::Reserve(uint64_t a_totalSizeInBytes)
@@ -155,6 +328,16 @@ void LinearStorageCPU::MemCopyAt(uint64_t a_offsetInBytes, const void* a_data, u
     memcpy(&data[a_offsetInBytes], a_data, a_sizeInBytes);
 }
 
+void LinearStorageCPU::MemMove(uint64_t a_dstOffsetInBytes, uint64_t a_srcOffsetInBytes, uint64_t a_sizeInBytes)
+{
+  memmove(&data[a_dstOffsetInBytes], &data[a_srcOffsetInBytes], a_sizeInBytes);
+}
+
+void LinearStorageCPU::MemReadAt(uint64_t a_offsetInBytes, void* a_data, uint64_t a_sizeInBytes)
+{
+  memcpy(a_data, &data[a_offsetInBytes], a_sizeInBytes);
+}
+
 const void* LinearStorageCPU::GetBegin() const
 {
   if(data.size() == 0)
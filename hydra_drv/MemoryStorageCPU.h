@@ -17,6 +17,8 @@ struct LinearStorageCPU : public IMemoryStorage
   const size_t  GetCapacity() const;
 
   void MemCopyAt(uint64_t a_offsetInInts, const void* a_data, uint64_t a_sizeInBytes) override;
+  void MemMove(uint64_t a_dstOffsetInBytes, uint64_t a_srcOffsetInBytes, uint64_t a_sizeInBytes) override;
+  void MemReadAt(uint64_t a_offsetInBytes, void* a_data, uint64_t a_sizeInBytes) override;
 
   void DebugSaveToFile(const char* a_fileName);
 
@@ -1,10 +1,13 @@
 #include "MemoryStorageOCL.h"
 #include <fstream>
+#include <cstring>
 
 void MemoryStorageOCL::Clear()
 {
   m_currSize  = 0;
   m_totalSize = 0;
+  m_freeList.clear();
+  m_stats = MemStorageStats();
 }
 
 size_t MemoryStorageOCL::Reserve(uint64_t a_totalSize)
@@ -16,7 +19,7 @@ size_t MemoryStorageOCL::Reserve(uint64_t a_totalSize)
   if(m_dataBuffer != 0)
     clReleaseMemObject(m_dataBuffer);
 
-  m_dataBuffer = clCreateBuffer(m_ctx, CL_MEM_READ_ONLY, a_totalSize, nullptr, &ciErr1);
+  m_dataBuffer = clCreateBuffer(m_ctx, m_memFlags, a_totalSize, nullptr, &ciErr1);
 
   if (ciErr1 != CL_SUCCESS)
     return size_t(-1);
@@ -55,7 +58,160 @@ const size_t  MemoryStorageOCL::GetCapacity() const
 
 void MemoryStorageOCL::MemCopyAt(uint64_t a_offsetInBytes, const void* a_data, uint64_t a_sizeInBytes)
 {
-  CHECK_CL(clEnqueueWriteBuffer(m_queue, m_dataBuffer, CL_TRUE, a_offsetInBytes, a_sizeInBytes, a_data, 0, NULL, NULL));
+  if (a_data == nullptr || a_sizeInBytes == 0)
+    return;
+
+  if (m_staging == nullptr && !CreateStagingRing())
+  {
+    CHECK_CL(clEnqueueWriteBuffer(m_queue, m_dataBuffer, CL_TRUE, a_offsetInBytes, a_sizeInBytes, a_data, 0, NULL, NULL));
+    return;
+  }
+
+  // big objects are uploaded by pieces, so copy of the next piece overlaps with transfer of the previous one
+  //
+  const uint8_t* input = (const uint8_t*)a_data;
+
+  for (uint64_t offset = 0; offset < a_sizeInBytes; offset += STAGING_RING_SIZE/2)
+  {
+    const uint64_t currSize = (a_sizeInBytes - offset < STAGING_RING_SIZE/2) ? (a_sizeInBytes - offset) : STAGING_RING_SIZE/2;
+    uint8_t* pStaging       = AllocStaging(currSize);
+
+    memcpy(pStaging, input + offset, currSize);
+
+    StagingRange range;
+    range.begin = uint64_t(pStaging - m_stagingPtr);
+    range.end   = range.begin + currSize;
+    range.evt   = nullptr;
+
+    CHECK_CL(clEnqueueWriteBuffer(m_queue, m_dataBuffer, CL_FALSE, a_offsetInBytes + offset, currSize, pStaging, 0, NULL, &range.evt));
+    m_stagingInFlight.push_back(range);
+  }
+}
+
+bool MemoryStorageOCL::CreateStagingRing()
+{
+  if (m_ctx == nullptr || m_queue == nullptr)
+    return false;
+
+  cl_int ciErr1 = CL_SUCCESS;
+  m_staging = clCreateBuffer(m_ctx, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, STAGING_RING_SIZE, nullptr, &ciErr1);
+  if (ciErr1 != CL_SUCCESS || m_staging == nullptr)
+  {
+    m_staging = nullptr;
+    return false;
+  }
+
+  // pinned host memory stays mapped; it is used only as the host pointer for clEnqueueWriteBuffer, never by kernels
+  //
+  m_stagingPtr = (uint8_t*)clEnqueueMapBuffer(m_queue, m_staging, CL_TRUE, CL_MAP_WRITE, 0, STAGING_RING_SIZE, 0, nullptr, nullptr, &ciErr1);
+  if (ciErr1 != CL_SUCCESS || m_stagingPtr == nullptr)
+  {
+    clReleaseMemObject(m_staging);
+    m_staging    = nullptr;
+    m_stagingPtr = nullptr;
+    return false;
+  }
+
+  m_stagingHead = 0;
+  return true;
+}
+
+uint8_t* MemoryStorageOCL::AllocStaging(uint64_t a_size)
+{
+  if (m_stagingHead + a_size > STAGING_RING_SIZE)
+    m_stagingHead = 0;
+
+  const uint64_t begin = m_stagingHead;
+  const uint64_t end   = m_stagingHead + a_size;
+
+  // wait for previous writes that still read from this part of the ring
+  //
+  for (auto p = m_stagingInFlight.begin(); p != m_stagingInFlight.end();)
+  {
+    if (p->begin < end && begin < p->end)
+    {
+      CHECK_CL(clWaitForEvents(1, &p->evt));
+      clReleaseEvent(p->evt);
+      p = m_stagingInFlight.erase(p);
+    }
+    else
+      ++p;
+  }
+
+  m_stagingHead = end;
+  return m_stagingPtr + begin;
+}
+
+void MemoryStorageOCL::Flush()
+{
+  if (m_stagingInFlight.size() != 0)
+  {
+    std::vector<cl_event> events(m_stagingInFlight.size());
+    for (size_t i = 0; i < events.size(); i++)
+      events[i] = m_stagingInFlight[i].evt;
+
+    CHECK_CL(clWaitForEvents(cl_uint(events.size()), events.data()));
+
+    for (auto evt : events)
+      clReleaseEvent(evt);
+    m_stagingInFlight.clear();
+  }
+
+  // don't hold pinned memory while rendering; ring is created again on next update
+  //
+  if (m_staging != nullptr)
+  {
+    CHECK_CL(clEnqueueUnmapMemObject(m_queue, m_staging, m_stagingPtr, 0, nullptr, nullptr));
+    CHECK_CL(clFinish(m_queue));
+    clReleaseMemObject(m_staging);
+    m_staging     = nullptr;
+    m_stagingPtr  = nullptr;
+    m_stagingHead = 0;
+  }
+}
+
+void MemoryStorageOCL::MemMove(uint64_t a_dstOffsetInBytes, uint64_t a_srcOffsetInBytes, uint64_t a_sizeInBytes)
+{
+  // clEnqueueCopyBuffer does not allow overlapped regions inside single buffer (CL_MEM_COPY_OVERLAP); dst < src.
+  // Pieces of (src - dst) bytes never overlap, but small shifts would give millions of copies, so go through scratch buffer then
+  //
+  const uint64_t shift = a_srcOffsetInBytes - a_dstOffsetInBytes;
+
+  if (shift >= MEM_MOVE_CHUNK_SIZE || shift >= a_sizeInBytes)
+  {
+    for (uint64_t offset = 0; offset < a_sizeInBytes; offset += shift)
+    {
+      const uint64_t currSize = (a_sizeInBytes - offset < shift) ? (a_sizeInBytes - offset) : shift;
+      CHECK_CL(clEnqueueCopyBuffer(m_queue, m_dataBuffer, m_dataBuffer, a_srcOffsetInBytes + offset, a_dstOffsetInBytes + offset, currSize, 0, NULL, NULL));
+    }
+  }
+  else
+  {
+    const uint64_t scratchSize = (a_sizeInBytes < MEM_MOVE_CHUNK_SIZE) ? a_sizeInBytes : MEM_MOVE_CHUNK_SIZE;
+
+    cl_int ciErr1 = CL_SUCCESS;
+    cl_mem scratch = clCreateBuffer(m_ctx, CL_MEM_READ_WRITE, scratchSize, NULL, &ciErr1);
+    CHECK_CL(ciErr1);
+
+    for (uint64_t offset = 0; offset < a_sizeInBytes; offset += scratchSize) // forward order; chunk is read completely before it's destination is written
+    {
+      const uint64_t currSize = (a_sizeInBytes - offset < scratchSize) ? (a_sizeInBytes - offset) : scratchSize;
+      CHECK_CL(clEnqueueCopyBuffer(m_queue, m_dataBuffer, scratch, a_srcOffsetInBytes + offset, 0, currSize, 0, NULL, NULL));
+      CHECK_CL(clEnqueueCopyBuffer(m_queue, scratch, m_dataBuffer, 0, a_dstOffsetInBytes + offset, currSize, 0, NULL, NULL));
+    }
+
+    CHECK_CL(clFinish(m_queue));
+    clReleaseMemObject(scratch);
+    return;
+  }
+
+  CHECK_CL(clFinish(m_queue));
+}
+
+void MemoryStorageOCL::MemReadAt(uint64_t a_offsetInBytes, void* a_data, uint64_t a_sizeInBytes)
+{
+  Flush();
+  CHECK_CL(clEnqueueReadBuffer(m_queue, m_dataBuffer, CL_TRUE, a_offsetInBytes, a_sizeInBytes, a_data, 0, NULL, NULL));
 }
 
 void MemoryStorageOCL::DebugSaveToFile(const char* a_fileName)
@@ -78,6 +234,8 @@ void MemoryStorageBothCPUAndGPU::Clear()
 {
   if(m_pStorageCPU != nullptr) m_pStorageCPU->Clear();
   if(m_pStorageGPU != nullptr) m_pStorageGPU->Clear();
+  m_freeList.clear();
+  m_stats = MemStorageStats();
 }
 
 size_t MemoryStorageBothCPUAndGPU::Reserve(uint64_t a_totalSize) 
@@ -132,6 +290,20 @@ void MemoryStorageBothCPUAndGPU::MemCopyAt(uint64_t a_offsetInBytes, const void*
   if (m_pStorageGPU != nullptr) m_pStorageGPU->MemCopyAt(a_offsetInBytes, a_data, a_sizeInBytes);
 }
 
+void MemoryStorageBothCPUAndGPU::MemMove(uint64_t a_dstOffsetInBytes, uint64_t a_srcOffsetInBytes, uint64_t a_sizeInBytes)
+{
+  if (m_pStorageCPU != nullptr) m_pStorageCPU->MemMove(a_dstOffsetInBytes, a_srcOffsetInBytes, a_sizeInBytes);
+  if (m_pStorageGPU != nullptr) m_pStorageGPU->MemMove(a_dstOffsetInBytes, a_srcOffsetInBytes, a_sizeInBytes);
+}
+
+void MemoryStorageBothCPUAndGPU::MemReadAt(uint64_t a_offsetInBytes, void* a_data, uint64_t a_sizeInBytes)
+{
+  if (m_pStorageGPU != nullptr)      // kernels write to GPU copy only
+    m_pStorageGPU->MemReadAt(a_offsetInBytes, a_data, a_sizeInBytes);
+  else if (m_pStorageCPU != nullptr)
+    m_pStorageCPU->MemReadAt(a_offsetInBytes, a_data, a_sizeInBytes);
+}
+
 void MemoryStorageBothCPUAndGPU::DebugSaveToFile(const char* a_fileName)
 {
   if (m_pStorageGPU != nullptr) 
@@ -6,9 +6,12 @@
 
 struct MemoryStorageOCL : public IMemoryStorage
 {
-  MemoryStorageOCL()                                              : m_dataBuffer(nullptr), m_currSize(0), m_totalSize(0), m_ctx(nullptr), m_queue(nullptr) {  }
-  MemoryStorageOCL(cl_context a_ctx, cl_command_queue a_cmdQueue) : m_dataBuffer(nullptr), m_currSize(0), m_totalSize(0), m_ctx(a_ctx), m_queue(a_cmdQueue) {  }
-  ~MemoryStorageOCL() { Clear(); clReleaseMemObject(m_dataBuffer); m_dataBuffer = nullptr; }
+  MemoryStorageOCL()                                              : m_dataBuffer(nullptr), m_currSize(0), m_totalSize(0), m_ctx(nullptr), m_queue(nullptr), m_memFlags(CL_MEM_READ_ONLY),
+                                                                    m_staging(nullptr), m_stagingPtr(nullptr), m_stagingHead(0) {  }
+  MemoryStorageOCL(cl_context a_ctx, cl_command_queue a_cmdQueue, 
+                   cl_mem_flags a_memFlags = CL_MEM_READ_ONLY)    : m_dataBuffer(nullptr), m_currSize(0), m_totalSize(0), m_ctx(a_ctx), m_queue(a_cmdQueue), m_memFlags(a_memFlags),
+                                                                    m_staging(nullptr), m_stagingPtr(nullptr), m_stagingHead(0) {  }
+  ~MemoryStorageOCL() { Flush(); Clear(); clReleaseMemObject(m_dataBuffer); m_dataBuffer = nullptr; }
 
   void   Clear()                       override;
   size_t Reserve(uint64_t a_totalSize) override;
@@ -19,8 +22,11 @@ struct MemoryStorageOCL : public IMemoryStorage
   const size_t  GetCapacity() const;
 
   void MemCopyAt(uint64_t a_offsetInInts, const void* a_data, uint64_t a_sizeInBytes) override;
+  void MemMove(uint64_t a_dstOffsetInBytes, uint64_t a_srcOffsetInBytes, uint64_t a_sizeInBytes) override;
+  void MemReadAt(uint64_t a_offsetInBytes, void* a_data, uint64_t a_sizeInBytes) override;
 
   void DebugSaveToFile(const char* a_fileName);
+  void Flush() override;
 
   cl_mem GetOCLBuffer() { return m_dataBuffer; }
 
@@ -34,7 +40,27 @@ protected:
 
   cl_context       m_ctx;
   cl_command_queue m_queue;
+  cl_mem_flags     m_memFlags; ///< CL_MEM_READ_WRITE for storages that kernels write to (page requests of out of core textures)
 
+  // staging ring for non blocking uploads; MemCopyAt copies input to pinned memory and enqueues non blocking write from it
+  //
+  constexpr static uint64_t STAGING_RING_SIZE   = uint64_t(16*1024*1024);
+  constexpr static uint64_t MEM_MOVE_CHUNK_SIZE = uint64_t(16*1024*1024); ///< scratch buffer size for MemMove of overlapped regions
+
+  struct StagingRange
+  {
+    uint64_t begin;
+    uint64_t end;
+    cl_event evt;   ///< write from [begin, end) of the ring is finished when this event is complete
+  };
+
+  cl_mem                    m_staging;
+  uint8_t*                  m_stagingPtr;
+  uint64_t                  m_stagingHead;
+  std::vector<StagingRange> m_stagingInFlight;
+
+  bool     CreateStagingRing();
+  uint8_t* AllocStaging(uint64_t a_size);
 };
 
 
@@ -58,12 +84,15 @@ struct MemoryStorageBothCPUAndGPU : public IMemoryStorage
   const size_t  GetCapacity() const;
 
   void MemCopyAt(uint64_t a_offsetInInts, const void* a_data, uint64_t a_sizeInBytes) override;
+  void MemMove(uint64_t a_dstOffsetInBytes, uint64_t a_srcOffsetInBytes, uint64_t a_sizeInBytes) override;
+  void MemReadAt(uint64_t a_offsetInBytes, void* a_data, uint64_t a_sizeInBytes) override;
 
   void DebugSaveToFile(const char* a_fileName);
 
   cl_mem GetOCLBuffer() { return m_pStorageGPU->GetOCLBuffer(); }
 
   void FreeHostMem() override { delete m_pStorageCPU; m_pStorageCPU = nullptr; }
+  void Flush()       override { if (m_pStorageGPU != nullptr) m_pStorageGPU->Flush(); }
 
 protected:
 
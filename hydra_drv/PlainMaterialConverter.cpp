@@ -9,6 +9,7 @@
 
 #include <unordered_map>
 #include <algorithm>
+#include <functional>
 
 using RAYTR::IMaterial;
 
@@ -716,6 +717,9 @@ SWTexSampler SamplerFromTexref(const pugi::xml_node a_node, bool allowAlphaToRGB
   else
     res.gamma = 2.2f;
 
+  if (fabs(res.gamma - 2.2f) < 1e-4f)
+    res.flags |= TEX_GAMMA_22;
+
   float4x4 samplerMatrix;
 
   if (a_node.attribute(L"matrix") != nullptr)
@@ -1109,6 +1113,7 @@ void RenderDriverRTE::ReadBumpAndOpacity(std::shared_ptr<IMaterial> pResult, pug
         samplerNM       = SamplerFromTexref(texNode);
         texIdNM         = samplerNM.texId;
         samplerNM.gamma = 1.0f; // well yep, this is really important thing !!!
+        samplerNM.flags &= (~TEX_GAMMA_22);
       }
 
       // don't be foolish by this simple code, normalmaps will be generated in RenderDriverRTE::UpdateMaterial afterwards.
@@ -1132,7 +1137,10 @@ void RenderDriverRTE::ReadBumpAndOpacity(std::shared_ptr<IMaterial> pResult, pug
         samplerNM = SamplerFromTexref(texNode);
         texIdNM   = samplerNM.texId;
         if (texNode.attribute(L"input_gamma") == nullptr)
-          samplerNM.gamma = 1.0f;
+        {
+          samplerNM.gamma  = 1.0f;
+          samplerNM.flags &= (~TEX_GAMMA_22);
+        }
       }
   
       pResult->SetNormalSampler(texIdNM, samplerNM);
@@ -1555,6 +1563,146 @@ void RenderDriverRTE::EndMaterialUpdate()
 }
 
 
+/**
+\brief Find material classes (1 << PLAIN_MAT_CLASS_*) and max nesting of blends that are used by plain material tree.
+
+*/
+static int2 PlainMaterialFeatures(const std::vector<PlainMaterial>& a_mdata)
+{
+  std::function<int(int)> blendDepth = [&](int a_node) -> int
+  {
+    if (a_node < 0 || a_node >= int(a_mdata.size()) || materialGetType(&a_mdata[a_node]) != PLAIN_MAT_CLASS_BLEND_MASK)
+      return 0;
+    const int offs1 = as_int(a_mdata[a_node].data[BLEND_MASK_MATERIAL1_OFFSET]);
+    const int offs2 = as_int(a_mdata[a_node].data[BLEND_MASK_MATERIAL2_OFFSET]);
+    const int depth1 = (offs1 > 0) ? blendDepth(a_node + offs1) : 0;
+    const int depth2 = (offs2 > 0) ? blendDepth(a_node + offs2) : 0;
+    return 1 + std::max(depth1, depth2);
+  };
+
+  int2 res = make_int2(0, 0);
+  for (int i = 0; i < int(a_mdata.size()); i++)
+  {
+    const int type = materialGetType(&a_mdata[i]);
+    if (type >= 0 && type < 31)
+      res.x |= (1 << type);
+    res.y = std::max(res.y, blendDepth(i));
+  }
+
+  return res;
+}
+
+/**
+\brief Append flattened list of leaves of blend tree to a_mdata (see BLEND_FLAT_TABLE_OFFSET and materialEvalFlatBlend).
+       Tree is not flattened if it has more non constant blends on a single path than evaluator can keep.
+
+*/
+static void FlattenBlendTree(std::vector<PlainMaterial>& a_mdata)
+{
+  for (auto& node : a_mdata)                          // table is referenced only from the root
+  {
+    if (materialGetType(&node) == PLAIN_MAT_CLASS_BLEND_MASK)
+      ((int*)(node.data))[BLEND_FLAT_TABLE_OFFSET] = 0;
+  }
+
+  if (a_mdata.empty() || materialGetType(&a_mdata[0]) != PLAIN_MAT_CLASS_BLEND_MASK)
+    return;
+
+  struct FlatLeaf
+  {
+    int              offset;
+    float            constWeight;
+    std::vector<int> steps;
+  };
+
+  const int nodesNum = int(a_mdata.size());
+  std::vector<FlatLeaf> leaves;
+  bool tooDeep = false;
+
+  std::function<void(int, float, std::vector<int>&)> flatten = [&](int a_node, float a_constWeight, std::vector<int>& a_steps)
+  {
+    if (a_constWeight <= 0.0f || tooDeep)
+      return;
+
+    const PlainMaterial* pNode = &a_mdata[a_node];
+    if (materialGetType(pNode) != PLAIN_MAT_CLASS_BLEND_MASK)
+    {
+      leaves.push_back({a_node, a_constWeight, a_steps});
+      return;
+    }
+
+    const int child1 = a_node + as_int(pNode->data[BLEND_MASK_MATERIAL1_OFFSET]);
+    const int child2 = a_node + as_int(pNode->data[BLEND_MASK_MATERIAL2_OFFSET]);
+    if (child1 <= a_node || child2 <= a_node || child1 >= nodesNum || child2 >= nodesNum)
+    {
+      tooDeep = true;
+      return;
+    }
+
+    const bool weight1IsOne = (as_int(pNode->data[BLEND_MASK_FLAGS_OFFSET]) & BLEND_MASK_REFLECTION_WEIGHT_IS_ONE) && materialIsLeafBRDF(&a_mdata[child1]);
+
+    if (blendMaskAlphaIsConst(pNode))
+    {
+      const float alpha = clamp(blendMaskLuminance(pNode, make_float3(1.0f, 1.0f, 1.0f)), 0.0f, 1.0f);
+      flatten(child1, weight1IsOne ? a_constWeight : a_constWeight*alpha, a_steps);
+      flatten(child2, a_constWeight*(1.0f - alpha), a_steps);
+      return;
+    }
+
+    if (int(a_steps.size()) >= MIX_TREE_MAX_DEEP) // evaluator keeps alpha for each step
+    {
+      tooDeep = true;
+      return;
+    }
+
+    if (weight1IsOne)
+      flatten(child1, a_constWeight, a_steps);
+    else
+    {
+      a_steps.push_back((a_node << 1) | BLEND_FLAT_STEP_ALPHA);
+      flatten(child1, a_constWeight, a_steps);
+      a_steps.pop_back();
+    }
+
+    a_steps.push_back((a_node << 1) | BLEND_FLAT_STEP_ONE_MINUS_ALPHA);
+    flatten(child2, a_constWeight, a_steps);
+    a_steps.pop_back();
+  };
+
+  std::vector<int> steps;
+  flatten(0, 1.0f, steps);
+
+  if (tooDeep || leaves.empty())
+    return;
+
+  std::vector<float> table(1);
+  ((int*)table.data())[0] = int(leaves.size());
+
+  for (size_t i = 0; i < leaves.size(); i++)
+  {
+    int stepsKnown = 0;
+    if (i > 0)
+    {
+      const auto& prev = leaves[i - 1].steps;
+      const auto& curr = leaves[i].steps;
+      while (stepsKnown < int(std::min(prev.size(), curr.size())) && (prev[stepsKnown] >> 1) == (curr[stepsKnown] >> 1))
+        stepsKnown++;
+    }
+
+    table.push_back(as_float(leaves[i].offset));
+    table.push_back(leaves[i].constWeight);
+    table.push_back(as_float(int(leaves[i].steps.size()) | (stepsKnown << 16)));
+    for (int step : leaves[i].steps)
+      table.push_back(as_float(step));
+  }
+
+  const int tableOffset = int(a_mdata.size());
+  a_mdata.resize(a_mdata.size() + (table.size() + PLAIN_MATERIAL_DATA_SIZE - 1) / PLAIN_MATERIAL_DATA_SIZE);
+  memcpy(a_mdata[tableOffset].data, table.data(), table.size()*sizeof(float));
+
+  ((int*)(a_mdata[0].data))[BLEND_FLAT_TABLE_OFFSET] = tableOffset;
+}
+
 bool RenderDriverRTE::PutAbstractMaterialToStorage(const int32_t a_matId, std::shared_ptr<RAYTR::IMaterial> pMaterial, pugi::xml_node a_materialNode, bool processingBlend)
 {
   // (1) get plain materials
@@ -1572,6 +1720,9 @@ bool RenderDriverRTE::PutAbstractMaterialToStorage(const int32_t a_matId, std::s
     return false;
   }
 
+  m_materialFeatures[a_matId] = PlainMaterialFeatures(mdata);
+  FlattenBlendTree(mdata);
+
   if (MaterialHaveAtLeastOneProcTex(&mdata[0]))
   {
     int oldSize = int(mdata.size());
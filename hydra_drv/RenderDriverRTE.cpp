@@ -4,6 +4,8 @@
 #include <iostream>
 #include <queue>
 #include <string>
+#include <sstream>
+#include <cwchar>
 #include <regex>
 #include <chrono>
 
@@ -62,6 +64,7 @@ RenderDriverRTE::RenderDriverRTE(const wchar_t* a_options, int w, int h, int a_d
 
   m_useConvertedLayout      = false || (m_initFlags & GPU_RT_HW_LAYER_OCL);
   m_useBvhInstInsert        = false;
+  m_useIndexedLeaves        = m_useConvertedLayout && (a_options != nullptr) && (std::wstring(a_options).find(L"-bvh_indexed_leaves 1") != std::wstring::npos);
   m_texShadersWasRecompiled = false;
 
   if (MEASURE_RAYS)
@@ -81,6 +84,18 @@ RenderDriverRTE::RenderDriverRTE(const wchar_t* a_options, int w, int h, int a_d
   m_haveAtLeastOneAOMat  = false;
   m_haveAtLeastOneAOMat2 = false;
   m_texResizeEnabled     = false;
+  m_compactVertices      = true;
+  m_texMemBudget         = 0;
+  m_halfTexCoords        = false;
+  m_texMipmaps           = true;
+  m_texCompression       = false;
+  m_texHDRFormat         = TEX_FORMAT_RGBA32F;
+  m_texTiled             = false;
+  m_texOutOfCore         = false;
+  m_lightTree            = true;
+  m_geomTableDefrags     = -1;
+  m_texTableDefrags      = -1;
+  m_whiteDiffuseMatId    = 0;
 
   ///////////////////////////////////////////////////////////////////////////////////////////////////
   if (m_initFlags & GPU_RT_HW_LAYER_OCL)
@@ -100,10 +115,10 @@ RenderDriverRTE::RenderDriverRTE(const wchar_t* a_options, int w, int h, int a_d
   
   if (m_pBVH != nullptr)
   {
-    if (m_useBvhInstInsert)
-      m_pBVH->Init("-allow_insert_copy 1");
-    else
-      m_pBVH->Init("-allow_insert_copy 0");
+    std::string bvhCfg = m_useBvhInstInsert ? "-allow_insert_copy 1" : "-allow_insert_copy 0";
+    if (m_useIndexedLeaves)
+      bvhCfg += " -indexed_leaves 1";
+    m_pBVH->Init(bvhCfg.c_str());
   }
   else
   {
@@ -145,6 +160,18 @@ RenderDriverRTE::RenderDriverRTE(const wchar_t* a_options, int w, int h, int a_d
 
 void RenderDriverRTE::ExecuteCommand(const wchar_t* a_cmd, wchar_t* a_out)
 {
+  if (std::wstring(a_cmd) == L"meminfo" && a_out != nullptr) // all values are in MB
+  {
+    const size_t MB = size_t(1024 * 1024);
+    std::wstringstream out;
+    out << L"total = "     << m_memUsage.total      / MB << L"; geom = " << m_memUsage.geometry  / MB << L"; bvh = " << m_memUsage.bvh / MB 
+        << L"; tex = "     << m_memUsage.textures   / MB << L"; mat = "  << m_memUsage.materials / MB << L"; pdf = " << m_memUsage.pdfTables / MB 
+        << L"; fb = "      << m_memUsage.frameBuffs / MB;
+    const std::wstring res = out.str().substr(0, 255);
+    wcsncpy(a_out, res.c_str(), 256);
+    return;
+  }
+
 #ifndef WIN32
   if(std::wstring(a_cmd) == L"exitnow" && m_pHWLayer != nullptr) 
   {
@@ -158,6 +185,9 @@ void RenderDriverRTE::ExecuteCommand(const wchar_t* a_cmd, wchar_t* a_out)
 
 bool RenderDriverRTE::UpdateSettings(pugi::xml_node a_settingsNode)
 {
+  if (m_pHWLayer != nullptr)
+    m_pHWLayer->StopAsyncPasses();
+
   const int oldWidth  = m_width;
   const int oldHeight = m_height;
 
@@ -249,6 +279,11 @@ bool RenderDriverRTE::UpdateSettings(pugi::xml_node a_settingsNode)
   else
     vars.m_varsI[HRT_MMLT_BURN_ITERS] = 1024;
 
+  if(a_settingsNode.child(L"mmlt_chains") != nullptr)
+    vars.m_varsI[HRT_MMLT_CHAINS] = a_settingsNode.child(L"mmlt_chains").text().as_int();
+  else
+    vars.m_varsI[HRT_MMLT_CHAINS] = 8;
+
   if(a_settingsNode.child(L"mmlt_sds_fixed_prob") != nullptr)
     vars.m_varsF[HRT_MMLT_IMPLICIT_FIXED_PROB] = clamp(a_settingsNode.child(L"mmlt_sds_fixed_prob").text().as_float(), 0.0f, 0.95f);
   else
@@ -330,6 +365,73 @@ bool RenderDriverRTE::UpdateSettings(pugi::xml_node a_settingsNode)
   if (a_settingsNode.child(L"seed") != nullptr)
     m_legacy.m_lastSeed = a_settingsNode.child(L"seed").text().as_int();
 
+  if (a_settingsNode.child(L"deterministic_rng") != nullptr)
+    vars.m_varsI[HRT_RNG_DETERMINISTIC] = a_settingsNode.child(L"deterministic_rng").text().as_int();
+  else
+    vars.m_varsI[HRT_RNG_DETERMINISTIC] = 0;
+
+  vars.m_varsI[HRT_RNG_SEED] = m_legacy.m_lastSeed;
+
+  if (a_settingsNode.child(L"adaptive_sampling") != nullptr)
+    vars.m_varsI[HRT_ADAPTIVE_SAMPLING] = a_settingsNode.child(L"adaptive_sampling").text().as_int();
+  else
+    vars.m_varsI[HRT_ADAPTIVE_SAMPLING] = 0;
+
+  if (a_settingsNode.child(L"adaptive_min_spp") != nullptr)
+    vars.m_varsI[HRT_ADAPTIVE_MIN_SPP] = a_settingsNode.child(L"adaptive_min_spp").text().as_int();
+  else
+    vars.m_varsI[HRT_ADAPTIVE_MIN_SPP] = 16;
+
+  if (a_settingsNode.child(L"path_guiding") != nullptr)
+    vars.m_varsI[HRT_PATH_GUIDING] = a_settingsNode.child(L"path_guiding").text().as_int();
+  else
+    vars.m_varsI[HRT_PATH_GUIDING] = 0;
+
+  if (a_settingsNode.child(L"guiding_train_passes") != nullptr)
+    vars.m_varsI[HRT_GUIDING_TRAIN_PASSES] = a_settingsNode.child(L"guiding_train_passes").text().as_int();
+  else
+    vars.m_varsI[HRT_GUIDING_TRAIN_PASSES] = 31;
+
+  if (a_settingsNode.child(L"tex_mem_budget") != nullptr) // in MB; used by the next AllocAll to downscale textures
+    m_texMemBudget = size_t(a_settingsNode.child(L"tex_mem_budget").text().as_int())*size_t(1024*1024);
+
+  if (a_settingsNode.child(L"compact_vertices") != nullptr)
+    m_compactVertices = (a_settingsNode.child(L"compact_vertices").text().as_int() == 1);
+
+  if (a_settingsNode.child(L"half_texcoords") != nullptr)
+    m_halfTexCoords = (a_settingsNode.child(L"half_texcoords").text().as_int() == 1);
+
+  if (a_settingsNode.child(L"tex_mipmaps") != nullptr) // affect only textures that will be updated after this call
+    m_texMipmaps = (a_settingsNode.child(L"tex_mipmaps").text().as_int() == 1);
+
+  if (a_settingsNode.child(L"tex_compression") != nullptr) // affect only textures that will be updated after this call
+    m_texCompression = (a_settingsNode.child(L"tex_compression").text().as_int() == 1);
+
+  if (a_settingsNode.child(L"tex_tiled") != nullptr) // affect only textures that will be updated after this call
+    m_texTiled = (a_settingsNode.child(L"tex_tiled").text().as_int() == 1);
+
+  if (a_settingsNode.child(L"tex_out_of_core") != nullptr) // affect only textures that will be updated after this call
+    m_texOutOfCore = (a_settingsNode.child(L"tex_out_of_core").text().as_int() == 1);
+
+  if (a_settingsNode.child(L"light_tree") != nullptr) // affect only next EndScene
+    m_lightTree = (a_settingsNode.child(L"light_tree").text().as_int() == 1);
+
+  if (a_settingsNode.child(L"tex_hdr_format") != nullptr) // "float", "half" or "rgb9e5"; affect only textures that will be updated after this call
+  {
+    const std::wstring hdrFormat = a_settingsNode.child(L"tex_hdr_format").text().as_string();
+    if (hdrFormat == L"half")
+      m_texHDRFormat = TEX_FORMAT_RGBA16F;
+    else if (hdrFormat == L"rgb9e5")
+      m_texHDRFormat = TEX_FORMAT_RGB9E5;
+    else
+      m_texHDRFormat = TEX_FORMAT_RGBA32F;
+  }
+
+  if (a_settingsNode.child(L"cpu_async_render") != nullptr)
+    vars.m_varsI[HRT_CPU_ASYNC_RENDER] = a_settingsNode.child(L"cpu_async_render").text().as_int();
+  else
+    vars.m_varsI[HRT_CPU_ASYNC_RENDER] = 0;
+
   if(m_initFlags & GPU_RT_DO_NOT_PRINT_PASS_NUMBER)
     vars.m_varsI[HRT_SILENT_MODE] = 1;
 
@@ -452,8 +554,7 @@ void RenderDriverRTE::ClearAll()
 
   m_geomTable.clear();
   m_texTable.clear();
-  m_texTableAux.clear();
-  m_materialTable.clear();
+  m_pagedTextures.clear();
 
   m_lights.clear();
   m_lightsInstanced.clear();
@@ -461,6 +562,7 @@ void RenderDriverRTE::ClearAll()
   m_iesCache.clear();
   m_materialUpdated.clear();
   m_materialNodes.clear();
+  m_materialFeatures.clear();
   m_blendsToUpdate.clear();
   m_texturesProcessedNM.clear();
   m_procTextures.clear();
@@ -497,38 +599,73 @@ std::tuple<size_t, size_t> EstimateMemNeeded(const std::vector<HRTexResInfo>& a_
   return std::tuple<size_t, size_t>(memCommon, memBump);
 }
 
-int ResizeMostHeavyTexture(std::vector<HRTexResInfo>& a_texuresInfo, bool bump_only)
-{
-  size_t currSize = 0;
-  int currId = 0;
-  bool foundAtLeastOne = false;
+/**
+\brief Max heap of textures by their size that returns most heavy texture that still can be resized; entries become stale when texture
+       is resized through other queue, they are skipped on pop and the fresh ones are pushed by Resize.
 
-  // find most heavy one
-  //
-  for (int i = 0; i<int(a_texuresInfo.size()); i++)
+*/
+struct TexResizeQueue
+{
+  TexResizeQueue(const std::vector<HRTexResInfo>& a_texuresInfo, bool a_bumpOnly) : m_bumpOnly(a_bumpOnly)
   {
-    const auto& texInfo = a_texuresInfo[i];
-    size_t txSize = size_t(texInfo.aw*texInfo.ah)*size_t(texInfo.bpp);
+    for (int i = 0; i<int(a_texuresInfo.size()); i++)
+      Push(a_texuresInfo, i);
+  }
 
-    const bool accountIt = !bump_only || texInfo.usedAsBump;
+  static size_t TexSize(const HRTexResInfo& a_info) { return size_t(a_info.aw)*size_t(a_info.ah)*size_t(a_info.bpp); }
+
+  void Push(const std::vector<HRTexResInfo>& a_texuresInfo, int a_id)
+  {
+    const auto& texInfo  = a_texuresInfo[a_id];
+    const bool accountIt = !m_bumpOnly || texInfo.usedAsBump;
     const bool canResize = (texInfo.aw > texInfo.rw) && (texInfo.ah > texInfo.rh);
+    if (accountIt && canResize)
+      m_heap.push(std::make_pair(TexSize(texInfo), -a_id)); // on equal sizes take the texture with smaller index first
+  }
 
-    if (txSize > currSize && accountIt && canResize)
+  int Top(const std::vector<HRTexResInfo>& a_texuresInfo)
+  {
+    while (!m_heap.empty())
     {
-      currSize = txSize;
-      currId   = i;
-      foundAtLeastOne = true;
+      const int id = -m_heap.top().second;
+      if (m_heap.top().first == TexSize(a_texuresInfo[id]) && a_texuresInfo[id].aw > a_texuresInfo[id].rw && a_texuresInfo[id].ah > a_texuresInfo[id].rh)
+        return id;
+      m_heap.pop();
     }
+    return -1;
   }
 
-  if (!foundAtLeastOne)
+private:
+  bool m_bumpOnly;
+  std::priority_queue<std::pair<size_t, int> > m_heap;
+};
+
+/**
+\brief Halve the most heavy texture from a_queue; updates memory estimation and pushes new size to both queues.
+\return index of resized texture or -1 if there is nothing to resize
+
+*/
+static int ResizeMostHeavyTexture(std::vector<HRTexResInfo>& a_texuresInfo, TexResizeQueue& a_queue, TexResizeQueue& a_queueAll, TexResizeQueue& a_queueBump,
+                                  size_t& a_memCommon, size_t& a_memBump)
+{
+  const int currId = a_queue.Top(a_texuresInfo);
+  if (currId < 0)
     return -1;
 
-  a_texuresInfo[currId].aw /= 2;
-  a_texuresInfo[currId].ah /= 2;
+  auto& texInfo        = a_texuresInfo[currId];
+  const size_t oldSize = TexResizeQueue::TexSize(texInfo);
 
-  return currId;
+  texInfo.aw /= 2;
+  texInfo.ah /= 2;
+
+  const size_t newSize = TexResizeQueue::TexSize(texInfo);
+  a_memCommon -= (oldSize - newSize);
+  if (texInfo.usedAsBump)
+    a_memBump -= (oldSize - newSize);
 
+  a_queueAll.Push (a_texuresInfo, currId);
+  a_queueBump.Push(a_texuresInfo, currId);
+  return currId;
 }
 
 /**
@@ -557,17 +694,24 @@ void FitTextureRes(std::vector<HRTexResInfo>& a_texuresInfo, size_t in_memToFit,
   if (memCommon <= in_memToFit && memBump <= in_memToFitBump)
     return;
 
+  // memory estimation is updated incrementally and heavy textures are taken from heaps, so scenes with thousands of textures don't go quadratic here
+  //
+  TexResizeQueue queueAll (a_texuresInfo, false);
+  TexResizeQueue queueBump(a_texuresInfo, true);
+  size_t memCommonNext = memCommon;
+  size_t memBumpNext   = memBump;
+
   while(true)
   {
     int resizedId2 = -1;
-    int resizedId = ResizeMostHeavyTexture(a_texuresInfo, false);
+    int resizedId = ResizeMostHeavyTexture(a_texuresInfo, queueAll, queueAll, queueBump, memCommonNext, memBumpNext);
     if (resizedId >= 0)
     {
       if (!a_texuresInfo[resizedId].usedAsBump && memBump > in_memToFitBump)
-        resizedId2 = ResizeMostHeavyTexture(a_texuresInfo, true);
+        resizedId2 = ResizeMostHeavyTexture(a_texuresInfo, queueBump, queueAll, queueBump, memCommonNext, memBumpNext);
     }
     else if(memBump > in_memToFitBump)
-      resizedId2 = ResizeMostHeavyTexture(a_texuresInfo, true);
+      resizedId2 = ResizeMostHeavyTexture(a_texuresInfo, queueBump, queueAll, queueBump, memCommonNext, memBumpNext);
 
     const bool commonOk = (memCommon <= in_memToFit)     || resizedId == -1;
     const bool auxOk    = (memBump   <= in_memToFitBump) || resizedId2 == -1;
@@ -575,7 +719,8 @@ void FitTextureRes(std::vector<HRTexResInfo>& a_texuresInfo, size_t in_memToFit,
     if ((commonOk && auxOk) || iterNum > maxItrer)
       break;
 
-    std::tie(memCommon, memBump) = EstimateMemNeeded(a_texuresInfo);
+    memCommon = memCommonNext;
+    memBump   = memBumpNext;
     iterNum++;
   }
 }
@@ -587,9 +732,14 @@ HRDriverAllocInfo RenderDriverRTE::AllocAll(HRDriverAllocInfo a_info)
   const size_t maxBufferSize = m_pHWLayer->GetMaxBufferSizeInBytes();
   const size_t totalMem      = m_pHWLayer->GetAvaliableMemoryAmount(true);
   const size_t freeMem       = m_pHWLayer->GetAvaliableMemoryAmount(false);
-  const size_t memUsedByR    = totalMem - freeMem;
+  const size_t fbMem         = m_pHWLayer->GetFrameBufferMemoryAmount();
+  const size_t memUsedByR    = (fbMem != 0) ? fbMem : totalMem - freeMem;
   const size_t MB            = size_t(1024 * 1024);
 
+  const size_t mipMult = m_texMipmaps ? 4 : 3; // full mip chain takes 1/3 of level 0 
+  size_t texMemFit1    = size_t(a_info.imgMem)*mipMult/3; // what textures will actually take after FitTextureRes if user budget is set
+  size_t texMemFit2 = size_t(a_info.imgMemAux);
+
   // create memory storages and tables
   //
   const size_t approxSizeOfMatBlock = sizeof(PlainMaterial) * 8;
@@ -609,6 +759,29 @@ HRDriverAllocInfo RenderDriverRTE::AllocAll(HRDriverAllocInfo a_info)
         allTexInfoVec.push_back(info);
     }
 
+    // LDR textures that are not bumps are always block compressed to 1 byte per pixel or less;
+    // HDR textures are expected to fit half range; the rest may take mip chain space which UpdateImage drops if storage is full
+    //
+    double compressRatio = 1.0;
+    if (m_texCompression || m_texHDRFormat != TEX_FORMAT_RGBA32F)
+    {
+      double memFull = 0.0, memCompressed = 0.0;
+      for (const auto& info : allTexInfoVec)
+      {
+        const double txSize = double(info.w)*double(info.h)*double(info.bpp);
+        memFull += txSize;
+        if (m_texCompression && info.bpp == 4 && !info.usedAsBump)
+          memCompressed += 0.25*txSize;
+        else if (m_texHDRFormat != TEX_FORMAT_RGBA32F && info.bpp == 16)
+          memCompressed += 0.5*txSize;
+        else
+          memCompressed += txSize;
+      }
+      if (memCompressed > 0.0)
+        compressRatio = memFull / memCompressed;
+      texMemFit1 = size_t(double(texMemFit1) / compressRatio);
+    }
+
     const int64_t geomMem      = int64_t( std::min(size_t(a_info.geomMem), maxBufferSize));
     const double perCentCommon = double(a_info.imgMem)    / double(a_info.imgMemAux + a_info.imgMem);
     const double perCentAux    = double(a_info.imgMemAux) / double(a_info.imgMemAux + a_info.imgMem);
@@ -623,10 +796,18 @@ HRDriverAllocInfo RenderDriverRTE::AllocAll(HRDriverAllocInfo a_info)
     if (memRest2 <= int64_t(1*MB))
       memRest2 = 16 * MB;
 
-    const int64_t memForTex    = std::min(std::min(memRest,  int64_t(maxBufferSize)), a_info.imgMem    + int64_t(16*MB));
-    const int64_t memForTex2   = std::min(std::min(memRest2, int64_t(maxBufferSize)), a_info.imgMemAux + int64_t(16*MB));
+    int64_t memForTex  = std::min(std::min(memRest,  int64_t(maxBufferSize)), int64_t(texMemFit1) + int64_t(16*MB));
+    int64_t memForTex2 = std::min(std::min(memRest2, int64_t(maxBufferSize)), a_info.imgMemAux + int64_t(16*MB));
+
+    if (m_texMemBudget != 0 && (a_info.imgMemAux + a_info.imgMem) > 0)
+    {
+      memForTex  = std::min(memForTex,  std::max(int64_t(perCentCommon*double(m_texMemBudget)), int64_t(16*MB)));
+      memForTex2 = std::min(memForTex2, std::max(int64_t(perCentAux*double(m_texMemBudget)),    int64_t(16*MB)));
+      texMemFit1 = std::min(texMemFit1, size_t(memForTex));
+      texMemFit2 = std::min(texMemFit2, size_t(memForTex2));
+    }
 
-    FitTextureRes(allTexInfoVec, size_t(memForTex), size_t(memForTex2));
+    FitTextureRes(allTexInfoVec, size_t(double(memForTex)*compressRatio)*3/mipMult, size_t(memForTex2));
     for (auto info : allTexInfoVec)  
     {
       m_allTexInfo[info.id] = info;
@@ -637,29 +818,45 @@ HRDriverAllocInfo RenderDriverRTE::AllocAll(HRDriverAllocInfo a_info)
   size_t auxMemGeom   = 0, auxMemTex = 64 * MB;
   size_t newMemForGeo = a_info.geomMem; // size_t(0.85*double(a_info.geomMem)); // we can save ~ 15% due to tangent compression but thhis is hard to estimate precisly.
   size_t newMemForMat = a_info.matNum*approxSizeOfMatBlock;
-  size_t newMemForTab = (MAX_ENV_LIGHT_PDF_SIZE*MAX_ENV_LIGHT_PDF_SIZE)*sizeof(float) + 4*MB;
+  // env map is not known here, so reserve pdf table for the largest image; only images larger than MAX_ENV_LIGHT_PDF_SIZE need luminance pyramid.
+  // Flat table is prefix summ (N+1) and alias table (2N) floats; env light has up to 2 tables (see RelatedTextureIds).
+  //
+  size_t envPdfBytes = 3*size_t(MAX_ENV_LIGHT_PDF_SIZE*MAX_ENV_LIGHT_PDF_SIZE)*sizeof(float);
+  for (int i = 0; a_info.imgResInfoArray != nullptr && i < a_info.imgNum; i++)
+  {
+    const auto& info = a_info.imgResInfoArray[i];
+    if (info.w <= MAX_ENV_LIGHT_PDF_SIZE && info.h <= MAX_ENV_LIGHT_PDF_SIZE)
+      continue;
+
+    size_t mipW = 1, mipH = 1;
+    while (mipW < size_t(std::min(info.w, MAX_ENV_LIGHT_PDF_MIP_SIZE)))   mipW *= 2;
+    while (mipH < size_t(std::min(info.h, MAX_ENV_LIGHT_PDF_MIP_SIZE/2))) mipH *= 2;
+    envPdfBytes = std::max(envPdfBytes, (mipW*mipH*4/3)*sizeof(float));
+  }
+
+  size_t newMemForTab = 2*envPdfBytes + 4*MB;
 
   newMemForTab += a_info.lightsWithIESNum * 1 * MB;
-  if (newMemForTab > 64 * MB)
-    newMemForTab = 64 * MB;
+  if (newMemForTab > 256 * MB)
+    newMemForTab = 256 * MB;
 
-  size_t newMemForTex1 = auxMemTex + a_info.imgMem;
-  size_t newMemForTex2 = auxMemTex + a_info.imgMemAux;
+  size_t newMemForTex1 = auxMemTex + texMemFit1;
+  size_t newMemForTex2 = auxMemTex + texMemFit2;
   size_t newMemForTex3 = newMemForTex1 + newMemForTex2;
   size_t newTotalMem   = newMemForTex3 + newMemForGeo + newMemForMat + newMemForTab;
 
   if (newTotalMem >= freeMem)
   {
-    newMemForTex1 = auxMemTex + a_info.imgMem;
-    newMemForTex2 = auxMemTex + a_info.imgMem/2;
+    newMemForTex1 = auxMemTex + texMemFit1;
+    newMemForTex2 = auxMemTex + texMemFit1/2;
     newMemForTex3 = newMemForTex1 + newMemForTex2;
     newTotalMem   = newMemForTex3 + newMemForGeo + newMemForMat + newMemForTab;
   }
 
   if (newTotalMem >= freeMem)
   {
-    newMemForTex1 = auxMemTex + a_info.imgMem;
-    newMemForTex2 = auxMemTex + 2*a_info.imgMem/3;
+    newMemForTex1 = auxMemTex + texMemFit1;
+    newMemForTex2 = auxMemTex + 2*texMemFit1/3;
     newMemForTex3 = newMemForTex1 + newMemForTex2;
     newTotalMem   = newMemForTex3 + newMemForGeo + newMemForMat + newMemForTab;
   }
@@ -699,6 +896,7 @@ HRDriverAllocInfo RenderDriverRTE::AllocAll(HRDriverAllocInfo a_info)
 
   const int32_t maxMaterialIndex   = a_info.matNum-1;
   const int32_t whiteDiffuseOffset = m_pMaterialStorage->Update(maxMaterialIndex, &plainData[0], plainData.size()*sizeof(PlainMaterial));
+  m_whiteDiffuseMatId              = maxMaterialIndex;
 
 
   auto vars = m_pHWLayer->GetAllFlagsAndVars();
@@ -717,6 +915,14 @@ HRDriverAllocInfo RenderDriverRTE::AllocAll(HRDriverAllocInfo a_info)
     std::cerr << "[AllocAll]: NOT ENOUGHT MEMORY! --- " << std::endl;
   }
 
+  m_memUsage            = MemoryUsage();
+  m_memUsage.total      = totalMem;
+  m_memUsage.textures   = newMemForTex3;
+  m_memUsage.geometry   = newMemForGeo;
+  m_memUsage.materials  = newMemForMat;
+  m_memUsage.pdfTables  = newMemForTab;
+  m_memUsage.frameBuffs = memUsedByR;
+
   m_lastAllocInfo         = a_info;
   m_lastAllocInfo.geomMem = newMemForGeo;
   m_lastAllocInfo.imgMem  = newMemForTex3;
@@ -730,8 +936,19 @@ void RenderDriverRTE::GetLastErrorW(wchar_t a_msg[256])
   m_msg = L"";
 }
 
+int  TextureMipLevelsNum(int w, int h);
+void ResampleTexture(const void* a_data, int w, int h, int a_bpp, int a_newW, int a_newH, std::vector<uint8_t>& a_out);
+void BuildTextureMipChain(const void* a_data, int w, int h, int a_bpp, int a_levels, std::vector<uint8_t>& a_out);
+int  ChooseTextureCompression(const void* a_data, int w, int h, int a_bpp);
+void CompressTexture(const void* a_data, std::vector<uint8_t>& a_mips, int w, int h, int a_bpp, int a_levels, int a_format, std::vector<uint8_t>& a_outLevel0);
+int  ChooseTextureHDRFormat(const float* a_data, int w, int h, int a_requested);
+void ConvertTextureHDR(const float* a_data, size_t a_pixels, int a_format, std::vector<uint8_t>& a_out);
+void TileTexture(const void* a_data, std::vector<uint8_t>& a_mips, int w, int h, int a_bytesPerPixel, int a_levels, std::vector<uint8_t>& a_outLevel0);
+
 bool RenderDriverRTE::UpdateImage(int32_t a_texId, int32_t w, int32_t h, int32_t bpp, const void* a_data, pugi::xml_node a_texNode)
 {
+  m_pHWLayer->StopAsyncPasses();
+
   std::wstring type = a_texNode.attribute(L"type").as_string();
 
   if (type == L"proc")
@@ -740,8 +957,9 @@ bool RenderDriverRTE::UpdateImage(int32_t a_texId, int32_t w, int32_t h, int32_t
   if (a_data == nullptr)
     return false;
 
-  std::vector<uint32_t> dataResizedI;
-  HDRImage4f dst;
+  m_pagedTextures.erase(a_texId);
+
+  std::vector<uint8_t> dataResized;
 
   if (m_texResizeEnabled && a_texNode.attribute(L"rwidth") != nullptr && a_texNode.attribute(L"rheight") != nullptr)
   {
@@ -755,52 +973,101 @@ bool RenderDriverRTE::UpdateImage(int32_t a_texId, int32_t w, int32_t h, int32_t
       rheight = p->second.ah;
     }
 
+    // instead of downscaling, keep full resolution on disk and stream pages to the cache of the same size
+    //
+    if ((rwidth < w || rheight < h) && m_texOutOfCore && (bpp == 4 || bpp == 16) && (p == m_allTexInfo.end() || !p->second.usedAsBump))
+    {
+      const size_t cacheSize = size_t(rwidth)*size_t(rheight)*size_t(bpp)*4/3;
+      if (UpdateImagePaged(a_texId, w, h, bpp, a_data, cacheSize))
+        return true;
+      std::cerr << "RenderDriverRTE::UpdateImage: can't page tex id = " << a_texId << " from disk, fall back to downscaling" << std::endl;
+    }
+
     if (rwidth < w || rheight < h)
     {
       std::cout << "resize tex id = " << a_texId << " from (" << w << "," << h << ") to (" << rwidth << "," << rheight << ")" << std::endl;
 
-      HDRImage4f src;
+      ResampleTexture(a_data, w, h, bpp, rwidth, rheight, dataResized);
+      a_data = dataResized.data();
 
-      if (bpp == 4)
-      {
-        src.resize(w, h);
-        src.convertFromLDR(2.2f, (const unsigned int*)a_data, w*h);
-      }
-      else
-        src = HDRImage4f(w, h, (const float*)a_data);
+      w = rwidth;
+      h = rheight;
+    }
 
-      dst.resize(rwidth, rheight);
-      src.resampleTo(dst);
+  }
+
+  std::vector<uint8_t> mipData;
+  const int mips = (m_texMipmaps && (bpp == 4 || bpp == 16)) ? TextureMipLevelsNum(w, h) : 1;
+  if (mips > 1)
+    BuildTextureMipChain(a_data, w, h, bpp, mips, mipData);
+
+  // bump textures are read back on CPU to make normal maps, don't loose their precision
+  //
+  int  format = bpp;
+  auto pInfo  = m_allTexInfo.find(a_texId);
+  std::vector<uint8_t> packedData;
+  if (m_texCompression && (pInfo == m_allTexInfo.end() || !pInfo->second.usedAsBump))
+  {
+    format = ChooseTextureCompression(a_data, w, h, bpp);
+    if (format != bpp)
+    {
+      CompressTexture(a_data, mipData, w, h, bpp, mipData.empty() ? 1 : mips, format, packedData);
+      a_data = packedData.data();
+    }
+  }
 
-      if (bpp == 4)
+  if (format == TEX_FORMAT_RGBA32F && m_texHDRFormat != TEX_FORMAT_RGBA32F)
+  {
+    format = ChooseTextureHDRFormat((const float*)a_data, w, h, m_texHDRFormat);
+    if (format != bpp)
+    {
+      ConvertTextureHDR((const float*)a_data, size_t(w)*size_t(h), format, packedData);
+      a_data = packedData.data();
+      if (!mipData.empty())
       {
-        dataResizedI.resize(rwidth*rheight);
-        dst.convertToLDR(2.2f, dataResizedI);
-        a_data = dataResizedI.data();
+        std::vector<uint8_t> mipsConverted;
+        ConvertTextureHDR((const float*)mipData.data(), mipData.size() / sizeof(float4), format, mipsConverted);
+        mipData = std::move(mipsConverted);
       }
-      else
-        a_data = dst.data();
-
-      w = rwidth;
-      h = rheight;
     }
+  }
+
+  // per texture layout="tiled" or layout="linear" override global tex_tiled setting
+  //
+  const std::wstring layout = a_texNode.attribute(L"layout").as_string();
+  const bool         tiled  = (layout == L"tiled") || (layout != L"linear" && m_texTiled);
 
+  if (tiled && format < TEX_FORMAT_BLOCK_FIRST)
+  {
+    std::vector<uint8_t> tiledData;
+    TileTexture(a_data, mipData, w, h, (format == TEX_FORMAT_RGB9E5) ? 4 : format, mipData.empty() ? 1 : mips, tiledData);
+    packedData = std::move(tiledData);
+    a_data     = packedData.data();
+    format    |= TEX_LAYOUT_TILED;
   }
 
   SWTextureHeader texheader;
 
   texheader.width  = w;
   texheader.height = h;
-  texheader.depth  = 1;
-  texheader.bpp    = bpp;
+  texheader.mips   = mipData.empty() ? 1 : mips;
+  texheader.bpp    = format;
 
-  const size_t inDataBSz  = size_t(w)*size_t(h)*size_t(bpp);
+  const size_t inDataBSz  = (format == bpp) ? size_t(w)*size_t(h)*size_t(bpp) : packedData.size();
   const int    align      = int(m_pTexStorage->GetAlignSizeInBytes());
   const size_t headerSize = roundBlocks(sizeof(SWTextureHeader), align);
-  const size_t totalSize  = roundBlocks(inDataBSz, align) + headerSize;
+  size_t       totalSize  = roundBlocks(inDataBSz + mipData.size(), align) + headerSize;
 
   auto offset = m_pTexStorage->Update(a_texId, nullptr, totalSize);
 
+  if (offset == -1 && !mipData.empty()) // not enough space for mip chain, store level 0 only
+  {
+    mipData        = std::vector<uint8_t>();
+    texheader.mips = 1;
+    totalSize      = roundBlocks(inDataBSz, align) + headerSize;
+    offset         = m_pTexStorage->Update(a_texId, nullptr, totalSize);
+  }
+
   if (offset == -1)
   {
     std::cerr << "RenderDriverRTE::UpdateImage: can't append texture to tex storage; id = " << a_texId << std::endl;
@@ -808,7 +1075,16 @@ bool RenderDriverRTE::UpdateImage(int32_t a_texId, int32_t w, int32_t h, int32_t
   }
 
   m_pTexStorage->UpdatePartial(a_texId, &texheader, 0, sizeof(SWTextureHeader));
-  m_pTexStorage->UpdatePartial(a_texId, a_data, headerSize, inDataBSz);
+
+  if (mipData.empty())
+    m_pTexStorage->UpdatePartial(a_texId, a_data, headerSize, inDataBSz);
+  else // levels are packed tightly (see textureMipOffset), so the first mip is not aligned in general; write whole chain at aligned offset
+  {
+    std::vector<uint8_t> levels(inDataBSz + mipData.size());
+    memcpy(levels.data(), a_data, inDataBSz);
+    memcpy(levels.data() + inDataBSz, mipData.data(), mipData.size());
+    m_pTexStorage->UpdatePartial(a_texId, levels.data(), headerSize, levels.size());
+  }
 
   return true;
 }
@@ -834,6 +1110,8 @@ void OverrideAOInMaterialHead(pugi::xml_node a_materialNode, const std::unordere
 
 bool RenderDriverRTE::UpdateMaterial(int32_t a_matId, pugi::xml_node a_materialNode)
 {
+  m_pHWLayer->StopAsyncPasses();
+
   //std::cerr << "RenderDriverRTE::UpdateMaterial(" << a_matId << ") " << std::endl;
 
   const std::wstring mtype = a_materialNode.attribute(L"type").as_string();
@@ -904,6 +1182,8 @@ std::shared_ptr<RAYTR::ILight> CreateLightFromXmlNode(pugi::xml_node a_node, IMe
 
 bool RenderDriverRTE::UpdateLight(int32_t a_lightId, pugi::xml_node a_lightNode)
 {
+  m_pHWLayer->StopAsyncPasses();
+
   const std::wstring ltype  = a_lightNode.attribute(L"type").as_string();
   const std::wstring lshape = a_lightNode.attribute(L"shape").as_string();
 
@@ -915,6 +1195,18 @@ bool RenderDriverRTE::UpdateLight(int32_t a_lightId, pugi::xml_node a_lightNode)
     pLightMeshHeader         = (const PlainMesh*)(ldata + m_pGeomStorage->GetTable()[meshId]);
   }
   
+  // mesh light copies its mesh and triangle pick table to pdf storage under new ids; free copies of previous version of this light
+  //
+  if (a_lightId < m_lights.size() && m_lights[a_lightId] != nullptr)
+  {
+    const PlainLight oldLight = m_lights[a_lightId]->ConvertToPlainLight();
+    if (lightType(&oldLight) == PLAIN_LIGHT_TYPE_MESH)
+    {
+      m_pPdfStorage->Delete(as_int(oldLight.data[MESH_LIGHT_MESH_OFFSET_ID]));
+      m_pPdfStorage->Delete(as_int(oldLight.data[MESH_LIGHT_TABLE_OFFSET_ID]));
+    }
+  }
+
   m_lights[a_lightId] = CreateLightFromXmlNode(a_lightNode, m_pPdfStorage, m_iesCache, m_libPath, pLightMeshHeader);
 
   if (ltype == L"sky" || (ltype == L"area" && lshape == L"cylinder"))
@@ -1013,6 +1305,8 @@ std::vector<float> CalcAuxShadowRaysOffsets(const HRMeshDriverInput& a_input)
 
 bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, const HRMeshDriverInput& a_input, const HRBatchInfo* a_batchList, int32_t listSize)
 {
+  m_pHWLayer->StopAsyncPasses();
+
   const int align     = int(m_pGeomStorage->GetAlignSizeInBytes());
   const int alignOffs = sizeof(int) * 4;
 
@@ -1024,14 +1318,18 @@ bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, co
   const size_t vertPosOffset  = headerSize;
   const size_t vertPosSize    = roundBlocks(sizeof(float4)*a_input.vertNum, align);
 
+  const bool   compactVerts   = m_compactVertices || m_halfTexCoords;
+  const bool   halfTexCoords  = m_halfTexCoords;
+  const size_t vertNormStride = compactVerts ? sizeof(uint) : sizeof(float4);
+
   const size_t vertNormOffset = vertPosOffset + vertPosSize;
-  const size_t vertNormSize   = roundBlocks(sizeof(float4)*a_input.vertNum, align);
+  const size_t vertNormSize   = roundBlocks(vertNormStride*a_input.vertNum, align);
 
   const size_t vertTexcOffset = vertNormOffset + vertNormSize;                       
-  const size_t vertTexcSize   = 0; // roundBlocks(sizeof(float2)*a_input.vertNum, align);   // #TODO: add aux text coord channel if have such.
+  const size_t vertTexcSize   = (compactVerts && !halfTexCoords) ? roundBlocks(sizeof(float2)*a_input.vertNum, align) : 0;
     
   const size_t vertTangOffset = vertTexcOffset + vertTexcSize;
-  const size_t vertTangSize   = roundBlocks(sizeof(float4)*a_input.vertNum, align); // compressed tangent
+  const size_t vertTangSize   = roundBlocks(vertNormStride*a_input.vertNum, align); 
    
   const size_t triIndOffset   = vertTangOffset + vertTangSize;
   const size_t triIndSize     = roundBlocks(a_input.triNum * 3 * sizeof(int), align);
@@ -1044,29 +1342,11 @@ bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, co
 
   const size_t totalByteSize  = triSOffOffset + triSOffSize;
 
-  // (1) compress tangents
-  //
-  const float4* tan4f  = (const float4*)a_input.tan4f;
-
-  // (2) pack first texture coordinates to pos.w and norm.w
-  //
-  const float4* pos4f  = (const float4*)a_input.pos4f;
-  const float4* norm4f = (const float4*)a_input.norm4f;
-
-  std::vector<float4> posAndTx(pos4f,   pos4f  + a_input.vertNum);
-  std::vector<float4> normAndTy(norm4f, norm4f + a_input.vertNum);
-
-  for (size_t i = 0; i < a_input.vertNum; i++)
-  {
-    posAndTx [i].w = a_input.texcoord2f[2 * i + 0];
-    normAndTy[i].w = a_input.texcoord2f[2 * i + 1];
-  }
-
-  // (3) calc per-poly shadow rays aux offset and put them to separate array.
+  // (2) calc per-poly shadow rays aux offset and put them to separate array.
   //
   std::vector<float> shadowOffsets = CalcAuxShadowRaysOffsets(a_input);
 
-  // (4) put mesh to the storage
+  // (3) put mesh to the storage
   //
   auto offset = m_pGeomStorage->Update(a_meshId, nullptr, totalByteSize); // alloc new chunk for our mesh
 
@@ -1080,7 +1360,7 @@ bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, co
 
   header.vPosOffset       = int(vertPosOffset  / alignOffs);
   header.vNormOffset      = int(vertNormOffset / alignOffs);
-  header.vTexCoordOffset  = int(vertTexcOffset / alignOffs);                                                      //#TODO: put auxilarry tex coord channel if has such
+  header.vTexCoordOffset  = int(vertTexcOffset / alignOffs);
   header.vTangentOffset   = int(vertTangOffset / alignOffs);
   header.vIndicesOffset   = int(triIndOffset   / alignOffs);
   header.mIndicesOffset   = int(triMIndOffset  / alignOffs);
@@ -1088,11 +1368,12 @@ bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, co
 
   header.vPosNum          = a_input.vertNum;
   header.vNormNum         = a_input.vertNum;
-  header.vTexCoordNum     = a_input.vertNum;                                                                       //#TODO: put auxilarry tex coord channel if has such
+  header.vTexCoordNum     = (vertTexcSize == 0) ? 0 : a_input.vertNum;
   header.vTangentNum      = a_input.vertNum;
   header.tIndicesNum      = a_input.triNum * 3;
   header.mIndicesNum      = a_input.triNum;
   header.totalBytesNum    = int(totalByteSize);
+  header.vertFormat       = (compactVerts ? MESH_VERT_COMPACT : 0) | (halfTexCoords ? MESH_VERT_HALF_TEXCOORD : 0);
 
   if (totalByteSize > 4294967296)
   {
@@ -1101,10 +1382,63 @@ bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, co
   }
 
   m_pGeomStorage->UpdatePartial(a_meshId, &header, 0, sizeof(header));
-  m_pGeomStorage->UpdatePartial(a_meshId, &posAndTx[0],          vertPosOffset,  a_input.vertNum * sizeof(float4));
-  m_pGeomStorage->UpdatePartial(a_meshId, &normAndTy[0],         vertNormOffset, a_input.vertNum * sizeof(float4));
-  //m_pGeomStorage->UpdatePartial(a_meshId, a_input.texcoord2f,    vertTexcOffset, a_input.vertNum * sizeof(float2)); //#TODO: put auxilarry tex coord channel if has such
-  m_pGeomStorage->UpdatePartial(a_meshId, tan4f, vertTangOffset, a_input.vertNum * sizeof(float4)); // compressed tangent
+
+  // (4) pack vertices due to header.vertFormat; stream them to the storage by blocks to avoid one more copy of the whole mesh
+  //
+  const float4* pos4f  = (const float4*)a_input.pos4f;
+  const float4* norm4f = (const float4*)a_input.norm4f;
+  const float4* tan4f  = (const float4*)a_input.tan4f;
+  const float2* tex2f  = (const float2*)a_input.texcoord2f;
+
+  const int STREAM_BLOCK_SIZE = 65536;
+  const int maxBlockSize      = std::min(int(a_input.vertNum), STREAM_BLOCK_SIZE);
+
+  std::vector<float4> posAndTx (maxBlockSize);
+  std::vector<float4> normAndTy(compactVerts ? 0 : maxBlockSize);
+  std::vector<uint>   normOct  (compactVerts ? maxBlockSize : 0);
+  std::vector<uint>   tangOct  (compactVerts ? maxBlockSize : 0);
+
+  for (int blockBegin = 0; blockBegin < int(a_input.vertNum); blockBegin += STREAM_BLOCK_SIZE)
+  {
+    const int blockSize = std::min(STREAM_BLOCK_SIZE, int(a_input.vertNum) - blockBegin);
+
+    #pragma omp parallel for if(blockSize >= 4096)
+    for (int i = 0; i < blockSize; i++)
+    {
+      const int vertId = blockBegin + i;
+      posAndTx[i]      = pos4f[vertId];
+
+      if (compactVerts)
+      {
+        normOct[i] = encodeNormalOct(to_float3(norm4f[vertId]));
+        tangOct[i] = encodeTangentOct(tan4f[vertId]);
+        if (halfTexCoords)
+          posAndTx[i].w = as_float(int(floatToHalf(tex2f[vertId].x) | (floatToHalf(tex2f[vertId].y) << 16)));
+      }
+      else
+      {
+        normAndTy[i]   = norm4f[vertId];
+        posAndTx [i].w = tex2f[vertId].x;
+        normAndTy[i].w = tex2f[vertId].y;
+      }
+    }
+
+    m_pGeomStorage->UpdatePartial(a_meshId, posAndTx.data(), vertPosOffset + size_t(blockBegin)*sizeof(float4), size_t(blockSize)*sizeof(float4));
+
+    if (compactVerts)
+    {
+      m_pGeomStorage->UpdatePartial(a_meshId, normOct.data(), vertNormOffset + size_t(blockBegin)*sizeof(uint), size_t(blockSize)*sizeof(uint));
+      m_pGeomStorage->UpdatePartial(a_meshId, tangOct.data(), vertTangOffset + size_t(blockBegin)*sizeof(uint), size_t(blockSize)*sizeof(uint));
+    }
+    else
+      m_pGeomStorage->UpdatePartial(a_meshId, normAndTy.data(), vertNormOffset + size_t(blockBegin)*sizeof(float4), size_t(blockSize)*sizeof(float4));
+  }
+
+  if (vertTexcSize != 0)
+    m_pGeomStorage->UpdatePartial(a_meshId, tex2f, vertTexcOffset, a_input.vertNum * sizeof(float2));
+
+  if (!compactVerts)
+    m_pGeomStorage->UpdatePartial(a_meshId, tan4f, vertTangOffset, a_input.vertNum * sizeof(float4));
 
   m_pGeomStorage->UpdatePartial(a_meshId, a_input.indices,       triIndOffset,   a_input.triNum  * 3 * sizeof(int));
   m_pGeomStorage->UpdatePartial(a_meshId, a_input.triMatIndices, triMIndOffset,  a_input.triNum  * sizeof(int));
@@ -1113,14 +1447,100 @@ bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, co
   return true;
 }
 
+/**
+\brief HydraAPI image files (".image4ub", ".image4f"): int32 width, int32 height and then raw pixels.
+
+ Image is memory mapped and passed to UpdateImage directly, so HydraAPI does not need to load it to its own memory first.
+ Return false for other formats; HydraAPI loads them by itself and calls UpdateImage then.
+
+*/
 bool RenderDriverRTE::UpdateImageFromFile(int32_t a_texId, const wchar_t* a_fileName, pugi::xml_node a_texNode)
 { 
-  return false; 
+  if (a_fileName == nullptr)
+    return false;
+
+  const std::wstring fileName(a_fileName);
+  
+  int bpp = 0;
+  if (fileName.size() > 8 && fileName.substr(fileName.size() - 8) == L".image4f")
+    bpp = int(sizeof(float) * 4);
+  else if (fileName.size() > 9 && fileName.substr(fileName.size() - 9) == L".image4ub")
+    bpp = int(sizeof(uchar4));
+  else
+    return false;
+
+  MemoryMappedFile file;
+  if (!file.Open(fileName) || file.Size() < sizeof(int) * 2)
+    return false;
+
+  const int* wh = (const int*)file.Data();
+  const int  w  = wh[0];
+  const int  h  = wh[1];
+
+  if (w <= 0 || h <= 0 || file.Size() < sizeof(int) * 2 + size_t(w)*size_t(h)*size_t(bpp))
+    return false;
+
+  return UpdateImage(a_texId, w, h, bpp, wh + 2, a_texNode);
 }
 
+/**
+\brief Header of HydraAPI ".vsgf" mesh file; must be the same as HydraGeomData::Header. 
+
+ Data after header: float4 pos[vertNum], float4 norm[vertNum] (if no HAS_NO_NORMALS flag), float4 tangent[vertNum] (if HAS_TANGENT flag), 
+ float2 texcoord[vertNum], uint indices[indicesNum], uint matIndices[indicesNum/3]; then optional data we don't need.
+
+*/
+struct VSGFHeader
+{
+  uint64_t fileSizeInBytes;
+  uint32_t verticesNum;
+  uint32_t indicesNum;
+  uint32_t materialsNum;
+  uint32_t flags;
+};
+
+constexpr uint32_t VSGF_HAS_TANGENT    = 1;
+constexpr uint32_t VSGF_HAS_NO_NORMALS = 8;
+
 bool RenderDriverRTE::UpdateMeshFromFile(int32_t a_meshId, pugi::xml_node a_meshNode, const wchar_t* a_fileName)
 { 
-  return false; 
+  if (a_fileName == nullptr)
+    return false;
+
+  MemoryMappedFile file;
+  if (!file.Open(a_fileName) || file.Size() < sizeof(VSGFHeader))
+    return false;
+
+  const VSGFHeader* pHeader = (const VSGFHeader*)file.Data();
+
+  // UpdateMesh needs normals and tangents; let HydraAPI compute them if file does not have them
+  //
+  if ((pHeader->flags & VSGF_HAS_NO_NORMALS) || !(pHeader->flags & VSGF_HAS_TANGENT)) 
+    return false;
+
+  const size_t vertNum  = size_t(pHeader->verticesNum);
+  const size_t indNum   = size_t(pHeader->indicesNum);
+  const size_t dataSize = vertNum*sizeof(float)*(4 + 4 + 4 + 2) + indNum*sizeof(int) + (indNum/3)*sizeof(int);
+
+  if (pHeader->fileSizeInBytes > file.Size() || sizeof(VSGFHeader) + dataSize > file.Size() || indNum % 3 != 0)
+  {
+    std::cerr << "RenderDriverRTE::UpdateMeshFromFile(id = " << a_meshId << "), bad or truncated vsgf file" << std::endl;
+    return false;
+  }
+
+  const char* pData = (const char*)file.Data() + sizeof(VSGFHeader);
+
+  HRMeshDriverInput input;
+  input.vertNum       = int(vertNum);
+  input.triNum        = int(indNum / 3);
+  input.pos4f         = (float*)pData; pData += vertNum*sizeof(float) * 4; // mapping is read only, but UpdateMesh never writes to input
+  input.norm4f        = (float*)pData; pData += vertNum*sizeof(float) * 4;
+  input.tan4f         = (float*)pData; pData += vertNum*sizeof(float) * 4;
+  input.texcoord2f    = (float*)pData; pData += vertNum*sizeof(float) * 2;
+  input.indices       = (int*)pData;   pData += indNum*sizeof(int);
+  input.triMatIndices = (int*)pData;
+
+  return UpdateMesh(a_meshId, a_meshNode, input, nullptr, 0);
 }
 
 bool RenderDriverRTE::UpdateCamera(pugi::xml_node a_camNode)
@@ -1252,10 +1672,13 @@ void RenderDriverRTE::CalcCameraMatrices(float4x4* a_pModelViewMatrixInv, float4
 
 void RenderDriverRTE::BeginScene(pugi::xml_node a_sceneNode)
 {
+  m_pHWLayer->StopAsyncPasses();
+
   if (m_pBVH != nullptr)
     m_pBVH->ClearScene();
  
-  m_geomTable = m_pGeomStorage->GetTable();
+  m_geomTable        = m_pGeomStorage->GetTable();
+  m_geomTableDefrags = m_pGeomStorage->GetDefragmentsNum();
 
   m_instMatricesInv.resize(0);
   m_lightsInstanced.resize(0);
@@ -1357,6 +1780,7 @@ void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only th
  
     const size_t bvhSize = EstimateBVHSize(convertedData);
     std::cout << "[EndScene]: MEM(BVH)    = " << bvhSize / size_t(1024*1024) << "\tMB" << std::endl; m_memAllocated += bvhSize;
+    m_memUsage.bvh = bvhSize;
 
     //PrintBVHStat(convertedData, true);
     //DebugSaveBVH("D:/temp/bvh_layers2", convertedData);
@@ -1375,6 +1799,10 @@ void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only th
     std::cout << "[EndScene]: TexStorageS = " << m_pTexStorage->GetSize() / size_t(1024 * 1024) << "\tMB" << std::endl;
     std::cout << "[EndScene]: TexStorageC = " << m_pTexStorage->GetCapacity() / size_t(1024 * 1024) << "\tMB" << std::endl;
 
+    const MemStorageStats texStats = m_pTexStorage->GetStats();
+    std::cout << "[EndScene]: TexStorageF = " << texStats.bytesFree / size_t(1024 * 1024) << "\tMB in " << texStats.chunksFree << " holes" << std::endl;
+    std::cout << "[EndScene]: TexStorageR = " << texStats.bytesReused / size_t(1024 * 1024) << "\tMB reused by " << texStats.allocsReused << " allocs" << std::endl;
+
     std::cout << std::endl;
 
     int oclVer = 0;
@@ -1415,6 +1843,11 @@ void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only th
   vars.m_varsF[HRT_BSPHERE_RADIUS  ]    = m_sceneBoundingSphere.w;
   vars.m_varsI[HRT_SHADOW_MATTE_BACK]   = this->m_shadowMatteBackTexId;
   vars.m_varsF[HRT_BACK_TEXINPUT_GAMMA] = this->m_shadowMatteBackGamma;
+  {
+    const std::vector<int32_t> matTable = m_pMaterialStorage->GetTable(); // material updates could compact storage since AllocAll
+    if (m_whiteDiffuseMatId < int(matTable.size()) && matTable[m_whiteDiffuseMatId] >= 0)
+      vars.m_varsI[HRT_WHITE_DIFFUSE_OFFSET] = matTable[m_whiteDiffuseMatId];
+  }
   m_pHWLayer->SetAllFlagsAndVars(vars);
 
   // calculate light selector pdf tables
@@ -1442,6 +1875,10 @@ void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only th
 
     m_pHWLayer->SetAllLightsSelectTable(&tableRev[0], int32_t(tableRev.size()), false);
     m_pHWLayer->SetAllLightsSelectTable(&tableFwd[0], int32_t(tableFwd.size()), true);
+
+    const std::vector<float> lightTree = m_lightTree ? BuildLightTree(m_lightsInstanced) : std::vector<float>();
+    m_pHWLayer->SetLightTree(lightTree.data(), int32_t(lightTree.size()));
+
     m_pHWLayer->SetAllPODLights(&m_lightsInstanced[0], m_lightsInstanced.size());
   }
   else
@@ -1449,6 +1886,7 @@ void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only th
     std::cerr << "WARNING: RenderDriverRTE::EndScene(), no lights!" << std::endl;
     m_pHWLayer->SetAllInstLightInstId  (nullptr, 0);
     m_pHWLayer->SetAllLightsSelectTable(nullptr, 0);
+    m_pHWLayer->SetLightTree           (nullptr, 0);
     m_pHWLayer->SetAllPODLights        (nullptr, 0);
   }
   /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1460,6 +1898,24 @@ void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only th
   if(m_haveAtLeastOneAOMat2 && m_procTextures.size() != 0)
     m_pHWLayer->SetNamedBuffer("ao2", nullptr, size_t(-1));
 
+  // uploads were asynchronous up to this point to overlap with BVH build and materials conversion; wait for them before first trace
+  //
+  m_pTexStorage->Flush();
+  m_pTexStorageAux->Flush();
+  m_pGeomStorage->Flush();
+  m_pMaterialStorage->Flush();
+  m_pPdfStorage->Flush();
+
+  // specialize material kernels for material classes of the scene; white diffuse dummy is always present
+  //
+  int2 matFeatures = make_int2(1 << PLAIN_MAT_CLASS_LAMBERT, 0);
+  for (const auto& feature : m_materialFeatures)
+  {
+    matFeatures.x |= feature.second.x;
+    matFeatures.y  = std::max(matFeatures.y, feature.second.y);
+  }
+  m_pHWLayer->SetMaterialFeatures(matFeatures.x, matFeatures.y);
+
   m_pHWLayer->PrepareEngineTables();
 
   if (m_needToFreeCPUMem)
@@ -1493,8 +1949,6 @@ void RenderDriverRTE::FreeCPUMem()
 
   m_geomTable     = std::vector<int>();
   m_texTable      = std::vector<int>();
-  m_texTableAux   = std::vector<int>();
-  m_materialTable = std::vector<int>();
 
   m_instMatricesInv      = std::vector<float4x4>();
   m_instLightInstId      = std::vector<int32_t>();
@@ -1648,6 +2102,8 @@ void RenderDriverRTE::Draw()
   m_pHWLayer->SetCamMatrices(m_projInv.L(), m_modelViewInv.L(), mProj.L(), mWorldView.L(), aspect, DEG_TO_RAD*m_camera.fov);
   m_pHWLayer->PrepareEngineGlobals();
 
+  StreamTexturePages(); // load pages of out of core textures that previous passes missed
+
   const int NUM_PASS = 1;
 
   // (2) run rendering pass (depends on enabled algorithm)
@@ -1877,6 +2333,12 @@ void RenderDriverRTE::InstanceMeshes(int32_t a_mesh_id, const float* a_matrices,
 
   const int32_t meshId = a_mesh_id;
 
+  if (m_geomTableDefrags != m_pGeomStorage->GetDefragmentsNum()) // mesh was updated inside BeginScene/EndScene and storage was compacted
+  {
+    m_geomTable        = m_pGeomStorage->GetTable();
+    m_geomTableDefrags = m_pGeomStorage->GetDefragmentsNum();
+  }
+
   if (meshId >= m_geomTable.size())
   {
     std::cerr << " RenderDriverRTE::InstanceMeshes, bad mesh id = " << meshId << std::endl;
@@ -2108,7 +2570,7 @@ HRDriverInfo RenderDriverRTE::Info()
   info.supportMeshLoadFromInternalFormat  = false;
   info.supportLighting                    = false;
   
-  info.memTotal                           = int64_t(8) * int64_t(1024 * 1024 * 1024);
+  info.memTotal                           = (m_pHWLayer != nullptr) ? int64_t(m_pHWLayer->GetAvaliableMemoryAmount(true)) : int64_t(8) * int64_t(1024 * 1024 * 1024);
 
   return info;
 }
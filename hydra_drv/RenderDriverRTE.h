@@ -20,7 +20,8 @@
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-constexpr int MAX_ENV_LIGHT_PDF_SIZE = 2048;
+constexpr int MAX_ENV_LIGHT_PDF_SIZE     = 2048; ///< larger env maps are sampled with luminance pyramid instead of alias table
+constexpr int MAX_ENV_LIGHT_PDF_MIP_SIZE = 8192; ///< pdf storage reserve for the largest image of the scene is clamped to pyramid of this size; larger maps are downscaled if needed
 
 struct MeshGeometry
 {
@@ -139,6 +140,20 @@ protected:
   std::wstring m_libPath;
   size_t       m_memAllocated;
 
+  struct MemoryUsage ///< reserved/used memory by category in bytes; reported by "meminfo" command
+  {
+    MemoryUsage() : total(0), geometry(0), bvh(0), textures(0), materials(0), pdfTables(0), frameBuffs(0) {}
+    size_t total;
+    size_t geometry;
+    size_t bvh;
+    size_t textures;
+    size_t materials;
+    size_t pdfTables;
+    size_t frameBuffs;
+  } m_memUsage;
+
+  size_t       m_texMemBudget; ///< user limit for textures (both storages); 0 means no limit
+
   // camera parameters
   //
   struct Camera
@@ -171,11 +186,20 @@ protected:
   IMemoryStorage* m_pMaterialStorage;
   IMemoryStorage* m_pPdfStorage;
   bool            m_texResizeEnabled;
+  bool            m_compactVertices; ///< store normals and tangents as octahedral encoded uint
+  bool            m_halfTexCoords;   ///< store texture coordinates as half2 in pos.w; implies m_compactVertices
+  bool            m_texMipmaps;      ///< generate mip chains in UpdateImage; selected with ray cones during rendering
+  bool            m_texCompression;  ///< store textures block compressed (BC1/BC3/BC4/BC6H, BC5 for aux normal maps)
+  int             m_texHDRFormat;    ///< storage for float4 textures: TEX_FORMAT_RGBA32F, TEX_FORMAT_RGBA16F or TEX_FORMAT_RGB9E5
+  bool            m_texTiled;        ///< store plain textures in 4x4 tiles (TEX_LAYOUT_TILED) if texture node don't say otherwise
+  bool            m_texOutOfCore;    ///< page textures that don't fit in memory from disk (TEX_LAYOUT_PAGED) instead of downscaling them
+  bool            m_lightTree;       ///< select lights for explicit sampling with light BVH (see BuildLightTree) instead of power table
 
   std::vector<int> m_geomTable;
   std::vector<int> m_texTable;
-  std::vector<int> m_texTableAux;
-  std::vector<int> m_materialTable;
+  int              m_geomTableDefrags;  ///< GetDefragmentsNum() of geom storage when m_geomTable was read; compaction moves objects
+  int              m_texTableDefrags;   ///< the same for m_texTable and texture storage
+  int              m_whiteDiffuseMatId; ///< dummy material; HRT_WHITE_DIFFUSE_OFFSET is taken again in EndScene because compaction moves it
 
   std::vector< std::shared_ptr<RAYTR::ILight> >               m_lights;
   std::vector<PlainLight>                                     m_lightsInstanced;
@@ -183,6 +207,7 @@ protected:
   std::unordered_map<std::wstring, int2>                      m_iesCache;
   std::unordered_map<int, std::shared_ptr<RAYTR::IMaterial> > m_materialUpdated;
   std::unordered_map<int, pugi::xml_node >                    m_materialNodes;
+  std::unordered_map<int, int2>                               m_materialFeatures; ///< (class mask, blend depth) of each material; kernels are specialized for all of them in EndScene
   std::unordered_map<int32_t, HRTexResInfo>                   m_allTexInfo;
   std::unordered_map<std::wstring, int32_t>                   m_texturesProcessedNM;
   std::unordered_map<int, ProcTexInfo>                        m_procTextures;
@@ -239,6 +264,7 @@ protected:
 
   bool m_useConvertedLayout;
   bool m_useBvhInstInsert;
+  bool m_useIndexedLeaves;  ///< tree 0 leaves reference shared mesh vertices instead of copying triangles; meshes with any alpha test go to tree 1
   RENDER_METHOD m_renderMethod;
 
   bool m_gpuFB;
@@ -267,6 +293,32 @@ protected:
   int32_t       GetCachedAuxNormalMatId(int32_t a_matId, const PlainMaterial& a_mat, int textureIdNM, pugi::xml_node a_materialNode);
   bool          UpdateImageAux(int32_t a_texId, int32_t w, int32_t h, int32_t bpp, const void* a_data);
 
+  /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+  struct PagedTexture
+  {
+    PagedTexture() : format(0), pagesTotal(0), pinnedPageStart(0), slotsBegin(0), slotsNum(0), streamCounter(0) {}
+
+    int format;
+    int pagesTotal;
+    int pinnedPageStart;           ///< pages from this one are always resident in first slots
+    int slotsBegin;                ///< offset of cache slots inside texture storage object in bytes
+    int slotsNum;
+    uint64_t streamCounter;
+
+    std::vector<int>      slotOfPage; ///< -1 for non resident pages
+    std::vector<int>      pageOfSlot; ///< -1 for free slots
+    std::vector<uint64_t> slotTime;   ///< when slot was filled; slots are replaced in the order they were streamed
+
+    std::shared_ptr<MemoryMappedFile> pages; ///< all pages of all mip levels one after another, TEX_PAGE_BYTES each
+  };
+
+  std::unordered_map<int, PagedTexture> m_pagedTextures;
+
+  bool UpdateImagePaged(int32_t a_texId, int32_t w, int32_t h, int32_t bpp, const void* a_data, size_t a_cacheSizeInBytes);
+  void StreamTexturePages();
+  const void* PagedTextureData(int32_t a_texId) const; ///< page file of TEX_LAYOUT_PAGED texture or nullptr for others
+  /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
   bool PutAbstractMaterialToStorage(const int32_t matId, std::shared_ptr<RAYTR::IMaterial> a_pMaterial, pugi::xml_node a_materialNode, bool processingBlend = false);
   bool MaterialDependsOfMaterial(pugi::xml_node a, pugi::xml_node b);
 
@@ -278,6 +330,7 @@ protected:
   void BuildSkyPortalsDependencyDummyInstances(); ///< fix m_instLightInstId (instance light copies) to make sky lights and sky portals working, piece of shit 
 
   std::vector<float> CalcLightPickProbTable(std::vector<PlainLight>& a_inOutLights, const bool a_fwd = false);
+  std::vector<float> BuildLightTree(const std::vector<PlainLight>& a_lights);
 
   /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
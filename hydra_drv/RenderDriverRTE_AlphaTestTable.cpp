@@ -61,7 +61,7 @@ bool RenderDriverRTE::MeshHaveOpacity(const PlainMesh* pHeader) const
     if (p != m_materialUpdated.end())
     {
       int texId = as_int(p->second->m_plain.data[OPACITY_TEX_OFFSET]);
-      if (texId != INVALID_TEXTURE)
+      if (texId != INVALID_TEXTURE || (m_useIndexedLeaves && p->second->skipShadow))
       {
         meshHaveOpacity = true;
         break;
@@ -95,10 +95,18 @@ void RenderDriverRTE::CreateAlphaTestTable(ConvertionResult& a_cnvRes, AlphaBuff
     std::vector<uint2>& a_otrData = a_outBuffers.buf[treeId];
 
     const int numPrims = a_cnvRes.trif4Num[treeId];
+    const int4* i4data = (const int4*)a_cnvRes.pTriangleData[treeId];
+
+    if (a_cnvRes.leafIdx[treeId]) // indexed leaves are never alpha tested, see MeshHaveOpacity
+    {
+      a_cnvRes.pTriangleAlpha[treeId] = nullptr;
+      a_cnvRes.triAfNum      [treeId] = 0;
+      continue;
+    }
+
     a_otrData.resize(numPrims + auxSize); 
 
     bool haveAtLeastOneOpacityMesh = false;
-    const int4* i4data = (const int4*)a_cnvRes.pTriangleData[treeId];
 
     for (int triOffset = 0; triOffset < a_cnvRes.trif4Num[treeId];)
     {
@@ -117,9 +125,6 @@ void RenderDriverRTE::CreateAlphaTestTable(ConvertionResult& a_cnvRes, AlphaBuff
 
       const int*    vertIndices  = meshTriIndices(mesh);
 
-      const float4* vertPos      = meshVerts(mesh);
-      const float4* vertNorm     = meshNorms(mesh);
-      //const float2* vertTexCoord = meshTexCoords(mesh);
       const int*    matIndices   = meshMatIndices(mesh);
 
       const int mId = matIndices[primId];
@@ -167,9 +172,9 @@ void RenderDriverRTE::CreateAlphaTestTable(ConvertionResult& a_cnvRes, AlphaBuff
             const int offs_B = vertIndices[offset + 1];
             const int offs_C = vertIndices[offset + 2];
 
-            const float2 A_tex = float2(vertPos[offs_A].w, vertNorm[offs_A].w); //vertTexCoord[offs_A];
-            const float2 B_tex = float2(vertPos[offs_B].w, vertNorm[offs_B].w); //vertTexCoord[offs_B];
-            const float2 C_tex = float2(vertPos[offs_C].w, vertNorm[offs_C].w); //vertTexCoord[offs_C];
+            const float2 A_tex = meshTexCoordAt(mesh, offs_A);
+            const float2 B_tex = meshTexCoordAt(mesh, offs_B);
+            const float2 C_tex = meshTexCoordAt(mesh, offs_C);
 
             a_otrData[triOffset + 0].y = CompressTexCoord16(A_tex);
             a_otrData[triOffset + 1].y = CompressTexCoord16(B_tex);
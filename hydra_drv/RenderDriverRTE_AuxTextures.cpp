@@ -60,7 +60,7 @@ int32_t RenderDriverRTE::GetCachedAuxNormalMatId(int32_t a_matId, const PlainMat
     //HR_SaveLDRImageToFile(L"D:/temp/Cells_Balls_n_calculated.png", w, h, (int32_t*)pNormals);
 
     if (pNormals != nullptr)
-      UpdateImageAux(auxTexId, w, h, 4, pNormals);  // #TODO: add normal map compression  here ... ?
+      UpdateImageAux(auxTexId, w, h, 4, pNormals);
     else
       auxTexId = INVALID_TEXTURE;
 
@@ -72,13 +72,18 @@ int32_t RenderDriverRTE::GetCachedAuxNormalMatId(int32_t a_matId, const PlainMat
   return auxTexId;
 }
 
+std::vector<float4> DecodeTextureLevel0(const int4* a_header, const void* a_pages);
+
 const uchar4* RenderDriverRTE::GetAuxNormalMapFromDisaplacement(std::vector<uchar4>& normals, const PlainMaterial& mat, int textureIdNM, pugi::xml_node a_materialNode, int* pW, int* pH)
 {
   const std::wstring btype = a_materialNode.child(L"displacement").attribute(L"type").as_string();
   const uchar4* pNormals = nullptr;
 
-  if (m_texTable.size() <= textureIdNM)
-    m_texTable = m_pTexStorage->GetTable();
+  if (m_texTable.size() <= textureIdNM || m_texTableDefrags != m_pTexStorage->GetDefragmentsNum())
+  {
+    m_texTable        = m_pTexStorage->GetTable();
+    m_texTableDefrags = m_pTexStorage->GetDefragmentsNum();
+  }
 
   assert(m_texTable.size() > textureIdNM);
 
@@ -119,6 +124,19 @@ const uchar4* RenderDriverRTE::GetAuxNormalMapFromDisaplacement(std::vector<ucha
 
     pBumpData = dataConverted.data();
   }
+  else if (header->w != TEX_FORMAT_RGBA8) // decompress or convert from half
+  {
+    const std::vector<float4> decoded = DecodeTextureLevel0(header, PagedTextureData(textureIdNM));
+    dataConverted.resize(decoded.size());
+
+    for (size_t i = 0; i < decoded.size(); i++)
+    {
+      const float4 pixOut = clamp(decoded[i]*255.0f + 0.5f, 0.0f, 255.0f);
+      dataConverted[i]    = uchar4((unsigned char)pixOut.x, (unsigned char)pixOut.y, (unsigned char)pixOut.z, (unsigned char)pixOut.w);
+    }
+
+    pBumpData = dataConverted.data();
+  }
 
   if (btype == L"height_bump")
   {
@@ -129,9 +147,15 @@ const uchar4* RenderDriverRTE::GetAuxNormalMapFromDisaplacement(std::vector<ucha
     normals     = m_pHWLayer->NormalMapFromDisplacement(header->x, header->y, pBumpData, params.x, invHeight, params.y);
     pNormals    = &normals[0];
   }
-  else if (btype == L"normal_bump") // #TODO: process (header->w == 16) case ... 
+  else if (btype == L"normal_bump")
   {
-    pNormals = (const uchar4*)(header + 1);
+    if (pBumpData == dataConverted.data()) // converted data is local, copy it out
+    {
+      normals  = dataConverted;
+      pNormals = normals.data();
+    }
+    else
+      pNormals = pBumpData;
   }
 
   return pNormals;
@@ -139,16 +163,29 @@ const uchar4* RenderDriverRTE::GetAuxNormalMapFromDisaplacement(std::vector<ucha
 
 void SaveBMP(const wchar_t* fname, const int* pixels, int w, int h);
 
+void CompressTexture(const void* a_data, std::vector<uint8_t>& a_mips, int w, int h, int a_bpp, int a_levels, int a_format, std::vector<uint8_t>& a_outLevel0);
+
 bool RenderDriverRTE::UpdateImageAux(int32_t a_texId, int32_t w, int32_t h, int32_t bpp, const void* a_data)
 {
+  // aux textures are normal maps, keep only xy in BC5
+  //
+  std::vector<uint8_t> compressedData, noMips;
+  int format = bpp;
+  if (m_texCompression && bpp == 4)
+  {
+    format = TEX_FORMAT_BC5;
+    CompressTexture(a_data, noMips, w, h, bpp, 1, format, compressedData);
+    a_data = compressedData.data();
+  }
+
   SWTextureHeader texheader;
 
   texheader.width  = w;
   texheader.height = h;
-  texheader.depth  = 1;
-  texheader.bpp    = bpp;
+  texheader.mips   = 1;
+  texheader.bpp    = format;
 
-  const size_t inDataBSz  = size_t(w)*size_t(h)*size_t(bpp);
+  const size_t inDataBSz  = (format == bpp) ? size_t(w)*size_t(h)*size_t(bpp) : compressedData.size();
   const int    align      = int(m_pTexStorageAux->GetAlignSizeInBytes());
   const size_t headerSize = roundBlocks(sizeof(SWTextureHeader), align);
   const size_t totalSize  = roundBlocks(inDataBSz, align) + headerSize;
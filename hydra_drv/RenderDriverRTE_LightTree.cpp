@@ -0,0 +1,423 @@
+#include "RenderDriverRTE.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+/**
+\brief bounds of single light or light tree node; see LTREE_NODE_SIZE in clight.h for meaning of angles.
+
+*/
+struct LightTreeBounds
+{
+  float3 boxMin;
+  float3 boxMax;
+  float3 axis;
+  float  thetaO;
+  float  thetaE;
+  float  energy;
+  int    lightId;
+};
+
+constexpr static int LTREE_BUCKETS = 12; ///< number of SAOH buckets per axis
+
+static inline float3 LightTreeMin(float3 a, float3 b) { return float3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); }
+static inline float3 LightTreeMax(float3 a, float3 b) { return float3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); }
+
+/**
+\brief get box of local space points a_localMin..a_localMax that are transformed with light matrix at a_matrixOffset and translated to light position.
+
+*/
+static void LightTreeTransformedBox(const PlainLight& a_light, int a_matrixOffset, float3 a_localMin, float3 a_localMax, LightTreeBounds* a_out)
+{
+  const float3 pos = lightPos(&a_light);
+  for (int i = 0; i < 8; i++)
+  {
+    const float3 local  = float3((i & 1) ? a_localMax.x : a_localMin.x, (i & 2) ? a_localMax.y : a_localMin.y, (i & 4) ? a_localMax.z : a_localMin.z);
+    const float3 corner = pos + matrix3x3f_mult_float3(a_light.data + a_matrixOffset, local);
+    a_out->boxMin = (i == 0) ? corner : LightTreeMin(a_out->boxMin, corner);
+    a_out->boxMax = (i == 0) ? corner : LightTreeMax(a_out->boxMax, corner);
+  }
+}
+
+/**
+\brief get local space box of mesh light vertices; meshes are read back from pdf storage once and cached in a_meshBoxes.
+
+*/
+static bool MeshLightLocalBox(IMemoryStorage* a_pdfStorage, int a_meshId, std::unordered_map<int, std::pair<float3, float3> >& a_meshBoxes, float3* pMin, float3* pMax)
+{
+  auto p = a_meshBoxes.find(a_meshId);
+  if (p == a_meshBoxes.end())
+  {
+    PlainMesh header;
+    header.vPosNum = 0;
+    a_pdfStorage->ReadPartial(a_meshId, &header, 0, sizeof(PlainMesh));
+    if (header.vPosNum <= 0)
+      return false;
+
+    std::vector<float4> vpos(header.vPosNum);
+    a_pdfStorage->ReadPartial(a_meshId, vpos.data(), uint64_t(header.vPosOffset)*sizeof(float4), vpos.size()*sizeof(float4));
+
+    float3 boxMin = to_float3(vpos[0]);
+    float3 boxMax = to_float3(vpos[0]);
+    for (size_t i = 1; i < vpos.size(); i++)
+    {
+      boxMin = LightTreeMin(boxMin, to_float3(vpos[i]));
+      boxMax = LightTreeMax(boxMax, to_float3(vpos[i]));
+    }
+
+    p = a_meshBoxes.insert(std::make_pair(a_meshId, std::make_pair(boxMin, boxMax))).first;
+  }
+
+  (*pMin) = p->second.first;
+  (*pMax) = p->second.second;
+  return true;
+}
+
+/**
+\brief get bounds of light that have finite size.
+\return false for sky and direct lights; they are selected proportional to power only
+
+*/
+static bool LightTreeLightBounds(const PlainLight& a_light, IMemoryStorage* a_pdfStorage, std::unordered_map<int, std::pair<float3, float3> >& a_meshBoxes, 
+                                 LightTreeBounds* a_out)
+{
+  const float3 pos  = lightPos(&a_light);
+  const float3 norm = normalize(lightNorm(&a_light));
+  const bool   ies  = (lightFlags(&a_light) & LIGHT_HAS_IES) != 0;
+
+  a_out->boxMin = pos;
+  a_out->boxMax = pos;
+  a_out->axis   = norm;
+  a_out->thetaO = float(M_PI);
+  a_out->thetaE = float(M_PI)*0.5f;
+
+  switch (lightType(&a_light))
+  {
+  case PLAIN_LIGHT_TYPE_POINT_OMNI:
+    return true;
+
+  case PLAIN_LIGHT_TYPE_POINT_SPOT:
+    if (!ies)
+    {
+      a_out->thetaO = 0.0f;
+      a_out->thetaE = acosf(clamp(a_light.data[POINT_LIGHT_SPOT_COS2], -1.0f, 1.0f));
+    }
+    return true;
+
+  case PLAIN_LIGHT_TYPE_SPHERE:
+  {
+    const float r = a_light.data[SPHERE_LIGHT_RADIUS];
+    a_out->boxMin = pos - float3(r, r, r);
+    a_out->boxMax = pos + float3(r, r, r);
+    return true;
+  }
+
+  case PLAIN_LIGHT_TYPE_AREA:
+  {
+    const float sx = a_light.data[AREA_LIGHT_SIZE_X];
+    const float sy = a_light.data[AREA_LIGHT_SIZE_Y];
+    for (int i = 0; i < 4; i++) // disk is inside of square with sizes (sx,sx)
+    {
+      const float3 corner = pos + matrix3x3f_mult_float3(a_light.data + AREA_LIGHT_MATRIX_E00, float3((i & 1) ? sx : -sx, 0.0f, (i & 2) ? sy : -sy));
+      a_out->boxMin = LightTreeMin(a_out->boxMin, corner);
+      a_out->boxMax = LightTreeMax(a_out->boxMax, corner);
+    }
+    if (!ies)
+      a_out->thetaO = 0.0f;
+    return true;
+  }
+
+  case PLAIN_LIGHT_TYPE_CYLINDER: // normals of side surface go to all directions around the axis, so cone stays full
+  {
+    const float r = a_light.data[CYLINDER_LIGHT_RADIUS];
+    LightTreeTransformedBox(a_light, CYLINDER_LIGHT_MATRIX_E00, float3(-r, -r, a_light.data[CYLINDER_LIGHT_ZMIN]), float3(r, r, a_light.data[CYLINDER_LIGHT_ZMAX]), a_out);
+    a_out->axis = float3(0, 1, 0);
+    return true;
+  }
+
+  case PLAIN_LIGHT_TYPE_MESH:
+  {
+    float3 localMin, localMax;
+    if (a_pdfStorage == nullptr || !MeshLightLocalBox(a_pdfStorage, as_int(a_light.data[MESH_LIGHT_MESH_OFFSET_ID]), a_meshBoxes, &localMin, &localMax))
+      return false;
+    LightTreeTransformedBox(a_light, MESH_LIGHT_MATRIX_E00, localMin, localMax, a_out);
+    a_out->axis = float3(0, 1, 0);
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+/**
+\brief bounding cone of two cones of normals (Conty & Kulla, algorithm 1).
+
+*/
+static void LightTreeUnionCone(float3 a_axis, float a_thetaO, float3 b_axis, float b_thetaO, float3* pAxis, float* pThetaO)
+{
+  if (b_thetaO > a_thetaO)
+  {
+    std::swap(a_axis,   b_axis);
+    std::swap(a_thetaO, b_thetaO);
+  }
+
+  (*pAxis)   = a_axis;
+  (*pThetaO) = float(M_PI);
+
+  const float cosD   = clamp(dot(a_axis, b_axis), -1.0f, 1.0f);
+  const float thetaD = acosf(cosD);
+  if (fminf(thetaD + b_thetaO, float(M_PI)) <= a_thetaO)
+  {
+    (*pThetaO) = a_thetaO;
+    return;
+  }
+
+  const float thetaO = 0.5f*(a_thetaO + thetaD + b_thetaO);
+  const float3 ortho = b_axis - a_axis*cosD;
+  if (thetaO >= float(M_PI) || dot(ortho, ortho) < 1e-12f)
+    return;
+
+  const float thetaR = thetaO - a_thetaO;
+  (*pAxis)   = normalize(a_axis*cosf(thetaR) + normalize(ortho)*sinf(thetaR));
+  (*pThetaO) = thetaO;
+}
+
+static LightTreeBounds LightTreeUnion(const LightTreeBounds& a, const LightTreeBounds& b)
+{
+  if (a.energy <= 0.0f) return b;
+  if (b.energy <= 0.0f) return a;
+
+  LightTreeBounds res;
+  res.boxMin  = LightTreeMin(a.boxMin, b.boxMin);
+  res.boxMax  = LightTreeMax(a.boxMax, b.boxMax);
+  res.thetaE  = fmaxf(a.thetaE, b.thetaE);
+  res.energy  = a.energy + b.energy;
+  res.lightId = -1;
+  LightTreeUnionCone(a.axis, a.thetaO, b.axis, b.thetaO, &res.axis, &res.thetaO);
+  return res;
+}
+
+static LightTreeBounds LightTreeEmptyBounds()
+{
+  LightTreeBounds res;
+  res.boxMin  = float3(+1e30f, +1e30f, +1e30f);
+  res.boxMax  = float3(-1e30f, -1e30f, -1e30f);
+  res.axis    = float3(0, 0, 1);
+  res.thetaO  = 0.0f;
+  res.thetaE  = 0.0f;
+  res.energy  = 0.0f;
+  res.lightId = -1;
+  return res;
+}
+
+/**
+\brief SAOH cost of node; energy*area*orientation measure (Conty & Kulla, eq. 1).
+
+*/
+static float LightTreeCost(const LightTreeBounds& a_bounds)
+{
+  if (a_bounds.energy <= 0.0f)
+    return 0.0f;
+
+  const float3 size   = a_bounds.boxMax - a_bounds.boxMin;
+  const float  area   = 2.0f*(size.x*size.y + size.y*size.z + size.z*size.x);
+  const float  thetaO = a_bounds.thetaO;
+  const float  thetaW = fminf(thetaO + a_bounds.thetaE, float(M_PI));
+  const float  mOmega = 2.0f*float(M_PI)*(1.0f - cosf(thetaO)) +
+                        0.5f*float(M_PI)*(2.0f*thetaW*sinf(thetaO) - cosf(thetaO - 2.0f*thetaW) - 2.0f*thetaO*sinf(thetaO) + cosf(thetaO));
+
+  return a_bounds.energy*area*mOmega;
+}
+
+static inline float LightTreeCentroid(const LightTreeBounds& a_bounds, int a_axis)
+{
+  const float3 c = 0.5f*(a_bounds.boxMin + a_bounds.boxMax);
+  return (a_axis == 0) ? c.x : ((a_axis == 1) ? c.y : c.z);
+}
+
+/**
+\brief find split of a_lights[a_begin, a_end) with minimal SAOH cost; median split on largest axis if all centroids are the same.
+\return first light of second child
+
+*/
+static int LightTreeSplit(std::vector<LightTreeBounds>& a_lights, int a_begin, int a_end, const LightTreeBounds& a_nodeBounds)
+{
+  float3 cMin(+1e30f, +1e30f, +1e30f), cMax(-1e30f, -1e30f, -1e30f);
+  for (int i = a_begin; i < a_end; i++)
+  {
+    const float3 c = 0.5f*(a_lights[i].boxMin + a_lights[i].boxMax);
+    cMin = LightTreeMin(cMin, c);
+    cMax = LightTreeMax(cMax, c);
+  }
+
+  const float3 cSize     = cMax - cMin;
+  const float  maxExtent = fmaxf(cSize.x, fmaxf(cSize.y, cSize.z));
+  const float  nodeCost  = fmaxf(LightTreeCost(a_nodeBounds), 1e-20f);
+
+  float bestCost   = 1e30f;
+  int   bestAxis   = -1;
+  int   bestBucket = -1;
+
+  for (int axis = 0; axis < 3 && maxExtent > 0.0f; axis++)
+  {
+    const float axisMin    = (axis == 0) ? cMin.x  : ((axis == 1) ? cMin.y  : cMin.z);
+    const float axisExtent = (axis == 0) ? cSize.x : ((axis == 1) ? cSize.y : cSize.z);
+    if (axisExtent <= 0.0f)
+      continue;
+
+    LightTreeBounds buckets[LTREE_BUCKETS];
+    for (int b = 0; b < LTREE_BUCKETS; b++)
+      buckets[b] = LightTreeEmptyBounds();
+
+    for (int i = a_begin; i < a_end; i++)
+    {
+      const int b = std::min(int(LTREE_BUCKETS*(LightTreeCentroid(a_lights[i], axis) - axisMin) / axisExtent), LTREE_BUCKETS - 1);
+      buckets[b]  = LightTreeUnion(buckets[b], a_lights[i]);
+    }
+
+    const float kr = maxExtent / axisExtent; // prefer splits along largest axis, otherwise thin clusters are never split
+
+    for (int split = 1; split < LTREE_BUCKETS; split++)
+    {
+      LightTreeBounds left = LightTreeEmptyBounds(), right = LightTreeEmptyBounds();
+      for (int b = 0; b < split; b++)             left  = LightTreeUnion(left,  buckets[b]);
+      for (int b = split; b < LTREE_BUCKETS; b++) right = LightTreeUnion(right, buckets[b]);
+
+      const float cost = kr*(LightTreeCost(left) + LightTreeCost(right)) / nodeCost;
+      if (cost < bestCost)
+      {
+        bestCost   = cost;
+        bestAxis   = axis;
+        bestBucket = split;
+      }
+    }
+  }
+
+  if (bestAxis != -1)
+  {
+    const float axisMin    = (bestAxis == 0) ? cMin.x  : ((bestAxis == 1) ? cMin.y  : cMin.z);
+    const float axisExtent = (bestAxis == 0) ? cSize.x : ((bestAxis == 1) ? cSize.y : cSize.z);
+
+    auto middle = std::partition(a_lights.begin() + a_begin, a_lights.begin() + a_end, [=](const LightTreeBounds& a_light)
+    {
+      return std::min(int(LTREE_BUCKETS*(LightTreeCentroid(a_light, bestAxis) - axisMin) / axisExtent), LTREE_BUCKETS - 1) < bestBucket;
+    });
+
+    const int mid = int(middle - a_lights.begin());
+    if (mid != a_begin && mid != a_end)
+      return mid;
+  }
+
+  const int mid  = (a_begin + a_end) / 2;
+  const int axis = (cSize.x >= cSize.y && cSize.x >= cSize.z) ? 0 : ((cSize.y >= cSize.z) ? 1 : 2);
+  std::nth_element(a_lights.begin() + a_begin, a_lights.begin() + mid, a_lights.begin() + a_end, 
+                   [axis](const LightTreeBounds& a, const LightTreeBounds& b) { return LightTreeCentroid(a, axis) < LightTreeCentroid(b, axis); });
+  return mid;
+}
+
+/**
+\brief fill node a_nodeId from a_lights[a_begin, a_end) and recursively build its children; children are allocated in pairs.
+
+*/
+static void LightTreeFillNode(std::vector<LightTreeBounds>& a_lights, int a_begin, int a_end, int a_nodeId, int a_parent, int a_flags,
+                              std::vector<float>& a_nodes, std::vector<int>& a_leafOfLight)
+{
+  LightTreeBounds bounds = LightTreeEmptyBounds();
+  for (int i = a_begin; i < a_end; i++)
+    bounds = LightTreeUnion(bounds, a_lights[i]);
+
+  float* node = a_nodes.data() + size_t(a_nodeId)*LTREE_NODE_SIZE;
+  node[LTREE_BOX_MIN + 0] = bounds.boxMin.x;
+  node[LTREE_BOX_MIN + 1] = bounds.boxMin.y;
+  node[LTREE_BOX_MIN + 2] = bounds.boxMin.z;
+  node[LTREE_ENERGY]      = bounds.energy;
+  node[LTREE_BOX_MAX + 0] = bounds.boxMax.x;
+  node[LTREE_BOX_MAX + 1] = bounds.boxMax.y;
+  node[LTREE_BOX_MAX + 2] = bounds.boxMax.z;
+  node[LTREE_THETA_O]     = bounds.thetaO;
+  node[LTREE_AXIS + 0]    = bounds.axis.x;
+  node[LTREE_AXIS + 1]    = bounds.axis.y;
+  node[LTREE_AXIS + 2]    = bounds.axis.z;
+  node[LTREE_THETA_E]     = bounds.thetaE;
+  node[LTREE_CHILD]       = as_float(-1);
+  node[LTREE_PARENT]      = as_float(a_parent);
+  node[LTREE_LIGHT]       = as_float(-1);
+  node[LTREE_FLAGS]       = as_float(a_flags);
+
+  if (a_end - a_begin == 1)
+  {
+    node[LTREE_LIGHT] = as_float(a_lights[a_begin].lightId);
+    a_leafOfLight[a_lights[a_begin].lightId] = a_nodeId;
+    return;
+  }
+
+  const int mid   = (a_flags & LTREE_UNBOUNDED) ? (a_begin + a_end) / 2 : LightTreeSplit(a_lights, a_begin, a_end, bounds);
+  const int child = int(a_nodes.size() / LTREE_NODE_SIZE);
+  a_nodes.resize(a_nodes.size() + 2*LTREE_NODE_SIZE);
+  a_nodes[size_t(a_nodeId)*LTREE_NODE_SIZE + LTREE_CHILD] = as_float(child);
+
+  LightTreeFillNode(a_lights, a_begin, mid, child + 0, a_nodeId, a_flags, a_nodes, a_leafOfLight);
+  LightTreeFillNode(a_lights, mid,   a_end, child + 1, a_nodeId, a_flags, a_nodes, a_leafOfLight);
+}
+
+/**
+\brief build light BVH for SelectRandomLightRev. Leaf energy is PLIGHT_PICK_PROB_REV, so light groups, probability multipliers
+       and sky portals work in the same way as for the power table.
+\return tree data for lightTreeData (see clight.h) or empty vector if there are less than 2 lights with finite bounds
+
+*/
+std::vector<float> RenderDriverRTE::BuildLightTree(const std::vector<PlainLight>& a_lights)
+{
+  std::vector<LightTreeBounds> bounded, unbounded;
+  std::unordered_map<int, std::pair<float3, float3> > meshBoxes; // instances of mesh light share single mesh
+
+  for (size_t i = 0; i < a_lights.size(); i++)
+  {
+    LightTreeBounds bounds;
+    bounds.energy  = a_lights[i].data[PLIGHT_PICK_PROB_REV];
+    bounds.lightId = int(i);
+    if (bounds.energy <= 0.0f) // never selected; LightTreePdf returns 0 for them
+      continue;
+
+    if (LightTreeLightBounds(a_lights[i], m_pPdfStorage, meshBoxes, &bounds))
+      bounded.push_back(bounds);
+    else
+      unbounded.push_back(bounds);
+  }
+
+  if (bounded.size() < 2)
+    return std::vector<float>();
+
+  std::vector<float> nodes(LTREE_NODE_SIZE);
+  std::vector<int>   leafOfLight(a_lights.size(), -1);
+
+  if (unbounded.size() == 0)
+    LightTreeFillNode(bounded, 0, int(bounded.size()), 0, -1, 0, nodes, leafOfLight);
+  else
+  {
+    // root splits by energy between bounded and unbounded subtrees; it has no meaningful bounds
+    //
+    nodes.resize(3*LTREE_NODE_SIZE, 0.0f);
+    nodes[LTREE_CHILD]  = as_float(1);
+    nodes[LTREE_PARENT] = as_float(-1);
+    nodes[LTREE_LIGHT]  = as_float(-1);
+    nodes[LTREE_FLAGS]  = as_float(0);
+
+    LightTreeFillNode(bounded,   0, int(bounded.size()),   1, 0, 0,               nodes, leafOfLight);
+    LightTreeFillNode(unbounded, 0, int(unbounded.size()), 2, 0, LTREE_UNBOUNDED, nodes, leafOfLight);
+    nodes[LTREE_ENERGY] = nodes[1*LTREE_NODE_SIZE + LTREE_ENERGY] + nodes[2*LTREE_NODE_SIZE + LTREE_ENERGY];
+  }
+
+  const int nodesNum = int(nodes.size() / LTREE_NODE_SIZE);
+
+  std::vector<float> tree(LTREE_HEADER + nodes.size() + leafOfLight.size(), 0.0f);
+  tree[0] = as_float(nodesNum);
+  std::copy(nodes.begin(), nodes.end(), tree.begin() + LTREE_HEADER);
+  for (size_t i = 0; i < leafOfLight.size(); i++)
+    tree[LTREE_HEADER + nodes.size() + i] = as_float(leafOfLight[i]);
+
+  return tree;
+}
@@ -2,6 +2,10 @@
 #pragma warning(disable:4996) // for wcsncpy to be ok
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 #include <queue>
 #include <string>
 #include <vector>
@@ -183,39 +187,6 @@ void createGaussKernelWeights1D(int size, std::vector<float>& gKernel, float a_s
 
 static inline float maxcolorc(float3 v) { return fmax(v.x, fmax(v.y, v.z)); }
 
-static std::vector<float4> resizeToHalfSizef4(const float4* pixels, int width, int height)
-{
-  width  = width / 2;
-  height = height / 2;
-  if (width == 0)  width = 1;
-  if (height == 0) height = 1;
-
-  std::vector<float4> copy(width*height);
-
-  float4* oldArray = (float4*)(&pixels[0]);
-  float4* newArray = (float4*)(&copy[0]);
-
-  for (int y = 0; y < height; y++)
-  {
-    int offset1 = (2 * y + 0) * 2 * width;
-    int offset2 = (2 * y + 1) * 2 * width;
-
-    for (int x = 0; x < width; x++)
-    {
-      float4 x0 = oldArray[offset1 + 2 * x + 0];
-      float4 x1 = oldArray[offset1 + 2 * x + 1];
-      float4 x2 = oldArray[offset2 + 2 * x + 0];
-      float4 x3 = oldArray[offset2 + 2 * x + 1];
-
-      newArray[y*width + x] = 0.25f*(x0 + x1 + x2 + x3);
-    }
-  }
-
-  return copy;
-}
-
-
-
 /**
 \brief  create luminance image for futher construction of pdf table. Doadditional blur and add 0.1 to prevent zero length intervals;
 \param  pixels  - input random variable in rage [0, 1]
@@ -227,23 +198,7 @@ static std::vector<float4> resizeToHalfSizef4(const float4* pixels, int width, i
 
 std::vector<float> LuminanceFromFloat4Image(const float4* pixels, int& width, int& height)
 {
-  std::vector<float4> imageCopy;
-  const int maxResolution = MAX_ENV_LIGHT_PDF_SIZE;
-
-  for (int i = 0; i < 4; i++)
-  {
-    if (width > maxResolution || height > maxResolution)
-    {
-      imageCopy = resizeToHalfSizef4(pixels, width, height);
-      width  = width / 2;
-      height = height / 2;
-      pixels = &imageCopy[0];
-      if (width == 0)  width = 1;
-      if (height == 0) height = 1;
-    }
-  }
-
-  std::vector<float> luminanceData(width*height);
+  std::vector<float> luminanceData(size_t(width)*size_t(height));
 
   float avg = 0.0f;
   for (size_t i = 0; i < luminanceData.size(); i++)
@@ -369,111 +324,358 @@ std::vector<float> PrefixSumm(const std::vector<float>& a_vec)
   return avgBAccum;
 }
 
-std::string ws2s(const std::wstring& s);
-std::vector<float> CreateSphericalTextureFromIES(const std::string& a_iesData, int* pW, int* pH);
-
 /**
-\brief  Create 2 tables from ies file in single float1 storage and return pair of their ids.
-\param  pathW      - path to ies file
-\param  a_storage  - storage of floats 
-\param  a_iesCache - explicit cache for already processed IES files.
-\param  a_libPath  - input path to scene library; used to get full path of ies.
-\return pair of (texTableId, pdfTbaleId)
+\brief Build Walker/Vose alias table for SelectIndexAlias; it must be stored right after a_accum.
+\param a_accum - prefix summ from PrefixSumm
+\return (threshold, as_float(alias index)) for each of a_accum.size()-1 intervals
 
 */
-
-int2 AddIesTexTableToStorage(const std::wstring pathW, IMemoryStorage* a_storage, 
-                             std::unordered_map<std::wstring, int2>& a_iesCache, const std::wstring& a_libPath)
+std::vector<float> AliasTableFromPrefixSumm(const std::vector<float>& a_accum)
 {
-  int32_t iesTexId = INVALID_TEXTURE;
-  int32_t iesPdfId = INVALID_TEXTURE;
+  const int n = int(a_accum.size()) - 1;
+  if (n <= 0)
+    return std::vector<float>();
 
-  const std::wstring pathW1 = a_libPath + std::wstring(L"/") + pathW;
-  const std::string  pathA1 = ws2s(pathW1);
+  std::vector<float>  table(2*size_t(n));
+  std::vector<double> prob(n);
+  std::vector<int>    small, large;
 
-  auto p = a_iesCache.find(pathW);
-  if (p == a_iesCache.end())
+  const double total = double(a_accum[n]);
+  int maxIndex       = 0;
+
+  for (int i = 0; i < n; i++)
   {
-    int w, h;
-    std::vector<float> sphericalTexture;
-    
-    iesTexId         = a_storage->GetMaxObjectId() + 1;
-    sphericalTexture = CreateSphericalTextureFromIES(pathA1, &w, &h);
-    
-    if(sphericalTexture.size() == 1)
-      return int2(-1,-1);
+    const double weight = double(a_accum[i + 1] - a_accum[i]); // exactly what SelectIndexAlias use to eval pdf
+    prob[i] = (total > 0.0) ? weight*double(n) / total : 1.0;
+    if (prob[i] > prob[maxIndex])
+      maxIndex = i;
+    if (prob[i] < 1.0)
+      small.push_back(i);
+    else
+      large.push_back(i);
+  }
+
+  while (!small.empty() && !large.empty())
+  {
+    const int s = small.back(); small.pop_back();
+    const int l = large.back();
 
-    //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
-    float maxVal = 0.0f;
-    for (auto i = 0; i < sphericalTexture.size(); i++)
-      maxVal = fmax(maxVal, sphericalTexture[i]);
+    table[2*s + 0] = float(prob[s]);
+    table[2*s + 1] = as_float(l);
 
-    if(maxVal == 0.0f)
+    prob[l] = (prob[l] + prob[s]) - 1.0;
+    if (prob[l] < 1.0)
     {
-      std::cerr << "[ERROR]: broken IES file (maxVal = 0.0): " << pathA1.c_str() << std::endl;
-      return int2(-1, -1);
+      large.pop_back();
+      small.push_back(l);
     }
+  }
+
+  // the rest have probability ~1 due to round off; zero intervals must never be selected
+  //
+  for (auto i : large)
+  {
+    table[2*i + 0] = 1.0f;
+    table[2*i + 1] = as_float(i);
+  }
+
+  for (auto i : small)
+  {
+    const bool empty = (a_accum[i + 1] == a_accum[i]);
+    table[2*i + 0] = empty ? 0.0f : 1.0f;
+    table[2*i + 1] = as_float(empty ? maxIndex : i);
+  }
+
+  return table;
+}
+
+/**
+\brief Build luminance pyramid for sampleMap2DMip. Finest level is a_lum padded with zeros to power of 2 size, each texel of 
+       coarser level is the summ of its children.
+\param a_lum - luminance image of a_width*a_height texels
+\return pdf table of PDF_TABLE_LAYOUT_MIP: header, mip info (padded width, padded height, levels, finest level offset) and levels 
+        from 1x1 to the finest one
 
-    float invMax = 1.0f / maxVal;
-    for (auto i = 0; i < sphericalTexture.size(); i++)
+*/
+static std::vector<float> MipPyramidFromLuminance(const std::vector<float>& a_lum, int a_width, int a_height)
+{
+  int mipW = 1, mipH = 1, levels = 1;
+  while (mipW < a_width)  mipW *= 2;
+  while (mipH < a_height) mipH *= 2;
+  while ((mipW >> (levels - 1)) > 1 || (mipH >> (levels - 1)) > 1)
+    levels++;
+
+  auto levelW = [mipW](int a_level) { return std::max(mipW >> a_level, 1); };
+  auto levelH = [mipH](int a_level) { return std::max(mipH >> a_level, 1); };
+
+  std::vector<size_t> offsets(levels);
+  size_t total = 0;
+  for (int lvl = levels - 1; lvl >= 0; lvl--)
+  {
+    offsets[lvl] = total;
+    total       += size_t(levelW(lvl))*size_t(levelH(lvl));
+  }
+
+  std::vector<float> data(8 + total, 0.0f);
+  data[0] = as_float(a_width);
+  data[1] = as_float(a_height);
+  data[2] = as_float(PDF_TABLE_LAYOUT_MIP);
+  data[3] = as_float(int(data.size() - 4));
+  data[4] = as_float(mipW);
+  data[5] = as_float(mipH);
+  data[6] = as_float(levels);
+  data[7] = as_float(int(offsets[0]));
+
+  float* finest = data.data() + 8 + offsets[0];
+  for (int y = 0; y < a_height; y++)
+    memcpy(finest + size_t(y)*size_t(mipW), a_lum.data() + size_t(y)*size_t(a_width), a_width*sizeof(float));
+
+  for (int lvl = 1; lvl < levels; lvl++)
+  {
+    const int cw = levelW(lvl - 1), ch = levelH(lvl - 1);
+    const int pw = levelW(lvl),     ph = levelH(lvl);
+
+    const float* child  = data.data() + 8 + offsets[lvl - 1];
+    float*       parent = data.data() + 8 + offsets[lvl];
+
+    for (int y = 0; y < ch; y++)
     {
-      float val = invMax*sphericalTexture[i];
-      sphericalTexture[i] = val;
+      for (int x = 0; x < cw; x++)
+      {
+        const int px = (cw > pw) ? x / 2 : x;
+        const int py = (ch > ph) ? y / 2 : y;
+        parent[size_t(py)*size_t(pw) + size_t(px)] += child[size_t(y)*size_t(cw) + size_t(x)];
+      }
     }
-    //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
+  }
+
+  return data;
+}
+
+static std::vector<float> resizeToHalfSizef1(const std::vector<float>& a_lum, int& width, int& height)
+{
+  const int newW = std::max(width / 2, 1);
+  const int newH = std::max(height / 2, 1);
+
+  std::vector<float> copy(size_t(newW)*size_t(newH), 0.0f);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      copy[size_t(std::min(y / 2, newH - 1))*size_t(newW) + size_t(std::min(x / 2, newW - 1))] += 0.25f*a_lum[size_t(y)*size_t(width) + size_t(x)];
+
+  width  = newW;
+  height = newH;
+  return copy;
+}
 
-    std::vector<float> data2(sphericalTexture.size() + 5);
+std::string ws2s(const std::wstring& s);
+std::vector<float> CreateSphericalTextureFromIES(const std::string& a_iesData, int* pW, int* pH);
+
+/**
+\brief  FNV-1a hash of file content; equal IES profiles stored in different files share tables.
+\return false if file can't be read
 
-    data2[0] = as_float(w);
-    data2[1] = as_float(h);
-    data2[2] = as_float(1);
-    data2[3] = as_float(int(sphericalTexture.size() + 1));
+*/
+static bool IesFileContentHash(const std::string& a_path, uint64_t* a_pHash)
+{
+  std::ifstream fin(a_path.c_str(), std::ios::binary);
+  if (!fin.is_open())
+    return false;
 
-    double avgVal = 0.0f;
-    for (size_t i = 0; i < sphericalTexture.size(); i++)
+  uint64_t hash = 14695981039346656037ULL;
+  char buffer[4096];
+  while (fin)
+  {
+    fin.read(buffer, sizeof(buffer));
+    const std::streamsize readed = fin.gcount();
+    for (std::streamsize i = 0; i < readed; i++)
     {
-      avgVal      += double(sphericalTexture[i]);
-      data2[i + 4] = sphericalTexture[i];
+      hash ^= uint64_t(uint8_t(buffer[i]));
+      hash *= 1099511628211ULL;
     }
-    avgVal /= double(sphericalTexture.size());
+  }
+
+  (*a_pHash) = hash;
+  return true;
+}
+
+constexpr static int IES_CACHE_FILE_VERSION = 1;
 
-    a_storage->Update(iesTexId, &data2[0], data2.size() * sizeof(float));
+static std::string IesCacheFileName(uint64_t a_hash)
+{
+  std::stringstream fileName;
+  fileName << HydraTexCachePath() << "ies_" << std::hex << a_hash << ".bin";
+  return fileName.str();
+}
+
+/**
+\brief  Load texture (a_texData) and pdf (a_pdfData) tables of IES profile that were saved by SaveIesTablesToDisk.
+
+*/
+static bool LoadIesTablesFromDisk(uint64_t a_hash, std::vector<float>& a_texData, std::vector<float>& a_pdfData)
+{
+  std::ifstream fin(IesCacheFileName(a_hash).c_str(), std::ios::binary);
+  if (!fin.is_open())
+    return false;
+
+  int header[3] = { 0, 0, 0 }; // version, tex size, pdf size
+  fin.read((char*)header, sizeof(header));
+  if (!fin.good() || header[0] != IES_CACHE_FILE_VERSION || header[1] <= 4 || header[2] <= 4)
+    return false;
+
+  a_texData.resize(header[1]);
+  a_pdfData.resize(header[2]);
+  fin.read((char*)a_texData.data(), a_texData.size()*sizeof(float));
+  fin.read((char*)a_pdfData.data(), a_pdfData.size()*sizeof(float));
+  return fin.good();
+}
+
+static void SaveIesTablesToDisk(uint64_t a_hash, const std::vector<float>& a_texData, const std::vector<float>& a_pdfData)
+{
+  std::ofstream fout(IesCacheFileName(a_hash).c_str(), std::ios::binary | std::ios::trunc);
+  if (!fout.is_open())
+    return;
+
+  const int header[3] = { IES_CACHE_FILE_VERSION, int(a_texData.size()), int(a_pdfData.size()) };
+  fout.write((const char*)header, sizeof(header));
+  fout.write((const char*)a_texData.data(), a_texData.size()*sizeof(float));
+  fout.write((const char*)a_pdfData.data(), a_pdfData.size()*sizeof(float));
+}
 
-    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+\brief  Create spherical texture (a_texData) and pdf table (a_pdfData) of IES file; both have (w, h, layout, size) header.
+\return false if IES file is broken
 
-    HDRImageLite tempImage(w, h, 1, &sphericalTexture[0]);
-    tempImage.gaussBlur(2, 1.5f);
-    for (int i = 0; i < tempImage.width()*tempImage.height(); i++) // prevent pixels with zero pdf
-      sphericalTexture[i] = tempImage.data()[i] + 0.05f*float(avgVal);
+*/
+static bool CreateIesTables(const std::string& pathA1, std::vector<float>& a_texData, std::vector<float>& a_pdfData)
+{
+  int w, h;
+  std::vector<float> sphericalTexture = CreateSphericalTextureFromIES(pathA1, &w, &h);
     
-    data2 = PrefixSumm(sphericalTexture);
+  if(sphericalTexture.size() == 1)
+    return false;
+
+  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
+  float maxVal = 0.0f;
+  for (auto i = 0; i < sphericalTexture.size(); i++)
+    maxVal = fmax(maxVal, sphericalTexture[i]);
+
+  if(maxVal == 0.0f)
+  {
+    std::cerr << "[ERROR]: broken IES file (maxVal = 0.0): " << pathA1.c_str() << std::endl;
+    return false;
+  }
+
+  float invMax = 1.0f / maxVal;
+  for (auto i = 0; i < sphericalTexture.size(); i++)
+  {
+    float val = invMax*sphericalTexture[i];
+    sphericalTexture[i] = val;
+  }
+  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
+
+  std::vector<float>& data2 = a_texData;
+  data2.resize(sphericalTexture.size() + 5);
+
+  data2[0] = as_float(w);
+  data2[1] = as_float(h);
+  data2[2] = as_float(1);
+  data2[3] = as_float(int(sphericalTexture.size() + 1));
+
+  double avgVal = 0.0f;
+  for (size_t i = 0; i < sphericalTexture.size(); i++)
+  {
+    avgVal      += double(sphericalTexture[i]);
+    data2[i + 4] = sphericalTexture[i];
+  }
+  avgVal /= double(sphericalTexture.size());
+
+  ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  HDRImageLite tempImage(w, h, 1, &sphericalTexture[0]);
+  tempImage.gaussBlur(2, 1.5f);
+  for (int i = 0; i < tempImage.width()*tempImage.height(); i++) // prevent pixels with zero pdf
+    sphericalTexture[i] = tempImage.data()[i] + 0.05f*float(avgVal);
     
-    std::vector<float> data3(data2.size() + 4);
+  const std::vector<float> accum = PrefixSumm(sphericalTexture);
+  const std::vector<float> alias = AliasTableFromPrefixSumm(accum);
     
-    data3[0] = as_float(w);
-    data3[1] = as_float(h);
-    data3[2] = as_float(1);
-    data3[3] = as_float(int(data2.size()));
-    for (size_t i = 0; i < data2.size(); i++)
-      data3[i + 4] = data2[i];
+  std::vector<float>& data3 = a_pdfData;
+  data3.resize(accum.size() + alias.size() + 4);
     
-    iesPdfId = a_storage->GetMaxObjectId() + 1;
-    a_storage->Update(iesPdfId, &data3[0], data3.size() * sizeof(float));
+  data3[0] = as_float(w);
+  data3[1] = as_float(h);
+  data3[2] = as_float(PDF_TABLE_LAYOUT_FLAT);
+  data3[3] = as_float(int(accum.size()));
+  for (size_t i = 0; i < accum.size(); i++)
+    data3[i + 4] = accum[i];
+  for (size_t i = 0; i < alias.size(); i++)
+    data3[i + 4 + accum.size()] = alias[i];
+
+  return true;
+}
 
-    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+\brief  Create 2 tables from ies file in single float1 storage and return pair of their ids.
+\param  pathW      - path to ies file
+\param  a_storage  - storage of floats 
+\param  a_iesCache - explicit cache for already processed IES files. Keys are paths and content hashes ("#" + hex hash), so lights 
+                     that reference different files with equal profiles share tables. Tables are also cached on disk by content hash.
+\param  a_libPath  - input path to scene library; used to get full path of ies.
+\return pair of (texTableId, pdfTbaleId)
+
+*/
+
+int2 AddIesTexTableToStorage(const std::wstring pathW, IMemoryStorage* a_storage, 
+                             std::unordered_map<std::wstring, int2>& a_iesCache, const std::wstring& a_libPath)
+{
+  auto p = a_iesCache.find(pathW);
+  if (p != a_iesCache.end())
+    return p->second;
+
+  const std::wstring pathW1 = a_libPath + std::wstring(L"/") + pathW;
+  const std::string  pathA1 = ws2s(pathW1);
+
+  uint64_t hash       = 0;
+  const bool haveHash = IesFileContentHash(pathA1, &hash);
 
-    a_iesCache[pathW] = int2(iesTexId, iesPdfId);
+  std::wstringstream contentKey;
+  contentKey << L"#" << std::hex << hash;
+
+  if (haveHash)
+  {
+    auto p2 = a_iesCache.find(contentKey.str());
+    if (p2 != a_iesCache.end())
+    {
+      a_iesCache[pathW] = p2->second;
+      return p2->second;
+    }
   }
-  else
+
+  std::vector<float> data2, data3;
+  if (!haveHash || !LoadIesTablesFromDisk(hash, data2, data3))
   {
-    iesTexId = p->second.x;
-    iesPdfId = p->second.y;
+    if (!CreateIesTables(pathA1, data2, data3))
+      return int2(-1, -1);
+    if (haveHash)
+      SaveIesTablesToDisk(hash, data2, data3);
   }
 
+  const int32_t iesTexId = a_storage->GetMaxObjectId() + 1;
+  a_storage->Update(iesTexId, &data2[0], data2.size() * sizeof(float));
+
+  const int32_t iesPdfId = a_storage->GetMaxObjectId() + 1;
+  a_storage->Update(iesPdfId, &data3[0], data3.size() * sizeof(float));
+
+  a_iesCache[pathW] = int2(iesTexId, iesPdfId);
+  if (haveHash)
+    a_iesCache[contentKey.str()] = int2(iesTexId, iesPdfId);
+
   return int2(iesTexId, iesPdfId);
 }
 
 
+std::vector<float4> DecodeTextureLevel0(const int4* a_header, const void* a_pages);
+
 void RenderDriverRTE::UpdatePdfTablesForLight(int32_t a_lightId)
 {
   // (1) list all tex id
@@ -528,6 +730,21 @@ void RenderDriverRTE::UpdatePdfTablesForLight(int32_t a_lightId)
         lumImage = LuminanceFromUchar4Image((const uchar4*)pData, w, h);
       else if (bpp == 16)
         lumImage = LuminanceFromFloat4Image((const float4*)pData, w, h);
+      else if ((bpp & TEX_FORMAT_MASK) == TEX_FORMAT_BC6H    || (bpp & TEX_FORMAT_MASK) == TEX_FORMAT_RGBA32F || 
+               (bpp & TEX_FORMAT_MASK) == TEX_FORMAT_RGBA16F || (bpp & TEX_FORMAT_MASK) == TEX_FORMAT_RGB9E5)
+      {
+        const std::vector<float4> decoded = DecodeTextureLevel0(pHeader, PagedTextureData(texId));
+        lumImage = LuminanceFromFloat4Image(decoded.data(), w, h);
+      }
+      else
+      {
+        const std::vector<float4> decoded = DecodeTextureLevel0(pHeader, PagedTextureData(texId));
+        std::vector<uchar4> decodedLDR(decoded.size());
+        for (size_t i = 0; i < decoded.size(); i++)
+          decodedLDR[i] = uchar4((unsigned char)(decoded[i].x*255.0f + 0.5f), (unsigned char)(decoded[i].y*255.0f + 0.5f), 
+                                 (unsigned char)(decoded[i].z*255.0f + 0.5f), (unsigned char)(decoded[i].w*255.0f + 0.5f));
+        lumImage = LuminanceFromUchar4Image(decodedLDR.data(), w, h);
+      }
     }
     else
     {
@@ -543,24 +760,49 @@ void RenderDriverRTE::UpdatePdfTablesForLight(int32_t a_lightId)
 
     // (4) calc pdf table and find correct id of it for current light - m_lights[a_lightId]
     //
-    std::vector<float> pdfTable = PrefixSumm(lumImage);
-    
+    if (w <= MAX_ENV_LIGHT_PDF_SIZE && h <= MAX_ENV_LIGHT_PDF_SIZE)
+    {
+      while (true)
+      {
+        std::vector<float> pdfTable = PrefixSumm(lumImage);
+        const std::vector<float> alias = AliasTableFromPrefixSumm(pdfTable);
 
-    // (5) update pdf table
-    //
-    std::vector<float> data(pdfTable.size() + 5);
+        // (5) update pdf table; alias table follows prefix summ (see sampleMap2D); downscale only if it does not fit
+        //
+        std::vector<float> data(pdfTable.size() + alias.size() + 4);
 
-    data[0] = as_float(w);
-    data[1] = as_float(h);
-    data[2] = as_float(1);
-    data[3] = as_float(int(pdfTable.size()+1));
+        data[0] = as_float(w);
+        data[1] = as_float(h);
+        data[2] = as_float(PDF_TABLE_LAYOUT_FLAT);
+        data[3] = as_float(int(pdfTable.size()));
 
-    for (size_t i = 0; i < pdfTable.size(); i++)
-      data[i + 4] = pdfTable[i];
+        for (size_t i = 0; i < pdfTable.size(); i++)
+          data[i + 4] = pdfTable[i];
     
-    data[data.size() - 1] = 1.0f;
+        for (size_t i = 0; i < alias.size(); i++)
+          data[i + 4 + pdfTable.size()] = alias[i];
+
+        if (m_pPdfStorage->Update(pdfTabId[i], &data[0], data.size() * sizeof(float)) != -1 || (w == 1 && h == 1))
+          break;
+
+        std::cerr << "RenderDriverRTE::UpdatePdfTablesForLight: pdf storage is full, downscale pdf of (" << w << "," << h << ")" << std::endl;
+        lumImage = resizeToHalfSizef1(lumImage, w, h);
+      }
+    }
+    else
+    {
+      // (5) large maps are sampled with luminance pyramid at full resolution (see sampleMap2DMip); downscale only if it does not fit
+      //
+      while (true)
+      {
+        const std::vector<float> data = MipPyramidFromLuminance(lumImage, w, h);
+        if (m_pPdfStorage->Update(pdfTabId[i], &data[0], data.size() * sizeof(float)) != -1 || (w == 1 && h == 1))
+          break;
 
-    m_pPdfStorage->Update(pdfTabId[i], &data[0], data.size() * sizeof(float));
+        std::cerr << "RenderDriverRTE::UpdatePdfTablesForLight: pdf storage is full, downscale pdf of (" << w << "," << h << ")" << std::endl;
+        lumImage = resizeToHalfSizef1(lumImage, w, h);
+      }
+    }
 
     // (6) set pdfTabId to light
     //
@@ -668,7 +910,10 @@ std::vector<float> CalcTrianglePickProbTable(const PlainMesh* pLMesh, double* a_
     (*a_pOutSurfaceAreaTotal) += double(triSA);
   }
 
-  return PrefixSumm(triangleSurfaceArea);
+  std::vector<float> table       = PrefixSumm(triangleSurfaceArea);
+  const std::vector<float> alias = AliasTableFromPrefixSumm(table);
+  table.insert(table.end(), alias.begin(), alias.end());  // see MeshLightSamplePos
+  return table;
 }
 
 
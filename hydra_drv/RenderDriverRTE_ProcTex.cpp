@@ -609,7 +609,7 @@ bool RenderDriverRTE::UpdateImageProc(int32_t a_texId, int32_t w, int32_t h, int
     while (std::getline(procTexIn, line))
     {
       line = std::regex_replace(line.c_str(), tail, 
-                                " __global const float4* restrict in_texStorage1, __global const EngineGlobals* restrict in_globals, const float3 hr_viewVectorHack");
+                                " __global float4*                in_texStorage1, __global const EngineGlobals* restrict in_globals, const float3 hr_viewVectorHack");
       m_outProcTexFile << line.c_str() << std::endl;
     }
   }
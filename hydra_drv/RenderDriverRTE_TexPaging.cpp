@@ -0,0 +1,266 @@
+#include "RenderDriverRTE.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <cstdio>
+
+std::wstring s2ws(const std::string& s);
+
+int  TextureMipLevelsNum(int w, int h);
+void BuildTextureMipChain(const void* a_data, int w, int h, int a_bpp, int a_levels, std::vector<uint8_t>& a_out);
+
+constexpr static int TEX_PAGES_MIN_FREE_SLOTS = 64;  ///< cache always have at least this number of slots for non pinned pages
+constexpr static int TEX_PAGES_PER_PASS       = 256; ///< limit of pages streamed between two passes for single texture (4 MB)
+
+/**
+\brief FNV-1a hash of texture level 0; together with process id and sequence number it gives unique page file name.
+
+*/
+static uint64_t TextureContentHash(const void* a_data, size_t a_sizeInBytes)
+{
+  const uint8_t* bytes = (const uint8_t*)a_data;
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < a_sizeInBytes; i++)
+  {
+    hash ^= uint64_t(bytes[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/**
+\brief Copy page (a_pageX, a_pageY) of texture level to a_out; borders of incomplete pages are clamped.
+\param a_level - level texels, a_bpp bytes each
+\param a_out   - TEX_PAGE_BYTES of page data; rows are pageSize.x texels each
+
+*/
+static void CopyTexturePage(const uint8_t* a_level, int w, int h, int a_bpp, int2 a_pageSize, int a_pageX, int a_pageY, uint8_t* a_out)
+{
+  for (int y = 0; y < a_pageSize.y; y++)
+  {
+    const int srcY = std::min(a_pageY*a_pageSize.y + y, h - 1);
+    for (int x = 0; x < a_pageSize.x; x++)
+    {
+      const int srcX = std::min(a_pageX*a_pageSize.x + x, w - 1);
+      memcpy(a_out + (size_t(y)*size_t(a_pageSize.x) + size_t(x))*a_bpp, a_level + (size_t(srcY)*size_t(w) + size_t(srcX))*a_bpp, a_bpp);
+    }
+  }
+}
+
+/**
+\brief Put texture to storage as TEX_LAYOUT_PAGED (see read_texel_paged). All pages of full mip chain are written to disk, storage keeps only
+       page table and cache of a_cacheSizeInBytes. Coarse levels that fit single page are always resident.
+\return false if page file can't be written or storage is out of memory; texture should be downscaled then
+
+*/
+bool RenderDriverRTE::UpdateImagePaged(int32_t a_texId, int32_t w, int32_t h, int32_t bpp, const void* a_data, size_t a_cacheSizeInBytes)
+{
+  const int mips = TextureMipLevelsNum(w, h);
+  std::vector<uint8_t> mipData;
+  BuildTextureMipChain(a_data, w, h, bpp, mips, mipData);
+  if (mipData.empty())
+    return false;
+
+  const int2 pageSize = texturePageSize(bpp);
+
+  // (1) write all pages to disk, level by level. Texcache is shared by all hydra processes and other process may have
+  //     its page file mapped, so file is unique for process, texture content and call; it is deleted with PagedTexture::pages.
+  //
+  static std::atomic<uint32_t> fileCounter(0);
+
+  std::stringstream fileName;
+  fileName << HydraTexCachePath() << "texpages_" << HydraProcessId() << "_" << fileCounter++ << "_" << std::hex
+           << TextureContentHash(a_data, size_t(w)*size_t(h)*size_t(bpp)) << std::dec << ".bin";
+
+  int pagesTotal  = 0;
+  int pinnedLevel = -1;
+  int pinnedStart = 0;
+  {
+    std::ofstream fout(fileName.str().c_str(), std::ios::binary);
+    if (!fout.is_open())
+    {
+      std::cerr << "RenderDriverRTE::UpdateImagePaged: can't write page file " << fileName.str().c_str() << std::endl;
+      return false;
+    }
+
+    std::vector<uint8_t> page(TEX_PAGE_BYTES);
+    const uint8_t* level = (const uint8_t*)a_data;
+    int lw = w, lh = h;
+
+    for (int lvl = 0; lvl < mips; lvl++)
+    {
+      if (pinnedLevel == -1 && lw <= pageSize.x && lh <= pageSize.y)
+      {
+        pinnedLevel = lvl;
+        pinnedStart = pagesTotal;
+      }
+
+      const int pagesX = (lw + pageSize.x - 1) / pageSize.x;
+      const int pagesY = (lh + pageSize.y - 1) / pageSize.y;
+
+      for (int py = 0; py < pagesY; py++)
+      {
+        for (int px = 0; px < pagesX; px++)
+        {
+          CopyTexturePage(level, lw, lh, bpp, pageSize, px, py, page.data());
+          fout.write((const char*)page.data(), TEX_PAGE_BYTES);
+        }
+      }
+
+      pagesTotal += pagesX*pagesY;
+      level       = (lvl == 0) ? mipData.data() : level + size_t(lw)*size_t(lh)*size_t(bpp);
+      lw          = std::max(lw / 2, 1);
+      lh          = std::max(lh / 2, 1);
+    }
+
+    if (!fout.good())
+    {
+      fout.close();
+      std::remove(fileName.str().c_str());
+      return false;
+    }
+  }
+
+  auto pFile = std::make_shared<MemoryMappedFile>();
+  pFile->RemoveOnDestroy(fileName.str());
+  if (!pFile->Open(s2ws(fileName.str())))
+    return false;
+
+  // (2) allocate header, page table, request flags and cache slots; pin coarse levels to the first slots
+  //
+  const int pinnedPages = pagesTotal - pinnedStart;
+  const int slotsNum    = std::min(pagesTotal, std::max(int(a_cacheSizeInBytes / TEX_PAGE_BYTES), pinnedPages + TEX_PAGES_MIN_FREE_SLOTS));
+  const int align       = int(m_pTexStorage->GetAlignSizeInBytes());
+  const int slotsBegin  = int(roundBlocks(sizeof(int4)*2 + sizeof(int)*2*size_t(pagesTotal), align));
+
+  if (m_pTexStorage->Update(a_texId, nullptr, size_t(slotsBegin) + size_t(slotsNum)*size_t(TEX_PAGE_BYTES)) == -1)
+  {
+    std::cerr << "RenderDriverRTE::UpdateImagePaged: can't append texture to tex storage; id = " << a_texId << std::endl;
+    return false;
+  }
+
+  PagedTexture tex;
+  tex.format          = bpp | TEX_LAYOUT_PAGED;
+  tex.pagesTotal      = pagesTotal;
+  tex.pinnedPageStart = pinnedStart;
+  tex.slotsBegin      = slotsBegin;
+  tex.slotsNum        = slotsNum;
+  tex.slotOfPage.resize(pagesTotal, -1);
+  tex.pageOfSlot.resize(slotsNum, -1);
+  tex.slotTime.resize(slotsNum, 0);
+  tex.pages           = pFile;
+
+  std::vector<int> head(slotsBegin / sizeof(int), 0);
+  int4* header = (int4*)head.data();
+  header[0]    = make_int4(w, h, mips, tex.format);
+  header[1]    = make_int4(pagesTotal, pinnedLevel, pinnedStart, slotsBegin / int(sizeof(int4)));
+
+  for (int i = 0; i < pinnedPages; i++)
+  {
+    head[sizeof(int4)*2/sizeof(int) + pinnedStart + i] = i + 1;
+    tex.slotOfPage[pinnedStart + i] = i;
+    tex.pageOfSlot[i]               = pinnedStart + i;
+  }
+
+  m_pTexStorage->UpdatePartial(a_texId, head.data(), 0, head.size()*sizeof(int));
+
+  const uint8_t* pages = (const uint8_t*)pFile->Data();
+  m_pTexStorage->UpdatePartial(a_texId, pages + size_t(pinnedStart)*TEX_PAGE_BYTES, slotsBegin, size_t(pinnedPages)*TEX_PAGE_BYTES);
+
+  if (m_pHWLayer->GetAllFlagsAndVars().m_varsI[HRT_SILENT_MODE] == 0)
+    std::cout << "page tex id = " << a_texId << " (" << w << "," << h << "); pages = " << pagesTotal << ", cache slots = " << slotsNum << std::endl;
+
+  m_pagedTextures[a_texId] = tex;
+  return true;
+}
+
+const void* RenderDriverRTE::PagedTextureData(int32_t a_texId) const
+{
+  const auto p = m_pagedTextures.find(a_texId);
+  return (p == m_pagedTextures.end()) ? nullptr : p->second.pages->Data();
+}
+
+/**
+\brief Read page requests that fetch functions wrote during previous passes, load requested pages from disk to free or oldest cache slots
+       and update page tables. Must be called between passes.
+
+*/
+void RenderDriverRTE::StreamTexturePages()
+{
+  bool passesStopped = false;
+
+  for (auto& texPair : m_pagedTextures)
+  {
+    const int32_t texId = texPair.first;
+    PagedTexture& tex   = texPair.second;
+
+    // requests follow page table: header, info, pageTable[pagesTotal], requests[pagesTotal]
+    //
+    const size_t tableOffset = sizeof(int4)*2;
+    std::vector<int> tableAndRequests(size_t(tex.pagesTotal)*2);
+    m_pTexStorage->ReadPartial(texId, tableAndRequests.data() + tex.pagesTotal, tableOffset + sizeof(int)*size_t(tex.pagesTotal), sizeof(int)*size_t(tex.pagesTotal));
+
+    std::vector<int> requested;
+    for (int page = 0; page < tex.pagesTotal && int(requested.size()) < TEX_PAGES_PER_PASS; page++)
+    {
+      if (tableAndRequests[tex.pagesTotal + page] != 0 && tex.slotOfPage[page] == -1)
+        requested.push_back(page);
+    }
+
+    if (requested.empty())
+      continue;
+
+    if (!passesStopped)
+    {
+      m_pHWLayer->StopAsyncPasses();
+      passesStopped = true;
+    }
+
+    // pinned pages occupy the first slots and are never replaced; others are replaced in the order they were streamed
+    //
+    const int pinnedPages = tex.pagesTotal - tex.pinnedPageStart;
+    const int freeSlots   = tex.slotsNum - pinnedPages;
+    if (int(requested.size()) > freeSlots)
+      requested.resize(freeSlots);
+
+    std::vector<int> victims(freeSlots);
+    for (int i = 0; i < freeSlots; i++)
+      victims[i] = pinnedPages + i;
+
+    std::partial_sort(victims.begin(), victims.begin() + requested.size(), victims.end(),
+                      [&tex](int a, int b) { return tex.slotTime[a] < tex.slotTime[b]; });
+
+    const uint8_t* pages = (const uint8_t*)tex.pages->Data();
+
+    for (size_t i = 0; i < requested.size(); i++)
+    {
+      const int slot = victims[i];
+      const int page = requested[i];
+
+      if (tex.pageOfSlot[slot] != -1)
+        tex.slotOfPage[tex.pageOfSlot[slot]] = -1;
+
+      tex.pageOfSlot[slot] = page;
+      tex.slotOfPage[page] = slot;
+      tex.slotTime  [slot] = ++tex.streamCounter;
+
+      m_pTexStorage->UpdatePartial(texId, pages + size_t(page)*TEX_PAGE_BYTES, size_t(tex.slotsBegin) + size_t(slot)*TEX_PAGE_BYTES, TEX_PAGE_BYTES);
+    }
+
+    // upload new page table and clear all requests at once
+    //
+    for (int page = 0; page < tex.pagesTotal; page++)
+    {
+      tableAndRequests[page]                  = tex.slotOfPage[page] + 1;
+      tableAndRequests[tex.pagesTotal + page]  = 0;
+    }
+
+    m_pTexStorage->UpdatePartial(texId, tableAndRequests.data(), tableOffset, tableAndRequests.size()*sizeof(int));
+  }
+}
@@ -0,0 +1,770 @@
+#include "RenderDriverRTE.h"
+#include "../../HydraAPI/hydra_api/ssemath.h"
+
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <smmintrin.h>
+
+/**
+\brief Number of mip levels in full mip chain (down to 1x1) including level 0.
+
+*/
+int TextureMipLevelsNum(int w, int h)
+{
+  int levels = 1;
+  while (w > 1 || h > 1)
+  {
+    w = std::max(w / 2, 1);
+    h = std::max(h / 2, 1);
+    levels++;
+  }
+  return levels;
+}
+
+static inline uint8_t AvgOf4(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { return uint8_t((int(a) + int(b) + int(c) + int(d) + 2) / 4); }
+static inline float   AvgOf4(float a,   float b,   float c,   float d)   { return 0.25f*(a + b + c + d); }
+
+template<typename T>
+static void DownsampleBox2x2(const T* a_src, const int w, const int h, T* a_dst, const int w2, const int h2)
+{
+  #pragma omp parallel for if(w2*h2 >= 65536)
+  for (int y = 0; y < h2; y++)
+  {
+    const int y0 = std::min(2*y + 0, h - 1);
+    const int y1 = std::min(2*y + 1, h - 1);
+
+    for (int x = 0; x < w2; x++)
+    {
+      const int x0 = std::min(2*x + 0, w - 1);
+      const int x1 = std::min(2*x + 1, w - 1);
+
+      const T* p00 = a_src + (y0*w + x0)*4;
+      const T* p01 = a_src + (y0*w + x1)*4;
+      const T* p10 = a_src + (y1*w + x0)*4;
+      const T* p11 = a_src + (y1*w + x1)*4;
+      T* pOut      = a_dst + (y*w2 + x)*4;
+
+      for (int c = 0; c < 4; c++)
+        pOut[c] = AvgOf4(p00[c], p01[c], p10[c], p11[c]);
+    }
+  }
+}
+
+template<typename T>
+static void BuildMipChainT(const T* a_data, int w, int h, int a_levels, T* a_out)
+{
+  const T* src = a_data;
+  T*       dst = a_out;
+
+  for (int level = 1; level < a_levels; level++)
+  {
+    const int w2 = std::max(w / 2, 1);
+    const int h2 = std::max(h / 2, 1);
+
+    DownsampleBox2x2(src, w, h, dst, w2, h2);
+
+    src = dst;
+    dst = dst + size_t(w2)*size_t(h2)*4;
+    w   = w2;
+    h   = h2;
+  }
+}
+
+/**
+\brief Build mip chain for texture with 2x2 box filter.
+\param a_data   - level 0; w*h pixels of uchar4 (a_bpp == 4) or float4 (a_bpp == 16)
+\param a_levels - total number of levels including level 0
+\param a_out    - levels [1, a_levels) one after another, same layout as textureMipOffset expects
+
+LDR textures are filtered in stored (gamma) space, same as bilinear filtering in read_imagef_sw4 does.
+
+*/
+void BuildTextureMipChain(const void* a_data, int w, int h, int a_bpp, int a_levels, std::vector<uint8_t>& a_out)
+{
+  size_t pixels = 0;
+  for (int level = 1, lw = w, lh = h; level < a_levels; level++)
+  {
+    lw = std::max(lw / 2, 1);
+    lh = std::max(lh / 2, 1);
+    pixels += size_t(lw)*size_t(lh);
+  }
+
+  a_out.resize(pixels*size_t(a_bpp));
+
+  if (a_bpp == 4)
+    BuildMipChainT((const uint8_t*)a_data, w, h, a_levels, (uint8_t*)a_out.data());
+  else if (a_bpp == 16)
+    BuildMipChainT((const float*)a_data, w, h, a_levels, (float*)a_out.data());
+  else
+    a_out.clear();
+}
+
+static inline float Lanczos2(float x)
+{
+  x = fabs(x);
+  if (x < 1e-5f)
+    return 1.0f;
+  else if (x >= 2.0f)
+    return 0.0f;
+
+  const float px = M_PI*x;
+  return 2.0f*sin(px)*sin(0.5f*px)/(px*px);
+}
+
+/**
+\brief Taps of separable Lanczos2 filter that resize a_srcSize pixels to a_dstSize; filter is widened by the scale when downsampling.
+\param a_spans   - (first source pixel, taps number) for each destination pixel
+\param a_weights - normalized weights, a_maxTaps per destination pixel; taps outside of image are clamped to the border pixels
+
+*/
+static void ResampleWeights(const int a_srcSize, const int a_dstSize, std::vector<int2>& a_spans, std::vector<float>& a_weights, int& a_maxTaps)
+{
+  const float scale   = float(a_srcSize) / float(a_dstSize);
+  const float fscale  = std::max(scale, 1.0f);
+  const float support = 2.0f*fscale;
+
+  a_maxTaps = int(ceil(2.0f*support)) + 1;
+  a_spans.resize(a_dstSize);
+  a_weights.assign(size_t(a_dstSize)*size_t(a_maxTaps), 0.0f);
+
+  for (int i = 0; i < a_dstSize; i++)
+  {
+    const float center = (float(i) + 0.5f)*scale - 0.5f;
+    const int   first  = int(floor(center - support)) + 1;
+    const int   count  = std::min(int(floor(center + support)) - first + 1, a_maxTaps);
+    float*      w      = a_weights.data() + size_t(i)*size_t(a_maxTaps);
+
+    float sum = 0.0f;
+    for (int k = 0; k < count; k++)
+    {
+      w[k] = Lanczos2((float(first + k) - center) / fscale);
+      sum += w[k];
+    }
+
+    for (int k = 0; k < count; k++)
+      w[k] /= sum;
+
+    a_spans[i] = make_int2(first, count);
+  }
+}
+
+/**
+\brief Resize texture with separable Lanczos2 filter. Both passes are parallel over rows and filter all 4 channels at once with SSE.
+\param a_data - w*h pixels of uchar4 (a_bpp == 4) or float4 (a_bpp == 16)
+\param a_out  - a_newW*a_newH pixels in the same format
+
+LDR textures are filtered in linear space (gamma 2.2, alpha is linear), HDR results are clamped to non negative values.
+
+*/
+void ResampleTexture(const void* a_data, int w, int h, int a_bpp, int a_newW, int a_newH, std::vector<uint8_t>& a_out)
+{
+  std::vector<int2>  spansX, spansY;
+  std::vector<float> weightsX, weightsY;
+  int tapsX = 0, tapsY = 0;
+
+  ResampleWeights(w, a_newW, spansX, weightsX, tapsX);
+  ResampleWeights(h, a_newH, spansY, weightsY, tapsY);
+
+  // (1) horizontal pass: (w, h) --> (a_newW, h), each row is converted to linear float4 first
+  //
+  std::vector<float> tmp(size_t(a_newW)*size_t(h)*4);
+
+  #pragma omp parallel
+  {
+    std::vector<float> row(size_t(w)*4);
+
+    #pragma omp for
+    for (int y = 0; y < h; y++)
+    {
+      if (a_bpp == 4)
+      {
+        const uint8_t* src = (const uint8_t*)a_data + size_t(y)*size_t(w)*4;
+        for (int x = 0; x < w; x++)
+        {
+          row[x*4 + 0] = g_gamma22Table[src[x*4 + 0]];
+          row[x*4 + 1] = g_gamma22Table[src[x*4 + 1]];
+          row[x*4 + 2] = g_gamma22Table[src[x*4 + 2]];
+          row[x*4 + 3] = float(src[x*4 + 3])*(1.0f / 255.0f);
+        }
+      }
+      else
+        memcpy(row.data(), (const float*)a_data + size_t(y)*size_t(w)*4, size_t(w)*sizeof(float)*4);
+
+      float* dst = tmp.data() + size_t(y)*size_t(a_newW)*4;
+      for (int x = 0; x < a_newW; x++)
+      {
+        const float* wk = weightsX.data() + size_t(x)*size_t(tapsX);
+        __m128 acc = _mm_setzero_ps();
+        for (int k = 0; k < spansX[x].y; k++)
+        {
+          const int sx = std::min(std::max(spansX[x].x + k, 0), w - 1);
+          acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set_ps1(wk[k]), _mm_loadu_ps(row.data() + sx*4)));
+        }
+        _mm_storeu_ps(dst + x*4, acc);
+      }
+    }
+  }
+
+  // (2) vertical pass: (a_newW, h) --> (a_newW, a_newH) and conversion back to texture format
+  //
+  a_out.resize(size_t(a_newW)*size_t(a_newH)*size_t(a_bpp));
+
+  const __m128 gammaInv = _mm_set_ps1(1.0f / 2.2f);
+  const __m128 const255 = _mm_set_ps1(255.0f);
+  const __m128 rounding = _mm_set_ps1(0.5f);
+  const __m128 one      = _mm_set_ps1(1.0f);
+
+  #pragma omp parallel for
+  for (int y = 0; y < a_newH; y++)
+  {
+    const float* wk = weightsY.data() + size_t(y)*size_t(tapsY);
+
+    for (int x = 0; x < a_newW; x++)
+    {
+      __m128 acc = _mm_setzero_ps();
+      for (int k = 0; k < spansY[y].y; k++)
+      {
+        const int sy = std::min(std::max(spansY[y].x + k, 0), h - 1);
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set_ps1(wk[k]), _mm_loadu_ps(tmp.data() + (size_t(sy)*size_t(a_newW) + size_t(x))*4)));
+      }
+
+      acc = _mm_max_ps(acc, _mm_setzero_ps());
+      const size_t pixel = size_t(y)*size_t(a_newW) + size_t(x);
+
+      if (a_bpp == 4)
+      {
+        acc = _mm_min_ps(acc, one);
+        __m128 color = HydraSSE::powf4(acc, gammaInv);
+        color        = _mm_blend_ps(color, acc, 8); // alpha stays linear
+
+        const __m128i rgba = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(color, const255), rounding));
+        const __m128i out  = _mm_packus_epi16(_mm_packus_epi32(rgba, _mm_setzero_si128()), _mm_setzero_si128());
+        ((uint32_t*)a_out.data())[pixel] = uint32_t(_mm_cvtsi128_si32(out));
+      }
+      else
+        _mm_storeu_ps((float*)a_out.data() + pixel*4, acc);
+    }
+  }
+}
+
+/**
+\brief Decode level 0 of texture in any storage format (block compressed for example) to plain float4 pixels.
+\param a_header - texture header inside texture storage; data follows it
+\param a_pages  - page file data for TEX_LAYOUT_PAGED textures (see PagedTextureData); level 0 is never resident completely, so it is decoded 
+                  from disk and page requests in texture storage are not touched
+
+*/
+std::vector<float4> DecodeTextureLevel0(const int4* a_header, const void* a_pages)
+{
+  const int w      = a_header->x;
+  const int h      = a_header->y;
+  const int format = a_header->w;
+
+  std::vector<float4> res(size_t(w)*size_t(h));
+
+  if (format & TEX_LAYOUT_PAGED)
+  {
+    assert(a_pages != nullptr);
+    const int2 pageSize = texturePageSize(format);
+    const int  pagesX   = (w + pageSize.x - 1) / pageSize.x;
+
+    #pragma omp parallel for
+    for (int y = 0; y < h; y++)
+    {
+      for (int x = 0; x < w; x++)
+      {
+        const int   page = (y / pageSize.y)*pagesX + (x / pageSize.x); // level 0 pages go first in page file
+        const uint* data = (const uint*)a_pages + size_t(page)*(TEX_PAGE_BYTES / 4);
+        res[size_t(y)*size_t(w) + size_t(x)] = read_texel_sw(data, x % pageSize.x, y % pageSize.y, pageSize.x, format & TEX_FORMAT_MASK);
+      }
+    }
+
+    return res;
+  }
+
+  #pragma omp parallel for
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++)
+      res[size_t(y)*size_t(w) + size_t(x)] = read_texel_level(a_header, 0, x, y, w, h, format);
+
+  return res;
+}
+
+/**
+\brief Select block compressed format for texture or return a_bpp if texture should stay uncompressed.
+
+LDR: greyscale opaque -> BC4, opaque -> BC1, with alpha -> BC3. HDR: opaque and non negative -> BC6H.
+
+*/
+int ChooseTextureCompression(const void* a_data, int w, int h, int a_bpp)
+{
+  const size_t pixels = size_t(w)*size_t(h);
+
+  if (a_bpp == 4)
+  {
+    const uint8_t* data = (const uint8_t*)a_data;
+    bool opaque = true;
+    bool grey   = true;
+    for (size_t i = 0; i < pixels && (opaque || grey); i++)
+    {
+      const uint8_t* p = data + i*4;
+      opaque = opaque && (p[3] == 255);
+      grey   = grey   && (p[0] == p[1]) && (p[1] == p[2]);
+    }
+
+    if (!opaque)
+      return TEX_FORMAT_BC3;
+    return grey ? TEX_FORMAT_BC4 : TEX_FORMAT_BC1;
+  }
+  else if (a_bpp == 16)
+  {
+    const float* data = (const float*)a_data;
+    for (size_t i = 0; i < pixels; i++)
+    {
+      const float* p = data + i*4;
+      if (p[3] != 1.0f || !(p[0] >= 0.0f && p[1] >= 0.0f && p[2] >= 0.0f) || p[0] > 65504.0f || p[1] > 65504.0f || p[2] > 65504.0f)
+        return a_bpp;
+    }
+    return TEX_FORMAT_BC6H;
+  }
+
+  return a_bpp;
+}
+
+static inline uint32_t PackRGB565(const float c[3])
+{
+  const uint32_t r = uint32_t(std::min(std::max(c[0], 0.0f), 1.0f)*31.0f + 0.5f);
+  const uint32_t g = uint32_t(std::min(std::max(c[1], 0.0f), 1.0f)*63.0f + 0.5f);
+  const uint32_t b = uint32_t(std::min(std::max(c[2], 0.0f), 1.0f)*31.0f + 0.5f);
+  return (r << 11) | (g << 5) | b;
+}
+
+static inline void UnpackRGB565(const uint32_t c, float a_out[3])
+{
+  a_out[0] = float((c >> 11) & 31)*(1.0f / 31.0f);
+  a_out[1] = float((c >> 5)  & 63)*(1.0f / 63.0f);
+  a_out[2] = float(c & 31)*(1.0f / 31.0f);
+}
+
+static inline float DistSq3(const float a[3], const float b[3])
+{
+  const float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+  return dx*dx + dy*dy + dz*dz;
+}
+
+/**
+\brief Fit line to 16 points with principal axis of their covariance; outputs line endpoints that cover all points.
+
+*/
+static void FitLineEndpoints(const float a_pts[16][3], float a_end0[3], float a_end1[3])
+{
+  float mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 3; c++)
+      mean[c] += a_pts[i][c]*(1.0f / 16.0f);
+
+  float cov[6] = {0, 0, 0, 0, 0, 0}; // xx xy xz yy yz zz
+  for (int i = 0; i < 16; i++)
+  {
+    const float d[3] = {a_pts[i][0] - mean[0], a_pts[i][1] - mean[1], a_pts[i][2] - mean[2]};
+    cov[0] += d[0]*d[0]; cov[1] += d[0]*d[1]; cov[2] += d[0]*d[2];
+    cov[3] += d[1]*d[1]; cov[4] += d[1]*d[2]; cov[5] += d[2]*d[2];
+  }
+
+  float axis[3] = {1, 1, 1};
+  for (int iter = 0; iter < 8; iter++)
+  {
+    const float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+    const float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+    const float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+    const float len = std::max(std::max(std::abs(x), std::abs(y)), std::abs(z));
+    if (len <= 0.0f)
+      break;
+    axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+  }
+
+  const float lenSq = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+  float tMin = 0.0f, tMax = 0.0f;
+  for (int i = 0; i < 16; i++)
+  {
+    const float t = ((a_pts[i][0] - mean[0])*axis[0] + (a_pts[i][1] - mean[1])*axis[1] + (a_pts[i][2] - mean[2])*axis[2]) / std::max(lenSq, 1e-20f);
+    tMin = std::min(tMin, t);
+    tMax = std::max(tMax, t);
+  }
+
+  for (int c = 0; c < 3; c++)
+  {
+    a_end0[c] = mean[c] + axis[c]*tMax;
+    a_end1[c] = mean[c] + axis[c]*tMin;
+  }
+}
+
+/**
+\brief BC1 colour block in 4 colour mode (c0 > c1); rgb in [0,1].
+
+*/
+static void EncodeBC1Block(const float a_rgb[16][3], uint32_t a_out[2])
+{
+  float e0[3], e1[3];
+  FitLineEndpoints(a_rgb, e0, e1);
+
+  uint32_t c0 = PackRGB565(e0);
+  uint32_t c1 = PackRGB565(e1);
+  if (c0 < c1)
+    std::swap(c0, c1);
+
+  a_out[0] = c0 | (c1 << 16);
+  a_out[1] = 0;
+  if (c0 == c1) // all texels are endpoint 0 in both modes
+    return;
+
+  float pal[4][3];
+  UnpackRGB565(c0, pal[0]);
+  UnpackRGB565(c1, pal[1]);
+  for (int c = 0; c < 3; c++)
+  {
+    pal[2][c] = (2.0f*pal[0][c] + pal[1][c])*(1.0f / 3.0f);
+    pal[3][c] = (pal[0][c] + 2.0f*pal[1][c])*(1.0f / 3.0f);
+  }
+
+  for (int i = 0; i < 16; i++)
+  {
+    uint32_t best = 0;
+    float    dist = DistSq3(a_rgb[i], pal[0]);
+    for (uint32_t k = 1; k < 4; k++)
+    {
+      const float d = DistSq3(a_rgb[i], pal[k]);
+      if (d < dist) { dist = d; best = k; }
+    }
+    a_out[1] |= best << (2*i);
+  }
+}
+
+/**
+\brief BC4 block in 8 value mode (e0 > e1); values in [0,1].
+
+*/
+static void EncodeBC4Block(const float a_val[16], uint32_t a_out[2])
+{
+  int v[16];
+  int e0 = 0, e1 = 255;
+  for (int i = 0; i < 16; i++)
+  {
+    v[i] = int(std::min(std::max(a_val[i], 0.0f), 1.0f)*255.0f + 0.5f);
+    e0   = std::max(e0, v[i]);
+    e1   = std::min(e1, v[i]);
+  }
+
+  uint64_t bits = uint64_t(e0) | (uint64_t(e1) << 8);
+
+  if (e0 > e1)
+  {
+    int pal[8] = {7*e0, 7*e1, 0, 0, 0, 0, 0, 0};
+    for (int k = 2; k < 8; k++)
+      pal[k] = (8 - k)*e0 + (k - 1)*e1;
+
+    for (int i = 0; i < 16; i++)
+    {
+      int best = 0;
+      int dist = std::abs(7*v[i] - pal[0]);
+      for (int k = 1; k < 8; k++)
+      {
+        const int d = std::abs(7*v[i] - pal[k]);
+        if (d < dist) { dist = d; best = k; }
+      }
+      bits |= uint64_t(best) << (16 + 3*i);
+    }
+  }
+
+  a_out[0] = uint32_t(bits);
+  a_out[1] = uint32_t(bits >> 32);
+}
+
+static inline void PutBits(uint32_t* a_block, const int a_pos, const uint32_t a_val, const int a_count)
+{
+  for (int i = 0; i < a_count; i++)
+  {
+    const int pos = a_pos + i;
+    a_block[pos >> 5] |= ((a_val >> i) & 1u) << (pos & 31);
+  }
+}
+
+static inline int UnquantizeBC6H(const int q) { return (q == 0) ? 0 : ((q == 1023) ? 0xFFFF : (((q << 16) + 0x8000) >> 10)); }
+
+/**
+\brief BC6H block in mode 11 (single region, 10 bit endpoints, 4 bit indices); rgb are non negative half floats.
+
+Fitting is done in the space of half bit patterns, which is the space BC6H interpolates in. 
+
+*/
+static void EncodeBC6HBlock(const float a_rgb[16][3], uint32_t a_out[4])
+{
+  static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  float hbits[16][3];
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 3; c++)
+      hbits[i][c] = float(std::min(floatToHalf(std::max(a_rgb[i][c], 0.0f)), 0x7BFFu));
+
+  float e[2][3];
+  FitLineEndpoints(hbits, e[0], e[1]);
+
+  int q[2][3];
+  for (int k = 0; k < 2; k++)
+    for (int c = 0; c < 3; c++)
+      q[k][c] = std::min(std::max(int(e[k][c] / 31.0f + 0.5f), 0), 1023);
+
+  float pal[16][3];
+  for (int c = 0; c < 3; c++)
+  {
+    const int a = UnquantizeBC6H(q[0][c]);
+    const int b = UnquantizeBC6H(q[1][c]);
+    for (int k = 0; k < 16; k++)
+      pal[k][c] = float((((a*(64 - weights[k]) + b*weights[k] + 32) >> 6)*31) >> 6);
+  }
+
+  int idx[16];
+  for (int i = 0; i < 16; i++)
+  {
+    idx[i]     = 0;
+    float dist = DistSq3(hbits[i], pal[0]);
+    for (int k = 1; k < 16; k++)
+    {
+      const float d = DistSq3(hbits[i], pal[k]);
+      if (d < dist) { dist = d; idx[i] = k; }
+    }
+  }
+
+  if (idx[0] >= 8) // anchor index has only 3 bits; palette is symmetric, so swap endpoints
+  {
+    for (int c = 0; c < 3; c++)
+      std::swap(q[0][c], q[1][c]);
+    for (int i = 0; i < 16; i++)
+      idx[i] = 15 - idx[i];
+  }
+
+  a_out[0] = a_out[1] = a_out[2] = a_out[3] = 0;
+  PutBits(a_out, 0, 0x03, 5);
+  for (int k = 0; k < 2; k++)
+    for (int c = 0; c < 3; c++)
+      PutBits(a_out, 5 + 30*k + 10*c, uint32_t(q[k][c]), 10);
+
+  PutBits(a_out, 65, uint32_t(idx[0]), 3);
+  for (int i = 1; i < 16; i++)
+    PutBits(a_out, 64 + 4*i, uint32_t(idx[i]), 4);
+}
+
+/**
+\brief Compress single mip level; a_out must have textureLevelWords(w, h, a_format) words.
+
+*/
+static void CompressTextureLevel(const void* a_data, const int w, const int h, const int a_bpp, const int a_format, uint32_t* a_out)
+{
+  const int blocksX       = (w + 3) / 4;
+  const int blocksY       = (h + 3) / 4;
+  const int wordsPerBlock = (a_format == TEX_FORMAT_BC1 || a_format == TEX_FORMAT_BC4) ? 2 : 4;
+
+  #pragma omp parallel for if(blocksX*blocksY >= 1024)
+  for (int by = 0; by < blocksY; by++)
+  {
+    for (int bx = 0; bx < blocksX; bx++)
+    {
+      float px[16][4];
+      for (int i = 0; i < 16; i++)
+      {
+        const int x = std::min(bx*4 + (i & 3), w - 1);
+        const int y = std::min(by*4 + (i >> 2), h - 1);
+        const size_t offs = (size_t(y)*size_t(w) + size_t(x))*4;
+        for (int c = 0; c < 4; c++)
+          px[i][c] = (a_bpp == 4) ? float(((const uint8_t*)a_data)[offs + c])*(1.0f / 255.0f) : ((const float*)a_data)[offs + c];
+      }
+
+      float rgb[16][3], chan0[16], chan1[16];
+      for (int i = 0; i < 16; i++)
+      {
+        rgb[i][0] = px[i][0]; rgb[i][1] = px[i][1]; rgb[i][2] = px[i][2];
+        chan0[i]  = px[i][0];
+        chan1[i]  = (a_format == TEX_FORMAT_BC3) ? px[i][3] : px[i][1];
+      }
+
+      uint32_t* out = a_out + (size_t(by)*size_t(blocksX) + size_t(bx))*size_t(wordsPerBlock);
+
+      switch (a_format)
+      {
+      case TEX_FORMAT_BC1: EncodeBC1Block(rgb, out);                            break;
+      case TEX_FORMAT_BC3: EncodeBC4Block(chan1, out); EncodeBC1Block(rgb, out + 2); break;
+      case TEX_FORMAT_BC4: EncodeBC4Block(chan0, out);                          break;
+      case TEX_FORMAT_BC5: EncodeBC4Block(chan0, out); EncodeBC4Block(chan1, out + 2); break;
+      case TEX_FORMAT_BC6H: EncodeBC6HBlock(rgb, out);                          break;
+      default: break;
+      }
+    }
+  }
+}
+
+/**
+\brief Compress texture with all it's mip levels to block compressed format.
+\param a_data      - level 0 in plain format (a_bpp)
+\param a_mips      - in: levels [1, a_levels) in plain format as BuildTextureMipChain produce them; out: same levels compressed
+\param a_format    - one of block compressed TEX_FORMATS
+\param a_outLevel0 - compressed level 0
+
+*/
+void CompressTexture(const void* a_data, std::vector<uint8_t>& a_mips, int w, int h, int a_bpp, int a_levels, int a_format, std::vector<uint8_t>& a_outLevel0)
+{
+  a_outLevel0.resize(size_t(textureLevelWords(w, h, a_format))*sizeof(uint32_t));
+  CompressTextureLevel(a_data, w, h, a_bpp, a_format, (uint32_t*)a_outLevel0.data());
+
+  if (a_mips.empty())
+    return;
+
+  int wordsTotal = 0;
+  for (int level = 1, lw = w, lh = h; level < a_levels; level++)
+  {
+    lw = std::max(lw / 2, 1);
+    lh = std::max(lh / 2, 1);
+    wordsTotal += textureLevelWords(lw, lh, a_format);
+  }
+
+  std::vector<uint8_t> compressed(size_t(wordsTotal)*sizeof(uint32_t));
+
+  const uint8_t* src = a_mips.data();
+  uint32_t*      dst = (uint32_t*)compressed.data();
+  for (int level = 1; level < a_levels; level++)
+  {
+    w = std::max(w / 2, 1);
+    h = std::max(h / 2, 1);
+    CompressTextureLevel(src, w, h, a_bpp, a_format, dst);
+    src += size_t(w)*size_t(h)*size_t(a_bpp);
+    dst += textureLevelWords(w, h, a_format);
+  }
+
+  a_mips = std::move(compressed);
+}
+
+/**
+\brief Select storage format for float4 texture; a_requested is TEX_FORMAT_RGBA16F or TEX_FORMAT_RGB9E5.
+
+RGB9E5 needs opaque non negative data, otherwise half4 is used. Values that half can't hold keep texture in float4.
+
+*/
+int ChooseTextureHDRFormat(const float* a_data, int w, int h, int a_requested)
+{
+  const size_t pixels = size_t(w)*size_t(h);
+  const float  maxRGB9E5 = 65408.0f;
+  const float  maxHalf   = 65504.0f;
+
+  bool fitRGB9E5 = (a_requested == TEX_FORMAT_RGB9E5);
+  for (size_t i = 0; i < pixels; i++)
+  {
+    const float* p = a_data + i*4;
+    for (int c = 0; c < 4; c++)
+    {
+      if (!(std::abs(p[c]) <= maxHalf)) // also catch nan
+        return TEX_FORMAT_RGBA32F;
+    }
+    fitRGB9E5 = fitRGB9E5 && (p[3] == 1.0f) && (p[0] >= 0.0f) && (p[1] >= 0.0f) && (p[2] >= 0.0f) &&
+                (p[0] <= maxRGB9E5) && (p[1] <= maxRGB9E5) && (p[2] <= maxRGB9E5);
+  }
+
+  return fitRGB9E5 ? TEX_FORMAT_RGB9E5 : TEX_FORMAT_RGBA16F;
+}
+
+static inline uint32_t PackRGB9E5(const float* rgb)
+{
+  const float maxc = std::max(std::max(rgb[0], rgb[1]), std::max(rgb[2], 1e-30f));
+  int expShared    = std::max(-16, int(std::floor(std::log2(maxc)))) + 1 + 15;
+  if (int(std::floor(maxc / std::ldexp(1.0f, expShared - 24) + 0.5f)) == 512)
+    expShared++;
+
+  const float scale = std::ldexp(1.0f, 24 - expShared);
+  uint32_t res = uint32_t(expShared) << 27;
+  for (int c = 0; c < 3; c++)
+    res |= std::min(uint32_t(std::floor(rgb[c]*scale + 0.5f)), 511u) << (9*c);
+  return res;
+}
+
+/**
+\brief Convert float4 pixels to TEX_FORMAT_RGBA16F (8 bytes per pixel) or TEX_FORMAT_RGB9E5 (4 bytes per pixel).
+
+*/
+void ConvertTextureHDR(const float* a_data, size_t a_pixels, int a_format, std::vector<uint8_t>& a_out)
+{
+  a_out.resize(a_pixels*((a_format == TEX_FORMAT_RGB9E5) ? 4 : 8));
+  uint32_t* out = (uint32_t*)a_out.data();
+  const int64_t pixels = int64_t(a_pixels);
+
+  #pragma omp parallel for if(pixels >= 65536)
+  for (int64_t i = 0; i < pixels; i++)
+  {
+    const float* p = a_data + i*4;
+    if (a_format == TEX_FORMAT_RGB9E5)
+      out[i] = PackRGB9E5(p);
+    else
+    {
+      out[i*2 + 0] = floatToHalf(p[0]) | (floatToHalf(p[1]) << 16);
+      out[i*2 + 1] = floatToHalf(p[2]) | (floatToHalf(p[3]) << 16);
+    }
+  }
+}
+
+static void TileTextureLevel(const uint8_t* a_src, const int w, const int h, const int a_bytesPerPixel, uint8_t* a_dst)
+{
+  const int wp = (w + 3) & ~3;
+  const int hp = (h + 3) & ~3;
+
+  #pragma omp parallel for if(wp*hp >= 65536)
+  for (int y = 0; y < hp; y++)
+  {
+    const int ys = std::min(y, h - 1);
+    for (int x = 0; x < wp; x++)
+    {
+      const int xs = std::min(x, w - 1);
+      memcpy(a_dst + size_t(textureTiledOffset(x, y, w))*size_t(a_bytesPerPixel), a_src + (size_t(ys)*size_t(w) + size_t(xs))*size_t(a_bytesPerPixel), a_bytesPerPixel);
+    }
+  }
+}
+
+/**
+\brief Reorder plain texture with all it's mip levels to TEX_LAYOUT_TILED; borders of incomplete tiles are clamped.
+\param a_data          - level 0 in row major order
+\param a_mips          - in: levels [1, a_levels) in row major order; out: same levels tiled
+\param a_bytesPerPixel - 4, 8 or 16
+\param a_outLevel0     - tiled level 0
+
+*/
+void TileTexture(const void* a_data, std::vector<uint8_t>& a_mips, int w, int h, int a_bytesPerPixel, int a_levels, std::vector<uint8_t>& a_outLevel0)
+{
+  a_outLevel0.resize(size_t((w + 3) & ~3)*size_t((h + 3) & ~3)*size_t(a_bytesPerPixel));
+  TileTextureLevel((const uint8_t*)a_data, w, h, a_bytesPerPixel, a_outLevel0.data());
+
+  if (a_mips.empty())
+    return;
+
+  size_t tiledSize = 0;
+  for (int level = 1, lw = w, lh = h; level < a_levels; level++)
+  {
+    lw = std::max(lw / 2, 1);
+    lh = std::max(lh / 2, 1);
+    tiledSize += size_t((lw + 3) & ~3)*size_t((lh + 3) & ~3)*size_t(a_bytesPerPixel);
+  }
+
+  std::vector<uint8_t> tiled(tiledSize);
+
+  const uint8_t* src = a_mips.data();
+  uint8_t*       dst = tiled.data();
+  for (int level = 1; level < a_levels; level++)
+  {
+    w = std::max(w / 2, 1);
+    h = std::max(h / 2, 1);
+    TileTextureLevel(src, w, h, a_bytesPerPixel, dst);
+    src += size_t(w)*size_t(h)*size_t(a_bytesPerPixel);
+    dst += size_t((w + 3) & ~3)*size_t((h + 3) & ~3)*size_t(a_bytesPerPixel);
+  }
+
+  a_mips = std::move(tiled);
+}
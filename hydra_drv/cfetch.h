@@ -65,8 +65,8 @@ typedef struct GlobalRenderDataT
   int lightsSize;         
                           
   int lightsNum;
-  int dummy1;
-  int dummy2;
+  int lightTreeOffset;    ///< light BVH, see LightTreeSelect in clight.h
+  int lightTreeSize;      ///< size of light BVH in floats; 0 if it was not built
   int dummy3;
   
   int        sunNumber;           // #change this?
@@ -84,17 +84,102 @@ static inline void InitEngineGlobals(EngineGlobals* a_pGlobals)
 }
 #endif
 
+/**
+\brief Texture data formats. Plain formats are coded with their bytes per pixel (except RGB9E5); block compressed formats have codes above TEX_FORMAT_BLOCK_FIRST.
+
+*/
+enum TEX_FORMATS { TEX_FORMAT_RGBA8       = 4,     ///< uchar4
+                   TEX_FORMAT_RGBA16F     = 8,     ///< half4
+                   TEX_FORMAT_RGBA32F     = 16,    ///< float4
+                   TEX_FORMAT_RGB9E5      = 0x84,  ///< 4 bytes; 9 bit mantissa for r,g,b and shared 5 bit exponent, alpha is 1
+                   TEX_FORMAT_BLOCK_FIRST = 0x100,
+                   TEX_FORMAT_BC1         = 0x101, ///< 4x4 block in 8  bytes; rgb + 1 bit alpha
+                   TEX_FORMAT_BC3         = 0x103, ///< 4x4 block in 16 bytes; rgb + interpolated alpha
+                   TEX_FORMAT_BC4         = 0x104, ///< 4x4 block in 8  bytes; single channel, replicated to rgb
+                   TEX_FORMAT_BC5         = 0x105, ///< 4x4 block in 16 bytes; two channels of normal map, z is reconstructed
+                   TEX_FORMAT_BC6H        = 0x106  ///< 4x4 block in 16 bytes; unsigned half float rgb
+};
+
+#define TEX_FORMAT_MASK    0x0FFF
+#define TEX_LAYOUT_TILED   0x1000 ///< flag for plain formats in header.w: texels are stored in 4x4 tiles, see textureTiledOffset
+#define TEX_LAYOUT_PAGED   0x2000 ///< flag for plain formats in header.w: out of core texture, only part of pages are resident; see read_texel_paged
+#define TEX_DECODE_GAMMA22 0x4000 ///< never stored in header.w; fetch functions add it to format to linearize LDR texels with g_gamma22Table before filtering
+#define TEX_PAGE_BYTES     16384  ///< size of single page of paged texture
+
 typedef struct SWTextureHeaderT
 {
   int width;
   int height;
-  int depth;
-  int bpp;
-
-  // int mips;
+  int mips;   ///< number of mip levels; levels are stored one after another right after level 0; old textures have 1 here
+  int bpp;    ///< bytes per pixel for plain formats or one of TEX_FORMATS for others; may have TEX_LAYOUT_TILED or TEX_LAYOUT_PAGED bit
 
 } SWTextureHeader;
 
+/**
+\brief Size of single mip level in 32 bit words; all formats occupy whole number of words.
+
+*/
+static inline int textureLevelWords(const int a_width, const int a_height, const int a_format)
+{
+  const int format = a_format & TEX_FORMAT_MASK;
+  const int w      = (a_format & TEX_LAYOUT_TILED) ? ((a_width  + 3) & ~3) : a_width;  // tiles are padded
+  const int h      = (a_format & TEX_LAYOUT_TILED) ? ((a_height + 3) & ~3) : a_height;
+
+  if (format == TEX_FORMAT_BC1 || format == TEX_FORMAT_BC4)
+    return ((w + 3) / 4)*((h + 3) / 4)*2;
+  else if (format > TEX_FORMAT_BLOCK_FIRST)
+    return ((w + 3) / 4)*((h + 3) / 4)*4;
+  else if (format == TEX_FORMAT_RGB9E5)
+    return w*h;
+  else
+    return w*h*(format / 4);
+}
+
+/**
+\brief Page resolution of paged texture; every page takes TEX_PAGE_BYTES: 64x64 for 4 byte texels, 64x32 for 8 byte and 32x32 for 16 byte ones.
+
+*/
+static inline int2 texturePageSize(const int a_format)
+{
+  const int format = a_format & TEX_FORMAT_MASK;
+  if (format == TEX_FORMAT_RGBA32F)
+    return make_int2(32, 32);
+  else if (format == TEX_FORMAT_RGBA16F)
+    return make_int2(64, 32);
+  else
+    return make_int2(64, 64);
+}
+
+static inline int texturePagesNum(const int w, const int h, const int a_format)
+{
+  const int2 pageSize = texturePageSize(a_format);
+  return ((w + pageSize.x - 1) / pageSize.x)*((h + pageSize.y - 1) / pageSize.y);
+}
+
+/**
+\brief Get offset of mip level a_level from the begin of texture data and it's resolution.
+\param a_level  - mip level number
+\param a_format - texture format (header.w)
+\param pW       - in: width  of level 0; out: width  of a_level
+\param pH       - in: height of level 0; out: height of a_level
+\return offset in 32 bit words; for TEX_LAYOUT_PAGED textures it is the index of the first page of level
+
+*/
+static inline int textureMipOffset(const int a_level, const int a_format, __private int* pW, __private int* pH)
+{
+  int w = (*pW), h = (*pH);
+  int offset = 0;
+  for (int i = 0; i < a_level; i++)
+  {
+    offset += (a_format & TEX_LAYOUT_PAGED) ? texturePagesNum(w, h, a_format) : textureLevelWords(w, h, a_format);
+    w = (w > 1) ? w / 2 : 1;
+    h = (h > 1) ? h / 2 : 1;
+  }
+  (*pW) = w;
+  (*pH) = h;
+  return offset;
+}
+
 
 typedef struct SWTexSamplerT
 {
@@ -167,6 +252,13 @@ static inline __global const float* lightSelPdfTableFwd(__global const EngineGlo
 static inline int lightSelPdfTableSizeFwd(__global const EngineGlobals* a_pGlobals) { return a_pGlobals->lightSelectorTableSizeFwd; }
 static inline int lightSelPdfTableSizeRev(__global const EngineGlobals* a_pGlobals) { return a_pGlobals->lightSelectorTableSizeRev; }
 
+static inline __global const float* lightTreeData(__global const EngineGlobals* a_pGlobals)
+{
+  __global const int* pBegin  = (__global const int*)a_pGlobals;
+  __global const int* pTarget = pBegin + a_pGlobals->lightTreeOffset;
+  return (__global const float*)pTarget;
+}
+
 static inline int materialOffset(__global const EngineGlobals* a_pGlobals, const int matId)
 {
   __global const int*    pBegin = (__global const int*)a_pGlobals;
@@ -280,7 +372,232 @@ static inline float4 read_array_uchar4(__global const uchar4* a_data, int offset
   return mult*make_float4((float)c0.x, (float)c0.y, (float)c0.z, (float)c0.w);
 }
 
-static inline int4 bilinearOffsets(const float ffx, const float ffy, const int a_flags, const int w, const int h)
+/**
+\brief Extract a_count < 32 bits starting from bit a_pos of a block stored as little endian 32 bit words.
+
+*/
+static inline uint blockBits(__global const uint* a_block, const int a_pos, const int a_count)
+{
+  const int word  = a_pos >> 5;
+  const int shift = a_pos & 31;
+  uint bits = a_block[word] >> shift;
+  if (shift + a_count > 32)
+    bits |= a_block[word + 1] << (32 - shift);
+  return bits & ((1u << a_count) - 1u);
+}
+
+static inline float3 rgb565ToFloat3(const uint c)
+{
+  return make_float3((float)((c >> 11) & 31)*(1.0f / 31.0f), (float)((c >> 5) & 63)*(1.0f / 63.0f), (float)(c & 31)*(1.0f / 31.0f));
+}
+
+/**
+\brief Decode texel of BC1 colour block (2 words).
+\param a_texel      - texel index inside 4x4 block, (y*4 + x)
+\param a_allowAlpha - false for colour part of BC3 which is always decoded in 4 colour mode
+
+*/
+static inline float4 bc1Texel(__global const uint* a_block, const int a_texel, const bool a_allowAlpha)
+{
+  const uint c0  = a_block[0] & 0xFFFF;
+  const uint c1  = a_block[0] >> 16;
+  const uint idx = (a_block[1] >> (2*a_texel)) & 3;
+
+  const float3 e0 = rgb565ToFloat3(c0);
+  const float3 e1 = rgb565ToFloat3(c1);
+
+  float t     = 0.0f;
+  float alpha = 1.0f;
+
+  if (c0 > c1 || !a_allowAlpha)
+    t = (idx == 0) ? 0.0f : ((idx == 1) ? 1.0f : ((idx == 2) ? (1.0f / 3.0f) : (2.0f / 3.0f)));
+  else if (idx == 3)
+    return make_float4(0, 0, 0, 0);
+  else
+    t = (idx == 0) ? 0.0f : ((idx == 1) ? 1.0f : 0.5f);
+
+  const float3 c = e0 + t*(e1 - e0);
+  return make_float4(c.x, c.y, c.z, alpha);
+}
+
+/**
+\brief Decode value of BC4 block (2 words) in [0,1].
+
+*/
+static inline float bc4Value(__global const uint* a_block, const int a_texel)
+{
+  const int  e0  = (int)(a_block[0] & 0xFF);
+  const int  e1  = (int)((a_block[0] >> 8) & 0xFF);
+  const int  idx = (int)blockBits(a_block, 16 + 3*a_texel, 3);
+
+  int v = 0;
+  if (idx == 0)
+    v = 7*e0;
+  else if (idx == 1)
+    v = 7*e1;
+  else if (e0 > e1)
+    v = (8 - idx)*e0 + (idx - 1)*e1;
+  else if (idx <= 5)
+    return ((float)((6 - idx)*e0 + (idx - 1)*e1))*(1.0f / (5.0f*255.0f));
+  else
+    return (idx == 6) ? 0.0f : 1.0f;
+
+  return ((float)v)*(1.0f / (7.0f*255.0f));
+}
+
+/**
+\brief Decode texel of BC6H block (4 words); only mode 11 (single region, 10 bit raw endpoints) that texture upload produce is supported.
+
+*/
+static inline float4 bc6hTexel(__global const uint* a_block, const int a_texel)
+{
+  if ((a_block[0] & 0x1F) != 0x03)
+    return make_float4(0, 0, 0, 1);
+
+  const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  const int idx = (a_texel == 0) ? (int)blockBits(a_block, 65, 3) : (int)blockBits(a_block, 64 + 4*a_texel, 4);
+  const int wt  = weights[idx];
+
+  float res[3];
+  for (int c = 0; c < 3; c++)
+  {
+    int e[2];
+    for (int k = 0; k < 2; k++)
+    {
+      const int q = (int)blockBits(a_block, 5 + 30*k + 10*c, 10);
+      e[k] = (q == 0) ? 0 : ((q == 1023) ? 0xFFFF : (((q << 16) + 0x8000) >> 10));
+    }
+    const int v = (e[0]*(64 - wt) + e[1]*wt + 32) >> 6;
+    res[c] = halfToFloat((uint)((v*31) >> 6));
+  }
+
+  return make_float4(res[0], res[1], res[2], 1.0f);
+}
+
+/**
+\brief Decode single texel (px,py) of block compressed texture level.
+
+*/
+static inline float4 read_texel_bc(__global const uint* a_data, const int px, const int py, const int w, const int a_format)
+{
+  const int blockId = (py >> 2)*((w + 3) >> 2) + (px >> 2);
+  const int texel   = ((py & 3) << 2) + (px & 3);
+
+  if (a_format == TEX_FORMAT_BC1)
+    return bc1Texel(a_data + blockId*2, texel, true);
+  else if (a_format == TEX_FORMAT_BC4)
+  {
+    const float v = bc4Value(a_data + blockId*2, texel);
+    return make_float4(v, v, v, 1.0f);
+  }
+  else if (a_format == TEX_FORMAT_BC3)
+  {
+    const float4 c = bc1Texel(a_data + blockId*4 + 2, texel, false);
+    return make_float4(c.x, c.y, c.z, bc4Value(a_data + blockId*4, texel));
+  }
+  else if (a_format == TEX_FORMAT_BC5)
+  {
+    const float x = 2.0f*bc4Value(a_data + blockId*4 + 0, texel) - 1.0f;
+    const float y = 2.0f*bc4Value(a_data + blockId*4 + 2, texel) - 1.0f;
+    const float z = sqrt(fmax(1.0f - x*x - y*y, 0.0f));
+    return make_float4(0.5f*x + 0.5f, 0.5f*y + 0.5f, 0.5f*z + 0.5f, 1.0f);
+  }
+  else
+    return bc6hTexel(a_data + blockId*4, texel);
+}
+
+static inline float4 rgb9e5ToFloat4(const uint a_packed)
+{
+  const float scale = as_float((int)(((a_packed >> 27) + 103) << 23)); // 2^(e - 15 - 9)
+  return make_float4((float)(a_packed & 0x1FF)*scale, (float)((a_packed >> 9) & 0x1FF)*scale, (float)((a_packed >> 18) & 0x1FF)*scale, 1.0f);
+}
+
+/**
+\brief pow(i/255, 2.2); LDR textures sampled with input gamma 2.2 (TEX_GAMMA_22 sampler flag) are linearized with it instead of pow for every sample.
+
+*/
+__constant float g_gamma22Table[256] = {
+  0.0f, 5.0770519e-06f, 2.33280047e-05f, 5.69217657e-05f, 0.000107187362f, 0.000175123978f, 0.000261543755f, 0.00036713627f,
+  0.000492503787f, 0.000638182842f, 0.0008046585f, 0.000992374304f, 0.00120173952f, 0.00143313459f, 0.00168691532f, 0.00196341621f,
+  0.00226295316f, 0.0025858256f, 0.00293231832f, 0.00330270303f, 0.00369723958f, 0.00411617709f, 0.00455975492f, 0.00502820346f,
+  0.00552174485f, 0.00604059365f, 0.00658495738f, 0.007155037f, 0.0077510274f, 0.00837311775f, 0.0090214919f, 0.0096963287f,
+  0.0103978023f, 0.0111260824f, 0.0118813344f, 0.01266372f, 0.0134733969f, 0.0143105194f, 0.0151752382f, 0.0160677009f,
+  0.0169880521f, 0.0179364333f, 0.0189129834f, 0.0199178384f, 0.0209511319f, 0.0220129949f, 0.0231035562f, 0.0242229421f,
+  0.0253712769f, 0.0265486828f, 0.02775528f, 0.0289911865f, 0.0302565189f, 0.0315513914f, 0.0328759169f, 0.0342302066f,
+  0.0356143697f, 0.0370285142f, 0.0384727463f, 0.039947171f, 0.0414518916f, 0.0429870102f, 0.0445526273f, 0.0461488424f,
+  0.0477757536f, 0.0494334576f, 0.0511220501f, 0.0528416255f, 0.0545922773f, 0.0563740976f, 0.0581871775f, 0.0600316071f,
+  0.0619074756f, 0.0638148709f, 0.0657538803f, 0.0677245897f, 0.0697270844f, 0.0717614488f, 0.0738277663f, 0.0759261195f,
+  0.07805659f, 0.0802192587f, 0.0824142059f, 0.0846415107f, 0.0869012518f, 0.0891935069f, 0.091518353f, 0.0938758665f,
+  0.0962661231f, 0.0986891975f, 0.101145164f, 0.103634097f, 0.106156068f, 0.10871115f, 0.111299415f, 0.113920933f,
+  0.116575776f, 0.119264013f, 0.121985713f, 0.124740945f, 0.127529778f, 0.130352278f, 0.133208513f, 0.13609855f,
+  0.139022454f, 0.141980291f, 0.144972126f, 0.147998023f, 0.151058047f, 0.154152261f, 0.157280728f, 0.160443511f,
+  0.163640671f, 0.166872272f, 0.170138373f, 0.173439036f, 0.176774322f, 0.180144289f, 0.183548998f, 0.186988509f,
+  0.190462879f, 0.193972167f, 0.197516431f, 0.20109573f, 0.204710119f, 0.208359656f, 0.212044398f, 0.2157644f,
+  0.219519718f, 0.223310408f, 0.227136526f, 0.230998124f, 0.234895259f, 0.238827984f, 0.242796353f, 0.24680042f,
+  0.250840236f, 0.254915857f, 0.259027332f, 0.263174716f, 0.26735806f, 0.271577415f, 0.275832833f, 0.280124365f,
+  0.284452062f, 0.288815973f, 0.293216149f, 0.29765264f, 0.302125496f, 0.306634766f, 0.311180499f, 0.315762744f,
+  0.320381549f, 0.325036963f, 0.329729033f, 0.334457808f, 0.339223335f, 0.344025661f, 0.348864834f, 0.3537409f,
+  0.358653906f, 0.363603898f, 0.368590922f, 0.373615025f, 0.378676251f, 0.383774646f, 0.388910257f, 0.394083126f,
+  0.3992933f, 0.404540823f, 0.409825738f, 0.415148092f, 0.420507926f, 0.425905286f, 0.431340214f, 0.436812754f,
+  0.442322949f, 0.447870842f, 0.453456475f, 0.459079892f, 0.464741135f, 0.470440245f, 0.476177265f, 0.481952237f,
+  0.487765202f, 0.493616201f, 0.499505277f, 0.505432469f, 0.511397819f, 0.517401367f, 0.523443155f, 0.529523222f,
+  0.535641609f, 0.541798356f, 0.547993502f, 0.554227088f, 0.560499152f, 0.566809735f, 0.573158875f, 0.579546612f,
+  0.585972984f, 0.59243803f, 0.598941789f, 0.6054843f, 0.6120656f, 0.618685727f, 0.625344721f, 0.632042618f,
+  0.638779456f, 0.645555272f, 0.652370105f, 0.659223992f, 0.666116969f, 0.673049073f, 0.680020342f, 0.687030812f,
+  0.69408052f, 0.701169502f, 0.708297794f, 0.715465432f, 0.722672454f, 0.729918893f, 0.737204787f, 0.744530171f,
+  0.751895081f, 0.759299551f, 0.766743617f, 0.774227314f, 0.781750678f, 0.789313742f, 0.796916543f, 0.804559114f,
+  0.81224149f, 0.819963705f, 0.827725794f, 0.835527791f, 0.84336973f, 0.851251645f, 0.85917357f, 0.867135538f,
+  0.875137582f, 0.883179738f, 0.891262037f, 0.899384513f, 0.9075472f, 0.915750129f, 0.923993335f, 0.93227685f,
+  0.940600707f, 0.948964938f, 0.957369576f, 0.965814654f, 0.974300202f, 0.982826255f, 0.991392844f, 1.0f
+};
+
+static inline bool textureFormatIsLDR(const int a_format)
+{
+  const int format = a_format & TEX_FORMAT_MASK;
+  return (format == TEX_FORMAT_RGBA8 || format == TEX_FORMAT_BC1 || format == TEX_FORMAT_BC3 || format == TEX_FORMAT_BC4);
+}
+
+/**
+\brief Offset of texel (px,py) for TEX_LAYOUT_TILED; tiles of 4x4 texels are stored in row major order, texels inside tile too.
+
+*/
+static inline int textureTiledOffset(const int px, const int py, const int w)
+{
+  return (((py >> 2)*((w + 3) >> 2) + (px >> 2)) << 4) + ((py & 3) << 2) + (px & 3);
+}
+
+/**
+\brief Read texel (px,py) of mip level; a_format is header.w, i.e. one of TEX_FORMATS with optional TEX_LAYOUT_TILED bit.
+
+*/
+static inline float4 read_texel_sw(__global const uint* a_data, const int px, const int py, const int w, const int a_format)
+{
+  const int format = a_format & TEX_FORMAT_MASK;
+  if (format > TEX_FORMAT_BLOCK_FIRST)
+    return read_texel_bc(a_data, px, py, w, format);
+
+  const int offset = (a_format & TEX_LAYOUT_TILED) ? textureTiledOffset(px, py, w) : py*w + px;
+
+  if (format == TEX_FORMAT_RGBA8)
+    return read_array_uchar4((__global const uchar4*)a_data, offset);
+  else if (format == TEX_FORMAT_RGBA32F)
+    return ((__global const float4*)a_data)[offset];
+  else if (format == TEX_FORMAT_RGBA16F)
+  {
+    const uint rg = a_data[2*offset + 0];
+    const uint ba = a_data[2*offset + 1];
+    return make_float4(halfToFloat(rg & 0xFFFF), halfToFloat(rg >> 16), halfToFloat(ba & 0xFFFF), halfToFloat(ba >> 16));
+  }
+  else
+    return rgb9e5ToFloat4(a_data[offset]);
+}
+
+/**
+\brief Wrapped or clamped coordinates of 4 texels for bilinear filtering; returns (x0, x1, y0, y1).
+
+*/
+static inline int4 bilinearTexels(const float ffx, const float ffy, const int a_flags, const int w, const int h)
 {
 	const int sx = (ffx > 0.0f) ? 1 : -1;
 	const int sy = (ffy > 0.0f) ? 1 : -1;
@@ -324,23 +641,90 @@ static inline int4 bilinearOffsets(const float ffx, const float ffy, const int a
 		py_w1 = (py_w1 < 0) ? py_w1 + h : py_w1;
 	}
 
-	const int offset0 = py_w0*w + px_w0;
-	const int offset1 = py_w0*w + px_w1;
-	const int offset2 = py_w1*w + px_w0;
-	const int offset3 = py_w1*w + px_w1;
+	return make_int4(px_w0, px_w1, py_w0, py_w1);
+}
+
+static inline int4 bilinearOffsets(const float ffx, const float ffy, const int a_flags, const int w, const int h)
+{
+	const int4 texels = bilinearTexels(ffx, ffy, a_flags, w, h);
+
+	const int offset0 = texels.z*w + texels.x;
+	const int offset1 = texels.z*w + texels.y;
+	const int offset2 = texels.w*w + texels.x;
+	const int offset3 = texels.w*w + texels.y;
 
 	return make_int4(offset0, offset1, offset2, offset3);
 }
 
 
-static inline float4 read_imagef_sw4(texture2d_t a_tex, const float2 a_texCoord, const int a_flags)
+/**
+\brief Read texel (px,py) of out of core texture level.
+
+ Paged texture data: header, int4 (pagesTotal, pinnedLevel, pinnedPageStart, slotsBegin), int pageTable[pagesTotal], int requests[pagesTotal] and then
+ cache slots of TEX_PAGE_BYTES each. pageTable has (slot + 1) for resident pages and 0 for others; slotsBegin is offset of slot 0 in int4 from header.
+ Levels from pinnedLevel take single page each and are always resident. If page is not resident, it's request flag is set for the host to load 
+ it between passes and the texel is taken from pinned level. Host code must not fetch paged textures with this function (see DecodeTextureLevel0).
+
+\param a_pageStart - index of the first page of level (textureMipOffset)
+
+*/
+static inline float4 read_texel_paged(texture2d_t a_tex, const int a_pageStart, const int px, const int py, const int w, const int h, const int a_format)
 {
-  const int4 header = (*a_tex);
+  const int4 info     = a_tex[1];
+  const int2 pageSize = texturePageSize(a_format);
+  const int  pagesX   = (w + pageSize.x - 1) / pageSize.x;
 
-  const int w   = header.x;
-  const int h   = header.y;
-  //const int d   = header.z;
-  const int bpp = header.w;
+  __global const int* pageTable = (__global const int*)(a_tex + 2);
+
+  int page = a_pageStart + (py / pageSize.y)*pagesX + (px / pageSize.x);
+  int slot = pageTable[page];
+  int lx   = px % pageSize.x;
+  int ly   = py % pageSize.y;
+
+  if (slot == 0)
+  {
+    ((__global int*)pageTable)[info.x + page] = 1; // the only thing fetch functions write; kernels take texture storage without const and restrict for it
+
+    const int4 header = a_tex[0];
+    int wp = header.x, hp = header.y;
+    textureMipOffset(info.y, header.w, &wp, &hp);
+
+    page = info.z;
+    slot = pageTable[page];
+    lx   = (px*wp) / w;
+    ly   = (py*hp) / h;
+  }
+
+  __global const uint* data = (__global const uint*)(a_tex + info.w) + (slot - 1)*(TEX_PAGE_BYTES / 4);
+  return read_texel_sw(data, lx, ly, pageSize.x, a_format & TEX_FORMAT_MASK);
+}
+
+/**
+\brief Read texel (px,py) of mip level that starts at a_levelOffset (see textureMipOffset) for any texture layout.
+
+*/
+static inline float4 read_texel_level(texture2d_t a_tex, const int a_levelOffset, const int px, const int py, const int w, const int h, const int a_format)
+{
+  float4 res;
+  if (a_format & TEX_LAYOUT_PAGED)
+    res = read_texel_paged(a_tex, a_levelOffset, px, py, w, h, a_format);
+  else
+    res = read_texel_sw((__global const uint*)(a_tex + 1) + a_levelOffset, px, py, w, a_format);
+
+  if (a_format & TEX_DECODE_GAMMA22)
+  {
+    res.x = g_gamma22Table[(int)(res.x*255.0f + 0.5f)];
+    res.y = g_gamma22Table[(int)(res.y*255.0f + 0.5f)];
+    res.z = g_gamma22Table[(int)(res.z*255.0f + 0.5f)];
+  }
+
+  return res;
+}
+
+static inline float4 read_imagef_sw4_level(texture2d_t a_tex, const int a_levelOffset, const int w, const int h, const int a_format, 
+                                          const float2 a_texCoord, const int a_flags)
+{
+  const int format = ((a_flags & TEX_GAMMA_22) != 0 && textureFormatIsLDR(a_format)) ? (a_format | TEX_DECODE_GAMMA22) : a_format;
 
   const float fw  = (float)(w);
   const float fh  = (float)(h);
@@ -380,15 +764,7 @@ static inline float4 read_imagef_sw4(texture2d_t a_tex, const float2 a_texCoord,
       py = (py < 0) ? py + h : py;
     }
 
-    const int offset = py*w + px;
-
-    if (bpp == 4)
-      res = read_array_uchar4((__global const uchar4*)(a_tex + 1), offset);
-    else if (bpp == 16)
-    {
-      __global const float4* fdata = (__global const float4*)(a_tex + 1);
-      res = fdata[offset];
-    }
+    res = read_texel_level(a_tex, a_levelOffset, px, py, w, h, format);
   }
   else
   {
@@ -407,28 +783,14 @@ static inline float4 read_imagef_sw4(texture2d_t a_tex, const float2 a_texCoord,
     const float w3 = fx1 * fy;
     const float w4 = fx  * fy;
 
-    const int4 offsets = bilinearOffsets(ffx, ffy, a_flags, w, h);
+    const int4 texels = bilinearTexels(ffx, ffy, a_flags, w, h);
 
     // fetch pixels
     //
-    float4 f1, f2, f3, f4;
-
-    if (bpp == 4)
-    {
-      f1 = read_array_uchar4((__global const uchar4*)(a_tex + 1), offsets.x);
-      f2 = read_array_uchar4((__global const uchar4*)(a_tex + 1), offsets.y);
-      f3 = read_array_uchar4((__global const uchar4*)(a_tex + 1), offsets.z);
-      f4 = read_array_uchar4((__global const uchar4*)(a_tex + 1), offsets.w);
-    }
-    else if (bpp == 16)
-    {
-      __global const float4* fdata = (__global const float4*)(a_tex + 1);
-
-      f1 = fdata[offsets.x];
-      f2 = fdata[offsets.y];
-      f3 = fdata[offsets.z];
-      f4 = fdata[offsets.w];
-    }
+    const float4 f1 = read_texel_level(a_tex, a_levelOffset, texels.x, texels.z, w, h, format);
+    const float4 f2 = read_texel_level(a_tex, a_levelOffset, texels.y, texels.z, w, h, format);
+    const float4 f3 = read_texel_level(a_tex, a_levelOffset, texels.x, texels.w, w, h, format);
+    const float4 f4 = read_texel_level(a_tex, a_levelOffset, texels.y, texels.w, w, h, format);
 
     // Calculate the weighted sum of pixels (for each color channel)
     //
@@ -443,6 +805,43 @@ static inline float4 read_imagef_sw4(texture2d_t a_tex, const float2 a_texCoord,
   return res;
 }
 
+static inline float4 read_imagef_sw4(texture2d_t a_tex, const float2 a_texCoord, const int a_flags)
+{
+  const int4 header = (*a_tex);
+  return read_imagef_sw4_level(a_tex, 0, header.x, header.y, header.w, a_texCoord, a_flags);
+}
+
+/**
+\brief Trilinear texture fetch.
+\param a_lod - mip level; fractional part blends two neighbour levels; values <= 0 sample level 0 bilinearly.
+
+*/
+static inline float4 read_imagef_sw4_lod(texture2d_t a_tex, const float2 a_texCoord, const int a_flags, const float a_lod)
+{
+  const int4 header = (*a_tex);
+  const int  mips   = (header.z > 1) ? header.z : 1;
+
+  if (a_lod <= 0.0f || mips == 1 || (a_flags & TEX_POINT_SAM) != 0)
+    return read_imagef_sw4_level(a_tex, 0, header.x, header.y, header.w, a_texCoord, a_flags);
+
+  const float lod  = fmin(a_lod, (float)(mips - 1));
+  const int   lvl0 = (int)(lod);
+  const float t    = lod - (float)(lvl0);
+
+  int w0 = header.x, h0 = header.y;
+  const int offs0 = textureMipOffset(lvl0, header.w, &w0, &h0);
+  const float4 c0 = read_imagef_sw4_level(a_tex, offs0, w0, h0, header.w, a_texCoord, a_flags);
+
+  if (lvl0 + 1 >= mips || t < 1e-3f)
+    return c0;
+
+  int w1 = header.x, h1 = header.y;
+  const int offs1 = textureMipOffset(lvl0 + 1, header.w, &w1, &h1);
+  const float4 c1 = read_imagef_sw4_level(a_tex, offs1, w1, h1, header.w, a_texCoord, a_flags);
+
+  return c0 + t*(c1 - c0);
+}
+
 static inline float read_imagef_sw1(texture2d_t a_tex, const float2 a_texCoord, const int a_flags)
 {
   const int4 header = (*a_tex);
@@ -587,6 +986,41 @@ static inline float2 mul2x4(const float4 row0, const float4 row1, float2 v)
   return res;
 }
 
+/**
+\brief Mip level of texture for the ray cone footprint a_hitLod; takes in to account texture resolution and sampler uv scale.
+
+*/
+static inline float samplerTexLod(const SWTexSampler a_sampler, texture2d_t a_tex, const float a_hitLod)
+{
+  if (a_hitLod <= TEX_LOD_NONE)
+    return TEX_LOD_NONE;
+
+  const int4  header = (*a_tex);
+  const float det    = fabs(a_sampler.row0.x*a_sampler.row1.y - a_sampler.row0.y*a_sampler.row1.x);
+  return a_hitLod + 0.5f*log2(fmax((float)(header.x)*(float)(header.y)*det, 1e-20f));
+}
+
+/**
+\brief Apply sampler input gamma. LDR textures sampled with TEX_GAMMA_22 are already linear (see g_gamma22Table), so pow is left only for rare gamma values.
+\param a_linear - texColor was fetched from LDR texture with TEX_GAMMA_22 sampler
+
+*/
+static inline float4 samplerInputGamma(float4 texColor, const SWTexSampler a_sampler, const bool a_linear)
+{
+  if (!a_linear && a_sampler.gamma != 1.0f)
+  {
+    texColor.x = pow(texColor.x, a_sampler.gamma);
+    texColor.y = pow(texColor.y, a_sampler.gamma);
+    texColor.z = pow(texColor.z, a_sampler.gamma);
+  }
+  return texColor;
+}
+
+static inline bool samplerDecodesGamma(const SWTexSampler a_sampler, texture2d_t a_tex)
+{
+  return (a_sampler.flags & TEX_GAMMA_22) != 0 && textureFormatIsLDR(a_tex->w);
+}
+
 static inline float3 sample2D(int a_samplerOffset, float2 texCoord, __global const int4* a_samStorage, __global const int4* a_texStorage, __global const EngineGlobals* a_globals)
 {
   if(a_samplerOffset == INVALID_TEXTURE || a_samplerOffset < 0)
@@ -605,9 +1039,7 @@ static inline float3 sample2D(int a_samplerOffset, float2 texCoord, __global con
 
   float4 texColor4 = read_imagef_sw4(a_texStorage + offset, texCoordT, sampler.flags); 
 
-  texColor4.x = pow(texColor4.x, sampler.gamma);
-  texColor4.y = pow(texColor4.y, sampler.gamma);
-  texColor4.z = pow(texColor4.z, sampler.gamma);
+  texColor4 = samplerInputGamma(texColor4, sampler, samplerDecodesGamma(sampler, a_texStorage + offset));
 
   if (sampler.flags & TEX_ALPHASRC_W)
   {
@@ -636,18 +1068,17 @@ static inline float3 sample2DExt(int a_samplerOffset, float2 texCoord,
   int offset = textureHeaderOffset(a_globals, sampler.texId);
   float4 texColor2;
   if (offset >= 0)
-    texColor2 = read_imagef_sw4(a_texStorage + offset, texCoordT, sampler.flags);
+    texColor2 = read_imagef_sw4_lod(a_texStorage + offset, texCoordT, sampler.flags, samplerTexLod(sampler, a_texStorage + offset, a_ptList->texLod));
   else
     texColor2 = make_float4(1, 1, 1, 1);
 
   //float4 texColor4 = make_float4(1, 1, 1, -1.0f);
   float4 texColor1 = readProcTex(sampler.texId, a_ptList);
 
-  float4 texColor4 = (fabs(texColor1.w + 1.0f) < 1e-5f) ? texColor2 : texColor1;
+  const bool fromTexture = (fabs(texColor1.w + 1.0f) < 1e-5f);
+  float4 texColor4       = fromTexture ? texColor2 : texColor1;
   
-  texColor4.x = pow(texColor4.x, sampler.gamma);
-  texColor4.y = pow(texColor4.y, sampler.gamma);
-  texColor4.z = pow(texColor4.z, sampler.gamma);
+  texColor4 = samplerInputGamma(texColor4, sampler, fromTexture && offset >= 0 && samplerDecodesGamma(sampler, a_texStorage + offset));
 
   if (sampler.flags & TEX_ALPHASRC_W)
   {
@@ -677,9 +1108,7 @@ static inline float3 sample2DUI2(int a_samplerOffset, float2 texCoord, __global
 
   float4 texColor4 = read_imagef_sw4(a_texStorage + offset, texCoordT, sampler.flags);
 
-  texColor4.x = pow(texColor4.x, sampler.gamma);
-  texColor4.y = pow(texColor4.y, sampler.gamma);
-  texColor4.z = pow(texColor4.z, sampler.gamma);
+  texColor4 = samplerInputGamma(texColor4, sampler, samplerDecodesGamma(sampler, a_texStorage + offset));
 
   if (sampler.flags & TEX_ALPHASRC_W)
   {
@@ -704,7 +1133,7 @@ static inline float3 sample2DLite(int a_samplerOffset, float2 texCoord, __global
 
   const int offset = textureHeaderOffset(a_globals, sampler.texId);
 
-  float4 texColor4 = read_imagef_sw4(a_texStorage + offset, texCoordT, sampler.flags);
+  float4 texColor4 = read_imagef_sw4(a_texStorage + offset, texCoordT, sampler.flags & (~TEX_GAMMA_22)); // lite version never applies gamma
 
   if (sampler.flags & TEX_ALPHASRC_W)
   {
@@ -736,9 +1165,7 @@ static inline float3 sample2DAux(int2 a_samplerOffset, float2 texCoord, __global
 
   float4 texColor4 = read_imagef_sw4(a_texStorage + offset, texCoordT, sampler.flags);
 
-  texColor4.x = pow(texColor4.x, sampler.gamma);
-  texColor4.y = pow(texColor4.y, sampler.gamma);
-  texColor4.z = pow(texColor4.z, sampler.gamma);
+  texColor4 = samplerInputGamma(texColor4, sampler, samplerDecodesGamma(sampler, a_texStorage + offset));
 
   if (sampler.flags & TEX_ALPHASRC_W)
   {
@@ -772,9 +1199,7 @@ static inline float3 sample2DAuxExt(int2 a_samplerOffset, float2 texCoord, __glo
   const float4 texColor1 = readProcTex(sampler.texId, a_ptList);
   float4 texColor4       = (fabs(texColor1.w + 1.0f) < 1e-5f) ? texColor2 : texColor1;
 
-  texColor4.x = pow(texColor4.x, sampler.gamma);
-  texColor4.y = pow(texColor4.y, sampler.gamma);
-  texColor4.z = pow(texColor4.z, sampler.gamma);
+  texColor4 = samplerInputGamma(texColor4, sampler, (fabs(texColor1.w + 1.0f) < 1e-5f) && samplerDecodesGamma(sampler, a_texStorage + offset));
 
   if (sampler.flags & TEX_ALPHASRC_W)
   {
@@ -937,6 +1362,15 @@ static inline void MakeEyeRayFromF4Rnd(float4 lensOffs, __global const EngineGlo
   (*pRayDir) = ray_dir;
 }
 
+/**
+\brief Spread angle of primary ray cone, i.e. the angle that single pixel subtends.
+
+*/
+static inline float rayConeSpreadAngle(__global const EngineGlobals* a_globals)
+{
+  return 2.0f*tan(0.5f*a_globals->varsF[HRT_CAM_FOV]) / fmax(a_globals->varsF[HRT_HEIGHT_F], 1.0f);
+}
+
 #ifdef USE_1D_TEXTURES
 
 IDH_CALL int2 getObjectList(unsigned int offset, __read_only image1d_buffer_t objListTex)
@@ -948,6 +1382,11 @@ IDH_CALL int2 getObjectList(unsigned int offset, __read_only image1d_buffer_t ob
   return res;
 }
 
+IDH_CALL float4 getObjectListHeader(unsigned int offset, __read_only image1d_buffer_t objListTex)
+{
+  return read_imagef(objListTex, offset);
+}
+
 IDH_CALL BVHNode GetBVHNode(unsigned int offset, __read_only image1d_buffer_t bvhTex)
 {
   float4 nodeHalf1 = read_imagef(bvhTex, (int)(2 * offset + 0));
@@ -979,6 +1418,11 @@ IDH_CALL int2 getObjectList(unsigned int offset, __global const float4* objListT
 }
 
 
+IDH_CALL float4 getObjectListHeader(unsigned int offset, __global const float4* objListTex)
+{
+  return objListTex[offset];
+}
+
 IDH_CALL BVHNode GetBVHNode(int offset, __global const float4* bvhTex)
 {
   const int    offset2   = (offset >= 0) ? offset : 0;
@@ -1025,10 +1469,14 @@ typedef struct ALIGN_S(16) PlainMeshT
 
   unsigned int totalBytesNum;
   int polyShadowOffset;
-  int dummy2;
+  int vertFormat;       ///< combination of MESH_VERT_* flags; 0 means normals/tangents as float4 and texture coordinates in pos.w and norm.w
 
 } PlainMesh;
 
+enum MESH_VERT_FORMAT { MESH_VERT_COMPACT       = 1,   ///< normals and tangents are octahedral encoded uint; texture coordinates are in separate float2 array
+                        MESH_VERT_HALF_TEXCOORD = 2    ///< texture coordinates are half2 packed to pos.w; no separate texture coordinates array
+};
+
 static inline __global const PlainMesh* fetchMeshHeader(const Lite_Hit a_liteHit, __global const float4* a_geomStorage, __global const EngineGlobals* a_globals)
 {
   const int meshOffset = meshHeaderOffset(a_liteHit, a_globals);
@@ -1068,6 +1516,37 @@ static inline __global const float2* meshTexCoords(__global const PlainMesh* a_p
   return (__global const float2*)ptexcoords;
 }
 
+static inline float3 meshNormalAt(__global const PlainMesh* a_pMesh, const int a_vertId)
+{
+  __global const float4* pheader = (__global const float4*)a_pMesh;
+  if (a_pMesh->vertFormat & MESH_VERT_COMPACT)
+    return decodeNormalOct(((__global const uint*)(pheader + a_pMesh->vNormOffset))[a_vertId]);
+  else
+    return to_float3(pheader[a_pMesh->vNormOffset + a_vertId]);
+}
+
+static inline float4 meshTangentAt(__global const PlainMesh* a_pMesh, const int a_vertId)
+{
+  __global const float4* pheader = (__global const float4*)a_pMesh;
+  if (a_pMesh->vertFormat & MESH_VERT_COMPACT)
+    return decodeTangentOct(((__global const uint*)(pheader + a_pMesh->vTangentOffset))[a_vertId]);
+  else
+    return pheader[a_pMesh->vTangentOffset + a_vertId];
+}
+
+static inline float2 meshTexCoordAt(__global const PlainMesh* a_pMesh, const int a_vertId)
+{
+  __global const float4* pheader = (__global const float4*)a_pMesh;
+  const float posW = pheader[a_pMesh->vPosOffset + a_vertId].w;
+
+  if (a_pMesh->vertFormat & MESH_VERT_HALF_TEXCOORD)
+    return unpackHalf2(posW);
+  else if (a_pMesh->vertFormat & MESH_VERT_COMPACT)
+    return ((__global const float2*)(pheader + a_pMesh->vTexCoordOffset))[a_vertId];
+  else
+    return make_float2(posW, pheader[a_pMesh->vNormOffset + a_vertId].w);
+}
+
 static inline __global const int* meshTriIndices(__global const PlainMesh* a_pMesh)
 {
   __global const float4* pheader  = (__global const float4*)a_pMesh;
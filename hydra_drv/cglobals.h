@@ -15,6 +15,7 @@
 
 #define INVALID_TEXTURE  0xFFFFFFFE 
 
+#define TEX_GAMMA_22     0x08000000 ///< sampler input gamma is 2.2; LDR textures are linearized with table before filtering instead of pow after it
 #define TEX_POINT_SAM    0x10000000
 #define TEX_ALPHASRC_W   0x20000000
 #define TEX_CLAMP_U      0x40000000
@@ -463,6 +464,19 @@ enum VARIABLE_NAMES { // int vars
 
                       HRT_KMLT_OR_QMC_LGT_BOUNCES  = 39,
                       HRT_KMLT_OR_QMC_MAT_BOUNCES  = 40,
+
+                      HRT_RNG_DETERMINISTIC        = 41, // seed generators per (pixel, sample) with counter based hash; image does not depend on threads count and time
+                      HRT_RNG_SEED                 = 42,
+
+                      HRT_ADAPTIVE_SAMPLING        = 43, // CPU PT; stop converged tiles and spend their samples on noisy ones. Threshold is HRT_PATH_TRACE_ERROR.
+                      HRT_ADAPTIVE_MIN_SPP         = 44, // uniform passes before first error estimation
+
+                      HRT_CPU_ASYNC_RENDER         = 45, // CPU layer; run passes on background thread up to HRT_MAX_SAMPLES_PER_PIXEL, BeginTracingPass does not block
+
+                      HRT_PATH_GUIDING             = 46, // PT only (CPU IntegratorMISPT and OpenCL NextBounce); learn SD-tree of incident radiance and sample it together with BSDF (one-sample MIS), see cguiding.h
+                      HRT_GUIDING_TRAIN_PASSES     = 47, // passes that record radiance; SD-tree is rebuilt after 1, 2, 4, ... of them
+
+                      HRT_MMLT_CHAINS              = 48, // CPU MMLT; Markov chains per pass. Chains are seeded by their index, so with HRT_RNG_DETERMINISTIC image does not depend on threads count
 };
 
 enum VARIABLE_FLOAT_NAMES{ // float vars
@@ -1234,6 +1248,8 @@ IDH_CALL int IS_LEAF(int a_leftOffsetAndLeaf)                 { return a_leftOff
 IDH_CALL int PACK_LEAF_AND_OFFSET(int a_leftOffset, int leaf) { return (a_leftOffset & 0x7fffffff) | (leaf & 0x80000000); }
 IDH_CALL int EXTRACT_OFFSET(int a_leftOffsetAndLeaf)          { return a_leftOffsetAndLeaf & 0x7fffffff; }
 
+#define OBJLIST_LEAF_INDEXED (-2) ///< put to object list header .w; leaf triangles are stored as vertex indices, header .z is geomId
+
 
 // a know about bit fields, but in CUDA they didn't work
 //
@@ -1350,6 +1366,8 @@ typedef struct MisDataT
   float cosThetaPrev;         ///< previous angle cos; it allow to compute projected angle pdf (pdfWP = pdfW/cosThetaPrev);
   int   prevMaterialOffset;   ///< offset in material buffer to material leaf (elemental brdf) that were sampled on prev bounce; it is needed to disable caustics;
   int   isSpecular;           ///< indicate if bounce was pure specular;
+  float coneWidth;            ///< ray cone width at ray origin (in world units); used to select texture LOD;
+  uint  prevNormal;           ///< encoded normal at ray origin (see encodeNormal); needed to eval light tree pick probability for MIS;
 
 } MisData;
 
@@ -1360,6 +1378,8 @@ static inline MisData makeInitialMisData()
   data.cosThetaPrev       = 1.0f;
   data.prevMaterialOffset = -1;
   data.isSpecular         = 1;
+  data.coneWidth          = 0.0f;
+  data.prevNormal         = 0;
   return data;
 }
 
@@ -1394,6 +1414,112 @@ static inline float3 decodeNormal(uint a_data)
   return make_float3(x, y, z);
 }
 
+static inline float2 octWrap(const float2 v)
+{
+  return make_float2((1.0f - fabs(v.y))*(v.x >= 0.0f ? 1.0f : -1.0f),
+                     (1.0f - fabs(v.x))*(v.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+static inline float2 octProject(const float3 n)
+{
+  const float invL1 = 1.0f / fmax(fabs(n.x) + fabs(n.y) + fabs(n.z), 1e-20f);
+  float2 p = make_float2(n.x*invL1, n.y*invL1);
+  if (n.z < 0.0f)
+    p = octWrap(p);
+  return p;
+}
+
+static inline float3 octUnproject(const float x, const float y)
+{
+  float3 n = make_float3(x, y, 1.0f - fabs(x) - fabs(y));
+  const float t = fmax(-n.z, 0.0f);
+  n.x += (n.x >= 0.0f) ? -t : t;
+  n.y += (n.y >= 0.0f) ? -t : t;
+  return normalize(n);
+}
+
+/**
+\brief octahedral normal encoding; 16 bit snorm for both x and y. Unlike encodeNormal it has uniform precision over the whole sphere.
+*/
+static inline uint encodeNormalOct(const float3 n)
+{
+  const float2 p = octProject(n);
+  const int x = (int)floor(fmin(fmax(p.x, -1.0f), 1.0f)*32767.0f + 0.5f);
+  const int y = (int)floor(fmin(fmax(p.y, -1.0f), 1.0f)*32767.0f + 0.5f);
+  return (uint)(x & 0x0000FFFF) | ((uint)(y & 0x0000FFFF) << 16);
+}
+
+static inline float3 decodeNormalOct(const uint a_data)
+{
+  const float divInv = 1.0f / 32767.0f;
+  const float x = fmax((float)((short)(a_data & 0x0000FFFF))*divInv, -1.0f);
+  const float y = fmax((float)((short)(a_data >> 16))*divInv, -1.0f);
+  return octUnproject(x, y);
+}
+
+/**
+\brief octahedral tangent encoding; 16 bit x, 15 bit y and the bitangent sign (tangent.w) in the highest bit.
+*/
+static inline uint encodeTangentOct(const float4 t)
+{
+  const float2 p = octProject(make_float3(t.x, t.y, t.z));
+  const int x    = (int)floor(fmin(fmax(p.x, -1.0f), 1.0f)*32767.0f + 0.5f);
+  const int y    = (int)floor(fmin(fmax(p.y, -1.0f), 1.0f)*16383.0f + 0.5f);
+  const uint s   = (t.w < 0.0f) ? 0x80000000 : 0;
+  return (uint)(x & 0x0000FFFF) | ((uint)(y & 0x00007FFF) << 16) | s;
+}
+
+static inline float4 decodeTangentOct(const uint a_data)
+{
+  const float x  = fmax((float)((short)(a_data & 0x0000FFFF))*(1.0f / 32767.0f), -1.0f);
+  const float y  = fmax((float)(((int)(a_data << 1)) >> 17)*(1.0f / 16383.0f), -1.0f);
+  const float3 t = octUnproject(x, y);
+  return make_float4(t.x, t.y, t.z, (a_data & 0x80000000) ? -1.0f : 1.0f);
+}
+
+/**
+\brief software IEEE half to float conversion; works for both CPU and OpenCL since we can't rely on cl_khr_fp16.
+*/
+static inline float halfToFloat(const uint h)
+{
+  const uint s = (h & 0x8000) << 16;
+  const uint e = (h >> 10) & 0x1F;
+  const uint m = h & 0x03FF;
+
+  if (e == 0)                                                         // zero or subnormal
+    return ((s != 0) ? -1.0f : 1.0f)*(float)m*(1.0f / 16777216.0f); 
+  else if (e == 31)                                                   // inf or nan
+    return as_float((int)(s | 0x7F800000 | (m << 13)));
+  else
+    return as_float((int)(s | ((e + 112) << 23) | (m << 13)));
+}
+
+static inline uint floatToHalf(const float f)
+{
+  const uint x = (uint)as_int(f);
+  const uint s = (x >> 16) & 0x8000;
+  const int  e = (int)((x >> 23) & 0xFF) - 127 + 15;
+  uint       m = x & 0x007FFFFF;
+
+  if (e <= 0)
+  {
+    if (e < -10)
+      return s;
+    m = (m | 0x00800000) >> (1 - e);
+    return s | ((m + 0x00001000) >> 13);
+  }
+  else if (e >= 31)
+    return s | 0x7C00;
+
+  return (s | ((uint)e << 10) | (m >> 13)) + ((m >> 12) & 1); // round to nearest; carry to exponent is correct
+}
+
+static inline float2 unpackHalf2(const float a_packed)
+{
+  const uint bits = (uint)as_int(a_packed);
+  return make_float2(halfToFloat(bits & 0x0000FFFF), halfToFloat(bits >> 16));
+}
+
 struct ALIGN_S(16) HitPosNormT
 {
   float  pos_x;
@@ -2279,11 +2405,14 @@ typedef struct ShadeContextT
 \brief this structure will store results of procedural texture kernel execution.
 
 */
+#define TEX_LOD_NONE (-1000.0f) ///< texture LOD is unknown; sample the finest mip level
+
 typedef struct ProcTextureListT
 {
   int     currMaxProcTex;
   int     id_f4 [MAXPROCTEX];
   float3  fdata4[MAXPROCTEX];  
+  float   texLod;              ///< ray cone footprint at hit point; see SurfaceHit::texLod
 
 } ProcTextureList;
 
@@ -2292,6 +2421,7 @@ static inline void InitProcTextureList(__private ProcTextureList* a_pList)
 {
   a_pList->currMaxProcTex = 0;
   a_pList->id_f4[0] = INVALID_TEXTURE;
+  a_pList->texLod   = TEX_LOD_NONE;
 }
 
 static inline void WriteProcTextureList(__global float4* fdata, int tid, int size, __private const ProcTextureList* a_pList)
@@ -2463,6 +2593,11 @@ typedef struct ALIGN_S(16) PerRayAccT
   float  pdfCameraWP; ///< accumulated probability per projected solid angle for camera path
   float  pdfCamA0;    ///< equal to pdfWP[0]*G[0] (if [0] means light)
 
+  float  lightVertX;  ///< position of the first light path vertex (next to light); light tree pick probability of explicit strategy is evaluated there
+  float  lightVertY;
+  float  lightVertZ;
+  uint   lightVertN;  ///< encoded normal of the first light path vertex (see encodeNormal)
+
 } PerRayAcc;
 
 static inline PerRayAcc InitialPerParAcc()
@@ -2472,9 +2607,23 @@ static inline PerRayAcc InitialPerParAcc()
   res.pdfLightWP   = 1.0f;
   res.pdfCameraWP  = 1.0f;
   res.pdfCamA0     = 1.0f;
+  res.lightVertX   = 0.0f;
+  res.lightVertY   = 0.0f;
+  res.lightVertZ   = 0.0f;
+  res.lightVertN   = 0;
   return res;
 }
 
+static inline void perRayAccSetLightVert(__private PerRayAcc* a_pAcc, const float3 a_pos, const float3 a_normal)
+{
+  a_pAcc->lightVertX = a_pos.x;
+  a_pAcc->lightVertY = a_pos.y;
+  a_pAcc->lightVertZ = a_pos.z;
+  a_pAcc->lightVertN = encodeNormal(a_normal);
+}
+
+static inline float3 perRayAccLightVertPos(__private const PerRayAcc* a_pAcc) { return make_float3(a_pAcc->lightVertX, a_pAcc->lightVertY, a_pAcc->lightVertZ); }
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2491,9 +2640,24 @@ typedef struct SurfaceHitT
   int    matId;
   float  t;
   float  sRayOff;
+  float  texLod;   ///< log2 of ray cone footprint in uv units (texture size is not accounted); TEX_LOD_NONE if unknown
   bool   hfi;
 } SurfaceHit;
 
+/**
+\brief Texture LOD of ray cone footprint (see "Texture Level of Detail Strategies for Real-Time Ray Tracing", Akenine-Moller et al.).
+\param a_uvLodBias - 0.5*log2(uvArea/worldArea) of hit triangle
+\param a_coneWidth - cone width at hit point
+\param a_cosTheta  - cos between ray direction and surface normal
+
+*/
+static inline float rayConeTexLod(const float a_uvLodBias, const float a_coneWidth, const float a_cosTheta)
+{
+  if (a_coneWidth <= 0.0f)
+    return TEX_LOD_NONE;
+  return a_uvLodBias + log2(a_coneWidth / fmax(fabs(a_cosTheta), 0.05f));
+}
+
 #define PV_PACK_VALID_FIELD 1
 #define PV_PACK_WASSP_FIELD 2
 #define PV_PACK_HITFI_FIELD 4 // Hit From Inside 
@@ -2515,7 +2679,7 @@ static inline void WriteSurfaceHit(const __private SurfaceHit* a_pHit, int a_tid
   // ignore (hit.t, hit.sRayOff) because bpt don't need them! 
 
   const int bit3  = a_pHit->hfi ? PV_PACK_HITFI_FIELD : 0;
-  const float4 f4 = make_float4(a_pHit->t, a_pHit->sRayOff, 0, as_float(bit3));
+  const float4 f4 = make_float4(a_pHit->t, a_pHit->sRayOff, a_pHit->texLod, as_float(bit3));
 
   a_out[a_tid + 0*a_threadNum] = f1;
   a_out[a_tid + 1*a_threadNum] = f2;
@@ -2546,6 +2710,7 @@ static inline void ReadSurfaceHit(const __global float4* a_in, int a_tid, int a_
   a_pHit->matId      =              as_int(f3.w);
   a_pHit->t          = f4.x;
   a_pHit->sRayOff    = f4.y;
+  a_pHit->texLod     = f4.z;
 
   const int flags    = as_int(f4.w);
   a_pHit->hfi        = ((flags & PV_PACK_HITFI_FIELD) != 0);
@@ -2617,7 +2782,15 @@ enum PLAIN_MAT_FLAGS{
 
 #define PLAIN_MATERIAL_DATA_SIZE        192
 #define PLAIN_MATERIAL_CUSTOM_DATA_SIZE 80
-#define MIX_TREE_MAX_DEEP               7
+#ifndef MIX_TREE_MAX_DEEP
+#define MIX_TREE_MAX_DEEP               7      // OpenCL kernels may be compiled with less value for scenes with shallow blends, see GPUOCLLayer::SetMaterialFeatures
+#endif
+
+#ifndef MATERIAL_CLASS_MASK
+#define MATERIAL_CLASS_MASK             0x7FFFFFFF // bit (1 << PLAIN_MAT_CLASS_*) per material class; OpenCL kernels are compiled only for classes present in scene
+#endif
+
+#define MATERIAL_CLASS_ENABLED(a_class) ((MATERIAL_CLASS_MASK & (1 << (a_class))) != 0)
 
 struct PlainMaterialT
 {
@@ -2819,6 +2992,30 @@ static int SelectIndexPropToOpt(const float a_r, __global const float* a_accum,
   return currPos;
 }
 
+/**
+\brief  Select index proportional to piecewise constant function in O(1) with Walker/Vose alias table (see AliasTableFromPrefixSumm).
+\param  a_r     - input random variable in rage [0, 1]
+\param  a_accum - the same prefix summ as for SelectIndexPropToOpt, immediately followed by alias table: 
+                  (threshold, as_float(alias index)) for each of N-1 intervals.
+\param  N       - size of extended prefix summ array - i.e. a_accum[N-1] == summ(a_accum[0 .. N-2]).
+\param  pPDF    - out parameter. probability of picking up found value; evaluated from prefix summ, so it is the same as for SelectIndexPropToOpt.
+\return found index
+
+*/
+static inline int SelectIndexAlias(const float a_r, __global const float* a_accum, const int N, 
+                                   __private float* pPDF) 
+{
+  __global const float* alias = a_accum + N;
+
+  const float x  = a_r*(float)(N - 1);
+  const int   i0 = (int)x;
+  const int   i  = (i0 < N - 2) ? i0 : N - 2;
+  const int   j  = (x - (float)i < alias[2*i + 0]) ? i : as_int(alias[2*i + 1]);
+
+  (*pPDF) = (a_accum[j + 1] - a_accum[j]) / a_accum[N - 1];
+  return j;
+}
+
 /**
 \brief search for for the lower bound (left range)
 \param a          - array
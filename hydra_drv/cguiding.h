@@ -0,0 +1,176 @@
+#ifndef RTCGUIDING
+#define RTCGUIDING
+
+#include "cglobals.h"
+
+/**
+\brief Path guiding SD-tree (Muller et al., "Practical Path Guiding for Efficient Light-Transport Simulation") packed to float4 array.
+       Same data is read by CPU path tracer and by NextBounce/Shade kernels, so it is built on the host (see GuidingSDTree) and only read here.
+
+       [0]                      - (as_float(spatialNodesNum), as_float(quadNodesNum), 0, 0)
+       [1]                      - (boxMin, 0)
+       [2]                      - (boxMax, 0)
+       [3, 3 + spatialNodesNum) - spatial nodes: (split, as_float(axis), as_float(child), as_float(quadRoot)); axis is -1 for leaves,
+                                  child is the index of the first child (second is child + 1), quadRoot is the index of leaf quadtree or -1
+       [..., end)               - quadtree nodes, 2 float4 each: (energy of 4 quadrants), (as_float(child) of 4 quadrants; 0 for leaf quadrants)
+
+       All indices are absolute float4 offsets from the beginning of the array. Quadrant (x,y) is (x + 2*y).
+       Quadtree is built over equal area cylindrical mapping of the sphere, so uniform density on a quadrant is uniform in solid angle.
+*/
+
+#define GUIDING_HEADER_SIZE      3
+#define GUIDING_SAMPLE_FRACTION  0.5f  ///< probability to sample guiding tree instead of BSDF
+
+static inline float2 guidingDirToCyl(const float3 a_dir)
+{
+  const float cosTheta = clamp(a_dir.z, -1.0f, 1.0f);
+  float phi = atan2(a_dir.y, a_dir.x);
+  if (phi < 0.0f)
+    phi += 2.0f*M_PI;
+  return make_float2(clamp(0.5f*(cosTheta + 1.0f), 0.0f, 1.0f), clamp(phi*(0.5f*INV_PI), 0.0f, 1.0f));
+}
+
+static inline float3 guidingCylToDir(const float2 a_cyl)
+{
+  const float cosTheta = 2.0f*a_cyl.x - 1.0f;
+  const float sinTheta = sqrt(fmax(1.0f - cosTheta*cosTheta, 0.0f));
+  const float phi      = 2.0f*M_PI*a_cyl.y;
+  return make_float3(sinTheta*cos(phi), sinTheta*sin(phi), cosTheta);
+}
+
+static inline float guidingQuadEnergy(const float4 a_energy, const int a_quad)
+{
+  return (a_quad == 0) ? a_energy.x : ((a_quad == 1) ? a_energy.y : ((a_quad == 2) ? a_energy.z : a_energy.w));
+}
+
+static inline int guidingQuadChild(const float4 a_child, const int a_quad) { return as_int(guidingQuadEnergy(a_child, a_quad)); }
+
+static inline float guidingAxis(const float3 a_pos, const int a_axis) { return (a_axis == 0) ? a_pos.x : ((a_axis == 1) ? a_pos.y : a_pos.z); }
+
+static inline float guidingRand(const float a_r) { return fmin(fmax(a_r, 0.0f), 0.99999994f); }
+
+/**
+\brief return index of the quadtree for a_pos or -1 if there is no radiance data near a_pos; a_tree may be 0.
+
+*/
+static inline int guidingFindLeaf(__global const float4* a_tree, const float3 a_pos)
+{
+  if (a_tree == 0)
+    return -1;
+
+  const float3 boxMin = to_float3(a_tree[1]);
+  const float3 boxMax = to_float3(a_tree[2]);
+
+  if (a_pos.x < boxMin.x || a_pos.y < boxMin.y || a_pos.z < boxMin.z ||
+      a_pos.x > boxMax.x || a_pos.y > boxMax.y || a_pos.z > boxMax.z)
+    return -1;
+
+  float4 node = a_tree[GUIDING_HEADER_SIZE];
+  while (as_int(node.y) != -1)
+  {
+    const int child = as_int(node.z);
+    node = (guidingAxis(a_pos, as_int(node.y)) < node.x) ? a_tree[child] : a_tree[child + 1];
+  }
+
+  return as_int(node.w);
+}
+
+/**
+\brief sample direction proportional to the incident radiance; (*a_pPdf) is pdf in solid angle.
+
+*/
+static inline float3 guidingSample(__global const float4* a_tree, const int a_leaf, float2 a_rands, __private float* a_pPdf)
+{
+  float2 origin = make_float2(0.0f, 0.0f);
+  float  size   = 1.0f;
+  float  pdf    = 1.0f;
+  int    nodeId = a_leaf;
+
+  a_rands.x = guidingRand(a_rands.x);
+  a_rands.y = guidingRand(a_rands.y);
+
+  while (true)
+  {
+    const float4 energy = a_tree[nodeId + 0];
+    const float  row0   = energy.x + energy.y;
+    const float  total  = row0 + energy.z + energy.w;
+
+    const float pRow0 = row0 / total;
+    int qy = 0;
+    if (a_rands.y < pRow0)
+      a_rands.y = guidingRand(a_rands.y / pRow0);
+    else
+    {
+      a_rands.y = guidingRand((a_rands.y - pRow0) / fmax(1.0f - pRow0, 1e-30f));
+      qy        = 1;
+    }
+
+    const float e0    = guidingQuadEnergy(energy, 2*qy + 0);
+    const float pCol0 = e0 / fmax(e0 + guidingQuadEnergy(energy, 2*qy + 1), 1e-30f);
+    int qx = 0;
+    if (a_rands.x < pCol0)
+      a_rands.x = guidingRand(a_rands.x / pCol0);
+    else
+    {
+      a_rands.x = guidingRand((a_rands.x - pCol0) / fmax(1.0f - pCol0, 1e-30f));
+      qx        = 1;
+    }
+
+    const int q = qx + 2*qy;
+    pdf   *= 4.0f*guidingQuadEnergy(energy, q) / total;
+    size  *= 0.5f;
+    origin = make_float2(origin.x + (float)(qx)*size, origin.y + (float)(qy)*size);
+
+    const int child = guidingQuadChild(a_tree[nodeId + 1], q);
+    if (child == 0)
+      break;
+    nodeId = child;
+  }
+
+  (*a_pPdf) = pdf*(0.25f*INV_PI);
+  return guidingCylToDir(make_float2(origin.x + a_rands.x*size, origin.y + a_rands.y*size));
+}
+
+static inline float guidingPdf(__global const float4* a_tree, const int a_leaf, const float3 a_dir)
+{
+  const float2 cyl = guidingDirToCyl(a_dir);
+
+  float2 origin = make_float2(0.0f, 0.0f);
+  float  size   = 1.0f;
+  float  pdf    = 1.0f;
+  int    nodeId = a_leaf;
+
+  while (true)
+  {
+    const float4 energy = a_tree[nodeId + 0];
+    const float  total  = energy.x + energy.y + energy.z + energy.w;
+
+    size *= 0.5f;
+    const int qx = (cyl.x >= origin.x + size) ? 1 : 0;
+    const int qy = (cyl.y >= origin.y + size) ? 1 : 0;
+    const int q  = qx + 2*qy;
+
+    pdf   *= 4.0f*guidingQuadEnergy(energy, q) / total;
+    origin = make_float2(origin.x + (float)(qx)*size, origin.y + (float)(qy)*size);
+
+    const int child = guidingQuadChild(a_tree[nodeId + 1], q);
+    if (child == 0 || pdf == 0.0f)
+      break;
+    nodeId = child;
+  }
+
+  return pdf*(0.25f*INV_PI);
+}
+
+/**
+\brief one-sample MIS pdf of BSDF and guiding tree for the direction that both strategies can produce.
+
+*/
+static inline float guidingMixturePdf(__global const float4* a_tree, const int a_leaf, const float3 a_dir, const float a_bsdfPdf)
+{
+  if (a_leaf < 0)
+    return a_bsdfPdf;
+  return GUIDING_SAMPLE_FRACTION*guidingPdf(a_tree, a_leaf, a_dir) + (1.0f - GUIDING_SAMPLE_FRACTION)*a_bsdfPdf;
+}
+
+#endif
@@ -330,34 +330,6 @@ static inline float evalMap2DPdf(const float2 texCoordT, __global const float* i
   return (interval.y - interval.x)*(fw*fh)/intervals[sizeX*sizeY];
 }
 
-static inline float skyLightEvalPDF(__global const PlainLight* pLight, float3 illuminatingPoint, float3 rayDir, __global const EngineGlobals* a_globals, __global const float4* a_pdfStorage)
-{
-  __global const float* pdfHeader = pdfTableHeader(as_int(pLight->data[SKY_DOME_PDF_TABLE0]), a_pdfStorage, a_globals);
-  __global const float* intervals = pdfHeader + 4;
-
-  const int sizeX = as_int(pdfHeader[0]);
-  const int sizeY = as_int(pdfHeader[1]);
-  const float fw  = (float)sizeX;
-  const float fh  = (float)sizeY;
-  const float fN  = fw*fh;
-
-  // get tex coords and transform them with tex matrix, move to texture space
-  //
-  float sintheta = 0.0f;
-  const float2 texCoord = sphereMapTo2DTexCoord(rayDir, &sintheta);
-  if (sintheta == 0.f)
-    return 0.f;
-
-  // apply inverse texcoord transform to get phi and theta and than get correct pdf from table 
-  //
-  __global const float4x4* pMatrix = (__global const float4x4*)(pLight->data + SKY_DOME_MATRIX0);
-
-  const float2 texCoordT = mul2x4(pMatrix->row[0], pMatrix->row[1], texCoord);
-  const float mapPdf     = evalMap2DPdf(texCoordT, intervals, sizeX, sizeY);
-  return (mapPdf * 1.0f) / (2.f * M_PI * M_PI * fmax(sintheta, DEPSILON));
-}
-
-
 static inline int mylocalimax(int a, int b) { return (a > b) ? a : b; }
 static inline int mylocalimin(int a, int b) { return (a < b) ? a : b; }
 
@@ -374,7 +346,7 @@ static inline Map2DPiecewiseSample sampleMap2D(float3 rands, __global const floa
   const float fN = fw*fh;
 
   float pdf = 1.0f;
-  int pixelOffset = SelectIndexPropToOpt(rands.z, intervals, sizeX*sizeY+1, &pdf);
+  int pixelOffset = SelectIndexAlias(rands.z, intervals, sizeX*sizeY+1, &pdf); // alias table follows intervals
 
   if (pixelOffset >= sizeX*sizeY)
     pixelOffset = sizeX*sizeY - 1;
@@ -391,6 +363,149 @@ static inline Map2DPiecewiseSample sampleMap2D(float3 rands, __global const floa
   return result;
 }
 
+#define PDF_TABLE_LAYOUT_FLAT 1 ///< prefix summ followed by alias table; see sampleMap2D
+#define PDF_TABLE_LAYOUT_MIP  2 ///< luminance pyramid of power of 2 size; see sampleMap2DMip
+
+static inline float mipWarpRand(float a_r) { return fmin(fmax(a_r, 0.0f), 0.99999994f); }
+
+/**
+\brief  Sample map with hierarchical warping. Descend luminance pyramid from 1x1 level to the finest one, choose column with rands.x
+        and row with rands.y at each level and rescale randoms, so their remainder is the position inside the finest texel.
+\param  rands   - input 2 randoms in [0,1]
+\param  mipInfo - (padded width, padded height, levels, finest level offset) followed by levels from 1x1 to the finest one.
+                  Each texel of coarse level is the summ of its children; padded texels are zero.
+\param  sizeX   - map width
+\param  sizeY   - map height
+
+*/
+static inline Map2DPiecewiseSample sampleMap2DMip(float2 rands, __global const float* mipInfo, const int sizeX, const int sizeY)
+{
+  const int mipW   = as_int(mipInfo[0]);
+  const int mipH   = as_int(mipInfo[1]);
+  const int levels = as_int(mipInfo[2]);
+
+  __global const float* level = mipInfo + 4;
+  const float total           = level[0];
+
+  int x = 0, y = 0, lw = 1, lh = 1;
+  rands.x = mipWarpRand(rands.x);
+  rands.y = mipWarpRand(rands.y);
+
+  for (int lvl = levels - 2; lvl >= 0; lvl--)
+  {
+    __global const float* child = level + lw*lh;
+
+    const int cw = mylocalimax(mipW >> lvl, 1);
+    const int ch = mylocalimax(mipH >> lvl, 1);
+    const int x0 = (cw > lw) ? 2*x : x;
+    const int y0 = (ch > lh) ? 2*y : y;
+    const int y1 = (ch > lh) ? y0 + 1 : y0;
+
+    x = x0;
+    if (cw > lw)
+    {
+      const float left  = child[y0*cw + x0] + ((y1 != y0) ? child[y1*cw + x0] : 0.0f);
+      const float right = child[y0*cw + x0 + 1] + ((y1 != y0) ? child[y1*cw + x0 + 1] : 0.0f);
+      const float pLeft = left / fmax(left + right, 1e-30f);
+      if (rands.x < pLeft)
+        rands.x = mipWarpRand(rands.x / pLeft);
+      else
+      {
+        rands.x = mipWarpRand((rands.x - pLeft) / fmax(1.0f - pLeft, 1e-30f));
+        x       = x0 + 1;
+      }
+    }
+
+    y = y0;
+    if (ch > lh)
+    {
+      const float top  = child[y0*cw + x];
+      const float pTop = top / fmax(top + child[y1*cw + x], 1e-30f);
+      if (rands.y < pTop)
+        rands.y = mipWarpRand(rands.y / pTop);
+      else
+      {
+        rands.y = mipWarpRand((rands.y - pTop) / fmax(1.0f - pTop, 1e-30f));
+        y       = y1;
+      }
+    }
+
+    level = child;
+    lw    = cw;
+    lh    = ch;
+  }
+
+  x = mylocalimin(x, sizeX - 1);
+  y = mylocalimin(y, sizeY - 1);
+
+  Map2DPiecewiseSample result;
+  result.mapPdf   = level[y*lw + x]*(float)(sizeX*sizeY) / fmax(total, 1e-30f);
+  result.texCoord = make_float2(((float)x + rands.x) / (float)sizeX, ((float)y + rands.y) / (float)sizeY);
+  return result;
+}
+
+static inline float evalMap2DMipPdf(const float2 texCoordT, __global const float* mipInfo, const int sizeX, const int sizeY)
+{
+  const int mipW      = as_int(mipInfo[0]);
+  const int finestOff = as_int(mipInfo[3]);
+
+  const float u = texCoordT.x - floor(texCoordT.x);
+  const float v = texCoordT.y - floor(texCoordT.y);
+
+  const int pixelX = mylocalimin((int)(u*(float)sizeX), sizeX - 1);
+  const int pixelY = mylocalimin((int)(v*(float)sizeY), sizeY - 1);
+
+  __global const float* level = mipInfo + 4;
+  return level[finestOff + pixelY*mipW + pixelX]*(float)(sizeX*sizeY) / fmax(level[0], 1e-30f);
+}
+
+/**
+\brief  Sample 2D pdf table of any layout; a_pdfHeader is (width, height, layout, size) followed by table data.
+
+*/
+static inline Map2DPiecewiseSample sampleMap2DTable(float3 rands, __global const float* a_pdfHeader)
+{
+  const int sizeX = as_int(a_pdfHeader[0]);
+  const int sizeY = as_int(a_pdfHeader[1]);
+
+  if (as_int(a_pdfHeader[2]) == PDF_TABLE_LAYOUT_MIP)
+    return sampleMap2DMip(make_float2(rands.x, rands.y), a_pdfHeader + 4, sizeX, sizeY);
+  else
+    return sampleMap2D(rands, a_pdfHeader + 4, sizeX, sizeY);
+}
+
+static inline float evalMap2DTablePdf(const float2 texCoordT, __global const float* a_pdfHeader)
+{
+  const int sizeX = as_int(a_pdfHeader[0]);
+  const int sizeY = as_int(a_pdfHeader[1]);
+
+  if (as_int(a_pdfHeader[2]) == PDF_TABLE_LAYOUT_MIP)
+    return evalMap2DMipPdf(texCoordT, a_pdfHeader + 4, sizeX, sizeY);
+  else
+    return evalMap2DPdf(texCoordT, a_pdfHeader + 4, sizeX, sizeY);
+}
+
+static inline float skyLightEvalPDF(__global const PlainLight* pLight, float3 illuminatingPoint, float3 rayDir, __global const EngineGlobals* a_globals, __global const float4* a_pdfStorage)
+{
+  __global const float* pdfHeader = pdfTableHeader(as_int(pLight->data[SKY_DOME_PDF_TABLE0]), a_pdfStorage, a_globals);
+
+  // get tex coords and transform them with tex matrix, move to texture space
+  //
+  float sintheta = 0.0f;
+  const float2 texCoord = sphereMapTo2DTexCoord(rayDir, &sintheta);
+  if (sintheta == 0.f)
+    return 0.f;
+
+  // apply inverse texcoord transform to get phi and theta and than get correct pdf from table 
+  //
+  __global const float4x4* pMatrix = (__global const float4x4*)(pLight->data + SKY_DOME_MATRIX0);
+
+  const float2 texCoordT = mul2x4(pMatrix->row[0], pMatrix->row[1], texCoord);
+  const float mapPdf     = evalMap2DTablePdf(texCoordT, pdfHeader);
+  return (mapPdf * 1.0f) / (2.f * M_PI * M_PI * fmax(sintheta, DEPSILON));
+}
+
+
 /**
 \brief  Sample sphere around light according to IES table thats is stored as spheremap.
 
@@ -423,13 +538,8 @@ inline static void SkyLightSampleRev(__global const PlainLight* pLight, float3 r
                                      __global const EngineGlobals* a_globals, __global const float4* a_pdfStorage, texture2d_t a_tex,
                                      __private ShadowSample* a_out)
 {
-  __global const float* pdfHeader = pdfTableHeader(as_int(pLight->data[SKY_DOME_PDF_TABLE0]), a_pdfStorage, a_globals);
-  __global const float* intervals = pdfHeader + 4;
-
-  const int sizeX = as_int(pdfHeader[0]);
-  const int sizeY = as_int(pdfHeader[1]);
-
-  const Map2DPiecewiseSample sample = sampleMap2D(rands, intervals, sizeX, sizeY);
+  __global const float* pdfHeader   = pdfTableHeader(as_int(pLight->data[SKY_DOME_PDF_TABLE0]), a_pdfStorage, a_globals);
+  const Map2DPiecewiseSample sample = sampleMap2DTable(rands, pdfHeader);
 
   // apply inverse texcoord transform to get phi and theta
   //
@@ -767,10 +877,7 @@ static inline void CylinderLightSamplePos(__global const PlainLight* pLight, flo
   if (texId > 0)
   {
     __global const float* pdfHeader = pdfTableHeader(texId, a_tableStorage, a_globals);
-    __global const float* intervals = pdfHeader + 4;
-    const int sizeX = as_int(pdfHeader[0]);
-    const int sizeY = as_int(pdfHeader[1]);
-    sample = sampleMap2D(rands, intervals, sizeX, sizeY);
+    sample = sampleMap2DTable(rands, pdfHeader);
   }
 
   (*pPdfA) = sample.mapPdf / pLight->data[PLIGHT_SURFACE_AREA];
@@ -974,36 +1081,26 @@ static inline void MeshLightSamplePos(__global const PlainLight* pLight, float3
   __global const float*     table = (__global const float*)    (a_tableStorage + pdftOffset);
 
   __global const float4* vpos  = meshVerts(pMesh);
-  __global const float4* vnorm = meshNorms(pMesh);
-  //__global const float2* texc  = meshTexCoords(pMesh);
   __global const int* indices  = meshTriIndices(pMesh);
 
   float pickProb = 1.0f;
-  const int triangleId = SelectIndexPropToOpt(rands.z, table, triNum + 1, &pickProb);
+  const int triangleId = SelectIndexAlias(rands.z, table, triNum + 1, &pickProb);
 
   const int iA = indices[triangleId * 3 + 0];
   const int iB = indices[triangleId * 3 + 1];
   const int iC = indices[triangleId * 3 + 2];
 
-  const float4 dataA  = vpos[iA];
-  const float4 dataB  = vpos[iB];
-  const float4 dataC  = vpos[iC];
-
-  const float4 datanA = vnorm[iA];
-  const float4 datanB = vnorm[iB];
-  const float4 datanC = vnorm[iC];
-
-  const float3 A  = to_float3(dataA);
-  const float3 B  = to_float3(dataB);
-  const float3 C  = to_float3(dataC);
+  const float3 A  = to_float3(vpos[iA]);
+  const float3 B  = to_float3(vpos[iB]);
+  const float3 C  = to_float3(vpos[iC]);
 
-  const float3 nA = to_float3(datanA);
-  const float3 nB = to_float3(datanB);
-  const float3 nC = to_float3(datanC);
+  const float3 nA = meshNormalAt(pMesh, iA);
+  const float3 nB = meshNormalAt(pMesh, iB);
+  const float3 nC = meshNormalAt(pMesh, iC);
 
-  const float2 tA = make_float2(dataA.w, datanA.w); // texc[iA];
-  const float2 tB = make_float2(dataB.w, datanB.w); // texc[iB];
-  const float2 tC = make_float2(dataC.w, datanC.w); // texc[iC];
+  const float2 tA = meshTexCoordAt(pMesh, iA);
+  const float2 tB = meshTexCoordAt(pMesh, iB);
+  const float2 tC = meshTexCoordAt(pMesh, iC);
   
   // uniform barycentrics
   //
@@ -1338,10 +1435,7 @@ static inline float cylinderLightEvalPDF(__global const PlainLight* pLight, floa
   if (texId)
   {
     __global const float* pdfHeader = pdfTableHeader(texId, a_tableStorage, a_globals);
-    __global const float* intervals = pdfHeader + 4;
-    const int sizeX = as_int(pdfHeader[0]);
-    const int sizeY = as_int(pdfHeader[1]);
-    mapPdf = evalMap2DPdf(texCoord, intervals, sizeX, sizeY);
+    mapPdf = evalMap2DTablePdf(texCoord, pdfHeader);
   }
 
   const float hitDist = length(lpos - illuminatingPoint);
@@ -1758,16 +1852,160 @@ static inline unsigned int rndIntFromFloatLocal(float r, unsigned int a, unsigne
 }
 
 /**
-\brief select random visiable light.
-\param a_r       - random in range [0,1]
-\param hitPos    - position on surface which we are going to lit
-\param a_globals - engine globals
-\param pickProb  - out light pick probability
+\brief Light BVH (Conty & Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting").
+       Layout of lightTreeData: int nodesNum, 3 unused, nodes[nodesNum] (LTREE_NODE_SIZE floats each), int leafOfLight[lightsNum].
+       Node 0 is root; children of inner node are 'child' and 'child+1'. Lights without finite bounds (sky, direct) are collected 
+       in separate subtree with LTREE_UNBOUNDED flag and are selected proportional to their power only.
+
+*/
+#define LTREE_NODE_SIZE 16
+#define LTREE_BOX_MIN   0   ///< .. 2
+#define LTREE_ENERGY    3   ///< summ of PLIGHT_PICK_PROB_REV of all lights in node
+#define LTREE_BOX_MAX   4   ///< .. 6
+#define LTREE_THETA_O   7   ///< normals cone half angle
+#define LTREE_AXIS      8   ///< .. 10; normals cone axis
+#define LTREE_THETA_E   11  ///< emission angle behind normals cone
+#define LTREE_CHILD     12  ///< int; first child; -1 for leaf
+#define LTREE_PARENT    13  ///< int; -1 for root
+#define LTREE_LIGHT     14  ///< int; light offset for leaf
+#define LTREE_FLAGS     15  ///< int; LTREE_UNBOUNDED
+#define LTREE_HEADER    4
+
+#define LTREE_UNBOUNDED 1
+
+/**
+\brief estimate contribution of light tree node to point 'p' with normal 'n' (upper bound of cosines as in paper).
+\param n - surface normal; cosine at surface is taken by abs value because of transmission; zero normal disables it
+
+*/
+static inline float lightTreeNodeImportance(__global const float* a_node, float3 p, float3 n)
+{
+  const float3 boxMin = make_float3(a_node[LTREE_BOX_MIN + 0], a_node[LTREE_BOX_MIN + 1], a_node[LTREE_BOX_MIN + 2]);
+  const float3 boxMax = make_float3(a_node[LTREE_BOX_MAX + 0], a_node[LTREE_BOX_MAX + 1], a_node[LTREE_BOX_MAX + 2]);
+  const float3 axis   = make_float3(a_node[LTREE_AXIS    + 0], a_node[LTREE_AXIS    + 1], a_node[LTREE_AXIS    + 2]);
+
+  const float3 diag   = boxMax - boxMin;
+  const float3 toPos  = p - 0.5f*(boxMin + boxMax);
+  const float  r2     = 0.25f*dot(diag, diag);
+  const float  dist2  = dot(toPos, toPos);
+  const float  energy = a_node[LTREE_ENERGY];
+
+  if (dist2 <= r2)                                        // inside bounding sphere: all angles are unbounded
+    return energy / fmax(r2, 1e-12f);
+
+  const float3 dir    = toPos*(1.0f/sqrt(dist2));
+  const float  thetaU = asin(sqrt(r2 / dist2));
+  const float  theta  = acos(clamp(dot(axis, dir), -1.0f, 1.0f));
+  const float  thetaP = fmax(theta - a_node[LTREE_THETA_O] - thetaU, 0.0f);
+
+  if (thetaP >= a_node[LTREE_THETA_E])
+    return 0.0f;
+
+  float cosSurf = 1.0f;
+  if (dot(n, n) > 0.0f)
+  {
+    const float thetaI = acos(clamp(fabs(dot(n, dir)), 0.0f, 1.0f));
+    cosSurf = cos(fmax(thetaI - thetaU, 0.0f));
+  }
+
+  return energy*cos(thetaP)*cosSurf / dist2;
+}
+
+/**
+\brief probability to go to first child of inner node a_node
+\param a_tree - pointer to nodes
+
+*/
+static inline float lightTreeFirstChildProb(__global const float* a_tree, int a_node, float3 p, float3 n)
+{
+  const int child = as_int(a_tree[a_node*LTREE_NODE_SIZE + LTREE_CHILD]);
+
+  __global const float* pNode0 = a_tree + (child + 0)*LTREE_NODE_SIZE;
+  __global const float* pNode1 = a_tree + (child + 1)*LTREE_NODE_SIZE;
+
+  float w0, w1;
+  if ((as_int(pNode0[LTREE_FLAGS]) | as_int(pNode1[LTREE_FLAGS])) & LTREE_UNBOUNDED)
+  {
+    w0 = pNode0[LTREE_ENERGY];
+    w1 = pNode1[LTREE_ENERGY];
+  }
+  else
+  {
+    w0 = lightTreeNodeImportance(pNode0, p, n);
+    w1 = lightTreeNodeImportance(pNode1, p, n);
+  }
+
+  return (w0 + w1 > 0.0f) ? w0 / (w0 + w1) : 0.5f;
+}
+
+/**
+\brief traverse light tree with single random number that is rescaled on each level.
 \return selected light offset in global instanced lights array
 
 */
-static inline int SelectRandomLightRev(float a_r, float3 hitPos, __global const EngineGlobals* a_globals, 
-                                       __private float* pickProb)
+static inline int LightTreeSelect(float a_r, float3 hitPos, float3 hitNorm, __global const EngineGlobals* a_globals,
+                                  __private float* pickProb)
+{
+  __global const float* tree = lightTreeData(a_globals) + LTREE_HEADER;
+
+  int   node = 0;
+  float prob = 1.0f;
+
+  while (as_int(tree[node*LTREE_NODE_SIZE + LTREE_CHILD]) >= 0)
+  {
+    const int   child = as_int(tree[node*LTREE_NODE_SIZE + LTREE_CHILD]);
+    const float p0    = lightTreeFirstChildProb(tree, node, hitPos, hitNorm);
+
+    if (a_r < p0)
+    {
+      a_r  = a_r / p0;
+      prob = prob*p0;
+      node = child;
+    }
+    else
+    {
+      a_r  = (a_r - p0) / (1.0f - p0);
+      prob = prob*(1.0f - p0);
+      node = child + 1;
+    }
+    a_r = fmin(a_r, 0.99999994f);
+  }
+
+  (*pickProb) = prob;
+  return as_int(tree[node*LTREE_NODE_SIZE + LTREE_LIGHT]);
+}
+
+/**
+\brief probability of LightTreeSelect to select light a_lightOffset at hitPos; walks from leaf to root.
+
+*/
+static inline float LightTreePdf(int a_lightOffset, float3 hitPos, float3 hitNorm, __global const EngineGlobals* a_globals)
+{
+  __global const float* header     = lightTreeData(a_globals);
+  __global const float* tree       = header + LTREE_HEADER;
+  __global const float* leafOfLight = tree + as_int(header[0])*LTREE_NODE_SIZE;
+
+  int   node = as_int(leafOfLight[a_lightOffset]);
+  float prob = (node >= 0) ? 1.0f : 0.0f;
+
+  while (node >= 0 && as_int(tree[node*LTREE_NODE_SIZE + LTREE_PARENT]) >= 0)
+  {
+    const int   parent = as_int(tree[node*LTREE_NODE_SIZE + LTREE_PARENT]);
+    const float p0     = lightTreeFirstChildProb(tree, parent, hitPos, hitNorm);
+    prob *= (node == as_int(tree[parent*LTREE_NODE_SIZE + LTREE_CHILD])) ? p0 : (1.0f - p0);
+    node  = parent;
+  }
+
+  return prob;
+}
+
+/**
+\brief select random light proportional to its power only; needed for bidirectional integrators which assume that 
+       pick probability does not depend on surface point (it is PLIGHT_PICK_PROB_REV then).
+
+*/
+static inline int SelectRandomLightRevPower(float a_r, __global const EngineGlobals* a_globals,
+                                            __private float* pickProb)
 {
   const int tableSize = lightSelPdfTableSizeRev(a_globals);
   if (tableSize == 0)
@@ -1783,15 +2021,50 @@ static inline int SelectRandomLightRev(float a_r, float3 hitPos, __global const
   else
   {
     __global const float* table = lightSelPdfTableRev(a_globals);
-    return SelectIndexPropToOpt(a_r, table, tableSize, pickProb);
+    return SelectIndexAlias(a_r, table, tableSize, pickProb);
   }
 }
 
+/**
+\brief select random visiable light.
+\param a_r       - random in range [0,1]
+\param hitPos    - position on surface which we are going to lit
+\param hitNorm   - normal of surface which we are going to lit
+\param a_globals - engine globals
+\param pickProb  - out light pick probability
+\return selected light offset in global instanced lights array
+
+  If light tree is present, lights are selected proportional to their estimated contribution to hitPos, 
+  use lightPdfSelectRevAt to get pick probability for MIS then.
+
+*/
+static inline int SelectRandomLightRev(float a_r, float3 hitPos, float3 hitNorm, __global const EngineGlobals* a_globals, 
+                                       __private float* pickProb)
+{
+  if (a_globals->lightTreeSize != 0)
+    return LightTreeSelect(a_r, hitPos, hitNorm, a_globals, pickProb);
+  else
+    return SelectRandomLightRevPower(a_r, a_globals, pickProb);
+}
+
 static inline float lightPdfSelectRev(__global const PlainLight* pLight)
 {
   return pLight->data[PLIGHT_PICK_PROB_REV];
 }
 
+/**
+\brief pick probability of SelectRandomLightRev for light pLight at surface point (hitPos, hitNorm).
+       For lights in unbounded subtree it is equal to lightPdfSelectRev(pLight).
+
+*/
+static inline float lightPdfSelectRevAt(__global const PlainLight* pLight, float3 hitPos, float3 hitNorm, __global const EngineGlobals* a_globals)
+{
+  if (a_globals->lightTreeSize == 0)
+    return lightPdfSelectRev(pLight);
+  else
+    return LightTreePdf((int)(pLight - lightAt(a_globals, 0)), hitPos, hitNorm, a_globals);
+}
+
 /**
 \brief select random light
 \param a_r       - random in range [0,1]
@@ -1812,7 +2085,7 @@ static inline int SelectRandomLightFwd(float a_r, __global const EngineGlobals*
   else
   {
     __global const float* table = lightSelPdfTableFwd(a_globals);
-    return SelectIndexPropToOpt(a_r, table, tableSize, pickProb);
+    return SelectIndexAlias(a_r, table, tableSize, pickProb);
   }
 }
 
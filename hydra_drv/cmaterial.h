@@ -22,10 +22,28 @@ static inline float3 materialLeafEvalEmission(__global const PlainMaterial* a_pM
 
 static inline int materialIsLight(__global const PlainMaterial* a_pMat) { return length(materialGetEmission(a_pMat)) > 1e-4f ? 1 : 0; }
 
+static inline bool materialIsBlend(__global const PlainMaterial* a_pMat)
+{
+  return MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_BLEND_MASK) && (materialGetType(a_pMat) == PLAIN_MAT_CLASS_BLEND_MASK);
+}
+
 static inline bool materialIsLeafBRDF(__global const PlainMaterial* a_pMat)
 {
-  int type = materialGetType(a_pMat);
-  return (type != PLAIN_MAT_CLASS_BLEND_MASK);
+  return !materialIsBlend(a_pMat);
+}
+
+/**
+\brief Path guiding needs leaf material with non delta lobes; blends and pure specular classes are sampled with BSDF only.
+
+*/
+static inline bool materialCanBeGuided(__global const PlainMaterial* a_pMat)
+{
+  if (!materialIsLeafBRDF(a_pMat))
+    return false;
+
+  const int type = materialGetType(a_pMat);
+  return (type == PLAIN_MAT_CLASS_LAMBERT || type == PLAIN_MAT_CLASS_OREN_NAYAR || type == PLAIN_MAT_CLASS_TRANSLUCENT ||
+          type == PLAIN_MAT_CLASS_PHONG_SPECULAR || type == PLAIN_MAT_CLASS_BLINN_SPECULAR);
 }
 
 
@@ -1074,6 +1092,16 @@ enum BLEND_FLAGS_ENUM {
 
 #define BLEND_FLAGS                    23
 
+#define BLEND_FLAT_TABLE_OFFSET        32 // root blend only: local offset of flattened list of leaves (see materialEvalFlatBlend) or 0
+
+// Flattened blend is list of leaves in depth first order; for each leaf: 
+// (leafOffset, constWeight, stepsNum | (stepsKnown << 16), step[0], ..., step[stepsNum-1]), where step = (blendNodeOffset << 1) | BLEND_FLAT_STEP_*.
+// Leaf weight is constWeight multiplied by alpha or (1 - alpha) of each step node; blends with constant alpha are already folded to constWeight.
+// First stepsKnown steps are the same nodes as for the previous leaf, so their alpha is already evaluated.
+//
+enum BLEND_FLAT_STEP { BLEND_FLAT_STEP_ALPHA           = 0,
+                       BLEND_FLAT_STEP_ONE_MINUS_ALPHA = 1 };
+
 
 static inline float hermiteSplineEval(const float s, const float2 start, const float2 end, const float2 tangent1, const float2 tangent2)
 {
@@ -1115,14 +1143,9 @@ static inline float maxSigmoid(const float x, const float gamma)
 
 static inline float myluminance(const float3 a_lum) { return dot(make_float3(0.35f, 0.51f, 0.14f), a_lum); }
 
-static inline float blendMaskAlpha2(__global const PlainMaterial* pMat, 
-                                    const float3 v, const float3 n, const float2 hitTexCoord, 
-                                    __global const EngineGlobals* a_globals, texture2d_t a_tex, __private const ProcTextureList* a_ptList)
+static inline float blendMaskLuminance(__global const PlainMaterial* pMat, const float3 texColor)
 {
-  const int2   texId    = make_int2(as_int(pMat->data[BLEND_MASK_TEXID_OFFSET]), as_int(pMat->data[BLEND_MASK_TEXMATRIXID_OFFSET]));
-  const float3 texColor = sample2DExt(texId.y, hitTexCoord, (__global const int4*)pMat, a_tex, a_globals, a_ptList);
-  
-  const float3 lum1     = clamp(texColor*make_float3(pMat->data[BLEND_MASK_COLORX_OFFSET], pMat->data[BLEND_MASK_COLORY_OFFSET], pMat->data[BLEND_MASK_COLORZ_OFFSET]), 0.0f, 1.0f);
+  const float3 lum1 = clamp(texColor*make_float3(pMat->data[BLEND_MASK_COLORX_OFFSET], pMat->data[BLEND_MASK_COLORY_OFFSET], pMat->data[BLEND_MASK_COLORZ_OFFSET]), 0.0f, 1.0f);
 
   float lum;
   if ((as_int(pMat->data[BLEND_MASK_FLAGS_OFFSET]) & BLEND_MASK_EXTRUSION_LUMINANCE) != 0)
@@ -1130,6 +1153,32 @@ static inline float blendMaskAlpha2(__global const PlainMaterial* pMat,
   else
     lum = fmax(lum1.x, fmax(lum1.y, lum1.z));
 
+  if (as_int(pMat->data[BLEND_TYPE]) == BLEND_SIGMOID)
+    lum = maxSigmoid(lum, pMat->data[BLEND_SIGMOID_EXP]);
+
+  return lum;
+}
+
+/**
+\brief Return true if alpha of blend does not depend on hit point and direction; it is equal to clamp(blendMaskLuminance(pMat, (1,1,1)), 0, 1) then.
+
+*/
+static inline bool blendMaskAlphaIsConst(__global const PlainMaterial* pMat)
+{
+  const int samplerOffset = as_int(pMat->data[BLEND_MASK_TEXMATRIXID_OFFSET]);
+  const int flags         = as_int(pMat->data[BLEND_MASK_FLAGS_OFFSET]);
+  return (samplerOffset == INVALID_TEXTURE || samplerOffset < 0) && (flags & (BLEND_MASK_FALOFF | BLEND_MASK_FRESNEL)) == 0;
+}
+
+static inline float blendMaskAlpha2(__global const PlainMaterial* pMat, 
+                                    const float3 v, const float3 n, const float2 hitTexCoord, 
+                                    __global const EngineGlobals* a_globals, texture2d_t a_tex, __private const ProcTextureList* a_ptList)
+{
+  const int2   texId    = make_int2(as_int(pMat->data[BLEND_MASK_TEXID_OFFSET]), as_int(pMat->data[BLEND_MASK_TEXMATRIXID_OFFSET]));
+  const float3 texColor = sample2DExt(texId.y, hitTexCoord, (__global const int4*)pMat, a_tex, a_globals, a_ptList);
+  
+  const float lum       = blendMaskLuminance(pMat, texColor);
+
   const float normAngle = fabs(dot(v, n));
   float faloff = 0.0f;
 
@@ -1147,9 +1196,6 @@ static inline float blendMaskAlpha2(__global const PlainMaterial* pMat,
     faloff = hermiteSplineEvalT(faloffParam, (__global const float2*)points, (__global const float2*)tangents, numPoints);
   }
 
-  if (as_int(pMat->data[BLEND_TYPE]) == BLEND_SIGMOID)
-    lum = maxSigmoid(lum, pMat->data[BLEND_SIGMOID_EXP]);
-
   if (as_int(pMat->data[BLEND_MASK_FLAGS_OFFSET]) & BLEND_MASK_FALOFF) // --> faloff by normal angle
     return clamp(faloff, 0.0f, 1.0f);
   else if (as_int(pMat->data[BLEND_MASK_FLAGS_OFFSET]) & BLEND_MASK_FRESNEL)
@@ -1264,7 +1310,7 @@ static inline BRDFSelector materialRandomWalkBRDF(__global const PlainMaterial*
   {
     const float rndVal = a_rands[MMLT_FLOATS_PER_SAMPLE + i];
 
-    if (materialGetType(node) == PLAIN_MAT_CLASS_BLEND_MASK)
+    if (materialIsBlend(node))
       sel = blendSelectBRDF(node, rndVal, rayDir, hitNorm, hitTexCoord, (a_reflOnly && (i==0)), a_globals, a_tex, a_ptList);
 
     res.w         = res.w*sel.w;
@@ -1334,48 +1380,57 @@ static inline void MaterialLeafSampleAndEvalBRDF(__global const PlainMaterial* p
   a_out->pdf          = 1.0f;
   a_out->flags        = 0;
 
-  switch (materialGetType(pMat))
+  switch (materialGetType(pMat)) // classes that are absent in scene are compiled out from OpenCL kernels, see MATERIAL_CLASS_MASK
   {
   case PLAIN_MAT_CLASS_PHONG_SPECULAR: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_PHONG_SPECULAR)) break;
     PhongSampleAndEvalBRDF(pMat, rands.x, rands.y, ray_dir, hitNorm, pSurfHit->texCoord, a_globals, a_tex, a_ptList,
                            a_out);
     break;
 
   case PLAIN_MAT_CLASS_BLINN_SPECULAR: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_BLINN_SPECULAR)) break;
     BlinnSampleAndEvalBRDF(pMat, rands.x, rands.y, ray_dir, hitNorm, pSurfHit->texCoord, a_globals, a_tex, a_ptList,
                            a_out);
     break;
 
   case PLAIN_MAT_CLASS_PERFECT_MIRROR: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_PERFECT_MIRROR)) break;
     MirrorSampleAndEvalBRDF(pMat, rands.x, rands.y, ray_dir, hitNorm, pSurfHit->texCoord, a_globals, a_tex, a_ptList,
                             a_out);
     break;
 
   case PLAIN_MAT_CLASS_THIN_GLASS: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_THIN_GLASS)) break;
     ThinglassSampleAndEvalBRDF(pMat, rands.x, rands.y, ray_dir, hitNorm, pSurfHit->texCoord, a_globals, a_tex, a_ptList,
                                a_out);
     break;
   case PLAIN_MAT_CLASS_GLASS: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_GLASS)) break;
     GlassSampleAndEvalBRDF(pMat, rands, ray_dir, hitNorm, pSurfHit->texCoord, pSurfHit->hfi, a_globals, a_tex, a_ptList, a_isFwdDir,
                            a_out);
     break;
 
   case PLAIN_MAT_CLASS_TRANSLUCENT   : 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_TRANSLUCENT)) break;
     TranslucentSampleAndEvalBRDF(pMat, rands.x, rands.y, ray_dir, hitNorm, pSurfHit->texCoord, a_globals, a_tex, a_ptList,
                                  a_out);
     break;
 
   case PLAIN_MAT_CLASS_OREN_NAYAR    : 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_OREN_NAYAR)) break;
     OrennayarSampleAndEvalBRDF(pMat, rands.x, rands.y, ray_dir, hitNorm, pSurfHit->texCoord, a_globals, a_tex, a_ptList,
                                a_out);
     break;
 
   case PLAIN_MAT_CLASS_LAMBERT       : 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_LAMBERT)) break;
     LambertSampleAndEvalBRDF(pMat, rands.x, rands.y, hitNorm, pSurfHit->texCoord, a_globals, a_tex, a_ptList,
                              a_out);
     break;
 
   case PLAIN_MAT_CLASS_SHADOW_MATTE  : 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_SHADOW_MATTE)) break;
     ShadowmatteSampleAndEvalBRDF(pMat, ray_dir, hitNorm, a_shadow,
                                  a_out);
     break;
@@ -1535,48 +1590,57 @@ static inline BxDFResult materialLeafEval(__global const PlainMaterial* pMat, __
   switch (materialGetType(pMat))
   {
   case PLAIN_MAT_CLASS_PHONG_SPECULAR: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_PHONG_SPECULAR)) break;
     res.brdf    = phongEvalBxDF(pMat, sc->l, sc->v, n, sc->tc, a_evalFlags, a_globals, a_tex, a_ptList)*cosMult;
     res.pdfFwd  = phongEvalPDF (pMat, sc->l, sc->v, n, sc->tc,              a_globals, a_tex, a_ptList);
     res.pdfRev  = phongEvalPDF (pMat, sc->v, sc->l, n, sc->tc,              a_globals, a_tex, a_ptList);
     break;
   case PLAIN_MAT_CLASS_BLINN_SPECULAR: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_BLINN_SPECULAR)) break;
     res.brdf    = blinnEvalBxDF(pMat, sc->l, sc->v, n, sc->tc, a_globals, a_tex, a_ptList)*cosMult;
     res.pdfFwd  = blinnEvalPDF (pMat, sc->l, sc->v, n, sc->tc, a_globals, a_tex, a_ptList);
     res.pdfRev  = blinnEvalPDF (pMat, sc->v, sc->l, n, sc->tc, a_globals, a_tex, a_ptList);
     break;
   case PLAIN_MAT_CLASS_PERFECT_MIRROR: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_PERFECT_MIRROR)) break;
     res.brdf   = mirrorEvalBxDF(pMat, sc->l, sc->v, n)*cosMult;
     res.pdfFwd = mirrorEvalPDF (pMat, sc->l, sc->v, n);
     res.pdfRev = mirrorEvalPDF (pMat, sc->v, sc->l, n);
     break;
   case PLAIN_MAT_CLASS_THIN_GLASS: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_THIN_GLASS)) break;
     res.brdf   = thinglassEvalBxDF(pMat, sc->l, sc->v, n)*cosMult;
     res.pdfFwd = thinglassEvalPDF (pMat, sc->l, sc->v, n);
     res.pdfRev = thinglassEvalPDF (pMat, sc->v, sc->l, n);
     break;
   case PLAIN_MAT_CLASS_GLASS:  
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_GLASS)) break;
     res.brdf   = glassEvalBxDF(pMat, sc->l, sc->v, n)*cosMult;
     res.pdfFwd = glassEvalPDF (pMat, sc->l, sc->v, n);
     res.pdfRev = glassEvalPDF (pMat, sc->v, sc->l, n);
     break;
   case PLAIN_MAT_CLASS_TRANSLUCENT:
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_TRANSLUCENT)) break;
     res.btdf    = translucentEvalBxDF(pMat, sc->l, sc->v, n, sc->tc, a_globals, a_tex, a_ptList)*cosMult2;
     res.pdfFwd  = translucentEvalPDF (pMat, sc->l, sc->v, n);
     res.pdfRev  = translucentEvalPDF (pMat, sc->v, sc->l, n);
     res.diffuse = true;
     break;
   case PLAIN_MAT_CLASS_SHADOW_MATTE: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_SHADOW_MATTE)) break;
     res.brdf   = shadowmatteEvalBxDF(pMat, sc->l, n, sc->tc)*cosMult;
     res.pdfFwd = shadowmatteEvalPDF (pMat, sc->l, sc->v, n);
     res.pdfRev = shadowmatteEvalPDF (pMat, sc->v, sc->l, n);
     break;
   case PLAIN_MAT_CLASS_OREN_NAYAR: 
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_OREN_NAYAR)) break;
     res.brdf    = orennayarEvalBxDF(pMat, sc->l, sc->v, n, sc->tc, a_globals, a_tex, a_ptList)*cosMult;
     res.pdfFwd  = orennayarEvalPDF (pMat, sc->l, sc->v, n);
     res.pdfRev  = orennayarEvalPDF (pMat, sc->v, sc->l, n);
     res.diffuse = true;
     break;
   case PLAIN_MAT_CLASS_LAMBERT:  
+    if (!MATERIAL_CLASS_ENABLED(PLAIN_MAT_CLASS_LAMBERT)) break;
     res.brdf    = lambertEvalBxDF(pMat, sc->tc, a_globals, a_tex, a_ptList)*cosMult;
     res.pdfFwd  = lambertEvalPDF (pMat, sc->l, n);
     res.pdfRev  = lambertEvalPDF (pMat, sc->v, n);
@@ -1598,9 +1662,69 @@ static inline BxDFResult materialLeafEval(__global const PlainMaterial* pMat, __
 }
 
 
+/**
+\brief Evaluate blend tree that was flattened to the list of leaves (see BLEND_FLAT_TABLE_OFFSET) without stack.
+       Alpha of each blend node is evaluated once; leaves with zero weight are not evaluated at all.
+
+*/
+static inline BxDFResult materialEvalFlatBlend(__global const PlainMaterial* a_pMat, __private const ShadeContext* sc, const int a_evalFlags,
+                                               __global const EngineGlobals* a_globals, texture2d_t a_tex, texture2d_t a_texNormal, __private const ProcTextureList* a_ptList)
+{
+  BxDFResult val;
+  val.brdf    = make_float3(0, 0, 0);
+  val.btdf    = make_float3(0, 0, 0);
+  val.pdfFwd  = 0.0f;
+  val.pdfRev  = 0.0f;
+  val.diffuse = true;
+
+  const bool disableCaustics = ((a_evalFlags & EVAL_FLAG_DISABLE_CAUSTICS) != 0);
+
+  __global const float* table = (a_pMat + as_int(a_pMat->data[BLEND_FLAT_TABLE_OFFSET]))->data;
+  const int leavesNum         = as_int(table[0]);
+
+  float alphas[MIX_TREE_MAX_DEEP];
+  int   pos = 1;
+
+  for (int leafId = 0; leafId < leavesNum; leafId++)
+  {
+    const int leafOffset = as_int(table[pos + 0]);
+    const int stepsInfo  = as_int(table[pos + 2]);
+    const int stepsNum   = stepsInfo & 0xFFFF;
+    const int stepsKnown = stepsInfo >> 16;
+    float     currW      = table[pos + 1];
+
+    for (int k = 0; k < stepsNum; k++)
+    {
+      const int step = as_int(table[pos + 3 + k]);
+      if (k >= stepsKnown)
+        alphas[k] = blendMaskAlpha2(a_pMat + (step >> 1), sc->v, sc->n, sc->tc, a_globals, a_tex, a_ptList);
+      currW *= ((step & 1) == BLEND_FLAT_STEP_ALPHA) ? alphas[k] : 1.0f - alphas[k];
+    }
+
+    pos += 3 + stepsNum;
+
+    __global const PlainMaterial* pLeaf = a_pMat + leafOffset;
+
+    if (currW <= 0.0f || (disableCaustics && materialCastCaustics(pLeaf)))
+      continue;
+
+    const BxDFResult bxdfAndPdf = materialLeafEval(pLeaf, sc, a_evalFlags, a_globals, a_tex, a_texNormal, a_ptList);
+    val.brdf   += currW*bxdfAndPdf.brdf;
+    val.btdf   += currW*bxdfAndPdf.btdf;
+    val.pdfFwd += currW*bxdfAndPdf.pdfFwd;
+    val.pdfRev += currW*bxdfAndPdf.pdfRev;
+    val.diffuse = val.diffuse && bxdfAndPdf.diffuse;
+  }
+
+  return val;
+}
+
 static inline BxDFResult materialEval(__global const PlainMaterial* a_pMat, __private const ShadeContext* sc, const int a_evalFlags,
                                       __global const EngineGlobals* a_globals, texture2d_t a_tex, texture2d_t a_texNormal, __private const ProcTextureList* a_ptList)
 {
+  if (materialIsBlend(a_pMat) && as_int(a_pMat->data[BLEND_FLAT_TABLE_OFFSET]) > 0)
+    return materialEvalFlatBlend(a_pMat, sc, a_evalFlags, a_globals, a_tex, a_texNormal, a_ptList);
+
   BxDFResult val;
   val.brdf    = make_float3(0, 0, 0);
   val.btdf    = make_float3(0, 0, 0);
@@ -1628,7 +1752,7 @@ static inline BxDFResult materialEval(__global const PlainMaterial* a_pMat, __pr
 
     __global const PlainMaterial* pMat = a_pMat + currGlobalOffset;
 
-    if (materialGetType(pMat) == PLAIN_MAT_CLASS_BLEND_MASK)
+    if (materialIsBlend(pMat))
     {
       BRDFSelector mat1, mat2;
 
@@ -1779,7 +1903,7 @@ static inline TransparencyAndFog materialEvalTransparencyAndFog(__global const P
 
     __global const PlainMaterial* pMat = a_pMat + currGlobalOffset;
 
-    if (materialGetType(pMat) == PLAIN_MAT_CLASS_BLEND_MASK)
+    if (materialIsBlend(pMat))
     {
       BRDFSelector mat1, mat2;
 
@@ -1921,7 +2045,7 @@ static inline float3 materialEvalDiffuse(__global const PlainMaterial* a_pMat,
 
     __global const PlainMaterial* pMat = a_pMat + currGlobalOffset;
 
-    if (materialGetType(pMat) == PLAIN_MAT_CLASS_BLEND_MASK)
+    if (materialIsBlend(pMat))
     {
       BRDFSelector mat1, mat2;
 
@@ -1986,7 +2110,7 @@ static inline float3 materialEvalEmission(__global const PlainMaterial* a_pMat,
 
     __global const PlainMaterial* pMat = a_pMat + currGlobalOffset;
 
-    if (materialGetType(pMat) == PLAIN_MAT_CLASS_BLEND_MASK) // && (materialGetFlags(pMat) & PLAIN_MATERIAL_SURFACE_BLEND)
+    if (materialIsBlend(pMat)) // && (materialGetFlags(pMat) & PLAIN_MATERIAL_SURFACE_BLEND)
     {
       BRDFSelector mat1, mat2;
 
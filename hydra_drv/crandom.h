@@ -171,6 +171,57 @@ static inline float4 rndFloat4_Pseudo(RandomGen* gen)
 
 #endif // SIMPLE_RANDOM_GEN or COMPLEX
 
+/**
+\brief PCG output permutation (RXS-M-XS) used as a stateless integer hash.
+\param a_val - input 32 bit value
+\return well mixed 32 bit value
+
+*/
+static inline unsigned int HashPCG(unsigned int a_val)
+{
+  const unsigned int state = a_val * 747796405u + 2891336453u;
+  const unsigned int word  = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+/**
+\brief combine several counters into single hash value; order of arguments matters.
+
+*/
+static inline unsigned int HashCombine3(unsigned int a, unsigned int b, unsigned int c)
+{
+  return HashPCG(c ^ HashPCG(b ^ HashPCG(a)));
+}
+
+/**
+\brief counter based random number; depends only on (seed, pixel, sample, dimension) and thus does not depend on thread count or scheduling.
+\param a_seed    - global render seed
+\param a_pixelId - linear pixel index (y*width + x)
+\param a_sample  - sample (pass) index inside pixel
+\param a_dim     - dimension of the sample vector
+\return random float in range [0,1)
+
+*/
+static inline float rndFloat1_Counter(unsigned int a_seed, unsigned int a_pixelId, unsigned int a_sample, unsigned int a_dim)
+{
+  const unsigned int h = HashPCG(a_dim ^ HashCombine3(a_seed, a_pixelId, a_sample));
+  return ((float)(h >> 8)) * (1.0f / 16777216.0f);
+}
+
+/**
+\brief init pseudo random generator for target (pixel, sample) pair. Subsequent numbers taken from the generator form a deterministic stream.
+\param a_seed    - global render seed
+\param a_pixelId - linear pixel index (y*width + x)
+\param a_sample  - sample (pass) index inside pixel
+\param a_stream  - index of stream; use different values for different generators of same pixel (gen and gen2 for example)
+
+*/
+static inline RandomGen RandomGenInitCounter(unsigned int a_seed, unsigned int a_pixelId, unsigned int a_sample, unsigned int a_stream)
+{
+  const unsigned int h = HashPCG(a_stream ^ HashCombine3(a_seed, a_pixelId, a_sample));
+  return RandomGenInit((int)(h & 0x7FFFFFFF));
+}
+
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
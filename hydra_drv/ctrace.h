@@ -57,6 +57,60 @@ IDH_CALL float2 RayBoxIntersectionLite2(float3 ray_pos, float3 ray_dir, float3 b
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+\brief intersect leaf with OBJLIST_LEAF_INDEXED layout: one float4 per triangle (A, B, C, primId) where A, B, C are offsets of vertex positions in the same buffer.
+*/
+static inline Lite_Hit IntersectIndexedPrimitivesInLeaf(const float3 ray_pos, const float3 ray_dir,
+                                                        const float4 a_listHeader, const float t_min, 
+                                                        Lite_Hit a_result,
+                                                      #ifdef USE_1D_TEXTURES
+                                                        __read_only image1d_buffer_t a_objListTex,
+                                                      #else
+                                                        __global const float4* a_objListTex,
+                                                      #endif
+                                                        const int a_instId)
+{
+  const int triAddressStart = as_int(a_listHeader.x);
+  const int triAddressEnd   = triAddressStart + as_int(a_listHeader.y);
+  const int geomId          = as_int(a_listHeader.z);
+
+  for (int triAddress = triAddressStart; triAddress < triAddressEnd; triAddress++)
+  {
+   #ifdef USE_1D_TEXTURES
+    const float4 tri   = read_imagef(a_objListTex, triAddress);
+    const float3 A_pos = to_float3(read_imagef(a_objListTex, as_int(tri.x)));
+    const float3 B_pos = to_float3(read_imagef(a_objListTex, as_int(tri.y)));
+    const float3 C_pos = to_float3(read_imagef(a_objListTex, as_int(tri.z)));
+   #else
+    const float4 tri   = a_objListTex[triAddress];
+    const float3 A_pos = to_float3(a_objListTex[as_int(tri.x)]);
+    const float3 B_pos = to_float3(a_objListTex[as_int(tri.y)]);
+    const float3 C_pos = to_float3(a_objListTex[as_int(tri.z)]);
+   #endif
+
+    const float3 edge1 = B_pos - A_pos;
+    const float3 edge2 = C_pos - A_pos;
+    const float3 pvec  = cross(ray_dir, edge2);
+    const float3 tvec  = ray_pos - A_pos;
+    const float3 qvec  = cross(tvec, edge1);
+    const float invDet = 1.0f / dot(edge1, pvec);
+
+    const float v = dot(tvec, pvec)*invDet;
+    const float u = dot(qvec, ray_dir)*invDet;
+    const float t = dot(edge2, qvec)*invDet;
+
+    if (v > -1e-6f && u > -1e-6f && (u + v < 1.0f + 1e-6f) && t > t_min && t < a_result.t)
+    {
+      a_result.t      = t;
+      a_result.primId = as_int(tri.w);
+      a_result.geomId = geomId;
+      a_result.instId = a_instId;
+    }
+  }
+
+  return a_result;
+}
+
 static inline Lite_Hit IntersectAllPrimitivesInLeaf1(const float3 ray_pos, const float3 ray_dir,
                                                     const int leaf_offset, const float t_min, 
                                                     Lite_Hit a_result,
@@ -67,7 +121,11 @@ static inline Lite_Hit IntersectAllPrimitivesInLeaf1(const float3 ray_pos, const
                                                   #endif
                                                     )
 {
-  const int2 objectListInfo = getObjectList(leaf_offset, a_objListTex);
+  const float4 listHeader = getObjectListHeader(leaf_offset, a_objListTex);
+  if (as_int(listHeader.w) == OBJLIST_LEAF_INDEXED)
+    return IntersectIndexedPrimitivesInLeaf(ray_pos, ray_dir, listHeader, t_min, a_result, a_objListTex, -1);
+
+  const int2 objectListInfo = make_int2(as_int(listHeader.x), as_int(listHeader.y));
 
   const int NUM_FETCHES_TRI = 3; // sizeof(struct ObjectListTriangle) / sizeof(float4);
   const int triAddressStart = objectListInfo.x; 
@@ -127,7 +185,11 @@ static inline Lite_Hit IntersectAllPrimitivesInLeaf(const float3 ray_pos, const
                                                   #endif
                                                      const int a_instId)
 {
-  const int2 objectListInfo = getObjectList(leaf_offset, a_objListTex);
+  const float4 listHeader = getObjectListHeader(leaf_offset, a_objListTex);
+  if (as_int(listHeader.w) == OBJLIST_LEAF_INDEXED)
+    return IntersectIndexedPrimitivesInLeaf(ray_pos, ray_dir, listHeader, t_min, a_result, a_objListTex, a_instId);
+
+  const int2 objectListInfo = make_int2(as_int(listHeader.x), as_int(listHeader.y));
 
   const int NUM_FETCHES_TRI = 3; // sizeof(struct ObjectListTriangle) / sizeof(float4);
   const int triAddressStart = objectListInfo.x; 
@@ -1864,12 +1926,40 @@ static inline float2 triBaricentrics(float3 ray_pos, float3 ray_dir, float3 A_po
   return make_float2(u, v);
 }
 
+/**
+\brief 0.5*log2(uvArea/area) of triangle; this is the 'texel density' term of ray cones texture LOD.
+
+*/
+static inline float triangleUVLodBias(const float3 A_pos, const float3 B_pos, const float3 C_pos, 
+                                      const float2 A_tex, const float2 B_tex, const float2 C_tex)
+{
+  const float2 e1     = B_tex - A_tex;
+  const float2 e2     = C_tex - A_tex;
+  const float  uvArea = fabs(e1.x*e2.y - e1.y*e2.x);
+  const float  wsArea = length(cross(B_pos - A_pos, C_pos - A_pos));
+  return 0.5f*log2(fmax(uvArea, 1e-20f) / fmax(wsArea, 1e-20f));
+}
+
+/**
+\brief Correction of triangleUVLodBias for instance transform; assume (almost) uniform scale.
+
+*/
+static inline float instanceUVLodBias(const float4x4 a_instMatrix)
+{
+  const float3 c0  = mul3x3(a_instMatrix, make_float3(1, 0, 0));
+  const float3 c1  = mul3x3(a_instMatrix, make_float3(0, 1, 0));
+  const float3 c2  = mul3x3(a_instMatrix, make_float3(0, 0, 1));
+  const float  det = dot(cross(c0, c1), c2);
+  return (-1.0f/3.0f)*log2(fmax(fabs(det), 1e-20f));
+}
+
+/**
+\brief Evaluate surface in local (object) space. Note that surfHit.texLod contains only triangleUVLodBias here.
+
+*/
 static inline SurfaceHit surfaceEvalLS(const float3 a_rpos, const float3 a_rdir, const Lite_Hit hit, __global const PlainMesh* mesh)
 {
   __global const float4* vertPos      = meshVerts(mesh);
-  __global const float4* vertNorm     = meshNorms(mesh);
-  //__global const float2* vertTexCoord = meshTexCoords(mesh);             //#TODO: use this for aux tex channel
-  __global const float4* vertTangent  = meshTangents(mesh);
   __global const int*    vertIndices  = meshTriIndices(mesh);
   __global const int*    matIndices   = meshMatIndices(mesh);
   __global const float*  shadowRayOff = meshShadowRayOff(mesh);
@@ -1883,29 +1973,17 @@ static inline SurfaceHit surfaceEvalLS(const float3 a_rpos, const float3 a_rdir,
   const int offs_B    = vertIndices[offset + 1];
   const int offs_C    = vertIndices[offset + 2];
 
-  const float4 A_data1 = vertPos[offs_A];
-  const float4 B_data1 = vertPos[offs_B];
-  const float4 C_data1 = vertPos[offs_C];
-             
-  const float4 A_data2 = vertNorm[offs_A];
-  const float4 B_data2 = vertNorm[offs_B];
-  const float4 C_data2 = vertNorm[offs_C];
-
-  const float3 A_pos  = to_float3(A_data1);
-  const float3 B_pos  = to_float3(B_data1);
-  const float3 C_pos  = to_float3(C_data1);
+  const float3 A_pos  = to_float3(vertPos[offs_A]);
+  const float3 B_pos  = to_float3(vertPos[offs_B]);
+  const float3 C_pos  = to_float3(vertPos[offs_C]);
   
-  const float3 A_norm = to_float3(A_data2);
-  const float3 B_norm = to_float3(B_data2);
-  const float3 C_norm = to_float3(C_data2);
+  const float3 A_norm = meshNormalAt(mesh, offs_A);
+  const float3 B_norm = meshNormalAt(mesh, offs_B);
+  const float3 C_norm = meshNormalAt(mesh, offs_C);
   
-  const float2 A_tex  = make_float2(A_data1.w, A_data2.w);
-  const float2 B_tex  = make_float2(B_data1.w, B_data2.w);
-  const float2 C_tex  = make_float2(C_data1.w, C_data2.w);
-
-  //const float2 A_tex  = vertTexCoord[offs_A];  // #TODO: use this for aux tex channel
-  //const float2 B_tex  = vertTexCoord[offs_B];  // #TODO: use this for aux tex channel
-  //const float2 C_tex  = vertTexCoord[offs_C];  // #TODO: use this for aux tex channel
+  const float2 A_tex  = meshTexCoordAt(mesh, offs_A);
+  const float2 B_tex  = meshTexCoordAt(mesh, offs_B);
+  const float2 C_tex  = meshTexCoordAt(mesh, offs_C);
   
   const float2 uv     = triBaricentrics(a_rpos, a_rdir, A_pos, B_pos, C_pos);
 
@@ -1913,11 +1991,12 @@ static inline SurfaceHit surfaceEvalLS(const float3 a_rpos, const float3 a_rdir,
   surfHit.texCoord    = (1.0f - uv.x - uv.y)*A_tex  + uv.y*B_tex  + uv.x*C_tex;
   surfHit.normal      = (1.0f - uv.x - uv.y)*A_norm + uv.y*B_norm + uv.x*C_norm;
   surfHit.t           = hit.t;
+  surfHit.texLod      = triangleUVLodBias(A_pos, B_pos, C_pos, A_tex, B_tex, C_tex);
   surfHit.sRayOff     = shadowRayOff[hit.primId]; // *fmax(fmin(uv.x + uv.y, fmin(1.0f - uv.x, 1.0f - uv.y)), 0.0f); // offset more in the center of poly and edges, offset less at vertices.
   
-  const float4 A_tang = vertTangent[offs_A]; // GetVertexNorm(offs_A);
-  const float4 B_tang = vertTangent[offs_B]; // GetVertexNorm(offs_B);
-  const float4 C_tang = vertTangent[offs_C]; // GetVertexNorm(offs_C);
+  const float4 A_tang = meshTangentAt(mesh, offs_A);
+  const float4 B_tang = meshTangentAt(mesh, offs_B);
+  const float4 C_tang = meshTangentAt(mesh, offs_C);
 
   bool invertFlatNorm = false;
   surfHit.flatNormal  = normalize(cross(A_pos - B_pos, A_pos - C_pos));
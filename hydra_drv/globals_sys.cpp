@@ -3,6 +3,14 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
+#include <cstdlib>
+#include <cerrno>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 
 #ifdef WIN32
 constexpr int HYDRAPATHSIZE = 1024;
@@ -34,12 +42,231 @@ std::string HydraInstallPath()
 #endif
 }
 
+/**
+\brief Directory for out of core texture pages and cached light tables. Unlike shadercache it is not shipped with the installation, so create it on demand.
+
+*/
+std::string HydraTexCachePath()
+{
+  const std::string path = HydraInstallPath() + "texcache/";
+#ifdef WIN32
+  if (!CreateDirectoryA(path.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+#else
+  if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+#endif
+    std::cerr << "HydraTexCachePath: can't create directory " << path.c_str() << std::endl;
+  return path;
+}
+
+int HydraProcessId()
+{
+#ifdef WIN32
+  return int(GetCurrentProcessId());
+#else
+  return int(getpid());
+#endif
+}
+
 bool isFileExists(const std::string& a_fileName)
 {
   std::ifstream fin(a_fileName.c_str());
   return fin.is_open();
 }
 
+std::string ws2s(const std::wstring& s);
+
+#ifdef WIN32
+
+bool MemoryMappedFile::Open(const std::wstring& a_fileName)
+{
+  Close();
+
+  HANDLE file = CreateFileW(a_fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  m_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (m_data == nullptr)
+  {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  m_size    = size_t(fileSize.QuadPart);
+  m_handle  = file;
+  m_mapping = mapping;
+  return true;
+}
+
+void MemoryMappedFile::Close()
+{
+  if (m_data != nullptr)
+    UnmapViewOfFile(m_data);
+  if (m_mapping != nullptr)
+    CloseHandle((HANDLE)m_mapping);
+  if (m_handle != nullptr)
+    CloseHandle((HANDLE)m_handle);
+
+  m_data    = nullptr;
+  m_size    = 0;
+  m_handle  = nullptr;
+  m_mapping = nullptr;
+}
+
+#else
+
+bool MemoryMappedFile::Open(const std::wstring& a_fileName)
+{
+  Close();
+
+  const std::string fileName = ws2s(a_fileName);
+
+  const int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat fileInfo;
+  if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  void* pData = mmap(nullptr, size_t(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // mapping keeps the file referenced
+  
+  if (pData == MAP_FAILED)
+    return false;
+
+  madvise(pData, size_t(fileInfo.st_size), MADV_SEQUENTIAL);
+
+  m_data = pData;
+  m_size = size_t(fileInfo.st_size);
+  return true;
+}
+
+void MemoryMappedFile::Close()
+{
+  if (m_data != nullptr)
+    munmap(const_cast<void*>(m_data), m_size);
+
+  m_data = nullptr;
+  m_size = 0;
+}
+
+#endif
+
+#ifdef WIN32
+
+size_t HostMemoryTotal()
+{
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status))
+    return size_t(8) * size_t(1024 * 1024 * 1024);
+  return size_t(status.ullTotalPhys);
+}
+
+size_t HostMemoryAvailable()
+{
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status))
+    return size_t(8) * size_t(1024 * 1024 * 1024);
+  return size_t(status.ullAvailPhys);
+}
+
+#else
+
+static size_t ReadSizeFromFile(const char* a_fileName) // returns 0 if file is absent or limit is not set ("max")
+{
+  std::ifstream fin(a_fileName);
+  if (!fin.is_open())
+    return 0;
+
+  std::string value;
+  fin >> value;
+  if (value.empty() || value == "max")
+    return 0;
+
+  const unsigned long long res = strtoull(value.c_str(), nullptr, 10);
+  return (res >= (1ULL << 62)) ? 0 : size_t(res); // cgroup v1 reports 'no limit' as huge number
+}
+
+static void CGroupMemory(size_t* pLimit, size_t* pUsage)
+{
+  (*pLimit) = ReadSizeFromFile("/sys/fs/cgroup/memory.max");                     // cgroup v2
+  (*pUsage) = ReadSizeFromFile("/sys/fs/cgroup/memory.current");
+
+  if ((*pLimit) == 0)
+  {
+    (*pLimit) = ReadSizeFromFile("/sys/fs/cgroup/memory/memory.limit_in_bytes"); // cgroup v1
+    (*pUsage) = ReadSizeFromFile("/sys/fs/cgroup/memory/memory.usage_in_bytes");
+  }
+}
+
+size_t HostMemoryTotal()
+{
+  const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+  size_t total          = size_t(sysconf(_SC_PHYS_PAGES))*pageSize;
+
+  size_t cgLimit = 0, cgUsage = 0;
+  CGroupMemory(&cgLimit, &cgUsage);
+  if (cgLimit != 0 && cgLimit < total)
+    total = cgLimit;
+
+  return total;
+}
+
+size_t HostMemoryAvailable()
+{
+  size_t avail = 0;
+
+  std::ifstream fin("/proc/meminfo");
+  std::string   key;
+  size_t        valueKb = 0;
+  while (fin >> key >> valueKb)
+  {
+    if (key == "MemAvailable:")
+    {
+      avail = valueKb * size_t(1024);
+      break;
+    }
+    fin.ignore(256, '\n');
+  }
+
+  if (avail == 0)
+    avail = size_t(sysconf(_SC_AVPHYS_PAGES))*size_t(sysconf(_SC_PAGESIZE));
+
+  size_t cgLimit = 0, cgUsage = 0;
+  CGroupMemory(&cgLimit, &cgUsage);
+  if (cgLimit != 0)
+  {
+    const size_t cgAvail = (cgLimit > cgUsage) ? cgLimit - cgUsage : 0;
+    if (cgAvail < avail)
+      avail = cgAvail;
+  }
+
+  return avail;
+}
+
+#endif
+
 void PlaneHammersley(float *result, int n)
 {
   for (int k = 0; k<n; k++)
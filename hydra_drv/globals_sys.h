@@ -33,13 +33,48 @@
 #include <sstream>
 
 #include <stdexcept>
+#include <cstdio>
 
 void PlaneHammersley(float *result, int n);
 
 std::string getWindowsLastErrorMsg();
 std::string HydraInstallPath();
+std::string HydraTexCachePath(); ///< HydraInstallPath() + "texcache/"; directory is created if it does not exist
+int         HydraProcessId();    ///< current process id; used to keep per process files in shared directories apart
 bool        isFileExists(const std::string& a_fileName);
 
+size_t      HostMemoryTotal();     ///< physical memory of the host clamped by container (cgroup) limit
+size_t      HostMemoryAvailable(); ///< memory that can be allocated without swapping; clamped by container (cgroup) limit minus its current usage
+
+/**
+\brief Read only memory mapped file. Pages are loaded by OS on demand, so there is no intermediate copy of file data in user memory.
+
+*/
+struct MemoryMappedFile
+{
+  MemoryMappedFile() : m_data(nullptr), m_size(0), m_handle(nullptr), m_mapping(nullptr) {}
+  ~MemoryMappedFile() { Close(); if (!m_tempFileName.empty()) std::remove(m_tempFileName.c_str()); }
+
+  bool Open(const std::wstring& a_fileName);
+  void Close();
+
+  void RemoveOnDestroy(const std::string& a_fileName) { m_tempFileName = a_fileName; } ///< file is owned by this object and deleted after unmapping
+
+  const void* Data() const { return m_data; }
+  size_t      Size() const { return m_size; }
+
+protected:
+
+  MemoryMappedFile(const MemoryMappedFile& a_rhs) = delete;
+  MemoryMappedFile& operator=(const MemoryMappedFile& a_rhs) = delete;
+
+  const void* m_data;
+  size_t      m_size;
+  void*       m_handle;  ///< file HANDLE on windows, unused on posix
+  void*       m_mapping; ///< mapping HANDLE on windows, unused on posix
+  std::string m_tempFileName;
+};
+
 
 #include <sstream>
 #include <string>
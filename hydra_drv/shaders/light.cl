@@ -70,7 +70,7 @@ __kernel void LightSampleForwardKernel(__global float4*        restrict out_rpos
                                        __global float4*        restrict out_thoroughput,   // just for clearing them
                                        __global float4*        restrict out_fog,           // just for clearing them
                                                                                         
-                                       __global const float4*  restrict a_texStorage1,     // 
+                                       __global float4*                 a_texStorage1,     // 
                                        __global const float4*  restrict a_pdfStorage, 
                                        __global const EngineGlobals* restrict a_globals,
                                        const int iNumElements)
@@ -152,7 +152,7 @@ __kernel void LightSample(__global const int2*    restrict in_zind,
                           __global float4*        restrict out_srpos,
                           __global float4*        restrict out_srdir,
 
-                          __global const float4*  restrict a_texStorage1,  //
+                          __global float4*                 a_texStorage1,  //
                           __global const float4*  restrict a_texStorage2,  //
                           __global const float4*  restrict a_pdfStorage,   //
                           
@@ -209,7 +209,7 @@ __kernel void LightSample(__global const int2*    restrict in_zind,
   // (1) generate light sample
   //
   float lightPickProb   = 1.0f;
-  const int lightOffset = SelectRandomLightRev(rands.w, sHit.pos, a_globals,
+  const int lightOffset = SelectRandomLightRev(rands.w, sHit.pos, sHit.normal, a_globals,
                                                &lightPickProb);
 
   __global const PlainLight* pLight = lightAt(a_globals, lightOffset); // in_plainData1 + visiableLightsOffsets[lightOffset];
@@ -247,6 +247,7 @@ __kernel void CopyLightSampleToSurfaceHit(__global const float4* restrict in_ray
   surfHitWS.pos        = to_float3(data);
   surfHitWS.normal     = decodeNormal(as_int(data.w));
   surfHitWS.matId      = -1;
+  surfHitWS.texLod     = TEX_LOD_NONE;
 
   WriteSurfaceHit(&surfHitWS, tid, iNumElements, 
                   out_hits);
@@ -280,7 +281,7 @@ __kernel void MakeAORays(__global const uint*      restrict in_flags,
                          __global float4*          restrict out_rpos,
                          __global float4*          restrict out_rdir,
   
-                         __global const float4*    restrict in_texStorage1,
+                         __global float4*                   in_texStorage1,
                          __global const float4*    restrict in_mtlStorage,
                          __global const EngineGlobals* restrict a_globals,
                          int iterNum, int iNumElements)
@@ -345,7 +346,7 @@ __kernel void MakeAORaysPacked4(__global const uint*      restrict in_flags,
                                 __global int4*            restrict out_rdir,
                                 __global int*             restrict out_instId,
                                 
-                                __global const float4*    restrict in_texStorage1,
+                                __global float4*                   in_texStorage1,
                                 __global const float4*    restrict in_mtlStorage,
                                 __global const EngineGlobals* restrict a_globals,
                                 int aoId, int iNumElements)
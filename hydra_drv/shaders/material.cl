@@ -4,6 +4,7 @@
 #include "cmaterial.h"
 #include "clight.h"
 #include "cbidir.h"
+#include "cguiding.h"
 
 __kernel void MakeEyeShadowRays(__global const uint*          restrict a_flags,
                                 __global const float4*        restrict in_surfaceHit,
@@ -70,7 +71,7 @@ __kernel void UpdateForwardPdfFor3Way(__global const uint*          restrict a_f
                                       __global const MisData*       restrict in_misDataCurr,
                                       __global PerRayAcc*           restrict a_pdfAcc,
                                       
-                                      __global const float4*        restrict in_texStorage1,
+                                      __global float4*                       in_texStorage1,
                                       __global const float4*        restrict in_texStorage2,
                                       __global const float4*        restrict in_mtlStorage,
                                       __global const EngineGlobals* restrict a_globals,
@@ -156,7 +157,7 @@ __kernel void ConnectToEyeKernel(__global const uint*          restrict a_flags,
                                  
                                  __global const float4*        restrict in_mtlStorage,
                                  __global const EngineGlobals* restrict a_globals,
-                                 __global const float4*        restrict in_texStorage1,
+                                 __global float4*                       in_texStorage1,
                                  __global const float4*        restrict in_texStorage2,
                                  __constant ushort*            restrict a_mortonTable256,
                                  
@@ -244,7 +245,7 @@ __kernel void ConnectToEyeKernel(__global const uint*          restrict a_flags,
 
     __global const PlainLight* pLight = lightAt(a_globals, in_lightId[tid]);
     const float lightPickProbFwd = lightPdfSelectFwd(pLight);
-    const float lightPickProbRev = lightPdfSelectRev(pLight);
+    const float lightPickProbRev = lightPdfSelectRevAt(pLight, perRayAccLightVertPos(&accData), decodeNormal(accData.lightVertN), a_globals);
 
     const float cameraPdfA = imageToSurfaceFactor / mLightSubPathCount;
     const float lightPdfA  = in_lsam2[tid]; //PerThread().pdfLightA0; // remember that we packed it in lsam2 inside 'LightSampleForwardKernel'
@@ -310,7 +311,7 @@ __kernel void HitEnvOrLightKernel(__global const float4*    restrict in_rpos,
                                   __global PerRayAcc*       restrict a_pdfAccCopy,
                                   __global float*           restrict a_pdfCamA,
                                   
-                                  __global const float4*    restrict in_texStorage1,
+                                  __global float4*                   in_texStorage1,
                                   __global const float4*    restrict in_texStorage2,
                                   __global const float4*    restrict in_mtlStorage,
                                   __global const float4*    restrict in_pdfStorage,
@@ -477,7 +478,7 @@ __kernel void HitEnvOrLightKernel(__global const float4*    restrict in_rpos,
 
             float pdfAccFwdA = 1.0f       * (accData.pdfLightWP ) * lightPdfA*lPdfFwd.pickProb;
             float pdfAccRevA = cameraPdfA * (accData.pdfCameraWP);
-            float pdfAccExpA = cameraPdfA * (accData.pdfCameraWP)*(lightPdfA*lightPdfSelectRev(pLight) / fmax(cancelPrev, DEPSILON));
+            float pdfAccExpA = cameraPdfA * (accData.pdfCameraWP)*(lightPdfA*lightPdfSelectRevAt(pLight, ray_pos, decodeNormal(misPrev.prevNormal), a_globals) / fmax(cancelPrev, DEPSILON));
 
             if (a_currDepth == 0)
             {
@@ -501,8 +502,9 @@ __kernel void HitEnvOrLightKernel(__global const float4*    restrict in_rpos,
           }
           else if (unpackBounceNum(flags) > 0 && !(a_globals->g_flags & HRT_STUPID_PT_MODE) && (misPrev.isSpecular == 0)) // old MIS weights via pdfW
           {
-            const float lgtPdf    = lightPdfSelectRev(pLight)*lightEvalPDF(pLight, ray_pos, ray_dir, 
-                                                                           surfHit.pos, surfHit.normal, surfHit.texCoord, in_pdfStorage, a_globals);
+            const float pickProb  = lightPdfSelectRevAt(pLight, ray_pos, decodeNormal(misPrev.prevNormal), a_globals);
+            const float lgtPdf    = pickProb*lightEvalPDF(pLight, ray_pos, ray_dir, 
+                                                          surfHit.pos, surfHit.normal, surfHit.texCoord, in_pdfStorage, a_globals);
             const float bsdfPdf   = misPrev.matSamplePdf;
             const float misWeight = misWeightHeuristic(bsdfPdf, lgtPdf); // (bsdfPdf*bsdfPdf) / (lgtPdf*lgtPdf + bsdfPdf*bsdfPdf);
             emissColor *= misWeight;
@@ -599,10 +601,11 @@ __kernel void Shade(__global const float4*    restrict a_rpos,
                     __global float4*          restrict out_color,
                     __global uchar*           restrict out_shadow,
                      
-                    __global const float4*    restrict in_texStorage1,
+                    __global float4*                   in_texStorage1,
                     __global const float4*    restrict in_texStorage2,
                     __global const float4*    restrict in_mtlStorage,
                     __global const float4*    restrict in_pdfStorage,
+                    __global const float4*    restrict in_guideTree,   // path guiding SD-tree (see cguiding.h); 0 if guiding is off
                     __global const EngineGlobals* restrict a_globals,
                     int iNumElements)
 {
@@ -648,6 +651,7 @@ __kernel void Shade(__global const float4*    restrict a_rpos,
 
   const bool currLightCastCaustics = (a_globals->g_flags & HRT_ENABLE_PT_CAUSTICS);
   const bool disableCaustics       = (unpackBounceNumDiff(flags) > 0) && !currLightCastCaustics;
+  const int  guideLeaf             = (in_guideTree != 0 && materialCanBeGuided(pHitMaterial)) ? guidingFindLeaf(in_guideTree, surfHit.pos) : -1; // same leaf as in NextBounce
   
   if ((a_globals->varsI[HRT_RENDER_LAYER] == LAYER_INCOMING_PRIMARY) && (a_globals->varsI[HRT_RENDER_LAYER_DEPTH] == unpackBounceNum(flags))) //////////////////////////////////////////////////////////////////
     pHitMaterial = materialAtOffset(in_mtlStorage, a_globals->varsI[HRT_WHITE_DIFFUSE_OFFSET]);
@@ -669,6 +673,7 @@ __kernel void Shade(__global const float4*    restrict a_rpos,
   InitProcTextureList(&ptl);
   ReadProcTextureList(in_procTexData, tid, iNumElements,
                       &ptl);
+  ptl.texLod = surfHit.texLod;
 
   const int evalFlags       = (disableCaustics ? EVAL_FLAG_DISABLE_CAUSTICS : EVAL_FLAG_DEFAULT);
 
@@ -719,10 +724,11 @@ __kernel void Shade(__global const float4*    restrict a_rpos,
   }
   else
   {
-    const float lgtPdf = explicitSam.pdf*lightPickProb;
-    cosThetaOutAux     = dot(shadowRayDir, surfHit.normal);
+    const float lgtPdf  = explicitSam.pdf*lightPickProb;
+    const float bsdfPdf = guidingMixturePdf(in_guideTree, guideLeaf, shadowRayDir, evalData.pdfFwd);
+    cosThetaOutAux      = dot(shadowRayDir, surfHit.normal);
 
-    misWeight = misWeightHeuristic(lgtPdf, evalData.pdfFwd); // (lgtPdf*lgtPdf) / (lgtPdf*lgtPdf + bsdfPdf*bsdfPdf);
+    misWeight = misWeightHeuristic(lgtPdf, bsdfPdf); // (lgtPdf*lgtPdf) / (lgtPdf*lgtPdf + bsdfPdf*bsdfPdf);
     if (explicitSam.isPoint)
       misWeight = 1.0f;
   }
@@ -781,10 +787,15 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
                          __global PerRayAcc*       restrict a_pdfAcc,        // used only by 3-Way PT/LT passes
                          __global float*           restrict a_camPdfA,       // used only by 3-Way PT/LT passes
 
-                         __global const float4*    restrict in_texStorage1,    
+                         __global float4*                   in_texStorage1,    
                          __global const float4*    restrict in_texStorage2,
                          __global const float4*    restrict in_mtlStorage,
                          __global const float4*    restrict in_pdfStorage,   //
+
+                         __global const float4*    restrict in_guideTree,       // path guiding SD-tree (see cguiding.h); 0 if guiding is off
+                         __global float4*          restrict a_guideRecPos,      // path guiding training records, one per path; 0 if current pass doesn't train
+                         __global float4*          restrict a_guideRecColor,    //
+                         __global float4*          restrict a_guideRecWeight,   //
  
                          __global const EngineGlobals*  restrict a_globals,
                         int iNumElements)
@@ -818,6 +829,7 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
   InitProcTextureList(&ptl);
   ReadProcTextureList(in_procTexData, tid, iNumElements,
                       &ptl);
+  ptl.texLod = surfHit.texLod;
   
   const int rayBounceNum = unpackBounceNum(flags);
 
@@ -886,6 +898,15 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
   }
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   
+  const int guideLeaf = (in_guideTree != 0 && materialCanBeGuided(pHitMaterial)) ? guidingFindLeaf(in_guideTree, surfHit.pos) : -1;
+  float4 guideRands   = make_float4(0, 0, 0, 0);
+  if (guideLeaf >= 0 || a_guideRecPos != 0)
+  {
+    RandomGen gen = out_gens[tid];
+    guideRands    = rndFloat4_Pseudo(&gen);
+    out_gens[tid] = gen;
+  }
+
   const float3 shadowVal = decompressShadow(in_shadow[tid]);
 
   MatSample brdfSample; int localOffset = 0; 
@@ -896,6 +917,41 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
   matOffset    = matOffset    + localOffset*(sizeof(PlainMaterial)/sizeof(float4));
   pHitMaterial = pHitMaterial + localOffset;
 
+  // one-sample MIS of BSDF and guiding tree, same as IntegratorMISPT::PathTrace. Strategy is selected before sampling, so any non specular 
+  // direction has the same mixture pdf for both strategies; specular directions can come from BSDF only.
+  //
+  if (guideLeaf >= 0)
+  {
+    if (guideRands.x < GUIDING_SAMPLE_FRACTION)
+    {
+      float guidePdf = 0.0f;
+
+      ShadeContext sc;
+      sc.wp  = surfHit.pos;
+      sc.l   = guidingSample(in_guideTree, guideLeaf, make_float2(guideRands.y, guideRands.z), &guidePdf);
+      sc.v   = (-1.0f)*ray_dir;
+      sc.n   = surfHit.normal;
+      sc.fn  = surfHit.flatNormal;
+      sc.tg  = surfHit.tangent;
+      sc.bn  = surfHit.biTangent;
+      sc.tc  = surfHit.texCoord;
+      sc.hfi = surfHit.hfi;
+
+      const BxDFResult evalData = materialEval(pHitMaterial, &sc, (EVAL_FLAG_DEFAULT), /* global data --> */ a_globals, in_texStorage1, in_texStorage2, &ptl);
+      const bool transmit       = (dot(sc.l, surfHit.normal) < 0.0f);
+      const int  event          = isPureSpecular(brdfSample) ? RAY_EVENT_G : (brdfSample.flags & (RAY_EVENT_D | RAY_EVENT_G));
+
+      brdfSample.direction = sc.l;
+      brdfSample.color     = transmit ? evalData.btdf : evalData.brdf;
+      brdfSample.flags     = transmit ? (event | RAY_EVENT_T) : event;
+      brdfSample.pdf       = GUIDING_SAMPLE_FRACTION*guidePdf + (1.0f - GUIDING_SAMPLE_FRACTION)*evalData.pdfFwd;
+    }
+    else if (isPureSpecular(brdfSample))
+      brdfSample.pdf *= (1.0f - GUIDING_SAMPLE_FRACTION);
+    else
+      brdfSample.pdf = guidingMixturePdf(in_guideTree, guideLeaf, brdfSample.direction, brdfSample.pdf);
+  }
+
   const float invPdf       = 1.0f / fmax(brdfSample.pdf, DEPSILON2);
   const float cosTheta     = fabs(dot(brdfSample.direction, surfHit.normal));
   float3 outPathThroughput = cosTheta*brdfSample.color*invPdf; 
@@ -912,9 +968,10 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
   const float3 nextRay_pos = OffsRayPos(surfHit.pos, surfHit.normal, brdfSample.direction);
   // values that bidirectional techniques needs
   //
-  const float cosPrev = fabs(a_misDataPrev[tid].cosThetaPrev);
-  const float cosCurr = fabs(-dot(ray_dir, surfHit.normal));
-  const float dist    = length(surfHit.pos - ray_pos);
+  const MisData misPrev = a_misDataPrev[tid];
+  const float cosPrev   = fabs(misPrev.cosThetaPrev);
+  const float cosCurr   = fabs(-dot(ray_dir, surfHit.normal));
+  const float dist      = length(surfHit.pos - ray_pos);
   const float GTerm   = (cosPrev*cosCurr / fmax(dist*dist, DEPSILON2));
   
   // calc new ray
@@ -961,6 +1018,8 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
     misNext.isSpecular         = (int)isPureSpecular(brdfSample);
     misNext.prevMaterialOffset = matOffset;
     misNext.cosThetaPrev       = fabs(+dot(ray_dir, surfHit.normal)); // update it withCosNextActually ...
+    misNext.coneWidth          = ((rayBounceNum == 0) ? 0.0f : misPrev.coneWidth) + rayConeSpreadAngle(a_globals)*dist;
+    misNext.prevNormal         = encodeNormal(surfHit.normal);
     a_misDataPrev[tid]         = misNext;
   }
   ///////////////////////////////////////////////// 
@@ -996,7 +1055,10 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
         const int currDepth = rayBounceNum + 1;
         accPdf.pdfGTerm *= GTerm;
         if (currDepth == 1)
+        {
           accPdf.pdfCamA0 = GTerm; // spetial case, multiply it by pdf later ... 
+          perRayAccSetLightVert(&accPdf, surfHit.pos, surfHit.normal);
+        }
       }
       a_pdfAcc[tid] = accPdf;
     }
@@ -1031,6 +1093,7 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
             InitProcTextureList(&ptl); 
             ReadProcTextureList(in_procTexData, tid, iNumElements,
                                 &ptl);
+            ptl.texLod = surfHit.texLod;
             const float pdfFwdW = materialEval(pHitMaterial, &sc, (EVAL_FLAG_DEFAULT), // global data on the second line -->                          
                                                a_globals, in_texStorage1, in_texStorage2, &ptl).pdfFwd; 
            
@@ -1056,6 +1119,26 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
   if (unpackRayFlags(flags) & RAY_IS_DEAD)
     newPathThroughput = make_float3(0, 0, 0);
 
+  // path guiding training: incident radiance along nextRay_dir is known only when path is finished, so keep path color and throughput 
+  // of this vertex and let GuidingRecordFinish compute it. Each path keeps one uniformly selected vertex (reservoir of size 1); w is the number of candidates.
+  //
+  if (a_guideRecPos != 0 && !isPureSpecular(brdfSample) && brdfSample.pdf > 0.0f && maxcomp(newPathThroughput) > 0.0f)
+  {
+    float4 recColor = a_guideRecColor[tid];
+    recColor.w     += 1.0f;
+    if (guideRands.w*recColor.w < 1.0f)
+    {
+      const float3 invThroughput = make_float3((newPathThroughput.x > 0.0f) ? 1.0f/newPathThroughput.x : 0.0f, 
+                                               (newPathThroughput.y > 0.0f) ? 1.0f/newPathThroughput.y : 0.0f, 
+                                               (newPathThroughput.z > 0.0f) ? 1.0f/newPathThroughput.z : 0.0f);
+
+      a_guideRecPos   [tid] = to_float4(surfHit.pos, as_float(encodeNormalOct(nextRay_dir)));
+      a_guideRecWeight[tid] = to_float4(invThroughput, 1.0f/brdfSample.pdf);
+      recColor              = to_float4(to_float3(nextPathColor), recColor.w);
+    }
+    a_guideRecColor[tid] = recColor;
+  }
+
   a_flags      [tid] = flags;
   a_rpos       [tid] = to_float4(ray_pos, 0.0f);
   a_rdir       [tid] = to_float4(ray_dir, 0.0f);
@@ -1064,6 +1147,33 @@ __kernel void NextBounce(__global const int2*      restrict in_zind,
 
 }
 
+/**
+\brief Finish path guiding records of NextBounce when all bounces are done: a_recWeight[tid].x = luminance of incident radiance divided by pdf, 
+       multiplied by the number of vertices that the record represents; 0 if path has no record.
+
+*/
+__kernel void GuidingRecordFinish(__global const float4* restrict in_color,
+                                  __global const float4* restrict in_recColor,
+                                  __global float4*       restrict a_recWeight,
+                                  int iNumElements)
+{
+  int tid = GLOBAL_ID_X;
+  if (tid >= iNumElements)
+    return;
+
+  const float4 recColor = in_recColor[tid];
+
+  float value = 0.0f;
+  if (recColor.w > 0.0f)
+  {
+    const float4 weight   = a_recWeight[tid];
+    const float3 incident = (to_float3(in_color[tid]) - to_float3(recColor))*to_float3(weight);
+    value                 = contribFunc(incident)*weight.w*recColor.w;
+  }
+
+  a_recWeight[tid] = make_float4(value, 0.0f, 0.0f, 0.0f);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1299,7 +1409,7 @@ __kernel void ReadDiffuseColor(__global const float4*    restrict a_rdir,
                                __global const float4*    restrict in_surfaceHit,
 
                                __global const float4*    restrict in_procTexData,
-                               __global const int4*      restrict in_texStorage1,
+                               __global int4*                     in_texStorage1,
 
                                __global const EngineGlobals* a_globals, 
                                __global float4* a_color, int iNumElements)
@@ -737,7 +737,7 @@ __kernel void MMLTCameraPathBounce(__global   float4*        restrict a_rpos,
                                    __global PdfVertex*       restrict a_pdfVert,       // (!) MMLT pdfArray 
                                    __global float4*          restrict a_vertexSup,     // (!) MMLT out Path Vertex supplemental to surfaceHit data
 
-                                   __global const float4*    restrict in_texStorage1,    
+                                   __global float4*                   in_texStorage1,    
                                    __global const float4*    restrict in_texStorage2,
                                    __global const float4*    restrict in_mtlStorage,
                                    __global const float4*    restrict in_pdfStorage,   //
@@ -1076,7 +1076,7 @@ __kernel void MMLTLightSampleForward(__global   float4*        restrict a_rpos,
                                      __global float4*          restrict a_vertexSup,     // (!) MMLT out Path Vertex supplemental to surfaceHit data
                                      __global int*             restrict a_spec,          // (!) MMLTLightPathBounce only !!! prev bounce is specular.
                                     
-                                     __global const float4*        restrict in_texStorage1,    
+                                     __global float4*                       in_texStorage1,    
                                      __global const float4*        restrict in_pdfStorage,   //
                                      __global const EngineGlobals* restrict a_globals,
                                      const int   iNumElements)
@@ -1147,7 +1147,7 @@ __kernel void MMLTLightPathBounce (__global   float4*        restrict a_rpos,
                                    __global PdfVertex*       restrict a_pdfVert,       // (!) MMLT pdfArray 
                                    __global float4*          restrict a_vertexSup,     // (!) MMLT out Path Vertex supplemental to surfaceHit data
 
-                                   __global const float4*    restrict in_texStorage1,    
+                                   __global float4*                   in_texStorage1,    
                                    __global const float4*    restrict in_texStorage2,
                                    __global const float4*    restrict in_mtlStorage,
                                    __global const float4*    restrict in_pdfStorage,   //
@@ -1342,7 +1342,7 @@ __kernel void MMLTMakeShadowRay(__global const int2  *  restrict in_splitInfo,
 
                                 __global const float4*         restrict in_mtlStorage,
                                 __global const float4*         restrict in_pdfStorage,
-                                __global const float4*         restrict in_texStorage1,
+                                __global float4*                        in_texStorage1,
                                 __global const EngineGlobals*  restrict a_globals,
                                 const int iNumElements)
 {
@@ -1421,8 +1421,8 @@ __kernel void MMLTMakeShadowRay(__global const int2  *  restrict in_splitInfo,
       if (cv.valid && !wasSpecularOnly) // cv.wasSpecOnly exclude direct light actually
       {
         float lightPickProb = 1.0f;
-        int lightOffset = SelectRandomLightRev(lightSelector.group2.z, cv.hit.pos, a_globals,
-                                               &lightPickProb);
+        int lightOffset = SelectRandomLightRevPower(lightSelector.group2.z, a_globals,
+                                                    &lightPickProb);
        
         if (lightOffset >= 0)
         {
@@ -1481,7 +1481,7 @@ __kernel void MMLTConnect(__global const int2  *  restrict in_splitInfo,
                           __global       float4*  restrict out_color,
                           __global int2*          restrict out_zind,
 
-                          __global const float4*         restrict in_texStorage1,    
+                          __global float4*                        in_texStorage1,    
                           __global const float4*         restrict in_texStorage2,
                           __global const float4*         restrict in_mtlStorage,
                           __global const float4*         restrict in_pdfStorage,  
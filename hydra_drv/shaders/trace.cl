@@ -73,7 +73,7 @@ __kernel void BVH4TraversalInstKernel(__global const float4* restrict  rpos,
 
 __kernel void BVH4TraversalInstKernelA(__global const float4* restrict  rpos,     __global const float4* restrict  rdir, 
                                        __global const float4* restrict  a_bvh,    __global const float4* restrict  a_tris, __global const uint2*  restrict a_alpha,  
-                                       __global const float4* restrict  a_texStorage, __global const EngineGlobals* restrict a_globals,
+                                       __global float4*                 a_texStorage, __global const EngineGlobals* restrict a_globals,
                                        __global const uint*   restrict  in_flags, __global Lite_Hit*     restrict  out_hits, int iRunId, int iNumElements)
 {
   const int tid     = GLOBAL_ID_X;
@@ -99,7 +99,7 @@ __kernel void BVH4TraversalInstKernelA(__global const float4* restrict  rpos,
 
 __kernel void BVH4TraversalInstKernelAS(__global const float4* restrict  rpos,     __global const float4* restrict  rdir, 
                                         __global const float4* restrict  a_bvh,    __global const float4* restrict  a_tris, __global const uint2*  restrict a_alpha,  
-                                        __global const float4* restrict  a_texStorage, __global const EngineGlobals* restrict a_globals,
+                                        __global float4*                 a_texStorage, __global const EngineGlobals* restrict a_globals,
                                         __global const uint*   restrict  in_flags, __global Lite_Hit* restrict  out_hits, __global RandomGen* restrict out_gens,
                                         int iRunId, int iNumElements)
 {
@@ -141,6 +141,7 @@ __kernel void ComputeHit(__global const float4*   restrict rpos,
 
                          __global uint*           restrict out_flags,
                          __global float4*         restrict out_surfaceHit,
+                         __global const MisData*  restrict in_misDataPrev,
 
                          __global const EngineGlobals* restrict a_globals,
                          int a_remapTableSize, int a_totalInstNumber,  int a_size)
@@ -213,6 +214,16 @@ __kernel void ComputeHit(__global const float4*   restrict rpos,
   surfHitWS.t          = length(surfHitWS.pos - ray_pos); // seems this is more precise. VERY strange !!!
   surfHitWS.sRayOff    = length(shadowStartPos);
   
+  // (6) select texture LOD with ray cones; cone starts from zero width at camera and is only propagated along camera paths
+  //
+  if ((a_globals->g_flags & HRT_FORWARD_TRACING) == 0)
+  {
+    const float coneWidth0 = (unpackBounceNum(flags) == 0) ? 0.0f : in_misDataPrev[tid].coneWidth;
+    const float coneWidth  = coneWidth0 + rayConeSpreadAngle(a_globals)*surfHitWS.t;
+    surfHitWS.texLod       = rayConeTexLod(surfHit.texLod + instanceUVLodBias(instanceMatrix), coneWidth, dot(ray_dir, surfHitWS.normal));
+  }
+  else
+    surfHitWS.texLod     = TEX_LOD_NONE;
 
   ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// THIS IS FUCKING CRAZY !!!!
   {
@@ -366,7 +377,7 @@ __kernel void BVH4TraversalInstShadowKenrelAS(__global const uint*         restr
                                               __global const float4*        restrict a_bvh,
                                               __global const float4*        restrict a_tris,
                                               __global const uint2*         restrict a_alpha,
-                                              __global const float4*        restrict a_texStorage, 
+                                              __global float4*                       a_texStorage, 
                                               __global const EngineGlobals* restrict a_globals,
                                                int a_runId, int a_size)
 {
@@ -510,7 +521,7 @@ __kernel void BVH4TraversalInstShadowKenrelAS_Packed(__global const uint*
                                                      __global const float4*        restrict a_bvh,
                                                      __global const float4*        restrict a_tris,
                                                      __global const uint2*         restrict a_alpha,
-                                                     __global const float4*        restrict a_texStorage, 
+                                                     __global float4*                       a_texStorage, 
                                                      __global const EngineGlobals* restrict a_globals,
                                                      int a_runId, int a_size)
 {